@@ -0,0 +1,496 @@
+/* compressedimage.cpp: block compressed disk image file
+
+ See LICENSE for terms of use.
+
+ Format see compressedimage.hpp.
+ LZ4 is implemented here, so the static build needs no extra library.
+ Compression uses a single hash probe, speed is more important than
+ ratio: disk images are mostly zero blocks, which are not stored at all.
+
+ Not thread safe, caller (storagedrive_c) must serialize access.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+using namespace std;
+
+#include "compressedimage.hpp"
+
+/*** LZ4 block format ***/
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+#define LZ4_MINMATCH	4
+#define LZ4_LASTLITERALS	5	// last 5 bytes are always literals
+#define LZ4_MFLIMIT	12	// last match must start 12 bytes before end
+#define LZ4_HASH_BITS	12
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// write a length continuation: sequence of 255s and remainder
+static inline int lz4_write_length(uint8_t *dst, int op, int dst_capacity, unsigned len) {
+	while (len >= 255) {
+		if (op >= dst_capacity)
+			return -1;
+		dst[op++] = 255;
+		len -= 255;
+	}
+	if (op >= dst_capacity)
+		return -1;
+	dst[op++] = (uint8_t) len;
+	return op;
+}
+
+// output one sequence: literals src[anchor..anchor+lit_len), then match (if match_len > 0)
+// result: new output position, or -1 if dst full
+static int lz4_write_sequence(const uint8_t *src, int anchor, unsigned lit_len, unsigned offset,
+		unsigned match_len, uint8_t *dst, int op, int dst_capacity) {
+	if (op >= dst_capacity)
+		return -1;
+	int token_pos = op++;
+	uint8_t token = (uint8_t) ((lit_len >= 15 ? 15 : lit_len) << 4);
+	if (lit_len >= 15 && (op = lz4_write_length(dst, op, dst_capacity, lit_len - 15)) < 0)
+		return -1;
+	if (op + (int) lit_len > dst_capacity)
+		return -1;
+	memcpy(dst + op, src + anchor, lit_len);
+	op += lit_len;
+	if (match_len > 0) {
+		unsigned ml = match_len - LZ4_MINMATCH;
+		if (op + 2 > dst_capacity)
+			return -1;
+		dst[op++] = (uint8_t) offset;
+		dst[op++] = (uint8_t) (offset >> 8);
+		token |= (uint8_t) (ml >= 15 ? 15 : ml);
+		if (ml >= 15 && (op = lz4_write_length(dst, op, dst_capacity, ml - 15)) < 0)
+			return -1;
+	}
+	dst[token_pos] = token;
+	return op;
+}
+
+// compress src into dst
+// result: compressed length, 0 if it does not fit into dst_capacity
+int lz4_compress_block(const uint8_t *src, int src_len, uint8_t *dst, int dst_capacity) {
+	int32_t table[1 << LZ4_HASH_BITS];
+	int ip = 0, anchor = 0, op = 0;
+
+	for (unsigned i = 0; i < (1 << LZ4_HASH_BITS); i++)
+		table[i] = -1;
+
+	if (src_len > LZ4_MFLIMIT) {
+		int match_limit = src_len - LZ4_MFLIMIT;
+		while (ip < match_limit) {
+			uint32_t seq = lz4_read32(src + ip);
+			uint32_t h = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+			int ref = table[h];
+			table[h] = ip;
+			if (ref < 0 || ip - ref > 0xffff || lz4_read32(src + ref) != seq) {
+				ip++;
+				continue;
+			}
+			// extend match, keep last literals
+			int match_len = LZ4_MINMATCH;
+			int max_len = src_len - LZ4_LASTLITERALS - ip;
+			while (match_len < max_len && src[ref + match_len] == src[ip + match_len])
+				match_len++;
+			op = lz4_write_sequence(src, anchor, ip - anchor, ip - ref, match_len, dst, op,
+					dst_capacity);
+			if (op < 0)
+				return 0;
+			ip += match_len;
+			anchor = ip;
+		}
+	}
+	// last literals
+	op = lz4_write_sequence(src, anchor, src_len - anchor, 0, 0, dst, op, dst_capacity);
+	if (op < 0)
+		return 0;
+	return op;
+}
+
+// decompress src into dst, with full bounds checking
+// result: decompressed length, -1 on corrupt data
+int lz4_decompress_block(const uint8_t *src, int src_len, uint8_t *dst, int dst_capacity) {
+	int ip = 0, op = 0;
+
+	while (ip < src_len) {
+		unsigned token = src[ip++];
+		unsigned lit_len = token >> 4;
+		if (lit_len == 15) {
+			unsigned b;
+			do {
+				if (ip >= src_len)
+					return -1;
+				b = src[ip++];
+				lit_len += b;
+			} while (b == 255);
+		}
+		if (ip + (int) lit_len > src_len || op + (int) lit_len > dst_capacity)
+			return -1;
+		memcpy(dst + op, src + ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (ip == src_len)
+			break; // last sequence has no match
+
+		if (ip + 2 > src_len)
+			return -1;
+		unsigned offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || (int) offset > op)
+			return -1;
+		unsigned match_len = token & 0x0f;
+		if (match_len == 15) {
+			unsigned b;
+			do {
+				if (ip >= src_len)
+					return -1;
+				b = src[ip++];
+				match_len += b;
+			} while (b == 255);
+		}
+		match_len += LZ4_MINMATCH;
+		if (op + (int) match_len > dst_capacity)
+			return -1;
+		uint8_t *match = dst + op - offset;
+		if (offset >= match_len)
+			memcpy(dst + op, match, match_len);
+		else if (offset >= 8)
+			// overlapping, but 8 byte pieces are not
+			for (unsigned i = 0; i < match_len; i += 8)
+				memcpy(dst + op + i, match + i, min(8U, match_len - i));
+		else
+			// repeating short pattern
+			for (unsigned i = 0; i < match_len; i++)
+				dst[op + i] = match[i];
+		op += match_len;
+	}
+	return op;
+}
+
+/*** compressed_image_c ***/
+
+static bool is_zero(const uint8_t *buffer, unsigned len) {
+	const uint8_t *end = buffer + len;
+	while (buffer + sizeof(uint64_t) <= end) {
+		uint64_t v;
+		memcpy(&v, buffer, sizeof(v));
+		if (v)
+			return false;
+		buffer += sizeof(v);
+	}
+	while (buffer < end)
+		if (*buffer++)
+			return false;
+	return true;
+}
+
+compressed_image_c::compressed_image_c() {
+	f = NULL;
+	memset(&header, 0, sizeof(header));
+	file_end = 0;
+	cur_chunk = -1;
+	chunks_decompressed = 0;
+	chunks_compressed = 0;
+}
+
+// check file for magic
+bool compressed_image_c::is_compressed(fstream *f) {
+	char magic[sizeof(header.magic)];
+	f->clear();
+	f->seekg(0);
+	f->read(magic, sizeof(magic));
+	bool result = f->good() && !memcmp(magic, COMPRESSED_IMAGE_MAGIC, sizeof(magic));
+	f->clear();
+	return result;
+}
+
+// use an open image file: load header and index
+bool compressed_image_c::attach(fstream *f) {
+	this->f = f;
+	cur_chunk = -1;
+	f->clear();
+	f->seekg(0);
+	f->read((char *) &header, sizeof(header));
+	if (!f->good() || memcmp(header.magic, COMPRESSED_IMAGE_MAGIC, sizeof(header.magic))) {
+		error_text = "not a compressed image";
+		return false;
+	}
+	if (header.chunk_size == 0 || header.chunk_size % 512 || header.chunk_size > 0x10000) {
+		error_text = "invalid chunk size " + to_string(header.chunk_size);
+		return false;
+	}
+	index.resize(header.chunk_count);
+	f->seekg(COMPRESSED_IMAGE_HEADER_SIZE);
+	f->read((char *) index.data(), header.chunk_count * sizeof(index_entry_t));
+	if (!f->good()) {
+		error_text = "index truncated";
+		return false;
+	}
+	// gaps between reserved chunk spaces are free, left over from relocated chunks
+	std::vector<std::pair<uint64_t, uint32_t> > used;
+	for (unsigned i = 0; i < header.chunk_count; i++)
+		if (index[i].capacity)
+			used.push_back(make_pair(index[i].offset, index[i].capacity));
+	sort(used.begin(), used.end());
+	free_slots.clear();
+	file_end = COMPRESSED_IMAGE_HEADER_SIZE + header.chunk_count * sizeof(index_entry_t);
+	for (unsigned i = 0; i < used.size(); i++) {
+		if (used[i].first > file_end)
+			free_slot(file_end, used[i].first - file_end);
+		file_end = max(file_end, used[i].first + used[i].second);
+	}
+
+	chunk_buffer.resize(header.chunk_size);
+	io_buffer.resize(header.chunk_size);
+	return true;
+}
+
+// initialize an empty, open file as compressed image. All chunks are holes.
+// "capacity": image may grow up to this size
+bool compressed_image_c::create(fstream *f, uint64_t image_size, uint64_t capacity,
+		uint32_t chunk_size) {
+	assert(chunk_size > 0 && (chunk_size % 512) == 0 && chunk_size <= 0x10000);
+	this->f = f;
+	cur_chunk = -1;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COMPRESSED_IMAGE_MAGIC, sizeof(header.magic));
+	header.chunk_size = chunk_size;
+	header.chunk_count = (max(image_size, capacity) + chunk_size - 1) / chunk_size;
+	header.image_size = image_size;
+	index.assign(header.chunk_count, index_entry_t());
+	memset(index.data(), 0, index.size() * sizeof(index_entry_t));
+
+	if (!write_header())
+		return false;
+	f->seekp(COMPRESSED_IMAGE_HEADER_SIZE);
+	f->write((const char *) index.data(), index.size() * sizeof(index_entry_t));
+	if (f->fail()) {
+		error_text = "index write failed";
+		return false;
+	}
+	file_end = COMPRESSED_IMAGE_HEADER_SIZE + header.chunk_count * sizeof(index_entry_t);
+	free_slots.clear();
+
+	chunk_buffer.resize(header.chunk_size);
+	io_buffer.resize(header.chunk_size);
+	return true;
+}
+
+bool compressed_image_c::write_header(void) {
+	uint8_t sector[COMPRESSED_IMAGE_HEADER_SIZE];
+	memset(sector, 0, sizeof(sector));
+	memcpy(sector, &header, sizeof(header));
+	f->clear();
+	f->seekp(0);
+	f->write((const char *) sector, sizeof(sector));
+	if (f->fail()) {
+		error_text = "header write failed";
+		return false;
+	}
+	return true;
+}
+
+bool compressed_image_c::write_index_entry(uint32_t chunk) {
+	f->clear();
+	f->seekp(COMPRESSED_IMAGE_HEADER_SIZE + chunk * sizeof(index_entry_t));
+	f->write((const char *) &index[chunk], sizeof(index_entry_t));
+	if (f->fail()) {
+		error_text = "index write failed";
+		return false;
+	}
+	return true;
+}
+
+// space for a chunk of "len" bytes, some room for growth
+uint32_t compressed_image_c::slot_capacity(uint32_t len) {
+	return min((len + 63) & ~63U, header.chunk_size);
+}
+
+// file position for a chunk of "len" bytes: first fitting free slot, else end of file
+uint64_t compressed_image_c::allocate_slot(uint32_t len) {
+	uint32_t capacity = slot_capacity(len);
+	for (map<uint64_t, uint32_t>::iterator it = free_slots.begin(); it != free_slots.end();
+			++it) {
+		if (it->second < capacity)
+			continue;
+		uint64_t offset = it->first;
+		uint32_t rest = it->second - capacity;
+		free_slots.erase(it);
+		if (rest)
+			free_slots[offset + capacity] = rest;
+		return offset;
+	}
+	uint64_t offset = file_end;
+	file_end += capacity;
+	return offset;
+}
+
+// space no longer referenced by the index, merged with free neighbours
+void compressed_image_c::free_slot(uint64_t offset, uint32_t size) {
+	map<uint64_t, uint32_t>::iterator next = free_slots.lower_bound(offset);
+	if (next != free_slots.begin()) {
+		map<uint64_t, uint32_t>::iterator prev = next;
+		--prev;
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			free_slots.erase(prev);
+		}
+	}
+	if (next != free_slots.end() && offset + size == next->first) {
+		size += next->second;
+		free_slots.erase(next);
+	}
+	free_slots[offset] = size;
+}
+
+// decompress a chunk into chunk_buffer
+bool compressed_image_c::load_chunk(uint32_t chunk) {
+	if (cur_chunk == chunk)
+		return true;
+	cur_chunk = -1;
+	index_entry_t *entry = &index[chunk];
+	if (entry->length == 0) {
+		memset(chunk_buffer.data(), 0, header.chunk_size);
+	} else {
+		uint8_t *dst = entry->length == header.chunk_size ? chunk_buffer.data() : io_buffer.data();
+		f->clear();
+		f->seekg(entry->offset);
+		f->read((char *) dst, entry->length);
+		if (!f->good()) {
+			error_text = "chunk " + to_string(chunk) + " truncated";
+			return false;
+		}
+		if (dst == io_buffer.data()) {
+			int len = lz4_decompress_block(io_buffer.data(), entry->length, chunk_buffer.data(),
+					header.chunk_size);
+			if (len != (int) header.chunk_size) {
+				error_text = "chunk " + to_string(chunk) + " corrupt";
+				return false;
+			}
+			chunks_decompressed++;
+		}
+	}
+	cur_chunk = chunk;
+	return true;
+}
+
+// compress chunk_buffer and save as "chunk"
+bool compressed_image_c::store_chunk(uint32_t chunk) {
+	index_entry_t *entry = &index[chunk];
+	assert(cur_chunk == chunk);
+
+	if (is_zero(chunk_buffer.data(), header.chunk_size)) {
+		// hole. space stays reserved for reuse
+		entry->length = 0;
+		return write_index_entry(chunk);
+	}
+
+	const uint8_t *data = io_buffer.data();
+	// must be smaller than chunk, else store uncompressed
+	int len = lz4_compress_block(chunk_buffer.data(), header.chunk_size, io_buffer.data(),
+			header.chunk_size - 1);
+	if (len <= 0) {
+		data = chunk_buffer.data();
+		len = header.chunk_size;
+	}
+	chunks_compressed++;
+
+	// Never overwrite the data the index entry points to: after a crash
+	// between data and index write, the old length would describe new data.
+	// Only a hole has no valid data in its reserved space.
+	uint64_t old_offset = entry->offset;
+	uint32_t old_capacity = entry->capacity;
+	bool in_place = entry->length == 0 && (uint32_t) len <= entry->capacity;
+	uint64_t offset = in_place ? entry->offset : allocate_slot((uint32_t) len);
+	f->clear();
+	f->seekp(offset);
+	f->write((const char *) data, len);
+	if (f->fail()) {
+		error_text = "chunk write failed";
+		return false;
+	}
+	entry->offset = offset;
+	entry->length = len;
+	if (!in_place)
+		entry->capacity = slot_capacity(len);
+	if (!write_index_entry(chunk))
+		return false;
+	// old data no longer referenced
+	if (!in_place && old_capacity)
+		free_slot(old_offset, old_capacity);
+	return true;
+}
+
+// read "len" bytes from "position". Holes and data beyond the image read as 00s.
+bool compressed_image_c::read(uint8_t *buffer, uint64_t position, unsigned len) {
+	while (len > 0) {
+		uint32_t chunk = position / header.chunk_size;
+		unsigned chunk_offset = position % header.chunk_size;
+		unsigned n = min(len, header.chunk_size - chunk_offset);
+		if (chunk >= header.chunk_count || index[chunk].length == 0)
+			memset(buffer, 0, n);
+		else if (load_chunk(chunk))
+			memcpy(buffer, chunk_buffer.data() + chunk_offset, n);
+		else
+			return false;
+		buffer += n;
+		position += n;
+		len -= n;
+	}
+	return true;
+}
+
+// write "len" bytes to "position". Image grows up to chunk_count * chunk_size.
+bool compressed_image_c::write(uint8_t *buffer, uint64_t position, unsigned len) {
+	uint64_t end = position + len;
+	while (len > 0) {
+		uint32_t chunk = position / header.chunk_size;
+		unsigned chunk_offset = position % header.chunk_size;
+		unsigned n = min(len, header.chunk_size - chunk_offset);
+		if (chunk >= header.chunk_count) {
+			error_text = "write beyond image capacity";
+			return false;
+		}
+		if (n == header.chunk_size) {
+			// chunk completely overwritten, no need to load old content
+			cur_chunk = chunk;
+		} else if (!load_chunk(chunk))
+			return false;
+		memcpy(chunk_buffer.data() + chunk_offset, buffer, n);
+		if (!store_chunk(chunk))
+			return false;
+		buffer += n;
+		position += n;
+		len -= n;
+	}
+	if (end > header.image_size) {
+		header.image_size = end;
+		return write_header();
+	}
+	return true;
+}
+
+// statistics for "info"
+void compressed_image_c::get_usage(uint32_t *holes, uint32_t *compressed,
+		uint32_t *uncompressed, uint64_t *data_bytes) {
+	*holes = *compressed = *uncompressed = 0;
+	*data_bytes = 0;
+	for (unsigned i = 0; i < header.chunk_count; i++) {
+		if (index[i].length == 0)
+			(*holes)++;
+		else if (index[i].length == header.chunk_size)
+			(*uncompressed)++;
+		else
+			(*compressed)++;
+		*data_bytes += index[i].length;
+	}
+}
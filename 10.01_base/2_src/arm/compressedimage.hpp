@@ -0,0 +1,111 @@
+/* compressedimage.hpp: block compressed disk image file
+
+ See LICENSE for terms of use.
+
+ Image files are divided into fixed size chunks, each stored LZ4
+ compressed, uncompressed or, if all zero, not at all.
+ File layout, all numbers little endian:
+
+ header:	512 bytes
+	char	magic[8]	"UBCIMG01"
+	uint32	chunk_size	bytes per chunk, multiple of 512, max 64KB
+	uint32	chunk_count	entries in index, fixes max image size
+	uint64	image_size	logical size of image in bytes
+ index:	chunk_count entries of 16 bytes, directly after header
+	uint64	offset		file position of chunk data
+	uint32	length		0: chunk is all zero ("hole")
+						chunk_size: data not compressed
+						else: length of LZ4 block
+	uint32	capacity	bytes reserved at "offset"
+ data:	chunks at arbitrary positions behind the index
+
+ A rewritten chunk never overwrites the data its index entry points to:
+ it goes to a free slot or to the end of the file, then the index entry
+ is switched, then the old space is free. A crash leaves the old or the
+ new chunk valid, never a mix. Only a hole is refilled in place.
+ Free space is found again on attach as gaps between chunks,
+ "imagetool expand" and "imagetool compress" compacts the file.
+ */
+#ifndef _COMPRESSEDIMAGE_HPP_
+#define _COMPRESSEDIMAGE_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#define COMPRESSED_IMAGE_MAGIC	"UBCIMG01"
+#define COMPRESSED_IMAGE_HEADER_SIZE	512
+#define COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE	4096
+
+// LZ4 block format, compatible with liblz4 LZ4_compress_default() / LZ4_decompress_safe()
+int lz4_compress_block(const uint8_t *src, int src_len, uint8_t *dst, int dst_capacity);
+int lz4_decompress_block(const uint8_t *src, int src_len, uint8_t *dst, int dst_capacity);
+
+class compressed_image_c {
+private:
+#pragma pack(push,1)
+	struct header_t {
+		char magic[8];
+		uint32_t chunk_size;
+		uint32_t chunk_count;
+		uint64_t image_size;
+	};
+	struct index_entry_t {
+		uint64_t offset;
+		uint32_t length;
+		uint32_t capacity;
+	};
+#pragma pack(pop)
+
+	std::fstream *f;
+	header_t header;
+	std::vector<index_entry_t> index;
+	uint64_t file_end; // append position for relocated chunks
+	std::map<uint64_t, uint32_t> free_slots; // offset => size
+
+	// one decompressed chunk is kept
+	int64_t cur_chunk; // -1 = none
+	std::vector<uint8_t> chunk_buffer;
+	std::vector<uint8_t> io_buffer; // compressed data
+
+	uint32_t slot_capacity(uint32_t len);
+	uint64_t allocate_slot(uint32_t len);
+	void free_slot(uint64_t offset, uint32_t size);
+	bool load_chunk(uint32_t chunk);
+	bool store_chunk(uint32_t chunk);
+	bool write_header(void);
+	bool write_index_entry(uint32_t chunk);
+
+public:
+	compressed_image_c();
+
+	std::string error_text;
+
+	// statistics
+	uint64_t chunks_decompressed;
+	uint64_t chunks_compressed;
+
+	static bool is_compressed(std::fstream *f);
+
+	bool attach(std::fstream *f);
+	bool create(std::fstream *f, uint64_t image_size, uint64_t capacity, uint32_t chunk_size);
+
+	bool read(uint8_t *buffer, uint64_t position, unsigned len);
+	bool write(uint8_t *buffer, uint64_t position, unsigned len);
+
+	uint64_t size(void) {
+		return header.image_size;
+	}
+	uint32_t get_chunk_size(void) {
+		return header.chunk_size;
+	}
+	uint32_t get_chunk_count(void) {
+		return header.chunk_count;
+	}
+	void get_usage(uint32_t *holes, uint32_t *compressed, uint32_t *uncompressed,
+			uint64_t *data_bytes);
+};
+
+#endif
@@ -72,6 +72,44 @@ void codelabel_map_c::print(FILE *f) {
 	fprintf(f, "\n");
 }
 
+// nearest label at or below address: "label+offset", else octal address
+string codelabel_map_c::symbolize(unsigned address) {
+	codelabel_map_c::iterator best = end();
+	char buff[40];
+	for (codelabel_map_c::iterator it = begin(); it != end(); ++it)
+		if (it->second <= address && (best == end() || it->second > best->second))
+			best = it;
+	if (best == end()) {
+		sprintf(buff, "%06o", address);
+		return string(buff);
+	}
+	if (best->second == address)
+		return best->first;
+	sprintf(buff, "+%o", address - best->second);
+	return best->first + buff;
+}
+
+// start of range containing address: fixed "granularity" in bytes,
+// or 0 = nearest label at or below. Below all labels, address itself.
+unsigned codelabel_map_c::range_start(unsigned address, unsigned granularity) {
+	if (granularity)
+		return address / granularity * granularity;
+	codelabel_map_c::iterator best = end();
+	for (codelabel_map_c::iterator it = begin(); it != end(); ++it)
+		if (it->second <= address && (best == end() || it->second > best->second))
+			best = it;
+	return best == end() ? address : best->second;
+}
+
+// "start-end " for fixed ranges of more than one word, else empty
+string codelabel_map_c::range_text(unsigned start, unsigned granularity) {
+	char buff[40];
+	if (granularity <= 2)
+		return string();
+	sprintf(buff, "%06o-%06o ", start, start + granularity - 1);
+	return string(buff);
+}
+
 void memoryimage_c::init() {
 	unsigned wordidx;
 	for (wordidx = 0; wordidx < MEMORY_WORD_COUNT; wordidx++) {
@@ -67,6 +67,11 @@ public:
 
 	void print(FILE *f) ;
 
+	string symbolize(unsigned address) ;
+
+	// address ranges for profiles
+	unsigned range_start(unsigned address, unsigned granularity) ;
+	string range_text(unsigned start, unsigned granularity) ;
 };
 
 typedef enum {
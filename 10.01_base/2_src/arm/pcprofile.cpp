@@ -0,0 +1,117 @@
+/* pcprofile.cpp: statistical PC sampling profiler for emulated CPUs
+
+ See LICENSE for terms of use.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <algorithm>
+
+#include "pcprofile.hpp"	// own
+
+static const char *mode_name[pcprofile_c::mode_count] = { "kernel", "user" };
+
+pcprofile_c::pcprofile_c() {
+	interval_ns = 100000;
+	countdown_ns = interval_ns;
+	samples = 0;
+	wait_samples = 0;
+}
+
+// must be called before step()
+void pcprofile_c::clear(unsigned interval_ns) {
+	this->interval_ns = interval_ns;
+	countdown_ns = interval_ns;
+	histogram.assign(mode_count * 0x8000, 0);
+	samples = 0;
+	wait_samples = 0;
+}
+
+// code labels from MACRO-11 listing, added to labels of other listings
+bool pcprofile_c::add_listing(const char *fname) {
+	// not the global "membuffer", that holds user data
+	memoryimage_c *image = new memoryimage_c();
+	codelabel_map_c codelabels;
+	image->init();
+	bool ok = image->load_macro11_listing(fname, &codelabels);
+	delete image;
+	if (ok)
+		add_labels(&codelabels);
+	return ok;
+}
+
+// 18 bit IO page addresses (ROMs) are seen by the CPU at 160000..177777
+void pcprofile_c::add_labels(codelabel_map_c *codelabels) {
+	for (codelabel_map_c::iterator it = codelabels->begin(); it != codelabels->end(); ++it)
+		if (it->second <= 0177777)
+			labels.add(it->first, it->second);
+		else if (it->second >= 0760000 && it->second <= 0777777)
+			labels.add(it->first, it->second & 0177777);
+}
+
+static bool range_greater(const std::pair<unsigned, uint64_t> &a,
+		const std::pair<unsigned, uint64_t> &b) {
+	return a.second > b.second;
+}
+
+bool pcprofile_c::report(const char *basename, unsigned granularity, FILE *summary,
+		unsigned top) {
+	std::string fname = std::string(basename) + ".folded";
+	FILE *ffolded = fopen(fname.c_str(), "w");
+	if (ffolded == NULL)
+		return false;
+	fname = std::string(basename) + ".txt";
+	FILE *freport = fopen(fname.c_str(), "w");
+	if (freport == NULL) {
+		fclose(ffolded);
+		return false;
+	}
+
+	// mode << 16 | range start => samples
+	std::map<unsigned, uint64_t> ranges;
+	bool user_mode = false;
+	for (unsigned mode = 0; mode < mode_count; mode++)
+		for (unsigned pc = 0; pc < 0200000; pc += 2) {
+			uint32_t n = histogram.empty() ? 0 : histogram[mode << 15 | pc >> 1];
+			if (n == 0)
+				continue;
+			if (mode != mode_kernel)
+				user_mode = true;
+			unsigned start = labels.range_start(pc, granularity);
+			ranges[mode << 16 | start] += n;
+			// mode;range;pc
+			fprintf(ffolded, "%s;%s;%s %u\n", mode_name[mode], labels.symbolize(start).c_str(),
+					labels.symbolize(pc).c_str(), n);
+		}
+	if (wait_samples)
+		fprintf(ffolded, "WAIT %llu\n", (unsigned long long) wait_samples);
+	fclose(ffolded);
+
+	std::vector<std::pair<unsigned, uint64_t> > sorted(ranges.begin(), ranges.end());
+	std::sort(sorted.begin(), sorted.end(), range_greater);
+
+	FILE *f[2] = { freport, summary };
+	for (unsigned i = 0; i < 2; i++) {
+		if (f[i] == NULL)
+			continue;
+		fprintf(f[i], "PC profile: %llu samples, one per %u us emulated time\n",
+				(unsigned long long) samples, interval_ns / 1000);
+		if (wait_samples)
+			fprintf(f[i], "WAIT: %llu samples = %0.2f%%\n", (unsigned long long) wait_samples,
+					100.0 * wait_samples / samples);
+		fprintf(f[i], "   samples      %%  %srange\n", user_mode ? "mode    " : "");
+		for (unsigned j = 0; j < sorted.size(); j++) {
+			if (f[i] == summary && top && j >= top)
+				break;
+			unsigned start = sorted[j].first & 0177777;
+			fprintf(f[i], "%10llu %6.2f  %s%s%s\n", (unsigned long long) sorted[j].second,
+					100.0 * sorted[j].second / samples,
+					user_mode ? (sorted[j].first >> 16 ? "user    " : "kernel  ") : "",
+					labels.range_text(start, granularity).c_str(),
+					labels.symbolize(start).c_str());
+		}
+	}
+	fclose(freport);
+	return true;
+}
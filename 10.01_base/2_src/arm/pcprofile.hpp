@@ -0,0 +1,76 @@
+/* pcprofile.hpp: statistical PC sampling profiler for emulated CPUs
+
+ See LICENSE for terms of use.
+
+ The CPU emulation reports each executed opcode with its PC, mode and
+ emulated duration. Every "interval" of emulated time the PC is counted
+ in a histogram, so long opcodes, traps and WAIT get their fair share.
+ No signals or timers: sampling costs one subtraction per opcode.
+
+ The report groups samples by code label (MACRO-11 listings, ROMs)
+ or by fixed PC ranges and is sorted by sample count.
+ Samples are also written as "folded stacks" (mode;range;pc count),
+ input for flamegraph.pl and compatible viewers.
+ */
+#ifndef _PCPROFILE_HPP_
+#define _PCPROFILE_HPP_
+
+using namespace std;
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+#include "logsource.hpp"
+#include "memoryimage.hpp"	// codelabel_map_c
+
+class pcprofile_c {
+private:
+	std::vector<uint32_t> histogram; // [mode][pc/2]
+	int64_t countdown_ns;
+
+public:
+	enum mode_enum {
+		mode_kernel = 0, mode_user = 1, mode_count = 2
+	};
+
+	pcprofile_c();
+
+	unsigned interval_ns;
+	uint64_t samples; // all, including wait
+	uint64_t wait_samples;
+
+	codelabel_map_c labels; // for symbolic report, 16 bit addresses
+
+	// start new profile
+	void clear(unsigned interval_ns);
+
+	// opcode at pc took ns of emulated time
+	void step(uint16_t pc, unsigned mode, unsigned ns) {
+		countdown_ns -= ns;
+		while (countdown_ns <= 0) {
+			countdown_ns += interval_ns;
+			histogram[mode << 15 | pc >> 1]++;
+			samples++;
+		}
+	}
+
+	// CPU in WAIT for ns
+	void wait(unsigned ns) {
+		countdown_ns -= ns;
+		while (countdown_ns <= 0) {
+			countdown_ns += interval_ns;
+			wait_samples++;
+			samples++;
+		}
+	}
+
+	bool add_listing(const char *fname);
+	void add_labels(codelabel_map_c *codelabels);
+
+	// <basename>.txt sorted report, <basename>.folded stacks
+	// granularity: bytes per PC range, 0 = by label
+	bool report(const char *basename, unsigned granularity, FILE *summary, unsigned top);
+};
+
+#endif
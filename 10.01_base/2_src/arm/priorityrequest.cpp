@@ -64,6 +64,9 @@ dma_request_c::dma_request_c(unibusdevice_c *device) :
 	this->level_index = PRIORITY_LEVEL_INDEX_NPR;
 	this->success = false;
 	this->is_cpu_access = false ;// over written for emulated CPU
+	this->fixed_addr = false;
+	this->clipped = false;
+	this->chunk_buffer_offset = 0;
 	// register request for device
 	if (device) {
 		device->dma_requests.push_back(this);
@@ -107,22 +107,26 @@ public:
 	uint32_t wordcount;
 
 	bool is_cpu_access; // true if DMA is CPU memory access
+	bool fixed_addr; // all words to/from unibus_start_addr, no address increment
+	bool clipped; // wordcount cut at end of 18 bit address space: completes as timeout
+
 
 	// DMA transaction are divided in to smaller DAT transfer "chunks" 
 	uint32_t chunk_max_words; // max is PRU capacity PRU_MAX_DMA_WORDCOUNT (512)
 	uint32_t chunk_unibus_start_addr; // current chunk
 	uint32_t chunk_words; // size of current chunks
+	uint32_t chunk_buffer_offset; // words transfered in previous chunks
 
 	volatile bool success; // DMA can fail with bus timeout
 
 	// return ptr to chunk pos in buffer
 	uint16_t *chunk_buffer_start(void) {
-		return buffer + (chunk_unibus_start_addr - unibus_start_addr) / 2;
+		return buffer + chunk_buffer_offset;
 	}
 
 	// words already transfered in previous chunks
 	uint32_t wordcount_completed_chunks(void) {
-		return (chunk_unibus_start_addr - unibus_start_addr) / 2;
+		return chunk_buffer_offset;
 	}
 
 };
@@ -27,8 +27,34 @@
  A storagedrive is a disk or tape drive, with an image file as storage medium.
  a couple of these are connected to a single "storagecontroler"
  supports the "attach" command
+
+ Raw images are read through an own file descriptor, so the kernel
+ read ahead follows posix_fadvise() hints for sequential and random phases.
+ In sequential phases pages behind the access position are released,
+ copying a whole volume does not evict everything else from the page cache.
+ With "direct_io", the descriptor is opened with O_DIRECT:
+ reads go through an aligned bounce buffer, which reads ahead one SD card
+ erase block in sequential phases. Aligned writes are direct, unaligned writes
+ and file extension use the fstream.
+
+ With "journal", writes are batched in a write ahead journal next to the image.
+ A batch is committed with one fdatasync() of the journal, then written to
+ the image without sync. The image is synced only when the journal is truncated.
+ file_open() replays committed batches of a crashed session, so the image
+ never shows a partial batch. This is done even if "journal" is off now,
+ a read only image with a journal is not attached. A batch is committed by file_flush(),
+ a write with "flush", or when it reaches "journal_batch".
  */
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+#include <signal.h>
+#endif
 
 #include <fstream>
 #include <ios>
@@ -37,9 +63,39 @@ using namespace std;
 #include "logger.hpp"
 #include "storagedrive.hpp"
 
+// crash points of the journal test build, nothing in the drives
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+#define JOURNAL_FAULT_CHECK(point)	journal_fault_check(point)
+#else
+#define JOURNAL_FAULT_CHECK(point)
+#endif
+
 storagedrive_c::storagedrive_c(storagecontroller_c *controller) :
 		device_c() {
 	this->controller = controller;
+	cimage = NULL;
+	fd = -1;
+	fd_direct = false;
+	direct_buffer = NULL;
+	direct_buffer_size = 0;
+	direct_buffer_start = 0;
+	direct_buffer_valid = 0;
+	direct_write_failed = false;
+	erase_block.value = 4096; // typical for SD cards
+	access_end = 0;
+	access_run = 0;
+	access_sequential = false;
+	hint_pos = drop_pos = 0;
+	journal_fd = -1;
+	journal_end = 0;
+	journal_sequence = 0;
+	batch_end = 0;
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+	journal_fault = journal_fault_none;
+	journal_fault_batch = 0;
+#endif
+	journal_batch.value = 256;
+	journal_size.value = 4096;
 	/*
 	 // parameters for all drices
 	 param_add(&unitno) ;
@@ -48,12 +104,43 @@ storagedrive_c::storagedrive_c(storagecontroller_c *controller) :
 	 */
 }
 
+storagedrive_c::~storagedrive_c() {
+	journal_close();
+	fd_close();
+}
+
 // implements params, so must handle "change"
 bool storagedrive_c::on_param_changed(parameter_c *param) {
 	// no own "enable" logic
+	if (param == &direct_io) {
+		if (fd >= 0)
+			fd_open(fd_fname, direct_io.new_value); // reopen
+	} else if (param == &erase_block) {
+		if (erase_block.new_value < 64 || erase_block.new_value > 65536) {
+			ERROR("erase_block must be 64 .. 65536 KB");
+			return false;
+		}
+		erase_block.value = erase_block.new_value; // fd_open() uses it
+		if (fd >= 0 && fd_direct)
+			fd_open(fd_fname, true); // new buffer size
+	} else if (param == &journal) {
+		if (fd >= 0 && !file_readonly) {
+			if (journal.new_value)
+				journal_open();
+			else
+				journal_close();
+		}
+	}
 	return device_c::on_param_changed(param);
 }
 
+// "<image>.journal" exists and is not empty
+static bool journal_pending(std::string imagefname) {
+	struct stat st;
+	std::string journalfname = imagefname + ".journal";
+	return stat(journalfname.c_str(), &st) == 0 && st.st_size > 0;
+}
+
 // http://www.cplusplus.com/doc/tutorial/files/
 
 // open a file, if possible.
@@ -65,8 +152,15 @@ bool storagedrive_c::file_open(string imagefname, bool create) {
 	if (file_is_open())
 		file_close(); // after RL11 INIT
 	f.open(imagefname, ios::in | ios::out | ios::binary | ios::ate);
-	if (f.is_open())
+	if (f.is_open()) {
+		if (!file_attach_compressed())
+			return false;
+		if (!cimage) {
+			fd_open(imagefname, direct_io.value);
+			journal_attach();
+		}
 		return true;
+	}
 
 	// is readonly? try open for read only
 
@@ -74,6 +168,18 @@ bool storagedrive_c::file_open(string imagefname, bool create) {
 	f.open(imagefname, ios::in | ios::binary | ios::ate);
 	if (f.is_open()) {
 		file_readonly = true;
+		if (!file_attach_compressed())
+			return false;
+		if (!cimage && journal_pending(imagefname)) {
+			// committed writes of a crashed session can not be replayed
+			ERROR("%s: image %s is read only, journal not replayed. Not attached.",
+					name.value.c_str(), imagefname.c_str());
+			f.close();
+			file_readonly = false;
+			return false;
+		}
+		if (!cimage)
+			fd_open(imagefname, direct_io.value);
 		return true;
 	}
 
@@ -85,9 +191,204 @@ bool storagedrive_c::file_open(string imagefname, bool create) {
 	f.open(imagefname, ios::out);
 	f.close();
 	f.open(imagefname, ios::in | ios::out | ios::binary | ios::ate);
+	if (f.is_open()) {
+		fd_open(imagefname, direct_io.value);
+		journal_attach();
+	}
 	return f.is_open();
 }
 
+// if the opened file is a compressed image, all access goes through "cimage"
+bool storagedrive_c::file_attach_compressed(void) {
+	if (!compressed_image_c::is_compressed(&f))
+		return true; // raw image
+	cimage = new compressed_image_c();
+	if (!cimage->attach(&f)) {
+		ERROR("Compressed image %s: %s", name.value.c_str(), cimage->error_text.c_str());
+		delete cimage;
+		cimage = NULL;
+		f.close();
+		return false;
+	}
+	return true;
+}
+
+// open own descriptor for reads, direct writes and hints.
+// Without it, all access goes through the fstream.
+void storagedrive_c::fd_open(std::string imagefname, bool direct) {
+	fd_close();
+	fd_fname = imagefname;
+	int flags = file_readonly ? O_RDONLY : O_RDWR;
+	if (direct) {
+		fd = open(imagefname.c_str(), flags | O_DIRECT);
+		if (fd < 0)
+			WARNING("%s: no direct I/O on %s (%s), using page cache", name.value.c_str(),
+					imagefname.c_str(), strerror(errno));
+		else {
+			// a multiple of the read alignment
+			direct_buffer_size = (erase_block.value * 1024) & ~(STORAGEDRIVE_DIRECT_READ_ALIGN - 1);
+			void *p;
+			if (posix_memalign(&p, STORAGEDRIVE_DIRECT_READ_ALIGN, direct_buffer_size) != 0) {
+				ERROR("%s: can not allocate direct I/O buffer", name.value.c_str());
+				close(fd);
+				fd = -1;
+			} else {
+				direct_buffer = (uint8_t *) p;
+				fd_direct = true;
+			}
+		}
+	}
+	if (fd < 0)
+		fd = open(imagefname.c_str(), flags);
+	direct_buffer_valid = 0;
+	direct_write_failed = false;
+	access_end = 0;
+	access_run = 0;
+	access_sequential = false;
+}
+
+void storagedrive_c::fd_close(void) {
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	fd_direct = false;
+	if (direct_buffer)
+		free(direct_buffer);
+	direct_buffer = NULL;
+	direct_buffer_valid = 0;
+}
+
+// detect sequential and random phases from the access positions,
+// and advise the kernel.
+void storagedrive_c::access_track(uint64_t position, unsigned len) {
+	if (fd < 0)
+		return;
+	if (position == access_end) {
+		if (access_run < STORAGEDRIVE_SEQUENTIAL_RUN)
+			access_run++;
+	} else
+		access_run = 0;
+	access_end = position + len;
+
+	bool sequential = (access_run >= STORAGEDRIVE_SEQUENTIAL_RUN);
+	if (sequential != access_sequential) {
+		access_sequential = sequential;
+		// kernel read ahead on fd: large in sequential, none in random phases
+		posix_fadvise(fd, 0, 0, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+		hint_pos = position;
+		drop_pos = position & ~(uint64_t) (STORAGEDRIVE_DIRECT_READ_ALIGN - 1);
+	}
+	if (!sequential || access_end < hint_pos)
+		return;
+
+	// once per half erase block: prefetch ahead, release behind
+	uint64_t window = erase_block.value * 1024;
+	if (!fd_direct)
+		posix_fadvise(fd, access_end, window, POSIX_FADV_WILLNEED);
+	uint64_t drop_end = access_end & ~(uint64_t) (STORAGEDRIVE_DIRECT_READ_ALIGN - 1);
+	if (drop_end > drop_pos) {
+		// only clean pages are released, let the fstream write back first
+		f.flush();
+		posix_fadvise(fd, drop_pos, drop_end - drop_pos, POSIX_FADV_DONTNEED);
+		drop_pos = drop_end;
+	}
+	hint_pos = access_end + window / 2;
+}
+
+// read through own descriptor, 00s behind end of file
+void storagedrive_c::fd_read(uint8_t *buffer, uint64_t position, unsigned len) {
+	f.flush(); // data written by the fstream must be visible
+	if (fd_direct) {
+		if (direct_read(buffer, position, len))
+			return;
+		// permanent fallback
+		WARNING("%s: direct read failed (%s), using page cache", name.value.c_str(),
+				strerror(errno));
+		fd_open(fd_fname, false);
+	}
+	while (len > 0) {
+		ssize_t n = pread(fd, buffer, len, position);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			memset(buffer, 0, len); // end of file
+			return;
+		}
+		buffer += n;
+		position += n;
+		len -= n;
+	}
+}
+
+// read via aligned bounce buffer. In sequential phases a whole erase block
+// is loaded, else only the aligned pages around the request.
+// result: false on I/O error
+bool storagedrive_c::direct_read(uint8_t *buffer, uint64_t position, unsigned len) {
+	while (len > 0) {
+		if (position < direct_buffer_start
+				|| position >= direct_buffer_start + direct_buffer_valid) {
+			uint64_t start = position & ~(uint64_t) (STORAGEDRIVE_DIRECT_READ_ALIGN - 1);
+			unsigned load_len = direct_buffer_size;
+			if (!access_sequential) {
+				uint64_t end = (position + len + STORAGEDRIVE_DIRECT_READ_ALIGN - 1)
+						& ~(uint64_t) (STORAGEDRIVE_DIRECT_READ_ALIGN - 1);
+				load_len = std::min((uint64_t) direct_buffer_size, end - start);
+			}
+			ssize_t n;
+			do
+				n = pread(fd, direct_buffer, load_len, start);
+			while (n < 0 && errno == EINTR);
+			if (n < 0) {
+				direct_buffer_valid = 0;
+				return false;
+			}
+			direct_buffer_start = start;
+			direct_buffer_valid = n;
+			if (position >= start + n) {
+				memset(buffer, 0, len); // end of file
+				return true;
+			}
+		}
+		unsigned offset = position - direct_buffer_start;
+		unsigned n = std::min(len, direct_buffer_valid - offset);
+		memcpy(buffer, direct_buffer + offset, n);
+		buffer += n;
+		position += n;
+		len -= n;
+	}
+	return true;
+}
+
+// write aligned pieces via the bounce buffer.
+// result: false if not possible, caller must use the fstream
+bool storagedrive_c::direct_write(uint8_t *buffer, uint64_t position, unsigned len) {
+	if (!fd_direct || direct_write_failed)
+		return false;
+	if ((position | len) & (STORAGEDRIVE_DIRECT_WRITE_ALIGN - 1))
+		return false; // unaligned
+	f.flush(); // older data written by the fstream must not overwrite this later
+	direct_buffer_valid = 0; // bounce buffer used for write
+	while (len > 0) {
+		unsigned chunk = std::min(len, direct_buffer_size);
+		memcpy(direct_buffer, buffer, chunk);
+		ssize_t n;
+		do
+			n = pwrite(fd, direct_buffer, chunk, position);
+		while (n < 0 && errno == EINTR);
+		if (n != (ssize_t) chunk) {
+			// filesystem needs larger alignment, or other error: rewrite all via fstream
+			WARNING("%s: direct write failed (%s), using page cache for writes",
+					name.value.c_str(), n < 0 ? strerror(errno) : "short write");
+			direct_write_failed = true;
+			return false;
+		}
+		buffer += chunk;
+		position += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
 bool storagedrive_c::file_is_open() {
 	return f.is_open();
 }
@@ -98,6 +399,19 @@ bool storagedrive_c::file_is_open() {
  */
 void storagedrive_c::file_read(uint8_t *buffer, uint64_t position, unsigned len) {
 	assert(file_is_open());
+	if (cimage) {
+		if (!cimage->read(buffer, position, len)) {
+			ERROR("file_read() failure on %s: %s", name.value.c_str(), cimage->error_text.c_str());
+			memset(buffer, 0, len);
+		}
+		return;
+	}
+	access_track(position, len);
+	if (fd >= 0) {
+		fd_read(buffer, position, len);
+		journal_overlay(buffer, position, len);
+		return;
+	}
 	// 1. fill the buffer with 00s
 	memset(buffer, 0, len);
 
@@ -111,15 +425,45 @@ void storagedrive_c::file_read(uint8_t *buffer, uint64_t position, unsigned len)
 
 /* write "len" bytes from buffer into file at position "offset"
  * if file too short, it is extended
+ * "flush": push data to OS immediately. Callers writing many pieces
+ * may clear it and call file_flush() at the end.
  */
-void storagedrive_c::file_write(uint8_t *buffer, uint64_t position, unsigned len) {
+void storagedrive_c::file_write(uint8_t *buffer, uint64_t position, unsigned len, bool flush) {
+	assert(file_is_open());
+	assert(!file_readonly); // caller must take care
+
+	if (cimage) {
+		// holes instead of 00 fill
+		if (!cimage->write(buffer, position, len))
+			ERROR("file_write() failure on %s: %s", name.value.c_str(),
+					cimage->error_text.c_str());
+		if (flush)
+			f.flush();
+		return;
+	}
+
+	access_track(position, len);
+	if (journal_fd >= 0) {
+		journal_append(buffer, position, len);
+		if (flush || batch.size() >= journal_batch.value * 1024)
+			journal_commit();
+		return;
+	}
+	image_write(buffer, position, len, flush);
+}
+
+// write to raw image, extend with 00s
+void storagedrive_c::image_write(uint8_t *buffer, uint64_t position, unsigned len, bool flush) {
 	int64_t write_pos = (int64_t) position;  // unsigned-> int
 	const int max_chunk_size = 0x40000; //256KB: trade-off between performance and mem usage
 	uint8_t *fillbuff = NULL;
 	int64_t file_size, p;
 
-	assert(file_is_open());
-	assert(!file_readonly); // caller must take care
+	if (direct_buffer_valid > 0 && position < direct_buffer_start + direct_buffer_valid
+			&& position + len > direct_buffer_start)
+		direct_buffer_valid = 0; // read ahead is stale
+	if (direct_write(buffer, position, len))
+		return;
 
 	// enlarge file in chunks until filled up to "position"
 	f.clear(); // clear fail bit
@@ -159,20 +503,243 @@ void storagedrive_c::file_write(uint8_t *buffer, uint64_t position, unsigned len
 	f.write((const char*) buffer, len);
 	if (f.fail())
 		ERROR("file_write() failure on %s", name.value.c_str());
+	if (flush)
+		f.flush();
+}
+
+void storagedrive_c::file_flush(void) {
+	assert(file_is_open());
+	journal_commit();
 	f.flush();
 }
 
 uint64_t storagedrive_c::file_size(void) {
+	if (cimage)
+		return cimage->size();
 	f.seekp(0, ios::end);
-	return f.tellp();
+	return std::max((uint64_t) f.tellp(), batch_end); // uncommitted writes may extend
 }
 
 void storagedrive_c::file_close(void) {
 	assert(file_is_open());
+	file_flush_buffers();
+	if (cimage) {
+		delete cimage;
+		cimage = NULL;
+	}
+	journal_close();
+	fd_close();
 	f.close();
 	file_readonly = false;
 }
 
+/*** write ahead journal ***/
+
+// FNV-1a, detects torn batches
+static uint32_t journal_checksum(uint32_t checksum, const uint8_t *data, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		checksum = (checksum ^ data[i]) * 16777619;
+	return checksum;
+}
+#define JOURNAL_CHECKSUM_INIT	2166136261u
+
+// open journal for raw image, replay batches left by a crash
+void storagedrive_c::journal_open(void) {
+	journal_close();
+	if (fd < 0) {
+		WARNING("%s: no journal for %s", name.value.c_str(), fd_fname.c_str());
+		return;
+	}
+	journal_fname = fd_fname + ".journal";
+	journal_fd = open(journal_fname.c_str(), O_RDWR | O_CREAT, 0644);
+	if (journal_fd < 0) {
+		ERROR("%s: can not open journal %s: %s", name.value.c_str(), journal_fname.c_str(),
+				strerror(errno));
+		return;
+	}
+	journal_end = 0;
+	journal_sequence = 0;
+	journal_commits.value = 0;
+	journal_replay();
+}
+
+// a journal left by a crashed session is replayed, even if "journal" is off now.
+// Else the image would miss committed writes.
+void storagedrive_c::journal_attach(void) {
+	if (journal.value)
+		journal_open();
+	else if (journal_pending(fd_fname)) {
+		WARNING("%s: journal of %s left by crash, replayed", name.value.c_str(),
+				fd_fname.c_str());
+		journal_open(); // replay
+		journal_close(); // "journal" off: sync image, remove
+	}
+}
+
+// commit, sync image and remove journal
+void storagedrive_c::journal_close(void) {
+	if (journal_fd < 0)
+		return;
+	journal_commit();
+	journal_checkpoint();
+	close(journal_fd);
+	journal_fd = -1;
+	unlink(journal_fname.c_str());
+}
+
+// write all committed batches to image, ignore a torn last batch
+void storagedrive_c::journal_replay(void) {
+	storagedrive_journal_header_t hdr;
+	off_t size = lseek(journal_fd, 0, SEEK_END);
+	if (size <= 0)
+		return;
+	std::vector<uint8_t> log(size);
+	if (pread(journal_fd, log.data(), size, 0) != size) {
+		ERROR("%s: can not read journal %s", name.value.c_str(), journal_fname.c_str());
+		return;
+	}
+	uint64_t pos = 0, batch_start = 0;
+	uint32_t checksum = JOURNAL_CHECKSUM_INIT;
+	unsigned batches = 0;
+	while (pos + sizeof(hdr) <= (uint64_t) size) {
+		memcpy(&hdr, &log[pos], sizeof(hdr));
+		if (hdr.magic == STORAGEDRIVE_JOURNAL_RECORD) {
+			if (pos + sizeof(hdr) + hdr.len > (uint64_t) size)
+				break; // torn
+			checksum = journal_checksum(checksum, &log[pos], sizeof(hdr) + hdr.len);
+			pos += sizeof(hdr) + hdr.len;
+		} else if (hdr.magic == STORAGEDRIVE_JOURNAL_COMMIT && hdr.len == checksum) {
+			journal_sequence = hdr.position + 1;
+			while (batch_start < pos) {
+				memcpy(&hdr, &log[batch_start], sizeof(hdr));
+				image_write(&log[batch_start + sizeof(hdr)], hdr.position, hdr.len, false);
+				batch_start += sizeof(hdr) + hdr.len;
+			}
+			pos += sizeof(hdr);
+			batch_start = pos;
+			checksum = JOURNAL_CHECKSUM_INIT;
+			batches++;
+		} else
+			break; // torn or invalid
+	}
+	if (batches)
+		INFO("%s: %u batches replayed from journal %s", name.value.c_str(), batches,
+				journal_fname.c_str());
+	if (batch_start < (uint64_t) size)
+		WARNING("%s: %u uncommitted bytes in journal %s discarded", name.value.c_str(),
+				(unsigned) (size - batch_start), journal_fname.c_str());
+	journal_checkpoint();
+}
+
+// add write to current batch
+void storagedrive_c::journal_append(uint8_t *buffer, uint64_t position, unsigned len) {
+	storagedrive_journal_header_t hdr;
+	hdr.magic = STORAGEDRIVE_JOURNAL_RECORD;
+	hdr.len = len;
+	hdr.position = position;
+	unsigned offset = batch.size();
+	batch.resize(offset + sizeof(hdr) + len);
+	memcpy(&batch[offset], &hdr, sizeof(hdr));
+	memcpy(&batch[offset + sizeof(hdr)], buffer, len);
+	batch_record_t record;
+	record.position = position;
+	record.len = len;
+	record.offset = offset + sizeof(hdr);
+	batch_records.push_back(record);
+	batch_end = std::max(batch_end, position + len);
+}
+
+// append batch to journal, sync, then write it to image
+void storagedrive_c::journal_commit(void) {
+	if (journal_fd < 0 || batch_records.empty())
+		return;
+	storagedrive_journal_header_t hdr;
+	hdr.magic = STORAGEDRIVE_JOURNAL_COMMIT;
+	hdr.len = journal_checksum(JOURNAL_CHECKSUM_INIT, batch.data(), batch.size());
+	hdr.position = journal_sequence++;
+	unsigned len = batch.size();
+	batch.resize(len + sizeof(hdr));
+	memcpy(&batch[len], &hdr, sizeof(hdr));
+	len += sizeof(hdr);
+
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+	if (journal_fault == journal_fault_torn_commit
+			&& journal_commits.value + 1 == journal_fault_batch) {
+		// power fails while journal is written
+		if (pwrite(journal_fd, batch.data(), len / 2, journal_end) > 0)
+			fdatasync(journal_fd);
+		journal_fault_check(journal_fault_torn_commit);
+	}
+#endif
+	bool journaled = true;
+	if (pwrite(journal_fd, batch.data(), len, journal_end) != (ssize_t) len
+			|| fdatasync(journal_fd) != 0) {
+		ERROR("%s: journal write failed: %s, image synced directly", name.value.c_str(),
+				strerror(errno));
+		journaled = false;
+	}
+	JOURNAL_FAULT_CHECK(journal_fault_before_apply);
+
+	for (unsigned i = 0; i < batch_records.size(); i++) {
+		batch_record_t *record = &batch_records[i];
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+		if (i == batch_records.size() / 2) {
+			f.flush(); // first half really in image
+			journal_fault_check(journal_fault_torn_apply);
+		}
+#endif
+		image_write(&batch[record->offset], record->position, record->len, false);
+	}
+	f.flush();
+	batch.clear();
+	batch_records.clear();
+	batch_end = 0;
+
+	if (!journaled) {
+		if (fd >= 0)
+			fdatasync(fd);
+	} else {
+		journal_end += len;
+		if (journal_end >= journal_size.value * 1024)
+			journal_checkpoint();
+	}
+	journal_commits.value++;
+}
+
+// image synced: journal not needed anymore
+void storagedrive_c::journal_checkpoint(void) {
+	if (journal_fd < 0)
+		return;
+	f.flush();
+	if (fd >= 0)
+		fdatasync(fd);
+	JOURNAL_FAULT_CHECK(journal_fault_checkpoint);
+	if (ftruncate(journal_fd, 0) != 0)
+		ERROR("%s: can not truncate journal %s", name.value.c_str(), journal_fname.c_str());
+	fdatasync(journal_fd);
+	journal_end = 0;
+}
+
+// reads must see writes not yet committed
+void storagedrive_c::journal_overlay(uint8_t *buffer, uint64_t position, unsigned len) {
+	for (unsigned i = 0; i < batch_records.size(); i++) {
+		batch_record_t *record = &batch_records[i];
+		uint64_t start = std::max(position, record->position);
+		uint64_t end = std::min(position + len, record->position + record->len);
+		if (start < end)
+			memcpy(buffer + (start - position), &batch[record->offset + (start - record->position)],
+					end - start);
+	}
+}
+
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+// test build: simulated power loss
+void storagedrive_c::journal_fault_check(storagedrive_journal_fault_enum point) {
+	if (journal_fault == point && journal_commits.value + 1 == journal_fault_batch)
+		kill(getpid(), SIGKILL);
+}
+#endif
+
 // fill buffer with test data to be placed at "file_offset"
 void storagedrive_selftest_c::block_buffer_fill(unsigned block_number) {
 	assert((block_size % 4) == 0); // whole uint32
@@ -247,4 +814,3 @@ void storagedrive_selftest_c::test() {
 
 	free(block_touched);
 }
-
@@ -33,16 +33,107 @@ using namespace std;
 #include <string>
 #include <fstream>
 #include <assert.h>
+#include <vector>
 
 #include "utils.hpp"
 #include "device.hpp"
 #include "parameter.hpp"
+#include "compressedimage.hpp"
+
+// O_DIRECT: buffer address, file offset and length aligned to the logical block size.
+// Reads are aligned to a page, writes must be aligned by the caller.
+#define STORAGEDRIVE_DIRECT_READ_ALIGN	4096
+#define STORAGEDRIVE_DIRECT_WRITE_ALIGN	512
+// consecutive accesses until a sequential phase is assumed
+#define STORAGEDRIVE_SEQUENTIAL_RUN	4
+
+// write ahead journal "<image>.journal": a sequence of batches.
+// batch = records, then a commit with checksum over the records.
+#define STORAGEDRIVE_JOURNAL_RECORD	0x4a524543	// "JREC"
+#define STORAGEDRIVE_JOURNAL_COMMIT	0x4a434f4d	// "JCOM"
+
+typedef struct {
+	uint32_t magic; // JOURNAL_RECORD: "len" data bytes follow
+	uint32_t len; // JOURNAL_COMMIT: checksum of batch
+	uint64_t position; // JOURNAL_COMMIT: batch sequence number
+} storagedrive_journal_header_t;
+
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+// crash points for the journal test build, see 10.01_base/3_test/storagedrive
+enum storagedrive_journal_fault_enum {
+	journal_fault_none = 0,
+	journal_fault_torn_commit, // only part of batch written to journal
+	journal_fault_before_apply, // batch committed, image not changed
+	journal_fault_torn_apply, // batch partly written to image
+	journal_fault_checkpoint // image synced, journal not truncated
+};
+#endif
 
 class storagecontroller_c;
 
 class storagedrive_c: public device_c {
 private:
 	fstream f; // image file
+	compressed_image_c *cimage; // if image file is compressed, else NULL
+	bool file_attach_compressed(void);
+
+	// own descriptor of raw image files: reads, direct writes, page cache hints
+	int fd; // -1 if none
+	std::string fd_fname;
+	bool fd_direct; // opened with O_DIRECT
+	bool direct_write_failed; // filesystem rejects direct writes: fstream used
+	uint8_t *direct_buffer; // aligned bounce buffer, direct read ahead
+	unsigned direct_buffer_size;
+	uint64_t direct_buffer_start; // image position of direct_buffer[0]
+	unsigned direct_buffer_valid; // image bytes in direct_buffer
+
+	// access pattern, for posix_fadvise()
+	uint64_t access_end; // position behind last access
+	unsigned access_run; // consecutive accesses
+	bool access_sequential;
+	uint64_t hint_pos; // next hint in sequential phase
+	uint64_t drop_pos; // page cache released up to here
+
+	void fd_open(std::string imagefname, bool direct);
+	void fd_close(void);
+	void access_track(uint64_t position, unsigned len);
+	void fd_read(uint8_t *buffer, uint64_t position, unsigned len);
+	bool direct_read(uint8_t *buffer, uint64_t position, unsigned len);
+	bool direct_write(uint8_t *buffer, uint64_t position, unsigned len);
+	void image_write(uint8_t *buffer, uint64_t position, unsigned len, bool flush);
+
+	// journal: writes collect in "batch", are committed to the journal
+	// with one fdatasync() and then written to image without sync.
+	// The image is synced when the journal is truncated.
+	int journal_fd; // -1: journal off
+	std::string journal_fname;
+	uint64_t journal_end; // committed bytes in journal file
+	uint64_t journal_sequence;
+	std::vector<uint8_t> batch; // records not yet committed
+	struct batch_record_t {
+		uint64_t position;
+		unsigned len;
+		unsigned offset; // of data in "batch"
+	};
+	std::vector<batch_record_t> batch_records;
+	uint64_t batch_end; // highest image position written by batch
+
+	void journal_open(void);
+	void journal_attach(void);
+	void journal_close(void);
+	void journal_replay(void);
+	void journal_append(uint8_t *buffer, uint64_t position, unsigned len);
+	void journal_commit(void);
+	void journal_checkpoint(void);
+	void journal_overlay(uint8_t *buffer, uint64_t position, unsigned len);
+#ifdef STORAGEDRIVE_JOURNAL_FAULTS
+	void journal_fault_check(storagedrive_journal_fault_enum point);
+
+protected:
+	// test build: SIGKILL at "journal_fault" during commit #"journal_fault_batch"
+	storagedrive_journal_fault_enum journal_fault;
+	unsigned journal_fault_batch;
+#endif
 
 public:
 	storagecontroller_c *controller; // link to parent
@@ -58,6 +149,22 @@ public:
 	parameter_string_c image_filepath = parameter_string_c(this, "image", "img", /*readonly*/
 	false, "Path to image file");
 
+	// large sequential transfers should not evict everything else from the page cache
+	parameter_bool_c direct_io = parameter_bool_c(this, "direct_io", "dio", /*readonly*/
+	false, "1 = image access bypasses page cache (O_DIRECT)");
+	parameter_unsigned_c erase_block = parameter_unsigned_c(this, "erase_block", "ebs", /*readonly*/
+	false, "KB", "%u", "Read ahead in sequential phases, SD card erase block size", 32, 10);
+
+	// batched writes without torn images on power loss
+	parameter_bool_c journal = parameter_bool_c(this, "journal", "jnl", /*readonly*/
+	false, "1 = writes go through a write ahead journal next to the image");
+	parameter_unsigned_c journal_batch = parameter_unsigned_c(this, "journal_batch", "jnb", /*readonly*/
+	false, "KB", "%u", "Writes collected before a journal commit", 32, 10);
+	parameter_unsigned_c journal_size = parameter_unsigned_c(this, "journal_size", "jns", /*readonly*/
+	false, "KB", "%u", "Journal length which forces image sync and truncation", 32, 10);
+	parameter_unsigned_c journal_commits = parameter_unsigned_c(this, "journal_commits", "jnc", /*readonly*/
+	true, "", "%u", "Batches committed to journal", 32, 10);
+
 	virtual bool on_param_changed(parameter_c *param) override;
 
 //	parameter_bool_c writeprotect = parameter_bool_c(this, "writeprotect", "wp", /*readonly*/false, "Medium is write protected, different reasons") ;
@@ -65,11 +172,16 @@ public:
 	bool file_readonly;bool file_open(std::string imagefname, bool create);bool file_is_open(
 			void);
 	void file_read(uint8_t *buffer, uint64_t position, unsigned len);
-	void file_write(uint8_t *buffer, uint64_t position, unsigned len);
+	void file_write(uint8_t *buffer, uint64_t position, unsigned len, bool flush = true);
+	void file_flush(void);
 	uint64_t file_size(void);
 	void file_close(void);
+	// drives buffering image data write it back here, before the image is closed
+	virtual void file_flush_buffers(void) {
+	}
 
 	storagedrive_c(storagecontroller_c *controller);
+	~storagedrive_c();
 
 };
 
@@ -0,0 +1,478 @@
+/* tapedrive.cpp: magnetic tape drive, with a SIMH .tap image file as medium.
+
+ See LICENSE for terms of use.
+ */
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "logger.hpp"
+#include "timeout.hpp"
+#include "storagecontroller.hpp"
+#include "tapedrive.hpp"
+
+tapedrive_c::tapedrive_c(storagecontroller_c *controller) :
+		storagedrive_c(controller) {
+	type_name.value = "TU10";
+	log_label = "TAPE";
+	writeprotect.value = false;
+	stream.value = true;
+	bench_records.value = 2000;
+	bench_record_size.value = 512;
+	write_busy = false;
+	stream_generation = 0;
+	stream_reset();
+}
+
+tapedrive_c::~tapedrive_c() {
+	if (file_is_open()) {
+		flush();
+		file_close();
+	}
+}
+
+// forget positions and buffers, image changed
+// pending writes must have been drained.
+void tapedrive_c::stream_reset(void) {
+	position = 0;
+	image_size = file_is_open() ? file_size() : 0;
+	window.clear();
+	window_start = 0;
+	prefetch_valid = false;
+	prefetch_requested = false;
+	stream_generation++;
+	write_buffer.clear();
+	write_start = 0;
+	records_read.value = 0;
+	records_written.value = 0;
+}
+
+bool tapedrive_c::on_param_changed(parameter_c *param) {
+	if (param == &enabled) {
+		if (!enabled.new_value)
+			flush(); // worker() stops
+	} else if (param == &image_filepath) {
+		flush();
+		// worker() may still read ahead on old image
+		pthread_mutex_lock(&file_mutex);
+		bool opened = file_open(image_filepath.new_value, true);
+		pthread_mutex_unlock(&file_mutex);
+		if (opened) {
+			pthread_mutex_lock(&stream_mutex);
+			stream_reset();
+			pthread_mutex_unlock(&stream_mutex);
+			image_filepath.value = image_filepath.new_value;
+			controller->on_drive_status_changed(this);
+			return true;
+		}
+	} else if (param == &writeprotect) {
+		writeprotect.value = writeprotect.new_value;
+		controller->on_drive_status_changed(this);
+	} else if (param == &bench_filepath) {
+		// Not a setting but an action: clear, so the same file can be used again
+		if (!bench_filepath.new_value.empty()) {
+			bench(bench_filepath.new_value.c_str());
+			bench_filepath.new_value.clear();
+		}
+		return true;
+	}
+	return storagedrive_c::on_param_changed(param); // more actions (for enable)
+}
+
+// write pending records on power loss
+void tapedrive_c::on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) {
+	UNUSED(aclo_edge);
+	if (dclo_edge == SIGNAL_EDGE_RAISING)
+		flush();
+}
+
+void tapedrive_c::on_init_changed(void) {
+}
+
+/*** image file access, stream_mutex locked ***/
+
+// write to image and end medium behind the data
+void tapedrive_c::image_write(uint8_t *buffer, uint64_t pos, unsigned len) {
+	uint8_t eom[4] = { 0xff, 0xff, 0xff, 0xff };
+	pthread_mutex_lock(&file_mutex);
+	file_write(buffer, pos, len, /*flush*/false);
+	file_write(eom, pos + len, sizeof(eom), /*flush*/false);
+	file_flush();
+	pthread_mutex_unlock(&file_mutex);
+}
+
+// write all buffered records to image, wait for worker()
+void tapedrive_c::drain_writes(void) {
+	while (write_busy)
+		pthread_cond_wait(&stream_cond, &stream_mutex);
+	if (!write_buffer.empty()) {
+		image_write(write_buffer.data(), write_start, write_buffer.size());
+		write_buffer.clear();
+	}
+}
+
+// image changes by write: window and prefetch are stale
+void tapedrive_c::invalidate_reads(void) {
+	window.clear();
+	prefetch_valid = false;
+	prefetch_requested = false;
+	stream_generation++;
+}
+
+// copy "len" bytes at image position "pos".
+// Served from window, else from prefetched window, else window is loaded.
+// false: beyond end of image file
+bool tapedrive_c::get_bytes(uint64_t pos, unsigned len, uint8_t *buffer) {
+	if (pos + len > image_size)
+		return false;
+	while (len > 0) {
+		uint64_t window_end = window_start + window.size();
+		if (pos >= window_start && pos < window_end) {
+			unsigned n = std::min((uint64_t) len, window_end - pos);
+			memcpy(buffer, window.data() + (pos - window_start), n);
+			buffer += n;
+			pos += n;
+			len -= n;
+		} else if (prefetch_valid && pos >= prefetch_start
+				&& pos < prefetch_start + prefetch.size()) {
+			window.swap(prefetch);
+			window_start = prefetch_start;
+			prefetch_valid = false;
+		} else {
+			// synchronous load: first access, reverse motion, or worker too slow.
+			// Without streaming only the requested bytes.
+			unsigned n = stream.value ? TAPEDRIVE_STREAM_SIZE : len;
+			n = std::min((uint64_t) n, image_size - pos);
+			window.resize(n);
+			window_start = pos;
+			pthread_mutex_lock(&file_mutex);
+			file_read(window.data(), pos, n);
+			pthread_mutex_unlock(&file_mutex);
+		}
+	}
+	// reading second half of window: let worker() load the following
+	uint64_t window_end = window_start + window.size();
+	if (stream.value && !prefetch_valid && !prefetch_requested && window_end < image_size
+			&& pos > window_start + window.size() / 2) {
+		prefetch_start = window_end;
+		prefetch_requested = true;
+		pthread_cond_broadcast(&stream_cond);
+	}
+	return true;
+}
+
+bool tapedrive_c::get_length(uint64_t pos, uint32_t *value) {
+	uint8_t b[4];
+	if (!get_bytes(pos, 4, b))
+		return false;
+	*value = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+	return true;
+}
+
+// write "len" bytes at image position "pos"
+void tapedrive_c::put_bytes(uint64_t pos, unsigned len, uint8_t *buffer) {
+	// only continuous data in write behind buffer
+	if (!write_buffer.empty() && pos != write_start + write_buffer.size())
+		drain_writes();
+	if (write_buffer.empty())
+		write_start = pos;
+	write_buffer.insert(write_buffer.end(), buffer, buffer + len);
+	invalidate_reads();
+	image_size = std::max(image_size, pos + len);
+
+	if (!stream.value || write_buffer.size() >= TAPEDRIVE_WRITE_BEHIND_MAX)
+		drain_writes(); // synchronous, or worker() does not keep up
+	else if (write_buffer.size() >= TAPEDRIVE_STREAM_SIZE)
+		pthread_cond_broadcast(&stream_cond);
+}
+
+/*** worker() jobs, called with stream_mutex locked. File access unlocked ***/
+
+// write behind buffer to image.
+// "idle": also small amounts, if controller does not write anymore
+void tapedrive_c::write_behind(bool idle) {
+	std::vector<uint8_t> chunk;
+	chunk.swap(write_buffer);
+	uint64_t chunk_start = write_start;
+	write_busy = true;
+	pthread_mutex_unlock(&stream_mutex);
+
+	image_write(chunk.data(), chunk_start, chunk.size());
+	if (idle)
+		DEBUG("Write behind of %u bytes on idle", (unsigned) chunk.size());
+
+	pthread_mutex_lock(&stream_mutex);
+	write_busy = false;
+	pthread_cond_broadcast(&stream_cond); // drain_writes() may wait
+}
+
+// load window following the current one
+void tapedrive_c::read_ahead(void) {
+	unsigned generation = stream_generation;
+	uint64_t start = prefetch_start;
+	if (start >= image_size) {
+		prefetch_requested = false;
+		return;
+	}
+	unsigned n = std::min((uint64_t) TAPEDRIVE_STREAM_SIZE, image_size - start);
+	std::vector<uint8_t> chunk(n);
+	pthread_mutex_unlock(&stream_mutex);
+
+	pthread_mutex_lock(&file_mutex);
+	file_read(chunk.data(), start, n);
+	pthread_mutex_unlock(&file_mutex);
+
+	pthread_mutex_lock(&stream_mutex);
+	if (generation == stream_generation && prefetch_requested) {
+		prefetch.swap(chunk);
+		prefetch_valid = true;
+	}
+	prefetch_requested = false;
+}
+
+void tapedrive_c::worker(unsigned instance) {
+	UNUSED(instance); // only one
+	pthread_mutex_lock(&stream_mutex);
+	while (!workers_terminate) {
+		if (write_buffer.size() >= TAPEDRIVE_STREAM_SIZE && !write_busy)
+			write_behind(false);
+		else if (prefetch_requested && file_is_open())
+			read_ahead();
+		else {
+			// wait for job, check for termination regularly
+			struct timespec abstime;
+			timeout_c::deadline_ns(&abstime, 50 * MILLION);
+			bool signaled = (pthread_cond_timedwait(&stream_cond, &stream_mutex, &abstime) == 0);
+			// controller stopped writing: tape image complete on disk
+			if (!signaled && !write_buffer.empty() && !write_busy)
+				write_behind(true);
+		}
+	}
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+/*** tape operations ***/
+
+tapedrive_status_enum tapedrive_c::read_record(uint8_t *buffer, unsigned buffer_size,
+		unsigned *record_len) {
+	tapedrive_status_enum result;
+	uint32_t header;
+	*record_len = 0;
+	if (!file_is_open())
+		return tapedrive_not_ready;
+	pthread_mutex_lock(&stream_mutex);
+	drain_writes();
+	do {
+		if (!get_length(position, &header)) {
+			result = tapedrive_eom; // end of file
+			goto done;
+		}
+		if (header == TAPEDRIVE_GAP)
+			position += 4;
+	} while (header == TAPEDRIVE_GAP);
+
+	if (header == TAPEDRIVE_EOM) {
+		result = tapedrive_eom;
+	} else if (header == TAPEDRIVE_TAPEMARK) {
+		position += 4;
+		records_read.value++;
+		result = tapedrive_tapemark;
+	} else {
+		unsigned len = header & TAPEDRIVE_RECORD_LENGTH_MASK;
+		unsigned padded_len = (len + 1) & ~1;
+		if (position + 8 + padded_len > image_size) {
+			result = tapedrive_format_error;
+			goto done;
+		}
+		if (buffer)
+			get_bytes(position + 4, std::min(len, buffer_size), buffer);
+		position += 8 + padded_len;
+		*record_len = len;
+		records_read.value++;
+		result = (header & TAPEDRIVE_RECORD_ERROR) ? tapedrive_record_error : tapedrive_ok;
+	}
+	done: //
+	pthread_mutex_unlock(&stream_mutex);
+	return result;
+}
+
+// position before previous record or tape mark
+tapedrive_status_enum tapedrive_c::space_reverse(unsigned *record_len) {
+	tapedrive_status_enum result;
+	uint32_t trailer;
+	*record_len = 0;
+	if (!file_is_open())
+		return tapedrive_not_ready;
+	pthread_mutex_lock(&stream_mutex);
+	drain_writes();
+	do {
+		if (position == 0) {
+			result = tapedrive_bot;
+			goto done;
+		}
+		if (position < 4 || !get_length(position - 4, &trailer)) {
+			result = tapedrive_format_error;
+			goto done;
+		}
+		if (trailer == TAPEDRIVE_GAP)
+			position -= 4;
+	} while (trailer == TAPEDRIVE_GAP);
+
+	if (trailer == TAPEDRIVE_TAPEMARK) {
+		position -= 4;
+		records_read.value++;
+		result = tapedrive_tapemark;
+	} else {
+		unsigned len = trailer & TAPEDRIVE_RECORD_LENGTH_MASK;
+		unsigned padded_len = (len + 1) & ~1;
+		if (position < 8 + padded_len) {
+			result = tapedrive_format_error;
+			goto done;
+		}
+		position -= 8 + padded_len;
+		*record_len = len;
+		records_read.value++;
+		result = (trailer & TAPEDRIVE_RECORD_ERROR) ? tapedrive_record_error : tapedrive_ok;
+	}
+	done: //
+	pthread_mutex_unlock(&stream_mutex);
+	return result;
+}
+
+tapedrive_status_enum tapedrive_c::write_record(uint8_t *buffer, unsigned len) {
+	if (!file_is_open() || is_write_locked())
+		return tapedrive_not_ready;
+	assert(len > 0 && len <= TAPEDRIVE_RECORD_LENGTH_MASK);
+	unsigned padded_len = (len + 1) & ~1;
+	uint8_t length[4] = { (uint8_t) len, (uint8_t) (len >> 8), (uint8_t) (len >> 16), 0 };
+	uint8_t pad = 0;
+
+	pthread_mutex_lock(&stream_mutex);
+	put_bytes(position, 4, length);
+	put_bytes(position + 4, len, buffer);
+	if (padded_len != len)
+		put_bytes(position + 4 + len, 1, &pad);
+	put_bytes(position + 4 + padded_len, 4, length);
+	position += 8 + padded_len;
+	image_size = position; // medium ends here
+	records_written.value++;
+	pthread_mutex_unlock(&stream_mutex);
+	return tapedrive_ok;
+}
+
+tapedrive_status_enum tapedrive_c::write_tapemark(void) {
+	if (!file_is_open() || is_write_locked())
+		return tapedrive_not_ready;
+	uint8_t tapemark[4] = { 0, 0, 0, 0 };
+	pthread_mutex_lock(&stream_mutex);
+	put_bytes(position, 4, tapemark);
+	position += 4;
+	image_size = position;
+	records_written.value++;
+	pthread_mutex_unlock(&stream_mutex);
+	return tapedrive_ok;
+}
+
+void tapedrive_c::rewind(void) {
+	pthread_mutex_lock(&stream_mutex);
+	drain_writes();
+	position = 0;
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+void tapedrive_c::unload(void) {
+	if (!file_is_open())
+		return;
+	pthread_mutex_lock(&stream_mutex);
+	drain_writes();
+	pthread_mutex_lock(&file_mutex);
+	file_close();
+	pthread_mutex_unlock(&file_mutex);
+	stream_reset();
+	pthread_mutex_unlock(&stream_mutex);
+	controller->on_drive_status_changed(this);
+}
+
+void tapedrive_c::flush(void) {
+	if (!file_is_open())
+		return;
+	pthread_mutex_lock(&stream_mutex);
+	drain_writes();
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+/*** benchmark ***/
+
+// Write and read back "bench_records" records on a scratch image,
+// synchronous and streaming. Drive must be enabled for streaming,
+// else write behind and read ahead are done by the caller.
+bool tapedrive_c::bench(const char *scratch_fname) {
+	if (file_is_open()) {
+		ERROR("Benchmark: drive %s has an image", name.value.c_str());
+		return false;
+	}
+	unsigned record_count = bench_records.value;
+	unsigned record_size = bench_record_size.value;
+	if (record_count == 0 || record_size == 0 || record_size > TAPEDRIVE_RECORD_LENGTH_MASK) {
+		ERROR("Benchmark: invalid record count or size");
+		return false;
+	}
+	std::vector<uint8_t> record(record_size);
+	for (unsigned i = 0; i < record_size; i++)
+		record[i] = i;
+
+	bool saved_stream = stream.value;
+	bool saved_writeprotect = writeprotect.value;
+	writeprotect.value = false;
+	bool ok = true;
+	for (unsigned run = 0; ok && run < 2; run++) {
+		stream.value = (run == 1);
+		remove(scratch_fname);
+		if (!file_open(scratch_fname, true)) {
+			ERROR("Benchmark: can not create %s", scratch_fname);
+			ok = false;
+			break;
+		}
+		pthread_mutex_lock(&stream_mutex);
+		stream_reset();
+		pthread_mutex_unlock(&stream_mutex);
+
+		timeout_c timer;
+		timer.start_ns(0);
+		for (unsigned i = 0; i < record_count; i++)
+			write_record(record.data(), record_size);
+		write_tapemark();
+		flush();
+		uint64_t write_us = std::max(timer.elapsed_us(), (uint64_t) 1);
+
+		rewind();
+		timer.start_ns(0);
+		unsigned len;
+		for (unsigned i = 0; ok && i < record_count; i++)
+			if (read_record(record.data(), record_size, &len) != tapedrive_ok
+					|| len != record_size) {
+				ERROR("Benchmark: record %u not read back", i);
+				ok = false;
+			}
+		uint64_t read_us = std::max(timer.elapsed_us(), (uint64_t) 1);
+
+		unsigned write_rate = (uint64_t) record_count * MILLION / write_us;
+		unsigned read_rate = (uint64_t) record_count * MILLION / read_us;
+		INFO("Benchmark %s: %u records of %u bytes, write %u records/s, read %u records/s",
+				stream.value ? "streaming" : "synchronous", record_count, record_size,
+				write_rate, read_rate);
+		if (stream.value) {
+			bench_write_rate.value = write_rate;
+			bench_read_rate.value = read_rate;
+		}
+		pthread_mutex_lock(&stream_mutex);
+		drain_writes();
+		file_close();
+		stream_reset();
+		pthread_mutex_unlock(&stream_mutex);
+	}
+	remove(scratch_fname);
+	stream.value = saved_stream;
+	writeprotect.value = saved_writeprotect;
+	return ok;
+}
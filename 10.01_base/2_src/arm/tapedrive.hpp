@@ -0,0 +1,153 @@
+/* tapedrive.hpp: magnetic tape drive, with a SIMH .tap image file as medium.
+
+ See LICENSE for terms of use.
+
+ Image format as used by SIMH, all numbers little endian:
+	uint32	length		bit 31: record was read with error
+	data	"length" bytes, padded to even length
+	uint32	length		repeated, for reverse motion
+ length 0 is a tape mark, 0xffffffff marks the end of medium.
+ Erase gap markers 0xfffffffe are skipped.
+ The image file may end without end of medium marker.
+ Writing ends the medium behind the written record.
+
+ Tape is mostly accessed sequentially, so image file access is done in
+ large pieces, decoupled from the controller ("stream"):
+ - read ahead: records are taken from a window of the image file.
+   While the controller reads the second half of the window,
+   worker() loads the following window.
+ - write behind: written records collect in a buffer, worker() writes
+   it to the image when it is large or the controller idles.
+   Any other operation writes pending records first.
+ With "stream" off every record is read and written with own file accesses.
+
+ Controllers call the tape operations from their own worker(),
+ one at a time.
+ */
+#ifndef _TAPEDRIVE_HPP_
+#define _TAPEDRIVE_HPP_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+
+#include "storagedrive.hpp"
+
+// read ahead window and write behind chunk
+#define TAPEDRIVE_STREAM_SIZE	0x40000	// 256KB
+// write behind buffer is written synchronously, if worker() does not keep up
+#define TAPEDRIVE_WRITE_BEHIND_MAX	(4 * TAPEDRIVE_STREAM_SIZE)
+
+#define TAPEDRIVE_TAPEMARK	0x00000000
+#define TAPEDRIVE_GAP	0xfffffffe
+#define TAPEDRIVE_EOM	0xffffffff
+#define TAPEDRIVE_RECORD_ERROR	0x80000000
+#define TAPEDRIVE_RECORD_LENGTH_MASK	0x00ffffff
+
+// result of tape motion
+enum tapedrive_status_enum {
+	tapedrive_ok = 0,
+	tapedrive_tapemark, // tape mark passed
+	tapedrive_bot, // reverse motion stopped at begin of tape
+	tapedrive_eom, // end of medium, tape not moved
+	tapedrive_record_error, // record passed, but is marked bad
+	tapedrive_format_error, // image file corrupt
+	tapedrive_not_ready // no image, or write locked
+};
+
+class tapedrive_c: public storagedrive_c {
+private:
+	uint64_t position; // image file offset, always between records
+	uint64_t image_size; // readable bytes, including written records
+
+	// stream state, worker() and tape operations
+	pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+	// serializes file_*() calls of worker() and tape operations
+	pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	// read ahead
+	std::vector<uint8_t> window; // image content starting at window_start
+	uint64_t window_start;
+	std::vector<uint8_t> prefetch; // following window, loaded by worker()
+	uint64_t prefetch_start;
+	bool prefetch_valid;
+	bool prefetch_requested;
+	unsigned stream_generation; // changed on write: running prefetch is stale
+
+	// write behind
+	std::vector<uint8_t> write_buffer; // image content starting at write_start
+	uint64_t write_start;
+	bool write_busy; // worker() writes a chunk
+
+	// all with stream_mutex locked
+	void image_write(uint8_t *buffer, uint64_t pos, unsigned len);
+	void drain_writes(void);
+	void invalidate_reads(void);
+	bool get_bytes(uint64_t pos, unsigned len, uint8_t *buffer);
+	bool get_length(uint64_t pos, uint32_t *value);
+	void put_bytes(uint64_t pos, unsigned len, uint8_t *buffer);
+	void write_behind(bool idle);
+	void read_ahead(void);
+
+	void stream_reset(void);
+	bool bench(const char *scratch_fname);
+
+public:
+	parameter_bool_c writeprotect = parameter_bool_c(this, "writeprotect", "wp", /*readonly*/
+	false, "1 = no write ring in tape reel");
+	parameter_bool_c stream = parameter_bool_c(this, "stream", "st", /*readonly*/
+	false, "1 = read ahead and write behind, 0 = file access per record");
+
+	parameter_unsigned_c records_read = parameter_unsigned_c(this, "records_read", "rr", /*readonly*/
+	true, "", "%u", "Records read or spaced over.", 32, 10);
+	parameter_unsigned_c records_written = parameter_unsigned_c(this, "records_written", "rw", /*readonly*/
+	true, "", "%u", "Records and tape marks written.", 32, 10);
+
+	// benchmark: not a setting, but an action
+	parameter_string_c bench_filepath = parameter_string_c(this, "bench", "bn", /*readonly*/
+	false, "Measure record rates on this scratch file, drive must have no image");
+	parameter_unsigned_c bench_records = parameter_unsigned_c(this, "bench_records", "bnr", /*readonly*/
+	false, "", "%u", "Records per benchmark run.", 32, 10);
+	parameter_unsigned_c bench_record_size = parameter_unsigned_c(this, "bench_record_size", "bns", /*readonly*/
+	false, "byte", "%u", "Record size of benchmark.", 32, 10);
+	parameter_unsigned_c bench_write_rate = parameter_unsigned_c(this, "bench_write_rate", "bnw", /*readonly*/
+	true, "records/s", "%u", "Write rate of last benchmark, streaming.", 32, 10);
+	parameter_unsigned_c bench_read_rate = parameter_unsigned_c(this, "bench_read_rate", "bnrd", /*readonly*/
+	true, "records/s", "%u", "Read rate of last benchmark, streaming.", 32, 10);
+
+	tapedrive_c(storagecontroller_c *controller);
+	~tapedrive_c();
+
+	bool on_param_changed(parameter_c *param) override;
+	void on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) override;
+	void on_init_changed(void) override;
+
+	// read ahead and write behind
+	void worker(unsigned instance) override;
+
+	bool is_ready(void) {
+		return file_is_open();
+	}
+	bool is_bot(void) {
+		return position == 0;
+	}
+	bool is_write_locked(void) {
+		return writeprotect.value || file_readonly;
+	}
+
+	// tape operations.
+	// read_record: "buffer" may be NULL to space forward.
+	// record_len is the length of the record on tape, only "buffer_size" bytes are copied.
+	tapedrive_status_enum read_record(uint8_t *buffer, unsigned buffer_size, unsigned *record_len);
+	tapedrive_status_enum space_reverse(unsigned *record_len);
+	tapedrive_status_enum write_record(uint8_t *buffer, unsigned len);
+	tapedrive_status_enum write_tapemark(void);
+	void rewind(void);
+	// rewind and close image, operator must load tape again
+	void unload(void);
+	// write pending records to image
+	void flush(void);
+};
+
+#endif
@@ -47,6 +47,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "utils.hpp"
 #include "timeout.hpp"
@@ -108,6 +109,14 @@ void timeout_c::wait_ns(uint64_t duration_ns) {
 //		DEBUG("nanosleep() return a %d", res);
 }
 
+// default pthread condition clock is CLOCK_REALTIME
+void timeout_c::deadline_ns(struct timespec *abstime, uint64_t duration_ns) {
+	clock_gettime(CLOCK_REALTIME, abstime);
+	uint64_t nsec = abstime->tv_nsec + duration_ns;
+	abstime->tv_sec += nsec / BILLION;
+	abstime->tv_nsec = nsec % BILLION;
+}
+
 // wait a number of milliseconds
 void timeout_c::wait_ms(unsigned duration_ms) {
 	wait_ns(MILLION * duration_ms);
@@ -124,6 +133,10 @@ flexi_timeout_controller_c *the_flexi_timeout_controller;
 
 flexi_timeout_c::flexi_timeout_c() {
 	log_label = "FTO";
+	wheel_next = wheel_prev = incoming_next = NULL;
+	wheel_slot = flexi_timeout_controller_c::wheel_slot_none;
+	wheel_tick = 0;
+	wheel_used = false;
 	timeout_controller = the_flexi_timeout_controller;
 	timeout_controller->insert_timeout(this);
 	if (timeout_controller->mode == emulated_time) {
@@ -132,6 +145,9 @@ flexi_timeout_c::flexi_timeout_c() {
 	}
 }
 flexi_timeout_c::~flexi_timeout_c() {
+	// wait() aborted, or signaling thread still busy with sem_post()
+	if (wheel_used)
+		timeout_controller->emu_cancel_timeout_wait(this);
 	if (timeout_controller->mode == emulated_time) {
 		int sval;
 		sem_getvalue(&semaphore, &sval);
@@ -155,10 +171,9 @@ void flexi_timeout_c::start_ns(uint64_t duration_ns) {
 		starttime_ns = timeout_controller->world_now_ns();
 		signaltime_ns = starttime_ns + +duration_ns;
 	} else {
-		// emulated time
+		// emulated time. No wait signal needed, reached() compares with emu_now_ns
 		starttime_ns = timeout_controller->emu_now_ns;
 		signaltime_ns = starttime_ns + duration_ns;
-		timeout_controller->emu_insert_timeout_wait(this);
 	}
 }
 
@@ -235,7 +250,12 @@ flexi_timeout_controller_c::flexi_timeout_controller_c() {
 	mode = flexi_timeout_c::world_time; // downward copatibility
 // "emulated_time" only used when emulated CPU
 	emu_now_ns = 0;
-	emu_oldest_signal_time_ns = 0;
+	memset(wheel, 0, sizeof(wheel));
+	memset(wheel_occupied, 0, sizeof(wheel_occupied));
+	wheel_now_tick = 0;
+	wheel_count = 0;
+	incoming = NULL;
+	emu_next_check_ns = UINT64_MAX;
 }
 
 void flexi_timeout_controller_c::insert_timeout(flexi_timeout_c *timeout) {
@@ -274,8 +294,9 @@ void flexi_timeout_controller_c::set_mode(enum flexi_timeout_c::mode new_mode) {
 		// seamless continue with current time,
 		// so all starttime/endtime can be re-used, reached() and elapsed() preserved
 		emu_now_ns = world_now_ns();
-		emu_oldest_signal_time_ns = 0;
-		assert(emu_timeout_wait_list.size() == 0); // start empty
+		assert(wheel_count == 0 && incoming == NULL); // start empty
+		wheel_now_tick = emu_now_ns >> wheel_tick_shift;
+		__atomic_store_n(&emu_next_check_ns, UINT64_MAX, __ATOMIC_SEQ_CST);
 		// recalc all start and endtimes, so elapsed() and reached() are preserved)
 	} else {
 		// Transition emulated_time -> real_time
@@ -291,19 +312,163 @@ void flexi_timeout_controller_c::set_mode(enum flexi_timeout_c::mode new_mode) {
 		// as the app stopps calingstep() now, they'd freeze forever.
 		// so signal all.
 		mode = flexi_timeout_c::world_time; // before signaling waiters, they may wait() immediately again
-		std::multimap<uint64_t, flexi_timeout_c*>::iterator it = emu_timeout_wait_list.begin();
-		while (it != emu_timeout_wait_list.end()) {
-			int res = sem_post(&(it->second->semaphore)); // signal to sem_wait()
-			assert(res == 0);
-			it = emu_timeout_wait_list.erase(it); // delete and next
-		}
+		wheel_drain_incoming();
+		for (unsigned level = 0; level < wheel_levels; level++)
+			for (unsigned slot = 0; slot < wheel_slot_count; slot++)
+				while (wheel[level][slot])
+					wheel_signal(wheel[level][slot]);
+		__atomic_store_n(&emu_next_check_ns, UINT64_MAX, __ATOMIC_SEQ_CST);
 	}
 	pthread_mutex_unlock(&mutex);
 }
 
+// Device thread: insert, without lock.
+// Push on "incoming", and make sure emu_step_ns() looks at it in time.
+void flexi_timeout_controller_c::emu_insert_timeout_wait(flexi_timeout_c *timeout) {
+	timeout->wheel_tick = (timeout->signaltime_ns + (1 << wheel_tick_shift) - 1)
+			>> wheel_tick_shift; // round up: never signal early
+	timeout->wheel_used = true;
+	__atomic_store_n(&timeout->wheel_slot, wheel_slot_incoming, __ATOMIC_RELAXED);
+	timeout->incoming_next = __atomic_load_n(&incoming, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&incoming, &timeout->incoming_next, timeout, true,
+	__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		;
+	uint64_t next_check = __atomic_load_n(&emu_next_check_ns, __ATOMIC_RELAXED);
+	while (timeout->signaltime_ns < next_check
+			&& !__atomic_compare_exchange_n(&emu_next_check_ns, &next_check,
+					timeout->signaltime_ns, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		;
+}
+
+// Remove a timeout before it was signaled (wait() interrupted).
+// Also waits until a concurrent wheel_signal() is complete.
+void flexi_timeout_controller_c::emu_cancel_timeout_wait(flexi_timeout_c *timeout) {
+	pthread_mutex_lock(&mutex);
+	wheel_drain_incoming(); // incoming can not be unlinked from
+	if (timeout->wheel_slot >= 0)
+		wheel_unlink(timeout);
+	timeout->wheel_used = false;
+	pthread_mutex_unlock(&mutex);
+}
+
+// put into slot by time to go, O(1). Under mutex.
+void flexi_timeout_controller_c::wheel_link(flexi_timeout_c *timeout) {
+	unsigned level = 0;
+	// smallest level on which the signal tick is less than one round ahead
+	while (level < wheel_levels - 1
+			&& (timeout->wheel_tick >> (level * wheel_slot_bits))
+					- (wheel_now_tick >> (level * wheel_slot_bits)) >= wheel_slot_count)
+		level++;
+	uint64_t tick = timeout->wheel_tick;
+	if ((tick >> (level * wheel_slot_bits)) - (wheel_now_tick >> (level * wheel_slot_bits))
+			>= wheel_slot_count)
+		// beyond top level: park in its last slot, cascaded again from there
+		tick = wheel_now_tick + ((uint64_t) (wheel_slot_count - 1) << (level * wheel_slot_bits));
+	unsigned slot = (tick >> (level * wheel_slot_bits)) & (wheel_slot_count - 1);
+	flexi_timeout_c **head = &wheel[level][slot];
+	timeout->wheel_prev = NULL;
+	timeout->wheel_next = *head;
+	if (*head)
+		(*head)->wheel_prev = timeout;
+	*head = timeout;
+	wheel_occupied[level] |= (uint64_t) 1 << slot;
+	__atomic_store_n(&timeout->wheel_slot, level * wheel_slot_count + slot, __ATOMIC_RELAXED);
+	wheel_count++;
+}
+
+// O(1). Under mutex.
+void flexi_timeout_controller_c::wheel_unlink(flexi_timeout_c *timeout) {
+	unsigned level = timeout->wheel_slot / wheel_slot_count;
+	unsigned slot = timeout->wheel_slot % wheel_slot_count;
+	if (timeout->wheel_prev)
+		timeout->wheel_prev->wheel_next = timeout->wheel_next;
+	else
+		wheel[level][slot] = timeout->wheel_next;
+	if (timeout->wheel_next)
+		timeout->wheel_next->wheel_prev = timeout->wheel_prev;
+	if (wheel[level][slot] == NULL)
+		wheel_occupied[level] &= ~((uint64_t) 1 << slot);
+	__atomic_store_n(&timeout->wheel_slot, wheel_slot_none, __ATOMIC_RELAXED);
+	wheel_count--;
+}
+
+// remove and wake up waiter. Under mutex.
+void flexi_timeout_controller_c::wheel_signal(flexi_timeout_c *timeout) {
+	wheel_unlink(timeout);
+	int res = sem_post(&timeout->semaphore); // signal to sem_wait()
+	assert(res == 0);
+}
+
+// move new timeouts into wheel. Under mutex.
+void flexi_timeout_controller_c::wheel_drain_incoming(void) {
+	flexi_timeout_c *timeout = __atomic_exchange_n(&incoming, (flexi_timeout_c *) NULL,
+	__ATOMIC_SEQ_CST);
+	while (timeout) {
+		flexi_timeout_c *next = timeout->incoming_next;
+		// already due timeouts go into current slot, are signaled by next wheel_expire()
+		if (timeout->wheel_tick < wheel_now_tick)
+			timeout->wheel_tick = wheel_now_tick;
+		wheel_link(timeout);
+		timeout = next;
+	}
+}
+
+// earliest tick at which a non-empty slot must be processed, UINT64_MAX if none.
+// Slot start, so may be earlier than the timeouts in it. Under mutex.
+uint64_t flexi_timeout_controller_c::wheel_next_tick(void) {
+	uint64_t result = UINT64_MAX;
+	for (unsigned level = 0; level < wheel_levels; level++) {
+		if (!wheel_occupied[level])
+			continue;
+		unsigned shift = level * wheel_slot_bits;
+		unsigned cur = (wheel_now_tick >> shift) & (wheel_slot_count - 1);
+		// rotate occupied bits, so "cur" is bit 0
+		uint64_t bits = wheel_occupied[level];
+		bits = cur ? (bits >> cur) | (bits << (wheel_slot_count - cur)) : bits;
+		unsigned distance = __builtin_ctzll(bits);
+		uint64_t tick = ((wheel_now_tick >> shift) + distance) << shift;
+		if (tick < wheel_now_tick)
+			tick = wheel_now_tick; // current slot on level 0
+		if (tick < result)
+			result = tick;
+	}
+	return result;
+}
+
+// Process all slots up to now_tick in time order:
+// higher slots are cascaded down, then level 0 slots are signaled. Under mutex.
+void flexi_timeout_controller_c::wheel_expire(uint64_t now_tick) {
+	uint64_t tick;
+	while ((tick = wheel_next_tick()) <= now_tick) {
+		wheel_now_tick = tick;
+		// highest level on whose slot boundary "tick" is
+		int top_level = 0;
+		while (top_level < (int) wheel_levels - 1
+				&& (tick & (((uint64_t) 1 << ((top_level + 1) * wheel_slot_bits)) - 1)) == 0)
+			top_level++;
+		for (int level = top_level; level >= 0; level--) {
+			unsigned shift = level * wheel_slot_bits;
+			unsigned slot = (tick >> shift) & (wheel_slot_count - 1);
+			flexi_timeout_c *timeout = wheel[level][slot];
+			while (timeout) {
+				flexi_timeout_c *next = timeout->wheel_next;
+				if (timeout->wheel_tick <= tick)
+					wheel_signal(timeout);
+				else if (level > 0) {
+					// cascade
+					wheel_unlink(timeout);
+					wheel_link(timeout);
+				}
+				timeout = next;
+			}
+		}
+	}
+	wheel_now_tick = now_tick;
+}
+
 // advance emulated clock
 // and signal elapsed timeouts.
-void flexi_timeout_controller_c::emu_step_ns(unsigned emu_delta_ns) {
+void flexi_timeout_controller_c::emu_step_ns(uint64_t emu_delta_ns) {
 	if (mode != flexi_timeout_c::emulated_time)
 		return;
 
@@ -312,26 +477,25 @@ void flexi_timeout_controller_c::emu_step_ns(unsigned emu_delta_ns) {
 
 	// signals must be triggered? Quick test first.
 	// step() is called very frequently, timeouts change quite seldom.
-	if (emu_oldest_signal_time_ns && emu_now_ns >= emu_oldest_signal_time_ns) {
-		pthread_mutex_lock(&mutex);
-		// Create a map iterator and point to beginning of map
-		std::multimap<uint64_t, flexi_timeout_c*>::iterator it = emu_timeout_wait_list.begin();
-		while (it != emu_timeout_wait_list.end() && it->second->signaltime_ns <= emu_now_ns) {
-			int res = sem_post(&(it->second->semaphore)); // signal to sem_wait()
-			assert(res == 0);
-			it = emu_timeout_wait_list.erase(it); // delete and next
-		}
-		// save first entry timestamp in "emu_oldest_signal_time_ns" for quick test
-		if (it == emu_timeout_wait_list.end())
-			emu_oldest_signal_time_ns = 0;
-		else
-			emu_oldest_signal_time_ns = it->second->signaltime_ns;
-		pthread_mutex_unlock(&mutex);
-	}
+	if (emu_now_ns < __atomic_load_n(&emu_next_check_ns, __ATOMIC_RELAXED))
+		return;
+	pthread_mutex_lock(&mutex);
+	uint64_t next_check;
+	do {
+		wheel_drain_incoming();
+		wheel_expire(emu_now_ns >> wheel_tick_shift);
+		uint64_t next_tick = wheel_next_tick();
+		next_check = next_tick == UINT64_MAX ? UINT64_MAX : next_tick << wheel_tick_shift;
+		__atomic_store_n(&emu_next_check_ns, next_check, __ATOMIC_SEQ_CST);
+		// insert may have lowered emu_next_check_ns before store: process again
+	} while (__atomic_load_n(&incoming, __ATOMIC_SEQ_CST) != NULL);
+	pthread_mutex_unlock(&mutex);
 }
 
 // test procedures
 #include <thread>
+#include <vector>
+#include <atomic>
 #include "logger.hpp"
 
 class flexi_timeout_test_c {
@@ -562,6 +726,71 @@ private:
 		waitfor_simulation();
 	}
 
+	// Many concurrent timeouts in emulated time, benchmark for the timer wheel:
+	// insert threads re-arm their timeouts as soon as signaled,
+	// main thread steps emulated time in small random steps.
+	void test7() {
+		const unsigned timeout_count = 4096;
+		const unsigned thread_count = 4;
+		const unsigned step_count = 10 * MILLION;
+		printf("\nTest 7: %u concurrent timeouts in emulated time, %u insert threads\n",
+				timeout_count, thread_count);
+		world_starttime_us = world_now_us();
+		the_flexi_timeout_controller->set_mode(flexi_timeout_c::emulated_time);
+		std::vector<flexi_timeout_c *> timeouts;
+		for (unsigned i = 0; i < timeout_count; i++)
+			timeouts.push_back(new flexi_timeout_c()); // semaphore in emulated_time
+		std::atomic<bool> stop(false);
+		std::atomic<uint64_t> signaled(0), early(0);
+		std::vector<std::thread *> threads;
+		for (unsigned t = 0; t < thread_count; t++)
+			threads.push_back(new std::thread([&, t] {
+				unsigned seed = t;
+				for (unsigned i = t; i < timeout_count; i += thread_count) {
+					flexi_timeout_c *to = timeouts[i];
+					to->starttime_ns = the_flexi_timeout_controller->emu_now_ns;
+					to->signaltime_ns = to->starttime_ns + 1000 + rand_r(&seed) % (10 * MILLION);
+					the_flexi_timeout_controller->emu_insert_timeout_wait(to);
+				}
+				while (!stop) {
+					for (unsigned i = t; i < timeout_count; i += thread_count) {
+						flexi_timeout_c *to = timeouts[i];
+						if (sem_trywait(&to->semaphore) != 0)
+							continue;
+						signaled++;
+						if (the_flexi_timeout_controller->emu_now_ns < to->signaltime_ns)
+							early++;
+						// 1us..10ms
+						to->starttime_ns = the_flexi_timeout_controller->emu_now_ns;
+						to->signaltime_ns = to->starttime_ns + 1000 + rand_r(&seed) % (10 * MILLION);
+						the_flexi_timeout_controller->emu_insert_timeout_wait(to);
+					}
+				}
+			}));
+		uint64_t start_emu_ns = the_flexi_timeout_controller->emu_now_ns;
+		uint64_t start_ns = flexi_timeout_controller_c::world_now_ns();
+		for (unsigned i = 0; i < step_count; i++)
+			the_flexi_timeout_controller->emu_step_ns(rand() % 2000); // like CPU opcodes
+		uint64_t world_ns = flexi_timeout_controller_c::world_now_ns() - start_ns;
+		stop = true;
+		for (unsigned t = 0; t < thread_count; t++) {
+			threads[t]->join();
+			delete threads[t];
+		}
+		printf("%u emu_step_ns() in %0.3f s = %0.1f ns each, %0.3f emulated s\n", step_count,
+				world_ns / 1e9, (double) world_ns / step_count,
+				(the_flexi_timeout_controller->emu_now_ns - start_emu_ns) / 1e9);
+		printf("%llu timeouts signaled, %llu too early\n", (unsigned long long) signaled.load(),
+				(unsigned long long) early.load());
+		// wakes all pending
+		the_flexi_timeout_controller->set_mode(flexi_timeout_c::world_time);
+		for (unsigned i = 0; i < timeout_count; i++) {
+			while (sem_trywait(&timeouts[i]->semaphore) == 0)
+				;
+			delete timeouts[i];
+		}
+	}
+
 	// all tests
 	void run() {
 		test1();
@@ -570,6 +799,7 @@ private:
 		test4();
 		test5();
 		test6();
+		test7();
 		printf("\nTimeout tests completed\n\n");
 
 	}
@@ -27,12 +27,12 @@
 #ifndef _TIMEOUT_HPP_
 #define _TIMEOUT_HPP_
 
+#include <stdint.h>
 #include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
 
 #include <list>
-#include <map>
 
 #include "logsource.hpp"
 
@@ -54,6 +54,8 @@ public:
 	static void wait_ns(uint64_t duration_ns);
 	static void wait_us(unsigned duration_us);
 	static void wait_ms(unsigned duration_ms);
+	// absolute time "duration_ns" from now, for pthread_cond_timedwait()
+	static void deadline_ns(struct timespec *abstime, uint64_t duration_ns);
 
 };
 
@@ -63,6 +65,7 @@ class flexi_timeout_controller_c;
 
 class flexi_timeout_c: public logsource_c {
 	friend class flexi_timeout_controller_c;
+	friend class flexi_timeout_test_c;
 public:
 	// Basic modes of timeout-system
 	enum mode {
@@ -76,6 +79,13 @@ private:
 
 	sem_t semaphore; // for wait/signal
 
+	// emulated_time wait: link in timer wheel slot, or in incoming list
+	flexi_timeout_c *wheel_next, *wheel_prev;
+	flexi_timeout_c *incoming_next;
+	int wheel_slot; // level * slot_count + slot, or wheel_slot_* states
+	uint64_t wheel_tick; // signal time in wheel ticks
+	bool wheel_used; // was inserted for wait
+
 public:
 	// all timeouts are constructed for single global "the_flexi_timeout_controller",
 	// maybe changed later.
@@ -99,17 +109,38 @@ public:
 // handels a list of flexi_timeout_c, when using "emulatedt"
 class flexi_timeout_controller_c {
 	friend class flexi_timeout_c;
+	friend class flexi_timeout_test_c;
 private:
-	// timestamp of first (and oldest) timeout in list, for emu_step_ns() quick test
-	// 0 == none
-	uint64_t emu_oldest_signal_time_ns;
-	void update_oldest(void) {
-		std::multimap<uint64_t, flexi_timeout_c*>::iterator it = emu_timeout_wait_list.begin();
-		if (it == emu_timeout_wait_list.end())
-			emu_oldest_signal_time_ns = 0;
-		else
-			emu_oldest_signal_time_ns = it->second->signaltime_ns;
-	}
+	/* Waiting timeouts in "emulated_time" are kept in a hierarchical timer wheel:
+	 each level has 64 slots, a slot on level n spans 64^n ticks of 1024 ns.
+	 Timeouts are inserted lock free by device threads into "incoming",
+	 the CPU thread moves them into the wheel in emu_step_ns(), when due.
+	 Wheel is only accessed under mutex.
+	 */
+	static const unsigned wheel_tick_shift = 10; // 1024ns
+	static const unsigned wheel_slot_bits = 6;
+	static const unsigned wheel_slot_count = 1 << wheel_slot_bits;
+	static const unsigned wheel_levels = 5; // 64^5 ticks = 18 minutes
+	static const int wheel_slot_none = -1; // not waiting
+	static const int wheel_slot_incoming = -2;
+
+	flexi_timeout_c *wheel[wheel_levels][wheel_slot_count];
+	uint64_t wheel_occupied[wheel_levels]; // bit mask of non-empty slots
+	uint64_t wheel_now_tick; // all ticks before are expired
+	unsigned wheel_count; // timeouts in wheel
+
+	flexi_timeout_c *incoming; // lock free stack of new timeouts
+
+	// emu_step_ns() must process wheel at this time, or later.
+	// Lowered lock free by inserts. UINT64_MAX = nothing pending
+	uint64_t emu_next_check_ns;
+
+	void wheel_link(flexi_timeout_c *timeout);
+	void wheel_unlink(flexi_timeout_c *timeout);
+	void wheel_signal(flexi_timeout_c *timeout);
+	void wheel_drain_incoming(void);
+	uint64_t wheel_next_tick(void);
+	void wheel_expire(uint64_t now_tick);
 
 	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -127,27 +158,23 @@ public:
 			void insert_timeout(flexi_timeout_c *timeout);
 			void erase_timeout(flexi_timeout_c *timeout);
 
-			// list of timeouts and their wait signal times
-			// ordered by endtime. so iterators get the soonest event first.
-			std::multimap<uint64_t, flexi_timeout_c *> emu_timeout_wait_list;
-	// list is never searched for certain "starttime" key, just ordered for iterators.
-	// key "signaltime" is duplicate of flexi_timeout_c:.signaltime
-	// multiple identical "signaltime" keys are possible, hence a "multi" map.
-
 	void set_mode(enum flexi_timeout_c::mode new_mode);
 
-	// insert a timeout to monitor for wait() signal. with starttime as sorting key
-	void emu_insert_timeout_wait(flexi_timeout_c *timeout) {
-		pthread_mutex_lock(&mutex);
-		emu_timeout_wait_list.insert(std::pair<uint64_t,flexi_timeout_c*>(timeout->starttime_ns, timeout));
-		std::multimap<uint64_t,flexi_timeout_c*>::iterator it = emu_timeout_wait_list.begin();
-		emu_oldest_signal_time_ns = it->second->signaltime_ns;
-		pthread_mutex_unlock(&mutex);
-		// is checked on first step() call
-	}
+	// insert a timeout to monitor for wait() signal, lock free.
+	// Is checked on first emu_step_ns() call
+	void emu_insert_timeout_wait(flexi_timeout_c *timeout);
+	// remove a timeout not yet signaled
+	void emu_cancel_timeout_wait(flexi_timeout_c *timeout);
 
 	// advance internal timebase
-	void emu_step_ns(unsigned emu_delta_ns );
+	void emu_step_ns(uint64_t emu_delta_ns );
+
+	// signal time of next timeout, 0 = none.
+	// Unlocked: caller may batch emu_step_ns() until then, see cpu_c.
+	uint64_t emu_next_signal_time_ns(void) {
+		uint64_t result = __atomic_load_n(&emu_next_check_ns, __ATOMIC_RELAXED);
+		return result == UINT64_MAX ? 0 : result;
+	}
 };
 
 extern flexi_timeout_controller_c *the_flexi_timeout_controller; // singleton
@@ -0,0 +1,147 @@
+/* trackcache.cpp: whole track buffers for sector oriented disk drives
+
+ See LICENSE for terms of use.
+
+ Thread safe: controller and drive worker may both access the cache.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "storagedrive.hpp"
+#include "trackcache.hpp"
+
+track_cache_c::track_cache_c(storagedrive_c *drive) {
+	this->drive = drive;
+	track_size_bytes = 0;
+	sector_size_bytes = 0;
+	sectors_per_track = 0;
+	use_counter = 0;
+	dirty = false;
+	hits = misses = flushes = 0;
+}
+
+track_cache_c::~track_cache_c() {
+	invalidate();
+}
+
+void track_cache_c::configure(unsigned sectors_per_track, unsigned sector_size_bytes,
+		unsigned track_count) {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	invalidate();
+	this->sectors_per_track = sectors_per_track;
+	this->sector_size_bytes = sector_size_bytes;
+	track_size_bytes = sectors_per_track * sector_size_bytes;
+	tracks.resize(track_count);
+	for (unsigned i = 0; i < track_count; i++) {
+		tracks[i].trackno = -1;
+		tracks[i].last_use = 0;
+		tracks[i].data.assign(track_size_bytes, 0);
+		tracks[i].dirty.assign(sectors_per_track, false);
+		tracks[i].dirty_count = 0;
+	}
+}
+
+// find track in cache, or load it into least recently used buffer
+track_cache_c::track_buffer_t *track_cache_c::get_track(unsigned trackno) {
+	track_buffer_t *lru = NULL;
+	for (unsigned i = 0; i < tracks.size(); i++) {
+		track_buffer_t *track = &tracks[i];
+		if (track->trackno == (int64_t) trackno) {
+			hits++;
+			track->last_use = ++use_counter;
+			return track;
+		}
+		if (lru == NULL || track->last_use < lru->last_use)
+			lru = track;
+	}
+	assert(lru);
+	misses++;
+	write_back(lru); // evict
+	drive->file_read(lru->data.data(), (uint64_t) trackno * track_size_bytes, track_size_bytes);
+	lru->trackno = trackno;
+	lru->last_use = ++use_counter;
+	return lru;
+}
+
+// write runs of dirty sectors to image
+void track_cache_c::write_back(track_buffer_t *track) {
+	if (track->trackno < 0 || track->dirty_count == 0)
+		return;
+	if (drive->file_is_open()) {
+		uint64_t track_pos = (uint64_t) track->trackno * track_size_bytes;
+		unsigned sectorno = 0;
+		while (sectorno < sectors_per_track) {
+			if (!track->dirty[sectorno]) {
+				sectorno++;
+				continue;
+			}
+			unsigned run_start = sectorno;
+			while (sectorno < sectors_per_track && track->dirty[sectorno])
+				sectorno++;
+			unsigned offset = run_start * sector_size_bytes;
+			drive->file_write(track->data.data() + offset, track_pos + offset,
+					(sectorno - run_start) * sector_size_bytes, /*flush*/false);
+		}
+		drive->file_flush();
+	}
+	track->dirty.assign(sectors_per_track, false);
+	track->dirty_count = 0;
+	flushes++;
+}
+
+void track_cache_c::read_sector(unsigned trackno, unsigned sectorno, uint8_t *buffer) {
+	read_sectors(trackno, sectorno, 1, buffer);
+}
+
+void track_cache_c::write_sector(unsigned trackno, unsigned sectorno, uint8_t *buffer) {
+	write_sectors(trackno, sectorno, 1, buffer);
+}
+
+void track_cache_c::read_sectors(unsigned trackno, unsigned sectorno, unsigned count,
+		uint8_t *buffer) {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	assert(enabled());
+	assert(sectorno + count <= sectors_per_track);
+	track_buffer_t *track = get_track(trackno);
+	memcpy(buffer, track->data.data() + sectorno * sector_size_bytes, count * sector_size_bytes);
+}
+
+void track_cache_c::write_sectors(unsigned trackno, unsigned sectorno, unsigned count,
+		uint8_t *buffer) {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	assert(enabled());
+	assert(sectorno + count <= sectors_per_track);
+	track_buffer_t *track = get_track(trackno);
+	memcpy(track->data.data() + sectorno * sector_size_bytes, buffer, count * sector_size_bytes);
+	if (!dirty) {
+		dirty = true;
+		dirty_timer.start_ms(TRACK_CACHE_FLUSH_MS);
+	}
+	for (unsigned i = sectorno; i < sectorno + count; i++)
+		if (!track->dirty[i]) {
+			track->dirty[i] = true;
+			track->dirty_count++;
+		}
+}
+
+void track_cache_c::flush(void) {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	for (unsigned i = 0; i < tracks.size(); i++)
+		write_back(&tracks[i]);
+	dirty = false;
+}
+
+bool track_cache_c::flush_aged(void) {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	if (!dirty || !dirty_timer.reached())
+		return false;
+	flush();
+	return true;
+}
+
+void track_cache_c::invalidate(void) {
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+	flush();
+	for (unsigned i = 0; i < tracks.size(); i++)
+		tracks[i].trackno = -1;
+}
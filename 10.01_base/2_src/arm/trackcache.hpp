@@ -0,0 +1,91 @@
+/* trackcache.hpp: whole track buffers for sector oriented disk drives
+
+ See LICENSE for terms of use.
+
+ Real drives rotate a full track under the heads, and operating systems
+ access disks mostly track local. So on first access a whole track is
+ read from the image with one file access, following sector reads and
+ writes of that track hit the buffer.
+ Written sectors are marked dirty and written back on eviction of the
+ track, on flush() (drive seeks, unloads, image is closed), on invalidate()
+ and by the drive worker with flush_aged(), so no write stays in memory
+ longer than TRACK_CACHE_FLUSH_MS.
+ Only dirty sectors are written, so image files are not extended
+ beyond the last written sector.
+ Off by default: "track_cache" parameter of the drives.
+
+ Tracks are numbered linear in the image file: position = track * track size.
+ */
+#ifndef _TRACKCACHE_HPP_
+#define _TRACKCACHE_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+
+#include "timeout.hpp"
+
+// max time dirty sectors stay unwritten
+#define TRACK_CACHE_FLUSH_MS	1000
+
+class storagedrive_c;
+
+class track_cache_c {
+private:
+	struct track_buffer_t {
+		int64_t trackno; // -1 = unused
+		uint64_t last_use; // for LRU
+		std::vector<uint8_t> data;
+		std::vector<bool> dirty; // per sector
+		unsigned dirty_count;
+	};
+
+	storagedrive_c *drive;
+	unsigned track_size_bytes;
+	unsigned sector_size_bytes;
+	unsigned sectors_per_track;
+	std::vector<track_buffer_t> tracks;
+	uint64_t use_counter;
+	bool dirty; // any track has dirty sectors
+	timeout_c dirty_timer; // since first write after last flush
+
+	std::recursive_mutex mutex;
+
+	track_buffer_t *get_track(unsigned trackno);
+	void write_back(track_buffer_t *track);
+
+public:
+	track_cache_c(storagedrive_c *drive);
+	~track_cache_c();
+
+	// statistics
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t flushes; // tracks with dirty sectors written back
+
+	// track_count = 0: no cache, sectors go directly to the image file.
+	// existing dirty data is written back.
+	void configure(unsigned sectors_per_track, unsigned sector_size_bytes, unsigned track_count);
+
+	bool enabled(void) {
+		return !tracks.empty();
+	}
+
+	// access one sector of the image
+	void read_sector(unsigned trackno, unsigned sectorno, uint8_t *buffer);
+	void write_sector(unsigned trackno, unsigned sectorno, uint8_t *buffer);
+
+	// access successive sectors on one track, must not pass end of track
+	void read_sectors(unsigned trackno, unsigned sectorno, unsigned count, uint8_t *buffer);
+	void write_sectors(unsigned trackno, unsigned sectorno, unsigned count, uint8_t *buffer);
+
+	// write back all dirty sectors, tracks stay valid
+	void flush(void);
+	// flush, if oldest unwritten write is TRACK_CACHE_FLUSH_MS old.
+	// called periodically by drive worker. result: flushed
+	bool flush_aged(void);
+	// flush and forget all tracks: image file is changed or closed
+	void invalidate(void);
+};
+
+#endif
@@ -98,6 +98,7 @@ unibusadapter_c::unibusadapter_c() :
 	line_INIT = false;
 	line_DCLO = false;
 	line_ACLO = false;
+	dma_write_generation = 0;
 
 	requests_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -479,6 +480,7 @@ void unibusadapter_c::request_execute_active_on_PRU(unsigned level_index) {
 		mailbox->dma.control = dmareq->unibus_control;
 		mailbox->dma.wordcount = dmareq->chunk_words;
 		mailbox->dma.cpu_access = dmareq->is_cpu_access;
+		mailbox->dma.fixed_addr = dmareq->fixed_addr;
 
 		// Copy outgoing data into mailbox device_DMA buffer
 		if (UNIBUS_CONTROL_IS_DATO(dmareq->unibus_control)) {
@@ -589,15 +591,25 @@ void unibusadapter_c::request_active_complete(unsigned level_index, bool signal_
 // Blocking == true: DMA() wait for request to complete
 // Blocking == false: return immediately, the device logic should 
 //		 evaluate the request.complete flag or wait for the mutex
+// fixed_addr == true: all words are transfered to/from unibus_addr,
+//		as one transaction like a normal DMA (RK11 "inhibit bus address increment")
+// A transfer running past 777776 stops there and completes with timeout
+// at 1000000, like a single word access to non existing memory.
 
 void unibusadapter_c::DMA(dma_request_c& dma_request, bool blocking, uint8_t unibus_control,
-		uint32_t unibus_addr, uint16_t *buffer, uint32_t wordcount) {
+		uint32_t unibus_addr, uint16_t *buffer, uint32_t wordcount, bool fixed_addr) {
 	assert(dma_request.priority_slot < PRIORITY_SLOT_COUNT);
 	assert(dma_request.level_index == PRIORITY_LEVEL_INDEX_NPR);
 
 	// setup device request
 	assert(wordcount > 0);
-	assert((unibus_addr + 2*wordcount) <= 2*UNIBUS_WORDCOUNT);
+	assert(unibus_addr < 2*UNIBUS_WORDCOUNT);
+	// multi sector runs may exceed the 18 bit address space
+	dma_request.clipped = false;
+	if (!fixed_addr && (unibus_addr + 2 * wordcount) > 2*UNIBUS_WORDCOUNT) {
+		wordcount = (2*UNIBUS_WORDCOUNT - unibus_addr) / 2;
+		dma_request.clipped = true;
+	}
 	// lowest priority reserved for CPU
 	assert(!dma_request.is_cpu_access || dma_request.priority_slot == 31);
 
@@ -624,6 +636,8 @@ void unibusadapter_c::DMA(dma_request_c& dma_request, bool blocking, uint8_t uni
 	dma_request.unibus_control = unibus_control;
 	dma_request.unibus_start_addr = unibus_addr;
 	dma_request.chunk_unibus_start_addr = unibus_addr;
+	dma_request.chunk_buffer_offset = 0;
+	dma_request.fixed_addr = fixed_addr;
 	dma_request.unibus_end_addr = 0; // last transfered addr, or error position
 	dma_request.buffer = buffer;
 	dma_request.wordcount = wordcount;
@@ -688,9 +702,10 @@ void unibusadapter_c::DMA(dma_request_c& dma_request, bool blocking, uint8_t uni
 }
 
 // do DATO/DATI as master CPU.
+// wordcount > 1: DATI burst for instruction prefetch
 // result: success, else BUS TIMEOUT
 void unibusadapter_c::cpu_DATA_transfer(dma_request_c& cpu_data_transfer_request,
-		uint8_t unibus_control, uint32_t unibus_addr, uint16_t *buffer) {
+		uint8_t unibus_control, uint32_t unibus_addr, uint16_t *buffer, uint32_t wordcount) {
 	// no NPR/NPG/SACK arbitration
 	// no PRU->ARM signal on complete
 	cpu_data_transfer_request.is_cpu_access = true;
@@ -700,7 +715,7 @@ void unibusadapter_c::cpu_DATA_transfer(dma_request_c& cpu_data_transfer_request
 	// Also less then INTR, thats implementend in PRU statemachine_arbitration_master()
 	cpu_data_transfer_request.priority_slot = 31;
 	// "blocking" flag not used
-	DMA(cpu_data_transfer_request, true, unibus_control, unibus_addr, buffer, 1);
+	DMA(cpu_data_transfer_request, true, unibus_control, unibus_addr, buffer, wordcount);
 }
 
 // A device raises an interrupt and simultaneously changes a value in
@@ -981,7 +996,10 @@ void unibusadapter_c::worker_device_dma_chunk_complete_event() {
 	unsigned wordcount_transferred = dmareq->wordcount_completed_chunks()
 			+ mailbox->dma.wordcount;
 	assert(wordcount_transferred <= dmareq->wordcount);
-	assert(!dmareq->is_cpu_access || dmareq->wordcount == 1); // CPU accesses only single words
+	// CPU accesses are single words, or a prefetch burst in one chunk
+	assert(!dmareq->is_cpu_access || dmareq->wordcount <= dmareq->chunk_max_words);
+	if (!dmareq->is_cpu_access && UNIBUS_CONTROL_IS_DATO(mailbox->dma.control))
+		dma_write_generation++;
 	if (UNIBUS_CONTROL_IS_DATI(mailbox->dma.control)) {
 		// guard against buffer overrun
 		// PRU read chunk data from UNIBUS into mailbox
@@ -995,12 +1013,19 @@ void unibusadapter_c::worker_device_dma_chunk_complete_event() {
 		more_chunks = false;
 	} else if (wordcount_transferred == dmareq->wordcount) {
 		// last chunk completed
-		dmareq->success = true;
+		if (dmareq->clipped) {
+			// end of address space: timeout on first address behind
+			dmareq->unibus_end_addr = 2*UNIBUS_WORDCOUNT;
+			dmareq->success = false;
+		} else
+			dmareq->success = true;
 		more_chunks = false;
 	} else {
 		// more data to transfer: next chunk.
-		assert(!dmareq->is_cpu_access); // CPU accesses only single words
-		dmareq->chunk_unibus_start_addr = mailbox->dma.cur_addr + 2;
+		assert(!dmareq->is_cpu_access); // CPU accesses only one chunk
+		dmareq->chunk_buffer_offset += mailbox->dma.wordcount;
+		if (!dmareq->fixed_addr)
+			dmareq->chunk_unibus_start_addr = mailbox->dma.cur_addr + 2;
 		// dmarequest remains prl->active and ->busy
 
 		_DEBUG(
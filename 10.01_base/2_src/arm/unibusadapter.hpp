@@ -87,6 +87,9 @@ public:
 	volatile bool line_DCLO;
 	volatile bool line_ACLO;
 
+	// changed on every device DMA DATO chunk: CPU prefetch may be stale
+	volatile uint32_t dma_write_generation;
+
 	void on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) override; // must implement
 	void on_init_changed(void) override; // must implement
 
@@ -109,12 +112,12 @@ public:
 	void request_execute_active_on_PRU(unsigned level_index);
 
 	void DMA(dma_request_c& dma_request, bool blocking, uint8_t unibus_control,
-			uint32_t unibus_addr, uint16_t *buffer, uint32_t wordcount);
+			uint32_t unibus_addr, uint16_t *buffer, uint32_t wordcount, bool fixed_addr = false);
 	void INTR(intr_request_c& intr_request, unibusdevice_register_t *interrupt_register,
 			uint16_t interrupt_register_value);
 	void cancel_INTR(intr_request_c& intr_request);
 
-	void cpu_DATA_transfer(dma_request_c& dma_request, uint8_t unibus_control, uint32_t unibus_addr, uint16_t *buffer);
+	void cpu_DATA_transfer(dma_request_c& dma_request, uint8_t unibus_control, uint32_t unibus_addr, uint16_t *buffer, uint32_t wordcount = 1);
 
 	void print_shared_register_map(void);
 
@@ -252,6 +252,9 @@ void main(void) {
 				// start one INTR cycle. May be raised in midst of slave cycle
 				// by ARM, if access to "active" register triggers INTR.
 				sm_arb.device_request_mask |= mailbox.intr.priority_arbitration_bit;
+				// emulated CPU sees the request before its next opcode fetch
+				mailbox.arbitrator.ifs_intr_requests |= mailbox.intr.priority_arbitration_bit
+						& PRIORITY_ARBITRATION_INTR_MASK;
 				// sm_device_arb_worker() evaluates this, extern Arbitrator raises Grant,
 				// vector of GRANted level is transfered with statemachine sm_intr_master
 
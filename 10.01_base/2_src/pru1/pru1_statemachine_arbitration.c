@@ -240,6 +240,10 @@ uint8_t sm_arb_worker_cpu() {
 	uint8_t latch1val = buslatches_getbyte(1);
 	bool do_intr_arbitration = mailbox.arbitrator.ifs_intr_arbitration_pending; // ARM allowed INTR arbitration
 
+	// publish BR lines for ARM, own requests are on the latches after sm_arb_worker_device()
+	mailbox.arbitrator.ifs_intr_requests = (latch1val | sm_arb.device_request_mask)
+			& PRIORITY_ARBITRATION_INTR_MASK;
+
 	// monitor BBSY
 	if (latch1val & BIT(5)) {
 		// SACK set by a device
@@ -324,7 +324,8 @@ static statemachine_state_func sm_dma_state_99() {
 
 	if (final_dma_state == DMA_STATE_RUNNING) {
 		// dataptr and words_left already incremented
-		mailbox.dma.cur_addr += 2; // signal progress to ARM
+		if (!mailbox.dma.fixed_addr)
+			mailbox.dma.cur_addr += 2; // signal progress to ARM
 		return (statemachine_state_func) &sm_dma_state_1; // reloop
 	} else {
 		// remove addr and control from bus. 
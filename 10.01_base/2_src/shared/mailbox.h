@@ -130,7 +130,11 @@ typedef struct {
 
 	uint8_t	ifs_intr_arbitration_pending ; // produce GRANTS from requests
 
-	uint8_t _dummy[2];	// keep 32 bit borders
+	// BR4..BR7 requests on UNIBUS and of emulated devices, PRIORITY_ARBITRATION_BIT_B*.
+	// Published by PRU, so the emulated CPU asks for GRANTs only if a request is pending.
+	uint8_t ifs_intr_requests ;
+
+	uint8_t _dummy[1];	// keep 32 bit borders
 
 } mailbox_arbitrator_t;
 
@@ -143,7 +147,8 @@ typedef struct {
 	uint16_t wordcount; // # of remaining words transmit/receive, static
 	// ---dword---
 	uint8_t	cpu_access ; // 0 for device DMA, 1 for emulated CPU
-	uint8_t	dummy[3] ;
+	uint8_t	fixed_addr ; // 1: all words to/from startaddr (RK11 "IBA")
+	uint8_t	dummy[2] ;
 	// ---dword---
 	uint32_t cur_addr; // current address in transfer, if timeout: offending address.
 	// if complete: last address accessed.
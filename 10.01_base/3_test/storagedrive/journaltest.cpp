@@ -0,0 +1,206 @@
+/* journaltest.cpp: fault injection test of the storage drive write ahead journal
+
+ See LICENSE for terms of use.
+
+ Built with STORAGEDRIVE_JOURNAL_FAULTS, which enables the crash points
+ in storagedrive_c. Runs on the BBB.
+
+ A child process writes batches and is killed inside a commit.
+ After replay, the image must show the state after the last committed batch.
+ The replay is tested with "journal" on, and with "journal" off
+ (journal left by a crashed session must be replayed anyway).
+
+ journaltest [<scratch image file>]
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+
+#include "logger.hpp"
+#include "storagedrive.hpp"
+
+class storagedrive_journaltest_c: public storagedrive_c {
+private:
+	std::string imagefname;
+	std::string journalfname;
+	unsigned block_size;
+	unsigned block_count;
+	std::vector<uint8_t> block_buffer;
+
+	void block_buffer_fill(unsigned block_number, unsigned generation);
+	void block_buffer_check(unsigned block_number, unsigned generation);
+	void batch_blocks(unsigned batchno, std::vector<unsigned> *blocks);
+	void crash(storagedrive_journal_fault_enum fault, unsigned fault_batch);
+	void verify(unsigned committed, bool journal_on);
+
+public:
+	storagedrive_journaltest_c(const char *imagefname, unsigned block_size,
+			unsigned block_count) :
+			storagedrive_c(NULL) {
+		assert((block_size % 4) == 0); // whole uint32s
+		this->imagefname = imagefname;
+		this->journalfname = this->imagefname + ".journal";
+		this->block_size = block_size;
+		this->block_count = block_count;
+		block_buffer.resize(block_size);
+		name.value = "journaltest";
+		log_label = "JT";
+	}
+
+	// fill abstracts
+	virtual void on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) {
+		UNUSED(aclo_edge);
+		UNUSED(dclo_edge);
+	}
+	virtual void on_init_changed(void) {
+	}
+
+	void test(void);
+};
+
+// "generation": number of overwrites, in bits <31:24>
+void storagedrive_journaltest_c::block_buffer_fill(unsigned block_number, unsigned generation) {
+	uint32_t *dwords = (uint32_t *) block_buffer.data();
+	for (unsigned i = 0; i < block_size / 4; i++)
+		dwords[i] = i + (block_number * block_size / 4) + (generation << 24);
+}
+
+void storagedrive_journaltest_c::block_buffer_check(unsigned block_number, unsigned generation) {
+	uint32_t *dwords = (uint32_t *) block_buffer.data();
+	for (unsigned i = 0; i < block_size / 4; i++) {
+		uint32_t pattern_expected = i + (block_number * block_size / 4) + (generation << 24);
+		if (dwords[i] != pattern_expected) {
+			printf("ERROR journaltest: Block %d, dword %d: expected 0x%x, found 0x%x\n",
+					block_number, i, pattern_expected, dwords[i]);
+			exit(1);
+		}
+	}
+}
+
+// blocks overwritten by batch "batchno". Batch 0 writes all.
+void storagedrive_journaltest_c::batch_blocks(unsigned batchno, std::vector<unsigned> *blocks) {
+	blocks->clear();
+	for (unsigned i = 0; i < block_count; i++)
+		if (batchno == 0 || (i * 7 + batchno * 13) % 5 < 2)
+			blocks->push_back(i);
+}
+
+// generation 0 in all blocks, then a child writes batches with journal
+// and power fails in batch "fault_batch"
+void storagedrive_journaltest_c::crash(storagedrive_journal_fault_enum fault,
+		unsigned fault_batch) {
+	const unsigned batch_count = 6;
+	std::vector<unsigned> blocks;
+
+	remove(imagefname.c_str());
+	remove(journalfname.c_str());
+	journal.set(false);
+	file_open(imagefname, true);
+	batch_blocks(0, &blocks);
+	for (unsigned i = 0; i < blocks.size(); i++) {
+		block_buffer_fill(blocks[i], 0);
+		file_write(block_buffer.data(), block_size * blocks[i], block_size);
+	}
+	file_close();
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Small journal: checkpoint after every batch.
+		journal_size.set(fault == journal_fault_checkpoint ? 1 : 4096);
+		journal.set(true);
+		journal_fault = fault;
+		journal_fault_batch = fault_batch;
+		file_open(imagefname, false);
+		for (unsigned batchno = 1; batchno <= batch_count; batchno++) {
+			batch_blocks(batchno, &blocks);
+			for (unsigned i = 0; i < blocks.size(); i++) {
+				block_buffer_fill(blocks[i], batchno);
+				file_write(block_buffer.data(), block_size * blocks[i], block_size,
+						/*flush*/false);
+			}
+			file_flush(); // commit
+		}
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL) {
+		printf("ERROR journaltest: fault %d not injected\n", fault);
+		exit(1);
+	}
+}
+
+// open with replay, then every block must have the generation of the last committed batch
+void storagedrive_journaltest_c::verify(unsigned committed, bool journal_on) {
+	std::vector<unsigned> blocks;
+	std::vector<unsigned> generation(block_count, 0);
+	for (unsigned batchno = 1; batchno <= committed; batchno++) {
+		batch_blocks(batchno, &blocks);
+		for (unsigned i = 0; i < blocks.size(); i++)
+			generation[blocks[i]] = batchno;
+	}
+	journal.set(journal_on);
+	if (!file_open(imagefname, false)) {
+		printf("ERROR journaltest: can not open %s\n", imagefname.c_str());
+		exit(1);
+	}
+	for (unsigned i = 0; i < block_count; i++) {
+		file_read(block_buffer.data(), block_size * i, block_size);
+		block_buffer_check(i, generation[i]);
+	}
+	if (!journal_on && access(journalfname.c_str(), F_OK) == 0) {
+		printf("ERROR journaltest: journal not removed after replay\n");
+		exit(1);
+	}
+	file_close();
+	journal.set(false);
+}
+
+void storagedrive_journaltest_c::test() {
+	const unsigned fault_batch = 4;
+
+	for (int fault = journal_fault_torn_commit; fault <= journal_fault_checkpoint; fault++) {
+		unsigned committed = (fault == journal_fault_torn_commit) ? fault_batch - 1 : fault_batch;
+		crash((storagedrive_journal_fault_enum) fault, fault_batch);
+		verify(committed, /*journal_on*/true);
+		crash((storagedrive_journal_fault_enum) fault, fault_batch);
+		verify(committed, /*journal_on*/false);
+		printf("fault %d: OK\n", fault);
+	}
+
+	// read only image with journal: not attached
+	if (geteuid() != 0) { // root can write anyway
+		crash(journal_fault_before_apply, fault_batch);
+		chmod(imagefname.c_str(), 0444);
+		if (file_open(imagefname, false)) {
+			printf("ERROR journaltest: read only image with journal attached\n");
+			exit(1);
+		}
+		chmod(imagefname.c_str(), 0644);
+		printf("read only: OK\n");
+	}
+	remove(imagefname.c_str());
+	remove(journalfname.c_str());
+}
+
+int main(int argc, char *argv[]) {
+	const char *imagefname = argc > 1 ? argv[1] : "/tmp/journaltest.bin";
+	logger = new logger_c();
+
+	for (unsigned direct = 0; direct < 2; direct++) {
+		storagedrive_journaltest_c dut(imagefname, /* block_size*/1024, /* block_count */137);
+		dut.direct_io.set(direct);
+		printf("journaltest direct_io=%u\n", direct);
+		dut.test();
+	}
+	printf("journaltest: all OK\n");
+	return 0;
+}
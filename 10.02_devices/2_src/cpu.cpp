@@ -27,7 +27,9 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <algorithm>
 
 #include "logger.hpp"
 #include "mailbox.h"
@@ -37,6 +39,7 @@
 
 #include "unibusadapter.hpp"
 #include "unibusdevice.hpp"	// definition of class device_c
+#include "m9312.hpp"	// ROM code labels
 #include "cpu.hpp"
 
 /* If CPU_CONTROLLED_TIME,
@@ -76,7 +79,21 @@ void unibone_logdump(void) {
 // called before opcode fetch of next instruction
 // This is the point in time were INTR requests are checked and GRANTed
 // (PRU implementation may limit NPR GRANTs also to this time)
+// The PRU handshake is needed only if a BR above CPU level is pending,
+// PRU publishes BR4..7 in the mailbox.
 void unibone_grant_interrupts(void) {
+	if (!unibone_cpu->grant_always.value) {
+		uint8_t requests = mailbox->arbitrator.ifs_intr_requests & PRIORITY_ARBITRATION_INTR_MASK;
+		if (requests == 0)
+			return;
+		// BR4 = 0x01 -> 4, BR5 = 0x02 -> 5, etc.
+		uint8_t requested_intr_level = 31 - __builtin_clz(requests) + 4;
+		uint8_t cpu_level = mailbox->arbitrator.ifs_priority_level;
+		// no GRANT while fetching INTR vector, see PRU sm_arb_worker_cpu()
+		if (cpu_level == CPU_PRIORITY_LEVEL_FETCHING || requested_intr_level <= cpu_level)
+			return;
+	}
+	unibone_cpu->grant_handshakes.value++;
 	// after that the CPU should check for received INTR vectors
 	// in its microcode service() step.c
 	// allow PRU do to produce GRANT for device requests
@@ -98,18 +115,15 @@ void unibone_grant_interrupts(void) {
 // - Option to implement CPUs with local 22bit memory later.
 // - DEC also had separate IO and MEMORY Busses. See 11/44,60,70,84 and others
 
-#define UNIBUS_ACCESS_NS	1000
-// "real world" time for bus access. emulated timeout is stepped by this on every cycle.
-
 int unibone_dato(unsigned addr, unsigned data) {
 	uint16_t wordbuffer = (uint16_t) data;
 
-	the_flexi_timeout_controller->emu_step_ns(UNIBUS_ACCESS_NS);
 	if (unibone_cpu->direct_memory.value && addr < UNIBUS_IOPAGE_START) {
 		// Direct access Non-IOPage memory.
 		ddrmem->pmi_deposit(addr, data);
 		return true;
 	} else {
+		unibone_cpu->prefetch_invalidate(addr);
 		dbg = 1;
 		unibusadapter->cpu_DATA_transfer(unibone_cpu->data_transfer_request,
 		UNIBUS_CONTROL_DATO, addr, &wordbuffer);
@@ -121,7 +135,6 @@ int unibone_dato(unsigned addr, unsigned data) {
 }
 
 int unibone_datob(unsigned addr, unsigned data) {
-	the_flexi_timeout_controller->emu_step_ns(UNIBUS_ACCESS_NS);
 	if (unibone_cpu->direct_memory.value && addr < UNIBUS_IOPAGE_START) {
 		// read-modify-write
 		unsigned word_address = addr & ~1; // lower even address
@@ -137,6 +150,7 @@ int unibone_datob(unsigned addr, unsigned data) {
 		return true;
 	} else {
 		// TODO DATOB als 1 byte-DMA !
+		unibone_cpu->prefetch_invalidate(addr);
 		dbg = 1;
 		uint16_t w = (uint16_t) data;
 		unibusadapter->cpu_DATA_transfer(unibone_cpu->data_transfer_request,
@@ -150,7 +164,6 @@ int unibone_datob(unsigned addr, unsigned data) {
 
 int unibone_dati(unsigned addr, unsigned *data) {
 	uint16_t w;
-	the_flexi_timeout_controller->emu_step_ns(UNIBUS_ACCESS_NS);
 	if (unibone_cpu->direct_memory.value && addr < UNIBUS_IOPAGE_START) {
 		// boot address redirection by M9312? addrs 24/26 now in M9312 IOpage
 		addr |= ddrmem->pmi_address_overlay;
@@ -161,8 +174,15 @@ int unibone_dati(unsigned addr, unsigned *data) {
 		ddrmem->pmi_exam(addr, &w);
 		*data = w;
 		return true;
+	} else if (unibone_cpu->prefetch.value && addr < UNIBUS_IOPAGE_START) {
+		// opcode fetch at PC, immediate or index word fetch after PC increment
+		uint16_t pc_distance = unibone_cpu->ka11.r[7] - addr;
+		bool success = unibone_cpu->prefetch_dati(addr, &w, pc_distance <= 2);
+		*data = w;
+		return success;
 	} else {
 // ARM_DEBUG_PIN0(1) ; // CPU20 diag
+		unibone_cpu->prefetch_invalidate(addr);
 		dbg = 1;
 		unibusadapter->cpu_DATA_transfer(unibone_cpu->data_transfer_request,
 		UNIBUS_CONTROL_DATI, addr, &w);
@@ -175,6 +195,64 @@ int unibone_dati(unsigned addr, unsigned *data) {
 	}
 }
 
+// DATI from memory over UNIBUS, with read ahead of the instruction stream.
+// Miss on "istream" fetch: the next "prefetch" words are read in one DATI burst
+// instead of single PRU transfers. Data DATIs always go to the bus:
+// physical bus masters may change data words at any time,
+// a program polling a flag must see it.
+// Buffer is invalid after CPU DATO into it, after any DMA DATO
+// of an emulated device, and after IO page accesses
+// (physical devices may have written memory by DMA then).
+// Result: 1 = OK, 0 = bus timeout
+bool cpu_c::prefetch_dati(uint32_t addr, uint16_t *data, bool istream) {
+	uint32_t generation = unibusadapter->dma_write_generation;
+	if (generation != prefetch_dma_write_generation) {
+		prefetch_dma_write_generation = generation;
+		prefetch_count = 0;
+	}
+	// unsigned: addr below buffer is no hit
+	if (istream && addr - prefetch_addr < 2 * prefetch_count) {
+		*data = prefetch_words[(addr - prefetch_addr) / 2];
+		prefetch_hits.value++;
+		return true;
+	}
+	if (!istream || unibus->is_address_overlay_active()) {
+		dbg = 1;
+		unibusadapter->cpu_DATA_transfer(data_transfer_request, UNIBUS_CONTROL_DATI, addr,
+				data);
+		dbg = 0;
+		return data_transfer_request.success;
+	}
+	// burst never into the IO page
+	unsigned wordcount = std::min((unsigned) prefetch.value, (UNIBUS_IOPAGE_START - addr) / 2);
+	prefetch_bursts.value++;
+	// not updated if aborted by INIT
+	data_transfer_request.success = false;
+	data_transfer_request.unibus_end_addr = addr;
+	dbg = 1;
+	unibusadapter->cpu_DATA_transfer(data_transfer_request, UNIBUS_CONTROL_DATI, addr,
+			prefetch_words, wordcount);
+	dbg = 0;
+	prefetch_addr = addr;
+	if (data_transfer_request.success)
+		prefetch_count = wordcount;
+	else if (data_transfer_request.unibus_end_addr > addr)
+		// bus timeout behind addr: end of memory, words before are valid
+		prefetch_count = std::min(wordcount, (data_transfer_request.unibus_end_addr - addr) / 2);
+	else
+		prefetch_count = 0;
+	if (prefetch_count == 0)
+		return false;
+	*data = prefetch_words[0];
+	return true;
+}
+
+// DATO into buffer, or IO page access
+void cpu_c::prefetch_invalidate(uint32_t addr) {
+	if (addr >= UNIBUS_IOPAGE_START || (addr & ~1) - prefetch_addr < 2 * prefetch_count)
+		prefetch_count = 0;
+}
+
 // CPU has changed the arbitration level, just forward
 // if this is called as result of INTR fector PC and PSW fetch,
 // mailbox->arbitrator.cpu_priority_level was CPU_PRIORITY_LEVEL_FETCHING
@@ -213,6 +291,18 @@ cpu_c::cpu_c() :
 	// must be unibusdevice_c then!
 	register_count = 0;
 	swab_vbit.value = false;
+	predecode.value = true;
+	time_batch.value = 32;
+	prefetch.value = 4;
+	prefetch_addr = 0;
+	prefetch_count = 0;
+	prefetch_dma_write_generation = 0;
+	emu_time_pending_ns = 0;
+	emu_time_deadline_ns = 0;
+	emu_time_opcodes = 0;
+	trace_file.value = "cpu20_trace.bin";
+	profile_interval.value = 100;
+	profile_file.value = "cpu20_profile";
 
 	memset(&bus, 0, sizeof(bus));
 	memset(&ka11, 0, sizeof(ka11));
@@ -226,6 +316,7 @@ cpu_c::cpu_c() :
 cpu_c::~cpu_c() {
 	// restore
 	the_flexi_timeout_controller->set_mode(flexi_timeout_c::world_time);
+	ka11_tracering_free(ka11.tracering);
 	unibone_cpu = NULL;
 }
 
@@ -254,6 +345,85 @@ bool cpu_c::on_param_changed(parameter_c *param) {
 		// speed feedback, as measured
 		// see cpu_c() also
 		emulation_speed.value = direct_memory.new_value ? 0.5 : 0.1 ;
+	} else if (param == &mmu || param == &local_memory) {
+		// CPU thread must not step
+		if (runmode.value) {
+			ERROR("Stop CPU before changing %s", param->name.c_str());
+			return false;
+		}
+		if (param == &mmu) {
+			ka11.mmu = mmu.new_value;
+			// kernel mode, with kernel stack pointer
+			unsigned mode = ka11.psw >> 14 & 3;
+			if (mode) {
+				ka11.sp[mode] = ka11.r[6];
+				ka11.r[6] = ka11.sp[0];
+			}
+			ka11.psw &= 0377;
+			ka11.mmr0 = 0;
+			ka11.mmr3 = 0;
+		} else {
+			// 4MB minus the 18 bit address space
+			if (local_memory.new_value > (KA11_IOPAGE22_START - KA11_XMEM_START) / 1024) {
+				ERROR("local_memory must be <= %u KB",
+						(KA11_IOPAGE22_START - KA11_XMEM_START) / 1024);
+				return false;
+			}
+			xmem.assign(local_memory.new_value * 512, 0);
+			ka11.xmem = xmem.data();
+			ka11.xmem_size = local_memory.new_value * 1024;
+		}
+	} else if (param == &trace_ring) {
+		// CPU thread must not step
+		if (runmode.value) {
+			ERROR("Stop CPU before changing %s", param->name.c_str());
+			return false;
+		}
+		if (trace_ring.new_value > CPU_TRACE_RING_MAX_ENTRIES) {
+			ERROR("trace_ring must be <= %u", CPU_TRACE_RING_MAX_ENTRIES);
+			return false;
+		}
+		ka11_tracering_free(ka11.tracering);
+		ka11.tracering = NULL;
+		ka11.tracecur = NULL;
+		if (trace_ring.new_value) {
+			ka11.tracering = ka11_tracering_alloc(trace_ring.new_value);
+			if (ka11.tracering == NULL) {
+				ERROR("Can not allocate trace_ring");
+				return false;
+			}
+			// rounded up to power of 2
+			trace_ring.new_value = ka11.tracering->mask + 1;
+		}
+	} else if (param == &profile) {
+		if (profile.new_value && !profile.value) {
+			// CPU thread samples only after profile.value is set
+			profiler.clear(profile_interval.value * 1000);
+			profile_samples.value = 0;
+		}
+	} else if (param == &profile_interval) {
+		if (profile_interval.new_value == 0) {
+			ERROR("profile_interval must be > 0");
+			return false;
+		}
+	} else if (param == &profile_listing) {
+		profiler.labels.clear();
+		if (!profile_listing.new_value.empty()
+				&& !profiler.add_listing(profile_listing.new_value.c_str())) {
+			ERROR("Loading code labels from %s failed", profile_listing.new_value.c_str());
+			profile_listing.new_value = "";
+			return false;
+		}
+	} else if (param == &prefetch) {
+		if (prefetch.new_value > CPU_PREFETCH_MAX_WORDS) {
+			ERROR("prefetch must be <= %d", CPU_PREFETCH_MAX_WORDS);
+			return false;
+		}
+	} else if (param == &time_batch) {
+		if (time_batch.new_value == 0) {
+			ERROR("time_batch must be > 0");
+			return false;
+		}
 	}
 	return unibusdevice_c::on_param_changed(param); // more actions (for enable)
 }
@@ -273,14 +443,65 @@ void cpu_c::start() {
 #else
 	the_flexi_timeout_controller->set_mode(flexi_timeout_c::world_time);
 #endif
+	emu_time_pending_ns = 0;
+	emu_time_opcodes = 0;
+	emu_time_deadline_ns = the_flexi_timeout_controller->emu_next_signal_time_ns();
 	cycle_count.value = 0;
+	grant_handshakes.value = 0;
+	prefetch_hits.value = 0;
+	prefetch_bursts.value = 0;
+	prefetch_count = 0; // memory may have changed while halted
 
 	// 	what if CONT while WAITING??
 }
 
+// advance emulated time of devices by what CPU has executed
+void cpu_c::emu_time_publish(void) {
+	the_flexi_timeout_controller->emu_step_ns(emu_time_pending_ns);
+	emu_time_pending_ns = 0;
+	emu_time_opcodes = 0;
+	emu_time_deadline_ns = the_flexi_timeout_controller->emu_next_signal_time_ns();
+}
+
+// save trace ring to trace_file
+void cpu_c::trace_ring_dump(const char *reason) {
+	KA11_tracering *ring = ka11.tracering;
+	if (ring == NULL) {
+		ERROR("trace_ring not enabled");
+		return;
+	}
+	if (ka11_tracering_save(ring, trace_file.value.c_str()))
+		ERROR("Trace ring dump to \"%s\" failed: %s", trace_file.value.c_str(),
+				strerror(errno));
+	else
+		INFO("%s: last %llu opcodes of trace ring dumped to \"%s\"", reason,
+				(unsigned long long) std::min(ring->count, (uint64_t) ring->mask + 1),
+				trace_file.value.c_str());
+}
+
+// write profile report with labels of listing and of M9312 ROMs
+void cpu_c::profile_write(void) {
+	codelabel_map_c listing_labels = profiler.labels;
+	list<device_c *>::iterator it;
+	for (it = device_c::mydevices.begin(); it != device_c::mydevices.end(); ++it) {
+		m9312_c *m9312 = dynamic_cast<m9312_c *>(*it);
+		if (m9312)
+			for (unsigned i = 0; i < 5; i++)
+				if (m9312->rom[i])
+					profiler.add_labels(&m9312->rom[i]->codelabels);
+	}
+	if (profiler.report(profile_file.value.c_str(), profile_granularity.value, stdout, 10))
+		INFO("PC profile written to %s.txt and %s.folded", profile_file.value.c_str(),
+				profile_file.value.c_str());
+	else
+		ERROR("Writing PC profile to %s failed: %s", profile_file.value.c_str(), strerror(errno));
+	profiler.labels = listing_labels; // ROMs may change
+}
+
 // stop CPU logic on PRU and switch arbitration mode
 void cpu_c::stop(const char * info, bool print_pc) {
 
+	emu_time_publish(); // rest of emulated time
 	// time base of all device emulators now based on "real world" time
 	the_flexi_timeout_controller->set_mode(flexi_timeout_c::world_time);
 
@@ -314,6 +535,10 @@ void cpu_c::worker(unsigned instance) {
 //unsigned dr = 0760102;
 	unsigned opcode = 0;
 	(void) opcode;
+	// measure instructions_per_second
+	timeout_c speed_timer;
+	unsigned speed_loops = 0;
+	uint32_t speed_cycle_count = 0;
 
 	power_event_ACLO_active = power_event_ACLO_inactive = power_event_DCLO_active = false;
 
@@ -323,6 +548,7 @@ void cpu_c::worker(unsigned instance) {
 //worker_init_realtime_priority(device_rt);
 
 	timeout.wait_us(1);
+	speed_timer.start_ms(0);
 
 	while (!workers_terminate) {
 		// speed control is difficult, force to use more ARM cycles
@@ -347,6 +573,8 @@ void cpu_c::worker(unsigned instance) {
 			ka11.sw = swreg.value & 0xffff;
 			unibus->init(50);
 			ka11_reset(&ka11);
+			if (ka11.tracering)
+				ka11_tracering_clear(ka11.tracering);
 			if (!halt_switch.value) {
 				// START without HALT
 				start(); // HALTED -> RUNNING
@@ -355,21 +583,77 @@ void cpu_c::worker(unsigned instance) {
 		start_switch.value = false; // momentary action
 
 		int prev_ka11_state = ka11.state;
+		uint16_t prev_pc = ka11.r[7]; // for profile
+		uint16_t prev_psw = ka11.psw;
 		// ARM_DEBUG_PIN(0,1) ; // measure pmi gain
 		ka11_condstep(&ka11);
 		// ARM_DEBUG_PIN(0,0) ;
 		if (prev_ka11_state > 0 && ka11.state == KA11_STATE_HALTED) {
 			// CPU run on HALT, sync runmode
 			stop("CPU HALT by opcode", true);
+			if (trace_halt.value && ka11.tracering)
+				trace_ring_dump("HALT");
+		}
+		if (ka11.tracering) {
+			// one shot on vector, disarmed after dump
+			if (trace_vector.value && ka11.tracecur
+					&& (ka11.tracecur->flags & KA11_TRACE_TRAP)
+					&& ka11.tracecur->vector == trace_vector.value) {
+				char buff[80];
+				sprintf(buff, "Trap to %03o at %06o", trace_vector.value, ka11.tracecur->pc);
+				trace_ring_dump(buff);
+				trace_vector.value = 0;
+			}
 		}
+		if (trace_dump.value)
+			trace_ring_dump("trace_dump"); // error if no ring
+		trace_dump.value = false; // momentary action
 		// running CPU: produce emulated time for all devices
 		if (ka11.state == KA11_STATE_RUNNING) {
 			cycle_count.value++;
+			emu_time_pending_ns += ka11.time_ns; // by KA11 opcode timing
 		} else if (ka11.state == KA11_STATE_WAITING)
 			// we should us "world" time here, but want to avoid permanent time-source switching
 			// so just assume this here is called every 500ns (estimated average worker loop time)
-			the_flexi_timeout_controller->emu_step_ns(500);
+			emu_time_pending_ns += 500;
 		// if KA11_STATE_HALTED: world time is used, see start() / stop()
+		if (profile.value) {
+			// sample on emulated time, opcode accounted for PC it was fetched from
+			if (ka11.state == KA11_STATE_RUNNING)
+				profiler.step(prev_pc,
+						(prev_psw >> 14) == 3 ?
+								pcprofile_c::mode_user : pcprofile_c::mode_kernel, ka11.time_ns);
+			else if (ka11.state == KA11_STATE_WAITING)
+				profiler.wait(500);
+		}
+		if (profile_report.value)
+			profile_write();
+		profile_report.value = false; // momentary action
+		// Publish in batches, but not later than next timeout is due.
+		// A timeout started after last publish is seen with next batch.
+		if (++emu_time_opcodes >= time_batch.value
+				|| (emu_time_deadline_ns
+						&& the_flexi_timeout_controller->emu_now_ns + emu_time_pending_ns
+								>= emu_time_deadline_ns))
+			emu_time_publish();
+
+		// check the time only every 1024 loops, is slow
+		if ((++speed_loops & 0x3ff) == 0 && speed_timer.elapsed_ms() >= 1000) {
+			if (cycle_count.value < speed_cycle_count)
+				speed_cycle_count = 0; // restarted
+			instructions_per_second.value = (uint64_t) (cycle_count.value - speed_cycle_count)
+					* 1000 / speed_timer.elapsed_ms();
+			speed_cycle_count = cycle_count.value;
+			speed_timer.start_ms(0);
+			profile_samples.value = profiler.samples;
+			if (ka11.intr_latency) {
+				intr_latency_count.value = ka11.intr_latency_count;
+				intr_latency_avg.value =
+						ka11.intr_latency_count ?
+								ka11.intr_latency_sum_ns / ka11.intr_latency_count : 0;
+				intr_latency_max.value = ka11.intr_latency_max_ns;
+			}
+		}
 
 		// serialize asynchronous power events
 		// ACLO inactive & no HALT: reboot
@@ -413,6 +697,14 @@ void cpu_c::worker(unsigned instance) {
 		}
 
 		ka11.swab_vbit = (swab_vbit.value == true);
+		ka11.predecode = (predecode.value == true);
+		if (intr_latency.value && !ka11.intr_latency) {
+			// measurement (re)started
+			ka11.intr_latency_count = 0;
+			ka11.intr_latency_sum_ns = 0;
+			ka11.intr_latency_max_ns = 0;
+		}
+		ka11.intr_latency = (intr_latency.value == true);
 	}
 }
 
@@ -28,10 +28,12 @@
 
 using namespace std;
 
+#include <vector>
 #include "utils.hpp"
 //#include "unibusadapter.hpp"
 //#include "unibusdevice.hpp"
 #include "unibuscpu.hpp"
+#include "pcprofile.hpp"
 #include "cpu20/11.h"
 #include "cpu20/ka11.h"
 
@@ -66,9 +68,18 @@ public:
 	parameter_bool_c direct_memory = parameter_bool_c(this, "pmi", "pmi",/*readonly*/
 	false, "Private Memory Interconnect: CPU accesses memory internally, not over UNIBUS.");
 
+	parameter_bool_c mmu = parameter_bool_c(this, "mmu", "mmu",/*readonly*/
+	false, "KT11 memory management as 11/40, kernel/user mode, MFPI/MTPI. MMR3 enables 22 bit.");
+
+	parameter_unsigned_c local_memory = parameter_unsigned_c(this, "local_memory", "lm",/*readonly*/
+	false, "KB", "%u", "Memory above UNIBUS 248KB for 22 bit mapping, in ARM RAM. No DMA access.", 16, 10);
+
 	parameter_bool_c swab_vbit = parameter_bool_c(this, "swab_vbit", "swab",/*readonly*/
 	false, "SWAB instruction does not(=0) or does(=1) modify psw v-bit (=0 is standard 11/20 behavior)");
 
+	parameter_bool_c predecode = parameter_bool_c(this, "predecode", "pd",/*readonly*/
+	false, "1 = opcode dispatch over predecoded table, 0 = classic switch cascade.");
+
 	parameter_unsigned_c pc = parameter_unsigned_c(this, "PC", "pc",/*readonly*/
 	false, "", "%06o", "program counter helper register.", 16, 8);
 
@@ -78,9 +89,101 @@ public:
 	parameter_unsigned_c cycle_count = parameter_unsigned_c(this, "cycle_count", "cc",/*readonly*/
 	true, "", "%u", "CPU opcodes executed since last HALT (32bit roll around).", 32, 10);
 
+	parameter_unsigned_c instructions_per_second = parameter_unsigned_c(this, "instructions_per_second", "ips",/*readonly*/
+	true, "", "%u", "CPU opcodes executed in last second.", 32, 10);
+
+	parameter_bool_c grant_always = parameter_bool_c(this, "grant_always", "ga",/*readonly*/
+	false, "1 = PRU GRANT handshake before every opcode, 0 = only if BR above CPU level pending.");
+
+	parameter_unsigned_c grant_handshakes = parameter_unsigned_c(this, "grant_handshakes", "gh",/*readonly*/
+	true, "", "%u", "PRU GRANT handshakes since last HALT (32bit roll around).", 32, 10);
+
+	parameter_unsigned_c prefetch = parameter_unsigned_c(this, "prefetch", "pf",/*readonly*/
+	false, "", "%u", "Instruction stream words read in one UNIBUS DATI burst, 0 = off. Not used with PMI.", 8, 10);
+
+	parameter_unsigned_c prefetch_hits = parameter_unsigned_c(this, "prefetch_hits", "pfh",/*readonly*/
+	true, "", "%u", "Instruction stream DATIs served from prefetch buffer since last HALT (32bit roll around).", 32, 10);
+
+	parameter_unsigned_c prefetch_bursts = parameter_unsigned_c(this, "prefetch_bursts", "pfb",/*readonly*/
+	true, "", "%u", "DATI bursts to fill prefetch buffer since last HALT (32bit roll around).", 32, 10);
+
+	parameter_unsigned_c time_batch = parameter_unsigned_c(this, "time_batch", "tb",/*readonly*/
+	false, "", "%u", "Emulated time: published to devices every n opcodes, or on next timeout.", 16, 10);
+
+	parameter_unsigned_c trace_ring = parameter_unsigned_c(this, "trace_ring", "tr",/*readonly*/
+	false, "", "%u", "Entries in opcode trace ring (PC, opcode, PSW, addresses, time), 0 = off.", 32, 10);
+
+	parameter_string_c trace_file = parameter_string_c(this, "trace_file", "tf",/*readonly*/
+	false, "File for trace ring dump, evaluate with \"tracetool\".");
+
+	parameter_bool_c trace_dump = parameter_bool_c(this, "trace_dump", "td",/*readonly*/
+	false, "1 = dump trace ring to trace_file now.");
+
+	parameter_bool_c trace_halt = parameter_bool_c(this, "trace_halt", "th",/*readonly*/
+	false, "1 = dump trace ring on HALT.");
+
+	parameter_unsigned_c trace_vector = parameter_unsigned_c(this, "trace_vector", "tv",/*readonly*/
+	false, "", "%03o", "Dump trace ring once on trap or interrupt through this vector, 0 = off.", 16, 8);
+
+	parameter_bool_c profile = parameter_bool_c(this, "profile", "prof",/*readonly*/
+	false, "1 = sample PC every profile_interval. Enabling clears the samples.");
+
+	parameter_unsigned_c profile_interval = parameter_unsigned_c(this, "profile_interval", "pri",/*readonly*/
+	false, "us", "%u", "Emulated time between PC samples. Set before profile is enabled.", 32, 10);
+
+	parameter_unsigned_c profile_granularity = parameter_unsigned_c(this, "profile_granularity", "prg",/*readonly*/
+	false, "bytes", "%u", "Profile by PC ranges of this size, 0 = by code label.", 16, 10);
+
+	parameter_string_c profile_listing = parameter_string_c(this, "profile_listing", "prl",/*readonly*/
+	false, "MACRO-11 *.lst file with code labels for the profile. M9312 ROM labels are added.");
+
+	parameter_string_c profile_file = parameter_string_c(this, "profile_file", "prf",/*readonly*/
+	false, "Profile report is written to <file>.txt, flamegraph folded stacks to <file>.folded.");
+
+	parameter_bool_c profile_report = parameter_bool_c(this, "profile_report", "prr",/*readonly*/
+	false, "1 = write profile report now.");
+
+	parameter_unsigned_c profile_samples = parameter_unsigned_c(this, "profile_samples", "prs",/*readonly*/
+	true, "", "%u", "PC samples since profile enabled.", 32, 10);
+
+	parameter_bool_c intr_latency = parameter_bool_c(this, "intr_latency", "ilt",/*readonly*/
+	false, "1 = measure time from INTR vector receive to first ISR opcode fetch.");
+
+	parameter_unsigned_c intr_latency_count = parameter_unsigned_c(this, "intr_latency_count", "ilc",/*readonly*/
+	true, "", "%u", "INTRs measured since intr_latency enabled.", 32, 10);
+
+	parameter_unsigned_c intr_latency_avg = parameter_unsigned_c(this, "intr_latency_avg", "ila",/*readonly*/
+	true, "ns", "%u", "Average INTR latency.", 32, 10);
+
+	parameter_unsigned_c intr_latency_max = parameter_unsigned_c(this, "intr_latency_max", "ilm",/*readonly*/
+	true, "ns", "%u", "Maximum INTR latency.", 32, 10);
+
 
 	struct Bus bus; // UNIBUS interface of CPU
 	struct KA11 ka11; // Angelos CPU state
+	std::vector<uint16_t> xmem; // local_memory
+
+#define CPU_TRACE_RING_MAX_ENTRIES	0x40000	// 12MB
+
+	// instruction stream prefetch, for memory over UNIBUS without PMI
+#define CPU_PREFETCH_MAX_WORDS	8
+	uint16_t prefetch_words[CPU_PREFETCH_MAX_WORDS];
+	uint32_t prefetch_addr; // of prefetch_words[0]
+	unsigned prefetch_count; // valid words, 0 = empty
+	uint32_t prefetch_dma_write_generation; // of unibusadapter when filled
+	bool prefetch_dati(uint32_t addr, uint16_t *data, bool istream);
+	void prefetch_invalidate(uint32_t addr);
+
+	// emulated time, summed up by CPU thread and published in batches
+	uint64_t emu_time_pending_ns;
+	uint64_t emu_time_deadline_ns; // next timeout, cached. 0 = none
+	unsigned emu_time_opcodes;
+	void emu_time_publish(void);
+
+	void trace_ring_dump(const char *reason);
+
+	pcprofile_c profiler;
+	void profile_write(void);
 
 	void start(void);
 	void stop(const char * info, bool print_pc = false);
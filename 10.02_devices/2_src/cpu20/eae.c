@@ -258,7 +258,7 @@ done:
 int
 dato_ke11(Bus *bus, void *dev)
 {
-	KE11 *ke = dev;
+	KE11 *ke = (KE11*)dev;
 	if(bus->addr >= 0777300 && bus->addr < 0777320){
 //		printf("EAE DATO %o %o\n", bus->addr, bus->data);
 		switch(bus->addr){
@@ -306,7 +306,7 @@ dato_ke11(Bus *bus, void *dev)
 int
 datob_ke11(Bus *bus, void *dev)
 {
-	KE11 *ke = dev;
+	KE11 *ke = (KE11*)dev;
 	if(bus->addr >= 0777300 && bus->addr < 0777320){
 //		printf("EAE DATOB %o %o\n", bus->addr, bus->data);
 		switch(bus->addr){
@@ -371,7 +371,7 @@ datob_ke11(Bus *bus, void *dev)
 int
 dati_ke11(Bus *bus, void *dev)
 {
-	KE11 *ke = dev;
+	KE11 *ke = (KE11*)dev;
 	if(bus->addr >= 0777300 && bus->addr < 0777320){
 //		printf("EAE DATI %o\n", bus->addr);
 		switch(bus->addr){
@@ -404,7 +404,7 @@ dati_ke11(Bus *bus, void *dev)
 void
 reset_ke11(void *dev)
 {
-	KE11 *ke = dev;
+	KE11 *ke = (KE11*)dev;
 	ke->ac = 0;
 	ke->mq = 0;
 	ke->x = 0;
@@ -36,7 +36,7 @@ datob_bus(Bus *bus)
 void
 levelchange(word psw)
 {
-	unibone_prioritylevelchange(psw>>5);
+	unibone_prioritylevelchange(psw>>5 & 7);
 }
 
 
@@ -63,6 +63,19 @@ enum {
 
 #define ISSET(f) ((cpu->psw&(f)) != 0)
 
+/* KT11 memory management */
+enum {
+	MMR0_NONRES = 0100000,
+	MMR0_LENGTH = 040000,
+	MMR0_RDONLY = 020000,
+	MMR0_ABORT = 0160000,
+	MMR0_ENABLE = 1,
+	MMR3_22BIT = 020,
+};
+
+#define CURMODE	(cpu->psw>>14 & 3)
+#define PREVMODE	(cpu->psw>>12 & 3)
+
 
 word
 sgn(word w)
@@ -119,22 +132,178 @@ ka11_reset(KA11 *cpu)
 	Busdev *bd;
 
 	cpu->traps = 0;
-	cpu->external_intr = 0;
-	cpu->mutex = PTHREAD_MUTEX_INITIALIZER ;
+	__atomic_store_n(&cpu->intr_pending, 0, __ATOMIC_RELAXED);
+	cpu->intr_taken = 0;
+	cpu->mmr0 = 0;
+	cpu->mmr3 = 0;
 
 	for(bd = cpu->bus->devs; bd; bd = bd->next)
 		bd->reset(bd->dev);
 }
 
+/* Load PSW, with mmu switch stack pointer on mode change.
+ Without mmu only the lower byte exists. */
+static void
+setpsw(KA11 *cpu, word psw)
+{
+	if(!cpu->mmu)
+		psw &= 0377;
+	else{
+		psw &= 0170377;
+		if((psw ^ cpu->psw) & 0140000){
+			cpu->sp[CURMODE] = cpu->r[6];
+			cpu->r[6] = cpu->sp[psw>>14 & 3];
+		}
+	}
+	cpu->psw = psw;
+}
+
+/* Virtual to 22 bit physical address, IO page at KA11_IOPAGE22_START.
+ Without 22 bit mapping the top 8K of the 18 bit space are the IO page.
+ Result ~0: abort, MMR0 updated if not frozen by previous abort. */
+static uint32
+mmu_map(KA11 *cpu, word va, int write)
+{
+	int mode, page, block, acf;
+	word pdr, abort;
+	uint32 pa;
+
+	if(!(cpu->mmr0 & MMR0_ENABLE)){
+		pa = ubxt(va);
+		return pa >= KA11_XMEM_START ? pa | KA11_IOPAGE22_START : pa;
+	}
+	mode = cpu->prevspace ? PREVMODE : CURMODE;
+	page = va>>13;
+	block = va>>6 & 0177;
+	pdr = cpu->pdr[mode][page];
+	abort = 0;
+	acf = pdr>>1 & 3;
+	if(acf == 0 || acf == 2)
+		abort |= MMR0_NONRES;
+	else if(acf == 1 && write)
+		abort |= MMR0_RDONLY;
+	if(pdr & 010 ? block < (pdr>>8 & 0177) : block > (pdr>>8 & 0177))
+		abort |= MMR0_LENGTH;
+	if(abort){
+		if(!(cpu->mmr0 & MMR0_ABORT))
+			cpu->mmr0 = (cpu->mmr0 & ~0156) | abort | mode<<5 | page<<1;
+		cpu->mmu_abort = 1;
+		return ~0u;
+	}
+	if(write)
+		cpu->pdr[mode][page] |= 0100;	// W: page written
+	if(cpu->mmr3 & MMR3_22BIT)
+		return (((uint32)cpu->par[mode][page]<<6) + (va & 017777)) & 017777777;
+	pa = (((uint32)(cpu->par[mode][page] & 07777)<<6) + (va & 017777)) & 0777777;
+	return pa >= KA11_XMEM_START ? pa | KA11_IOPAGE22_START : pa;
+}
+
+/* KT11 registers in IO page. Result 0: no register at pa */
+static int
+mmureg(KA11 *cpu, uint32 pa, int write, int b)
+{
+	word *reg, *pdr, mask;
+	uint32 a = pa & ~1;
+
+	pdr = nil;
+	if(a >= 0772300 && a < 0772320){
+		reg = pdr = &cpu->pdr[0][a>>1 & 7];
+		mask = 077416;
+	}else if(a >= 0772340 && a < 0772360){
+		reg = &cpu->par[0][a>>1 & 7];
+		pdr = &cpu->pdr[0][a>>1 & 7];
+		mask = 0177777;
+	}else if(a >= 0777600 && a < 0777620){
+		reg = pdr = &cpu->pdr[3][a>>1 & 7];
+		mask = 077416;
+	}else if(a >= 0777640 && a < 0777660){
+		reg = &cpu->par[3][a>>1 & 7];
+		pdr = &cpu->pdr[3][a>>1 & 7];
+		mask = 0177777;
+	}else if(a == 0777572){
+		reg = &cpu->mmr0;
+		mask = 0160557;
+	}else if(a == 0777576){
+		reg = &cpu->mmr2;
+		mask = 0;
+	}else if(a == 0772516){
+		reg = &cpu->mmr3;
+		mask = MMR3_22BIT;
+	}else
+		return 0;
+	if(!write){
+		cpu->bus->data = *reg;
+		return 1;
+	}
+	if(b)
+		mask &= pa & 1 ? 0177400 : 0377;
+	SETMASK(*reg, cpu->bus->data, mask);
+	if(pdr)
+		*pdr &= ~0100;	// W: not written since PAR/PDR load
+	return 1;
+}
+
+#ifdef KA11_TRACE_RING
+/* new ring entry for this step(), stamped with emulated time of all before */
+static void
+tracering_begin(KA11 *cpu)
+{
+	KA11_tracering *ring = cpu->tracering;
+	KA11_trace *t;
+
+	ring->stamp += cpu->time_ns;
+	t = &ring->entries[ring->count++ & ring->mask];
+	t->stamp = ring->stamp;
+	t->pc = cpu->r[7];
+	t->ir = 0;
+	t->psw = cpu->psw;
+	t->vector = 0;
+	t->flags = 0;
+	t->naddr = 0;
+	cpu->tracecur = t;
+}
+
+static void
+tracering_addr(KA11 *cpu, uint32 pa)
+{
+	KA11_trace *t = cpu->tracecur;
+	if(t && t->naddr < KA11_TRACE_ADDRS)
+		t->addr[t->naddr++] = pa;
+}
+#endif
+
 int
 dati(KA11 *cpu, int b)
 {
+	uint32 pa;
+
 	if(!b && cpu->ba&1)
 		goto be;
 
+	if(cpu->mmu){
+		pa = mmu_map(cpu, cpu->ba, 0);
+		if(pa == ~0u)
+			goto be;
+		if(pa >= KA11_IOPAGE22_START){
+			pa &= 0777777;
+			if(mmureg(cpu, pa, 0, b))
+				goto ok;
+			if((pa&0777776) == 0777776){
+				cpu->bus->data = cpu->psw;
+				goto ok;
+			}
+		}else if(pa >= KA11_XMEM_START){
+			if(pa - KA11_XMEM_START >= cpu->xmem_size)
+				goto be;
+			cpu->bus->data = cpu->xmem[(pa - KA11_XMEM_START)>>1];
+			goto ok;
+		}
+	}else
+		pa = ubxt(cpu->ba);
+
 	/* internal registers */
-	if((cpu->ba&0177400) == 0177400){
-		switch(cpu->ba&0377){
+	if((pa&0777400) == 0777400){
+		switch(pa&0377){
 		case 0170: case 0171:
 			cpu->bus->data = cpu->sw;
 			goto ok;
@@ -151,11 +320,15 @@ dati(KA11 *cpu, int b)
 		}
 	}
 
-	cpu->bus->addr = ubxt(cpu->ba)&~1;
+	cpu->bus->addr = pa&~1;
 	if(dati_bus(cpu->bus))
 		goto be;
 ok:
 	trace("DATI [%06o] => %06o\n", cpu->ba, cpu->bus->data);
+#ifdef KA11_TRACE_RING
+	if(cpu->tracering)
+		tracering_addr(cpu, pa);
+#endif
 	cpu->be = 0;
 	return 0;
 be:
@@ -167,20 +340,55 @@ be:
 int
 dato(KA11 *cpu, int b)
 {
+	uint32 pa;
+
 trace("%s [%06o] <= %06o\n", b? "DATOB":"DATO", cpu->ba, cpu->bus->data);
 	if(!b && cpu->ba&1)
 		goto be;
 
+	if(cpu->mmu){
+		pa = mmu_map(cpu, cpu->ba, 1);
+		if(pa == ~0u)
+			goto be;
+		if(pa >= KA11_IOPAGE22_START){
+			pa &= 0777777;
+			if(mmureg(cpu, pa, 1, b))
+				goto ok;
+			if((pa&0777776) == 0777776){
+				/* byte write changes only its byte */
+				if(!b)
+					setpsw(cpu, cpu->bus->data);
+				else if(pa & 1)
+					setpsw(cpu, (cpu->psw & 0377) | (cpu->bus->data & 0177400));
+				else
+					setpsw(cpu, (cpu->psw & 0177400) | (cpu->bus->data & 0377));
+				levelchange(cpu->psw);
+				goto ok;
+			}
+		}else if(pa >= KA11_XMEM_START){
+			word *w;
+			if(pa - KA11_XMEM_START >= cpu->xmem_size)
+				goto be;
+			w = &cpu->xmem[(pa - KA11_XMEM_START)>>1];
+			if(!b)
+				*w = cpu->bus->data;
+			else
+				SETMASK(*w, cpu->bus->data, pa & 1 ? 0177400 : 0377);
+			goto ok;
+		}
+	}else
+		pa = ubxt(cpu->ba);
+
 	/* internal registers */
-	if((cpu->ba&0177400) == 0177400){
-		switch(cpu->ba&0377){
+	if((pa&0777400) == 0777400){
+		switch(pa&0377){
 		case 0170: case 0171:
 			/* can't write switches */
 			goto ok;
 		case 0376:
 			/* writes 0 for the odd byte.
 			   I think this is correct. */
-			cpu->psw = cpu->bus->data;
+			setpsw(cpu, cpu->bus->data);
 			levelchange(cpu->psw);
 			goto ok;
 		case 0377:
@@ -189,15 +397,19 @@ trace("%s [%06o] <= %06o\n", b? "DATOB":"DATO", cpu->ba, cpu->bus->data);
 	}
 
 	if(b){
-		cpu->bus->addr = ubxt(cpu->ba);
+		cpu->bus->addr = pa;
 		if(datob_bus(cpu->bus))
 			goto be;
 	}else{
-		cpu->bus->addr = ubxt(cpu->ba)&~1;
+		cpu->bus->addr = pa&~1;
 		if(dato_bus(cpu->bus))
 			goto be;
 	}
 ok:
+#ifdef KA11_TRACE_RING
+	if(cpu->tracering)
+		tracering_addr(cpu, pa | KA11_TRACE_WRITE);
+#endif
 	cpu->be = 0;
 	return 0;
 be:
@@ -312,6 +524,142 @@ setnz(KA11 *cpu, word w)
 	if(w == 0) cpu->psw |= PSW_Z;
 }
 
+/* Predecoded dispatch.
+ The instruction class depends only on opcode bits <15:6>: a table maps them
+ to the handler in step(), dispatched with computed gotos instead of the
+ cascade of switches. The table is built from the same decode cascade,
+ so both paths execute identical handler code.
+ Decode results are not cached per PC: device DMA may load code,
+ and the opcode fetch bus cycle must stay. */
+enum {
+	OP_RI, OP_MOV, OP_CMP, OP_BIT, OP_BIC, OP_BIS, OP_ADD, OP_SUB, OP_CLR, OP_COM,
+	OP_INC, OP_DEC, OP_NEG, OP_ADC, OP_SBC, OP_TST, OP_ROR, OP_ROL, OP_ASR, OP_ASL,
+	OP_JSR, OP_EMT, OP_TRAP, OP_BR, OP_BNE, OP_BEQ, OP_BGE, OP_BLT, OP_BGT, OP_BLE,
+	OP_BPL, OP_BMI, OP_BHI, OP_BLOS, OP_BVC, OP_BVS, OP_BCC, OP_BCS, OP_JMP,
+	OP_RTS_CCC_SEC, OP_SWAB, OP_OPERATE, OP_MFPI, OP_MTPI,
+	OP_COUNT
+};
+
+static uint8 decode_table[01000 * 2];
+static int decode_table_valid = 0;
+
+/* Instruction timing, approximated from the PDP-11/20 handbook (core memory).
+ Time of an instruction with register operands, by class.
+ Operand access times are added by addressing mode, traps add the trap
+ sequence. */
+static const uint16 class_time_ns[OP_COUNT] = {
+	0,	// RI: trap sequence only
+	2300, 2300, 2300, 2300, 2300, 2300, 2300,	// MOV..SUB
+	2300, 2300, 2300, 2300, 2300, 2300, 2300, 2300,	// CLR..TST
+	2300, 2300, 2300, 2300,	// ROR..ASL
+	3200, 2100, 2100,	// JSR, EMT, TRAP
+	2600, 2600, 2600, 2600, 2600, 2600, 2600, 2600,	// BR..BPL
+	2600, 2600, 2600, 2600, 2600, 2600, 2600,	// BMI..BCS
+	1200, 3500, 2300,	// JMP, RTS/CCC/SEC, SWAB
+	0,	// OPERATE: see operate_time_ns[]
+	3200, 3200	// MFPI, MTPI, as 11/40
+};
+// HALT, WAIT, RTI, BPT, IOT, RESET (INIT pulse not included)
+static const uint16 operate_time_ns[010] = { 1800, 1800, 4800, 2100, 2100, 20000, 0, 0 };
+// source / destination operand access, by addressing mode
+static const uint16 src_time_ns[010] = { 0, 1500, 1500, 2700, 1500, 2700, 2700, 3900 };
+static const uint16 dst_time_ns[010] = { 0, 1400, 1400, 2600, 1400, 2600, 2600, 3800 };
+#define TRAP_TIME_NS	7200
+// time_table[]: + destination time
+#define TIME_DST	0x8000
+
+// instruction time by opcode bits <15:6>, source mode included
+static uint16 time_table[01000 * 2];
+
+// instruction class, as decoded by the switch cascade in step()
+static int
+decode_class(word ir)
+{
+	switch(ir & 0170000){
+	case 0110000: case 0010000:	return OP_MOV;
+	case 0120000: case 0020000:	return OP_CMP;
+	case 0130000: case 0030000:	return OP_BIT;
+	case 0140000: case 0040000:	return OP_BIC;
+	case 0150000: case 0050000:	return OP_BIS;
+	case 0060000:	return OP_ADD;
+	case 0160000:	return OP_SUB;
+	case 0170000: case 0070000:	return OP_RI;
+	}
+	switch(ir & 0007700){
+	case 0005000:	return OP_CLR;
+	case 0005100:	return OP_COM;
+	case 0005200:	return OP_INC;
+	case 0005300:	return OP_DEC;
+	case 0005400:	return OP_NEG;
+	case 0005500:	return OP_ADC;
+	case 0005600:	return OP_SBC;
+	case 0005700:	return OP_TST;
+	case 0006000:	return OP_ROR;
+	case 0006100:	return OP_ROL;
+	case 0006200:	return OP_ASR;
+	case 0006300:	return OP_ASL;
+	case 0006500:	return OP_MFPI;
+	case 0006600:	return OP_MTPI;
+	case 0006400: case 0006700:	return OP_RI;
+	}
+	switch(ir & 0107400){
+	case 0004000: case 0004400:	return OP_JSR;
+	case 0104000:	return OP_EMT;
+	case 0104400:	return OP_TRAP;
+	}
+	if((ir & 074000) == 0 && (ir & 0103400) != 0)
+		switch(ir & 0103400){
+		case 0000400:	return OP_BR;
+		case 0001000:	return OP_BNE;
+		case 0001400:	return OP_BEQ;
+		case 0002000:	return OP_BGE;
+		case 0002400:	return OP_BLT;
+		case 0003000:	return OP_BGT;
+		case 0003400:	return OP_BLE;
+		case 0100000:	return OP_BPL;
+		case 0100400:	return OP_BMI;
+		case 0101000:	return OP_BHI;
+		case 0101400:	return OP_BLOS;
+		case 0102000:	return OP_BVC;
+		case 0102400:	return OP_BVS;
+		case 0103000:	return OP_BCC;
+		case 0103400:	return OP_BCS;
+		}
+	switch(ir & 0777300){
+	case 0100:	return OP_JMP;
+	case 0200:	return OP_RTS_CCC_SEC;
+	case 0300:	return OP_SWAB;
+	}
+	// HALT..RESET only in 000000..000077
+	return (ir & ~077) == 0 ? OP_OPERATE : OP_RI;
+}
+
+static void
+decode_table_init(void)
+{
+	unsigned i;
+	for(i = 0; i < sizeof(decode_table); i++){
+		word ir = i << 6;
+		int op = decode_class(ir);
+		decode_table[i] = op;
+		time_table[i] = class_time_ns[op];
+		if(op >= OP_MOV && op <= OP_SUB)
+			time_table[i] += src_time_ns[(ir >> 9) & 7];
+		if((op >= OP_MOV && op <= OP_ASL) || op == OP_JSR || op == OP_JMP || op == OP_SWAB
+				|| op == OP_MFPI || op == OP_MTPI)
+			time_table[i] |= TIME_DST;
+	}
+	decode_table_valid = 1;
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 void
 step(KA11 *cpu)
 {
@@ -320,6 +668,7 @@ step(KA11 *cpu)
 	uint b;
 	uint c;
 	uint src, dst, sf, df, sm, dm;
+	uint t;
 	word mask, sign;
 	int inhov;
 	byte oldpsw;
@@ -359,7 +708,7 @@ step(KA11 *cpu)
 #define BXT	if(by) b = sxt(b)
 #define BR	PC += br
 #define CBR(c)	if(((c)>>(cpu->psw&017)) & 1) BR
-#define PUSH	SP -= 2; if(!inhov && (SP&~0377) == 0) cpu->traps |= TRAP_STACK
+#define PUSH	SP -= 2; if(!inhov && (SP&~0377) == 0 && !CURMODE) cpu->traps |= TRAP_STACK
 #define POP	SP += 2
 #define OUT(a,d)	cpu->ba = (a); cpu->bus->data = (d); if(dato(cpu, 0)) goto be
 #define IN(d)	if(dati(cpu, 0)) goto be; d = cpu->bus->data
@@ -368,25 +717,44 @@ step(KA11 *cpu)
 #define TRB(m)	trace("EXEC [%06o] "#m"%s\n", PC-2, by ? "B" : "")
 
 	inhov = 0;
+#ifdef KA11_TRACE_RING
+	if(cpu->tracering)
+		tracering_begin(cpu);
+#endif
+	cpu->time_ns = 0;
+	cpu->mmu_abort = 0;
+
+	if(cpu->intr_taken){
+		// first opcode of ISR
+		uint64_t latency_ns = now_ns() - cpu->intr_request_ns;
+		cpu->intr_taken = 0;
+		cpu->intr_latency_count++;
+		cpu->intr_latency_sum_ns += latency_ns;
+		if(latency_ns > cpu->intr_latency_max_ns)
+			cpu->intr_latency_max_ns = latency_ns;
+	}
 
-	{
-		// external interrupt from parallel threads?
-		pthread_mutex_lock(&cpu->mutex) ;
-		bool external_intr = cpu->external_intr ;
-		word external_intrvec = cpu->external_intrvec ;
-		cpu->external_intr = 0 ;
-		pthread_mutex_unlock(&cpu->mutex) ;
-		if (external_intr){
-			//ARM_DEBUG_PIN1(0);	// INTR processed
-			cpu->state = KA11_STATE_RUNNING ;
-			TRAP(external_intrvec);
-		}	
+	// external interrupt from parallel threads?
+	if(__atomic_load_n(&cpu->intr_pending, __ATOMIC_RELAXED)){
+		uint32_t intr = __atomic_exchange_n(&cpu->intr_pending, 0, __ATOMIC_ACQUIRE);
+		//ARM_DEBUG_PIN1(0);	// INTR processed
+		cpu->state = KA11_STATE_RUNNING ;
+		cpu->intr_taken = cpu->intr_latency;
+		TRAP(intr & 0177777);
 	}
 
 
 	oldpsw = PSW;
+	if(cpu->mmu && !(cpu->mmr0 & MMR0_ABORT))
+		cpu->mmr2 = PC;
 	INA(PC, cpu->ir);
 	PC += 2;	/* don't increment on bus error! */
+#ifdef KA11_TRACE_RING
+	if(cpu->tracering){
+		cpu->tracecur->ir = cpu->ir;
+		cpu->tracecur->flags |= KA11_TRACE_FETCHED;
+	}
+#endif
 	by = !!(cpu->ir&B15);
 	br = sxt(cpu->ir)<<1;
 	src = cpu->ir>>6 & 077;
@@ -398,37 +766,68 @@ step(KA11 *cpu)
 	if(by)	mask = M8, sign = B7;
 	else	mask = M16, sign = B15;
 
+	if(!decode_table_valid)
+		decode_table_init();
+	t = time_table[cpu->ir >> 6];
+	if(t & TIME_DST)
+		t = (t & ~TIME_DST) + dst_time_ns[dm];
+	else if(cpu->ir < 010)
+		t = operate_time_ns[cpu->ir];
+	cpu->time_ns += t;
+
+	if(cpu->predecode){
+		// same order as OP_*
+		static void *dispatch[OP_COUNT] = {
+			&&ri, &&op_mov, &&op_cmp, &&op_bit, &&op_bic, &&op_bis, &&op_add,
+			&&op_sub, &&op_clr, &&op_com, &&op_inc, &&op_dec, &&op_neg,
+			&&op_adc, &&op_sbc, &&op_tst, &&op_ror, &&op_rol, &&op_asr,
+			&&op_asl, &&op_jsr, &&op_emt, &&op_trap, &&op_br, &&op_bne,
+			&&op_beq, &&op_bge, &&op_blt, &&op_bgt, &&op_ble, &&op_bpl,
+			&&op_bmi, &&op_bhi, &&op_blos, &&op_bvc, &&op_bvs, &&op_bcc,
+			&&op_bcs, &&op_jmp, &&op_rts_ccc_sec, &&op_swab, &&op_operate,
+			&&op_mfpi, &&op_mtpi
+		};
+		goto *dispatch[decode_table[cpu->ir >> 6]];
+	}
+
 	/* Binary */
 	switch(cpu->ir & 0170000){
-	case 0110000: case 0010000:	TRB(MOV);
+	case 0110000: case 0010000:
+	op_mov:	TRB(MOV);
 		RD_B; CLV;
 		b = SR; NZ;
 		if(dm==0) cpu->r[df] = SR;
 		else writedest(cpu, SR, by);
 		SVC;
-	case 0120000: case 0020000:	TRB(CMP);
+	case 0120000: case 0020000:
+	op_cmp:	TRB(CMP);
 		RD_B; CLCV;
 		b = SR + W(~DR) + 1; NC; BXT;
 		if(sgn((SR ^ DR) & ~(DR ^ b))) SEV;
 		NZ; SVC;
-	case 0130000: case 0030000:	TRB(BIT);
+	case 0130000: case 0030000:
+	op_bit:	TRB(BIT);
 		RD_B; CLV;
 		b = DR & SR;
 		NZ; SVC;
-	case 0140000: case 0040000:	TRB(BIC);
+	case 0140000: case 0040000:
+	op_bic:	TRB(BIC);
 		RD_B; CLV;
 		b = DR & ~SR;
 		NZ; WR; SVC;
-	case 0150000: case 0050000:	TRB(BIS);
+	case 0150000: case 0050000:
+	op_bis:	TRB(BIS);
 		RD_B; CLV;
 		b = DR | SR;
 		NZ; WR; SVC;
-	case 0060000:			TR(ADD);
+	case 0060000:
+	op_add:	TR(ADD);
 		by = 0; RD_B; CLCV;
 		b = SR + DR; C;
 		if(sgn(~(SR ^ DR) & (DR ^ b))) SEV;
 		NZ; WR; SVC;
-	case 0160000:			TR(SUB);
+	case 0160000:
+	op_sub:	TR(SUB);
 		by = 0; RD_B; CLCV;
 		b = DR + W(~SR) + 1; NC;
 		if(sgn((SR ^ DR) & (DR ^ b))) SEV;
@@ -440,68 +839,113 @@ step(KA11 *cpu)
 
 	/* Unary */
 	switch(cpu->ir & 0007700){
-	case 0005000:	TRB(CLR);
+	case 0005000:
+	op_clr:	TRB(CLR);
 		RD_U; CLCV;
 		b = 0;
 		NZ; WR; SVC;
-	case 0005100:	TRB(COM);
+	case 0005100:
+	op_com:	TRB(COM);
 		RD_U; CLV; SEC;
 		b = W(~SR);
 		NZ; WR; SVC;
-	case 0005200:	TRB(INC);
+	case 0005200:
+	op_inc:	TRB(INC);
 		RD_U; CLV;
 		b = W(SR+1); BXT;
 		if(sgn(~SR&b)) SEV;
 		NZ; WR; SVC;
-	case 0005300:	TRB(DEC);
+	case 0005300:
+	op_dec:	TRB(DEC);
 		RD_U; CLV;
 		b = W(SR+~0); BXT;
 		if(sgn(SR&~b)) SEV;
 		NZ; WR; SVC;
-	case 0005400:	TRB(NEG);
+	case 0005400:
+	op_neg:	TRB(NEG);
 		RD_U; CLCV;
 		b = W(~SR+1); BXT; if(b) SEC;
 		if(sgn(b&SR)) SEV;
 		NZ; WR; SVC;
-	case 0005500:	TRB(ADC);
+	case 0005500:
+	op_adc:	TRB(ADC);
 		RD_U; c = ISSET(PSW_C); CLCV;
 		b = SR + c; C; BXT;
 		if(sgn(~SR&b)) SEV;
 		NZ; WR; SVC;
-	case 0005600:	TRB(SBC);
+	case 0005600:
+	op_sbc:	TRB(SBC);
 		RD_U; c = !ISSET(PSW_C)-1; CLCV;
 		b = W(SR+c); if(c && SR == 0) SEC; BXT;
 		if(sgn(SR&~b)) SEV;
 		NZ; WR; SVC;
-	case 0005700:	TRB(TST);
+	case 0005700:
+	op_tst:	TRB(TST);
 		RD_U; CLCV;
 		b = SR;
 		NZ; SVC;
 
-	case 0006000:	TRB(ROR);
+	case 0006000:
+	op_ror:	TRB(ROR);
 		RD_U; c = ISSET(PSW_C); CLCV;
 		b = (SR&mask) >> 1; if(c) b |= sign; if(SR & 1) SEC; BXT;
 		NZ; if((PSW>>3^PSW)&1) SEV;
 		WR; SVC;
-	case 0006100:	TRB(ROL);
+	case 0006100:
+	op_rol:	TRB(ROL);
 		RD_U; c = ISSET(PSW_C); CLCV;
 		b = (SR<<1) & mask; if(c) b |= 1; if(SR & B15) SEC; BXT;
 		NZ; if((PSW>>3^PSW)&1) SEV;
 		WR; SVC;
-	case 0006200:	TRB(ASR);
+	case 0006200:
+	op_asr:	TRB(ASR);
 		RD_U; c = ISSET(PSW_C); CLCV;
 		b = W(SR>>1) | SR&B15; if(SR & 1) SEC; BXT;
 		NZ; if((PSW>>3^PSW)&1) SEV;
 		WR; SVC;
-	case 0006300:	TRB(ASL);
+	case 0006300:
+	op_asl:	TRB(ASL);
 		RD_U; CLCV;
 		b = W(SR<<1); if(SR & B15) SEC; BXT;
 		NZ; if((PSW>>3^PSW)&1) SEV;
 		WR; SVC;
 
-	case 0006400:
+	/* KT11: move from/to previous instruction space */
 	case 0006500:
+	op_mfpi:	if(!cpu->mmu) goto ri;
+		TR(MFPI);
+		if(dm == 0)
+			b = df == 6 && PREVMODE != CURMODE ? cpu->sp[PREVMODE] : cpu->r[df];
+		else{
+			if(addrop(cpu, dst, 0)) goto be;
+			cpu->prevspace = 1;
+			c = dati(cpu, 0);
+			cpu->prevspace = 0;
+			if(c) goto be;
+			b = cpu->bus->data;
+		}
+		PUSH; OUT(SP, b);
+		CLV; NZ; SVC;
 	case 0006600:
+	op_mtpi:	if(!cpu->mmu) goto ri;
+		TR(MTPI);
+		BA = SP; POP; IN(b);
+		if(dm == 0){
+			if(df == 6 && PREVMODE != CURMODE)
+				cpu->sp[PREVMODE] = b;
+			else
+				cpu->r[df] = b;
+		}else{
+			if(addrop(cpu, dst, 0)) goto be;
+			cpu->bus->data = b;
+			cpu->prevspace = 1;
+			c = dato(cpu, 0);
+			cpu->prevspace = 0;
+			if(c) goto be;
+		}
+		CLV; NZ; SVC;
+
+	case 0006400:
 	case 0006700:
 		goto ri;
 
@@ -509,58 +953,80 @@ step(KA11 *cpu)
 
 	switch(cpu->ir & 0107400){
 	case 0004000:
-	case 0004400:	TR(JSR);
+	case 0004400:
+	op_jsr:	TR(JSR);
 		if(dm == 0) goto ill;
 		if(addrop(cpu, dst, 0)) goto be;
 		DR = cpu->b;
 		PUSH; OUT(SP, cpu->r[sf]);
 		cpu->r[sf] = PC; PC = DR;
 		SVC;
-	case 0104000:	TR(EMT); TRAP(030);
-	case 0104400:	TR(TRAP); TRAP(034);
+	case 0104000:
+	op_emt:	TR(EMT); TRAP(030);
+	case 0104400:
+	op_trap:	TR(TRAP); TRAP(034);
 	}
 
 	/* Branches */
-    // ! 000 0!! !xx xxx xxx    (! = at least one is non-zero)
-    if((cpu->ir & 074000) == 0 && (cpu->ir & 0103400) != 0)
-        switch(cpu->ir & 0103400){
-        case 0000400:	TR(BR); BR; SVC;
-        case 0001000:	TR(BNE); CBR(0x0F0F); SVC;
-        case 0001400:	TR(BEQ); CBR(0xF0F0); SVC;
-        case 0002000:	TR(BGE); CBR(0xCC33); SVC;
-        case 0002400:	TR(BLT); CBR(0x33CC); SVC;
-        case 0003000:	TR(BGT); CBR(0x0C03); SVC;
-        case 0003400:	TR(BLE); CBR(0xF3FC); SVC;
-        case 0100000:	TR(BPL); CBR(0x00FF); SVC;
-        case 0100400:	TR(BMI); CBR(0xFF00); SVC;
-        case 0101000:	TR(BHI); CBR(0x0505); SVC;
-        case 0101400:	TR(BLOS); CBR(0xFAFA); SVC;
-        case 0102000:	TR(BVC); CBR(0x3333); SVC;
-        case 0102400:	TR(BVS); CBR(0xCCCC); SVC;
-        case 0103000:	TR(BCC); CBR(0x5555); SVC;
-        case 0103400:	TR(BCS); CBR(0xAAAA); SVC;
-        }
+	// ! 000 0!! !xx xxx xxx    (! = at least one is non-zero)
+	if((cpu->ir & 074000) == 0 && (cpu->ir & 0103400) != 0)
+		switch(cpu->ir & 0103400){
+		case 0000400:
+		op_br:	TR(BR); BR; SVC;
+		case 0001000:
+		op_bne:	TR(BNE); CBR(0x0F0F); SVC;
+		case 0001400:
+		op_beq:	TR(BEQ); CBR(0xF0F0); SVC;
+		case 0002000:
+		op_bge:	TR(BGE); CBR(0xCC33); SVC;
+		case 0002400:
+		op_blt:	TR(BLT); CBR(0x33CC); SVC;
+		case 0003000:
+		op_bgt:	TR(BGT); CBR(0x0C03); SVC;
+		case 0003400:
+		op_ble:	TR(BLE); CBR(0xF3FC); SVC;
+		case 0100000:
+		op_bpl:	TR(BPL); CBR(0x00FF); SVC;
+		case 0100400:
+		op_bmi:	TR(BMI); CBR(0xFF00); SVC;
+		case 0101000:
+		op_bhi:	TR(BHI); CBR(0x0505); SVC;
+		case 0101400:
+		op_blos:	TR(BLOS); CBR(0xFAFA); SVC;
+		case 0102000:
+		op_bvc:	TR(BVC); CBR(0x3333); SVC;
+		case 0102400:
+		op_bvs:	TR(BVS); CBR(0xCCCC); SVC;
+		case 0103000:
+		op_bcc:	TR(BCC); CBR(0x5555); SVC;
+		case 0103400:
+		op_bcs:	TR(BCS); CBR(0xAAAA); SVC;
+		}
 
 	/* Misc */
 	switch(cpu->ir & 0777300){
-	case 0100:	TR(JMP);
+	case 0100:
+	op_jmp:	TR(JMP);
 		if(dm == 0) goto ill;
 		if(addrop(cpu, dst, 0)) goto be;
 		PC = cpu->b;
 		SVC;
 	case 0200:
-        switch(cpu->ir&070){
-        case 000:	TR(RTS);
-            BA = SP; POP;
-            PC = cpu->r[df];
-            IN(cpu->r[df]);
-            SVC;
-        case 010: case 020: case 030:
-            goto ri;
-        case 040: case 050:	TR(CCC); PSW &= ~(cpu->ir&017); SVC;
-        case 060: case 070:	TR(SEC); PSW |= cpu->ir&017; SVC;
-        }
-	case 0300:	TR(SWAB);
+	op_rts_ccc_sec:
+		switch(cpu->ir&070){
+		case 000:	TR(RTS);
+			BA = SP; POP;
+			PC = cpu->r[df];
+			IN(cpu->r[df]);
+			SVC;
+		case 010: case 020: case 030:
+			goto ri;
+		case 040: case 050:	TR(CCC); PSW &= ~(cpu->ir&017); SVC;
+		case 060: case 070:	TR(SEC); PSW |= cpu->ir&017; SVC;
+		}
+		goto ri;	// not reached, all cases end above
+	case 0300:
+	op_swab:	TR(SWAB);
 		RD_U;
 		if(cpu->swab_vbit) {
 		    CLCV;   // v-bit cleared, ZQKC compatible
@@ -573,17 +1039,22 @@ step(KA11 *cpu)
 	}
 
 	/* Operate */
+op_operate:
 	switch(cpu->ir){
-	case 0:	TR(HALT); cpu->state = KA11_STATE_HALTED; return;
+	case 0:	TR(HALT); if(CURMODE) goto ill; cpu->state = KA11_STATE_HALTED; return;
 	case 1:	TR(WAIT); /*ARM_DEBUG_PIN0(1); */cpu->state = KA11_STATE_WAITING; return ; // no traps
 	case 2:	TR(RTI);
 		BA = SP; POP; IN(PC);
-		BA = SP; POP; IN(PSW);
+		BA = SP; POP; IN(b);
+		/* user mode can not leave user mode or change priority */
+		if(CURMODE)
+			b = (b & ~0340) | (PSW & 0170340);
+		setpsw(cpu, b);
 		levelchange(cpu->psw) ;
 		SVC;
 	case 3:	TR(BPT); TRAP(014);
 	case 4:	TR(IOT); TRAP(020);
-	case 5:	TR(RESET); ka11_reset(cpu); unibone_bus_init(10) ; SVC;
+	case 5:	TR(RESET); if(CURMODE) SVC; ka11_reset(cpu); unibone_bus_init(10) ; SVC;
 	}
 
 	// All other instructions should be reserved now
@@ -596,15 +1067,40 @@ be:	if(cpu->be > 1){
 		cpu->state = KA11_STATE_HALTED;
 		return;
 	}
+	if(cpu->mmu_abort){
+		trace("MMU abort at %06o, MMR0 %06o\n", cpu->ba, cpu->mmr0);
+		cpu->mmu_abort = 0;
+		TRAP(0250);
+	}
 	trace("bus error at %06o\n", cpu->ba);
 	TRAP(4);
 
 trap:
 	trace("TRAP %o\n", TV);
-	PUSH; OUT(SP, PSW);
-	PUSH; OUT(SP, PC);
-	INA(TV, PC);
-	INA(TV+2, PSW);
+	cpu->time_ns += TRAP_TIME_NS;
+#ifdef KA11_TRACE_RING
+	if(cpu->tracering){
+		cpu->tracecur->vector = TV;
+		cpu->tracecur->flags |= KA11_TRACE_TRAP;
+	}
+#endif
+	if(cpu->mmu){
+		/* vector from kernel space, then old PSW and PC onto stack of new mode */
+		SR = PSW;
+		DR = PC;
+		setpsw(cpu, PSW & 07777);
+		INA(TV, PC);
+		INA(TV+2, b);
+		setpsw(cpu, (b & ~030000) | (SR>>2 & 030000));
+		PUSH; OUT(SP, SR);
+		PUSH; OUT(SP, DR);
+	}else{
+		PUSH; OUT(SP, PSW);
+		PUSH; OUT(SP, PC);
+		INA(TV, PC);
+		INA(TV+2, b);
+		setpsw(cpu, b);
+	}
 	levelchange(PSW);
 	/* no trace trap after a trap */
 	oldpsw = PSW;
@@ -614,7 +1110,7 @@ trap:
 //	SVC;
 
 service:
-	c = PSW >> 5;
+	c = PSW >> 5 & 7;
 	if(oldpsw & PSW_T){
 		oldpsw &= ~PSW_T;
 		TRAP(014);
@@ -648,15 +1144,15 @@ service:
 void
 ka11_setintr(KA11 *cpu, unsigned vec)
 {
-	pthread_mutex_lock(&cpu->mutex) ;
-	cpu->external_intr = true;
-	cpu->external_intrvec = vec;
+	if(cpu->intr_latency)
+		cpu->intr_request_ns = now_ns();
+	// publishes intr_request_ns also
+	__atomic_store_n(&cpu->intr_pending, KA11_INTR_PENDING | vec, __ATOMIC_RELEASE);
 	trace("INTR vec=%03o\n", vec) ;
 //	if (cpu->state == KA11_STATE_WAITING) // atomically
 //		cpu->state = KA11_STATE_RUNNING ;
 //	ARM_DEBUG_PIN1(1);	// INTR pending
 //	ARM_DEBUG_PIN0(0);	// not waiting
-	pthread_mutex_unlock(&cpu->mutex) ;
 }
 
 // only to be called from ka11_condstep() thread
@@ -675,7 +1171,8 @@ ka11_pwrup_vector_fetch(KA11 *cpu)
 	// caller must have issued reset()
 	// cpu->traps &= ~TRAP_PWR; // no, would be a fix
 	INA(024, PC);
-	INA(024+2, PSW);
+	INA(024+2, TV);
+	setpsw(cpu, TV);
 	return ;
 be:
 	trace("BE\n");
@@ -691,10 +1188,11 @@ ka11_condstep(KA11 *cpu)
 
 	if((cpu->state == KA11_STATE_RUNNING) ||
 	   (cpu->state == KA11_STATE_WAITING && cpu->traps)
-	   || (cpu->state == KA11_STATE_WAITING && cpu->external_intr) ){
+	   || (cpu->state == KA11_STATE_WAITING
+		&& __atomic_load_n(&cpu->intr_pending, __ATOMIC_RELAXED)) ){
 //ARM_DEBUG_PIN0(0);	   
 		cpu->state = KA11_STATE_RUNNING;
-		// external_intr WAIT handled atomically in ka11_setintr() !
+		// intr_pending WAIT handled atomically in ka11_setintr() !
 
 		svc(cpu, cpu->bus);
 		step(cpu);
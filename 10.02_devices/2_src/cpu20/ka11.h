@@ -6,6 +6,46 @@ enum {
 	KA11_STATE_WAITING = 2
 };
 
+// intr_pending: flag | vector
+#define KA11_INTR_PENDING	0x10000
+
+// KT11 memory management: 22 bit physical address space.
+// Memory above 18 bit UNIBUS memory is local to the CPU,
+// IO page is moved to the top.
+#define KA11_XMEM_START	0760000
+#define KA11_IOPAGE22_START	017760000
+
+// Trace ring: compact binary record of every step(), for offline profiling.
+// Hooks in step(), dati(), dato() are removed if undefined.
+#define KA11_TRACE_RING
+
+#define KA11_TRACE_ADDRS	6	// bus addresses recorded per opcode
+#define KA11_TRACE_WRITE	0x80000000	// in addr[]: DATO or DATOB
+#define KA11_TRACE_FETCHED	0x01	// flags: ir valid
+#define KA11_TRACE_TRAP	0x02	// flags: vector valid
+// file: magic, uint32 entry count, uint32 entry size, entries oldest first
+#define KA11_TRACE_MAGIC	"KA11TRC1"
+
+typedef struct KA11_trace KA11_trace;
+struct KA11_trace
+{
+	uint64_t stamp;	// emulated ns at begin of step()
+	word pc, ir, psw, vector;
+	uint8 flags;
+	uint8 naddr;	// valid addr[], further accesses are not recorded
+	uint8 pad[2];
+	uint32 addr[KA11_TRACE_ADDRS];	// physical, | KA11_TRACE_WRITE
+};
+
+typedef struct KA11_tracering KA11_tracering;
+struct KA11_tracering
+{
+	KA11_trace *entries;
+	uint32 mask;	// entry count - 1, power of 2
+	uint64_t count;	// entries written since clear
+	uint64_t stamp;	// emulated ns since clear
+};
+
 
 typedef struct KA11 KA11;
 struct KA11
@@ -15,7 +55,7 @@ struct KA11
 	word ba;
 	word ir;
 	Bus *bus;
-	byte psw;
+	word psw;	// <15:12> current and previous mode only with mmu
 	int traps;
 	int be;
 	int state;
@@ -26,12 +66,36 @@ struct KA11
 	} br[4];
 
 	// UniBone 	
-	pthread_mutex_t mutex ;
-	volatile bool external_intr ; // INTR by parallel thread pending
-	volatile word external_intrvec;	// associated vector
+	// INTR by parallel thread pending: KA11_INTR_PENDING | vector
+	// set with release, CPU thread tests with relaxed load, no lock.
+	uint32_t intr_pending;
+
+	// INTR request to first ISR opcode fetch
+	int intr_latency;	// measure
+	int intr_taken;	// ISR entered, measure on next fetch
+	uint64_t intr_request_ns;
+	uint32_t intr_latency_count;
+	uint64_t intr_latency_sum_ns;
+	uint64_t intr_latency_max_ns;
+
+	// KT11-D like memory management as on 11/40, MFPI/MTPI, kernel and user mode.
+	// MMR3 bit 4 enables 22 bit mapping as on 11/23, 11/44
+	int mmu;	// option installed
+	word sp[4];	// stack pointers of modes not current, by mode
+	word par[4][8], pdr[4][8];	// by mode: 0 = kernel, 3 = user
+	word mmr0, mmr2, mmr3;
+	int prevspace;	// MFPI, MTPI: map with previous mode
+	int mmu_abort;	// last bus error is an MMU abort
+	word *xmem;	// local memory from KA11_XMEM_START on
+	uint32 xmem_size;	// bytes
 
 	word sw;
 	int swab_vbit;
+	int predecode;	// dispatch over decode table, not switch cascade
+	uint32_t time_ns;	// emulated duration of last step()
+
+	KA11_tracering *tracering;	// NULL: not recording
+	KA11_trace *tracecur;	// entry of current step()
 };
 
 
@@ -41,3 +105,9 @@ void ka11_pwrfail_trap(KA11 *cpu);
 void ka11_pwrup_vector_fetch(KA11 *cpu);
 void ka11_condstep(KA11 *cpu);
 
+KA11_tracering *ka11_tracering_alloc(uint32 entries);
+void ka11_tracering_free(KA11_tracering *ring);
+void ka11_tracering_clear(KA11_tracering *ring);
+int ka11_tracering_save(KA11_tracering *ring, const char *filename);
+KA11_tracering *ka11_tracering_load(const char *filename);
+
@@ -0,0 +1,98 @@
+#include "11.h"
+#include "ka11.h"
+
+/* Trace ring of step() records. Filled by ka11.c, saved for offline
+   analysis. File layout see KA11_TRACE_MAGIC in ka11.h */
+
+KA11_tracering*
+ka11_tracering_alloc(uint32 entries)
+{
+	KA11_tracering *ring;
+	uint32 n;
+
+	for(n = 1; n < entries; n <<= 1)
+		;
+	ring = (KA11_tracering*)malloc(sizeof(KA11_tracering));
+	if(ring == NULL)
+		return NULL;
+	ring->entries = (KA11_trace*)calloc(n, sizeof(KA11_trace));
+	if(ring->entries == NULL){
+		free(ring);
+		return NULL;
+	}
+	ring->mask = n-1;
+	ka11_tracering_clear(ring);
+	return ring;
+}
+
+void
+ka11_tracering_free(KA11_tracering *ring)
+{
+	if(ring == NULL)
+		return;
+	free(ring->entries);
+	free(ring);
+}
+
+void
+ka11_tracering_clear(KA11_tracering *ring)
+{
+	ring->count = 0;
+	ring->stamp = 0;
+}
+
+/* valid entries oldest first. 0 = ok */
+int
+ka11_tracering_save(KA11_tracering *ring, const char *filename)
+{
+	FILE *f;
+	uint32 hdr[2];
+	uint64_t i, first;
+
+	f = fopen(filename, "wb");
+	if(f == NULL)
+		return -1;
+	first = ring->count > ring->mask ? ring->count - ring->mask - 1 : 0;
+	hdr[0] = ring->count - first;
+	hdr[1] = sizeof(KA11_trace);
+	fwrite(KA11_TRACE_MAGIC, 1, 8, f);
+	fwrite(hdr, sizeof(hdr), 1, f);
+	for(i = first; i < ring->count; i++)
+		fwrite(&ring->entries[i & ring->mask], sizeof(KA11_trace), 1, f);
+	if(fclose(f))
+		return -1;
+	return 0;
+}
+
+/* ring sized and filled from file, NULL on error */
+KA11_tracering*
+ka11_tracering_load(const char *filename)
+{
+	FILE *f;
+	char magic[8];
+	uint32 hdr[2];
+	KA11_tracering *ring;
+
+	f = fopen(filename, "rb");
+	if(f == NULL)
+		return NULL;
+	if(fread(magic, 1, 8, f) != 8 || memcmp(magic, KA11_TRACE_MAGIC, 8)
+	   || fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[1] != sizeof(KA11_trace)){
+		fclose(f);
+		return NULL;
+	}
+	ring = ka11_tracering_alloc(hdr[0]);
+	if(ring == NULL){
+		fclose(f);
+		return NULL;
+	}
+	ring->count = fread(ring->entries, sizeof(KA11_trace), hdr[0], f);
+	fclose(f);
+	if(ring->count != hdr[0]){
+		ka11_tracering_free(ring);
+		return NULL;
+	}
+	if(ring->count)
+		ring->stamp = ring->entries[ring->count-1].stamp;
+	return ring;
+}
@@ -4,7 +4,7 @@
 int
 dati_kl11(Bus *bus, void *dev)
 {
-	KL11 *kl = dev;
+	KL11 *kl = (KL11*)dev;
 	if(bus->addr >= 0777560 && bus->addr < 0777570){
 		switch(bus->addr&6){
 		/* Receive */
@@ -39,7 +39,7 @@ dati_kl11(Bus *bus, void *dev)
 int
 dato_kl11(Bus *bus, void *dev)
 {
-	KL11 *kl = dev;
+	KL11 *kl = (KL11*)dev;
 	if(bus->addr >= 0777560 && bus->addr < 0777570){
 		switch(bus->addr&7){
 		/* Receive */
@@ -92,14 +92,14 @@ int NNN;
 int
 svc_kl11(Bus *bus, void *dev)
 {
-	KL11 *kl = dev;
+	KL11 *kl = (KL11*)dev;
 
 	NNN++;
 	if(NNN == 20){
 	/* transmit */
 	if(!kl->xmit_tbmt){
 		uint8 c = kl->xmit_b & 0177;
-		write(kl->ttyfd, &c, 1);
+		write(kl->ttyofd, &c, 1);
 #ifdef AUTODIAG
 	extern int diagpassed;
 	if(c == '\a')
@@ -129,16 +129,16 @@ svc_kl11(Bus *bus, void *dev)
 int
 bg_kl11(void *dev)
 {
-	KL11 *kl = dev;
+	KL11 *kl = (KL11*)dev;
 	if(kl->rcd_int && kl->rcd_int_enab){
 		kl->rcd_int = 0;
-printf("rx trap\n");
+//printf("rx trap\n");
 		return 060;
 	}
 
 	if(kl->xmit_int && kl->xmit_int_enab){
 		kl->xmit_int = 0;
-printf("tx trap\n");
+//printf("tx trap\n");
 		return 064;
 	}
 	assert(0);	// can't happen
@@ -149,7 +149,7 @@ printf("tx trap\n");
 void
 reset_kl11(void *dev)
 {
-	KL11 *kl = dev;
+	KL11 *kl = (KL11*)dev;
 	kl->rcd_busy = 0;
 	kl->rcd_rdr_enab = 0;
 	kl->rcd_int_enab = 0;
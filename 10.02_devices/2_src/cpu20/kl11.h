@@ -19,6 +19,7 @@ struct KL11
 	byte xmit_b;
 
 	int ttyfd;
+	int ttyofd;	// printer output, may be ttyfd
 };
 int dati_kl11(Bus *bus, void *dev);
 int dato_kl11(Bus *bus, void *dev);
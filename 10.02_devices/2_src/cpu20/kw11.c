@@ -4,8 +4,8 @@
 int
 dati_kw11(Bus *bus, void *dev)
 {
-	KW11 *kw = dev;
-	if(bus->addr == 777746){
+	KW11 *kw = (KW11*)dev;
+	if(bus->addr == 0777546){
 		bus->data = kw->lc_int_enab<<6 |
 			kw->lc_clock<<7;
 		return 0;
@@ -16,8 +16,8 @@ dati_kw11(Bus *bus, void *dev)
 int
 dato_kw11(Bus *bus, void *dev)
 {
-	KW11 *kw = dev;
-	if(bus->addr == 777546){
+	KW11 *kw = (KW11*)dev;
+	if(bus->addr == 0777546){
 		kw->lc_int_enab = bus->data>>6 & 1;
 		if((bus->data & 0200) == 0){
 			kw->lc_clock = 0;
@@ -74,7 +74,7 @@ handleclock(KW11 *kw)
 int
 svc_kw11(Bus *bus, void *dev)
 {
-	KW11 *kw = dev;
+	KW11 *kw = (KW11*)dev;
 	handleclock(kw);
 	return kw->lc_int && kw->lc_int_enab ? 6 : 0;
 }
@@ -83,7 +83,7 @@ svc_kw11(Bus *bus, void *dev)
 int
 bg_kw11(void *dev)
 {
-	KW11 *kw = dev;
+	KW11 *kw = (KW11*)dev;
 	kw->lc_int = 0;
 	return 0100;
 }
@@ -91,7 +91,7 @@ bg_kw11(void *dev)
 void
 reset_kw11(void *dev)
 {
-	KW11 *kw = dev;
+	KW11 *kw = (KW11*)dev;
 	kw->lc_int_enab = 0;
 	// TODO: 1?
 	kw->lc_clock = 0;
@@ -16,30 +16,54 @@
  */
 
 #include <assert.h>
+#include <time.h>
+#include <math.h>
+#include <algorithm>
 #include <memory>
 
 using namespace std;
 
 #include "logger.hpp"
 #include "utils.hpp"
+#include "timeout.hpp"
 #include "mscp_drive.hpp"
 #include "mscp_server.hpp"
 
 mscp_drive_c::mscp_drive_c(storagecontroller_c *controller, uint32_t driveNumber) :
-		storagedrive_c(controller), _useImageSize(false) {
-	set_workers_count(0) ; // needs no worker()
+		storagedrive_c(controller), _useImageSize(false), _cache(512),
+		_cacheMutex(PTHREAD_MUTEX_INITIALIZER), _readAheadMutex(PTHREAD_MUTEX_INITIALIZER),
+		_readAheadCond(PTHREAD_COND_INITIALIZER), _readAheadNext(0), _readAheadEnd(0),
+		_lastReadEnd(0), _flushCond(PTHREAD_COND_INITIALIZER), _traceFile(nullptr),
+		_geometry(nullptr), _virtualNs(0), _currentCylinder(0) {
+	set_workers_count(2) ; // worker() does read-ahead and write-back
 	log_label = "MSCPD";
 	SetDriveType("RA81");
 	SetOffline();
 
+	cache_blocks.value = MSCP_CACHE_DEFAULT_BLOCKS;
+	readahead.value = MSCP_READAHEAD_DEFAULT_BLOCKS;
+	_cache.Resize(cache_blocks.value);
+
+	write_back.value = false;
+	write_back_limit.value = MSCP_WRITEBACK_DEFAULT_BLOCKS;
+	ResizeWriteBack(write_back_limit.value);
+	_flushBuffer.resize(MSCP_FLUSH_RUN_BLOCKS * GetBlockSize());
+
+	timing.value = 0;
+	_timingClock.start_ns(0);
+
 	// Calculate the unit's ID:
 	_unitDeviceNumber = driveNumber + 1;
 }
 
 mscp_drive_c::~mscp_drive_c() {
 	if (file_is_open()) {
+		Flush();
 		file_close();
 	}
+	if (_traceFile) {
+		fclose(_traceFile);
+	}
 }
 
 // on_param_changed():
@@ -49,10 +73,18 @@ bool mscp_drive_c::on_param_changed(parameter_c *param) {
 	if (&type_name == param) {
 		return SetDriveType(type_name.new_value.c_str());
 	} else if (&image_filepath == param) {
+		// Write pending data to the old image
+		Flush();
 		// Try to open the image file.
 		if (file_open(image_filepath.new_value, true)) {
 			image_filepath.value = image_filepath.new_value;
+			pthread_mutex_lock(&_cacheMutex);
+			_cache.Clear();
+			pthread_mutex_unlock(&_cacheMutex);
+			ResetStatistics();
 			UpdateCapacity();
+			_virtualNs = 0;
+			_currentCylinder = 0;
 			return true;
 		}
 		// TODO: if file is a nonstandard size?
@@ -61,8 +93,60 @@ bool mscp_drive_c::on_param_changed(parameter_c *param) {
 		use_image_size.value = use_image_size.new_value;
 		UpdateCapacity();
 		return true;
-	} 
-	return device_c::on_param_changed(param); // more actions (for enable)false;
+	} else if (&cache_blocks == param) {
+		pthread_mutex_lock(&_cacheMutex);
+		_cache.Resize(cache_blocks.new_value);
+		pthread_mutex_unlock(&_cacheMutex);
+		return true;
+	} else if (&write_back == param) {
+		if (!write_back.new_value) {
+			Flush();
+		}
+		return true;
+	} else if (&write_back_limit == param) {
+		pthread_mutex_lock(&_cacheMutex);
+		FlushAll();
+		ResizeWriteBack(write_back_limit.new_value);
+		pthread_mutex_unlock(&_cacheMutex);
+		return true;
+	} else if (&trace_filepath == param) {
+		pthread_mutex_lock(&_cacheMutex);
+		if (_traceFile) {
+			fclose(_traceFile);
+			_traceFile = nullptr;
+		}
+		if (!trace_filepath.new_value.empty()) {
+			_traceFile = fopen(trace_filepath.new_value.c_str(), "a");
+		}
+		pthread_mutex_unlock(&_cacheMutex);
+		if (!trace_filepath.new_value.empty() && !_traceFile) {
+			ERROR("Can not open trace file %s", trace_filepath.new_value.c_str());
+			return false;
+		}
+		return true;
+	} else if (&timing == param) {
+		if (timing.new_value > 2) {
+			ERROR("timing must be 0, 1 or 2");
+			return false;
+		}
+		// deterministic runs start with heads and platter at 0
+		pthread_mutex_lock(&_cacheMutex);
+		_virtualNs = 0;
+		_currentCylinder = 0;
+		pthread_mutex_unlock(&_cacheMutex);
+		return true;
+	} else if (&replay_filepath == param) {
+		// Not a setting but an action: clear, so the same file can be replayed again
+		if (!replay_filepath.new_value.empty()) {
+			Replay(replay_filepath.new_value.c_str());
+			replay_filepath.new_value.clear();
+		}
+		return true;
+	} else if (&enabled == param && !enabled.new_value) {
+		// flush worker is stopped
+		Flush();
+	}
+	return storagedrive_c::on_param_changed(param); // more actions (for enable)
 }
 
 //
@@ -85,7 +169,11 @@ uint32_t mscp_drive_c::GetBlockSize() {
 uint32_t mscp_drive_c::GetBlockCount() {
 	if (_useImageSize) {
 		// Return the image size / Block size (rounding down).
-		return file_size() / GetBlockSize();
+		// file_size() moves the file pointer, so exclude read-ahead
+		pthread_mutex_lock(&_cacheMutex);
+		uint64_t size = file_size();
+		pthread_mutex_unlock(&_cacheMutex);
+		return size / GetBlockSize();
 	} else {
 		//
 		// Use the size defined by the drive type.
@@ -190,6 +278,8 @@ void mscp_drive_c::SetOnline() {
 //  Takes the drive offline.
 //
 void mscp_drive_c::SetOffline() {
+	// unit goes away (AVAILABLE, INIT, power): make image complete
+	Flush();
 	_online = false;
 	type_name.readonly = false;
 	image_filepath.readonly = false;
@@ -198,24 +288,215 @@ void mscp_drive_c::SetOffline() {
 //
 // Writes the specified number of bytes from the provided buffer,
 // starting at the specified logical block.
+// In write-back mode the blocks are only staged, else they are written
+// to the image. Cached copies of the written blocks are updated.
 //
 void mscp_drive_c::Write(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer) {
-	file_write(buffer, blockNumber * GetBlockSize(), lengthInBytes);
+	uint32_t blockSize = GetBlockSize();
+	uint64_t startNs = _timingClock.elapsed_ns();
+	uint32_t firstBlock = blockNumber;
+
+	pthread_mutex_lock(&_cacheMutex);
+	if (_traceFile) {
+		fprintf(_traceFile, "W %u %u\n", blockNumber, (unsigned) lengthInBytes);
+		fflush(_traceFile);
+	}
+	if (!write_back.value || !StageWrite(blockNumber, lengthInBytes, buffer)) {
+		// older staged data must not overwrite this later
+		if (!_dirtyMap.empty()) {
+			FlushAll();
+		}
+		file_write(buffer, (uint64_t) blockNumber * blockSize, lengthInBytes);
+		for (size_t offset = 0; offset < lengthInBytes; offset += blockSize) {
+			if (lengthInBytes - offset >= blockSize) {
+				_cache.Update(blockNumber, buffer + offset);
+			} else {
+				// partial block: cached copy is stale
+				_cache.Invalidate(blockNumber);
+			}
+			blockNumber++;
+		}
+	}
+	pthread_mutex_unlock(&_cacheMutex);
+	TimingDelay(firstBlock, lengthInBytes, startNs);
 }
 
 //
 // Reads the specifed number of bytes starting at the specified logical
-// block.  Returns a pointer to a buffer containing the data read.
-// Caller is responsible for freeing this buffer.
+// block into the provided buffer, which must hold "lengthInBytes".
 //
-uint8_t* mscp_drive_c::Read(uint32_t blockNumber, size_t lengthInBytes) {
-	uint8_t* buffer = new uint8_t[lengthInBytes];
-
+void mscp_drive_c::Read(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer) {
 	assert(nullptr != buffer);
+	uint64_t startNs = _timingClock.elapsed_ns();
+
+	if (_traceFile) {
+		pthread_mutex_lock(&_cacheMutex);
+		if (_traceFile) {
+			fprintf(_traceFile, "R %u %u\n", blockNumber, (unsigned) lengthInBytes);
+			fflush(_traceFile);
+		}
+		pthread_mutex_unlock(&_cacheMutex);
+	}
+	ReadBlocks(blockNumber, lengthInBytes, buffer);
+	TimingDelay(blockNumber, lengthInBytes, startNs);
+}
+
+//
+// ServiceTime():
+//  Modeled time for a real drive to seek to "blockNumber" and transfer
+//  "blockCount" blocks, if the command starts at platter time "atNs".
+//  LBNs are mapped sector, then track, then cylinder.  Seek time grows
+//  with the square root of the distance, rotational latency is the wait
+//  for the first sector after the seek.  Moves the heads.
+//
+uint64_t mscp_drive_c::ServiceTime(uint32_t blockNumber, uint32_t blockCount, uint64_t atNs) {
+	uint64_t revolutionNs = 60 * BILLION / _geometry->RPM;
+	uint64_t sectorNs = revolutionNs / _geometry->Sectors;
+	uint32_t blocksPerCylinder = _geometry->Sectors * _geometry->Tracks;
+	uint32_t lastCylinder = _geometry->Cylinders - 1;
+	uint32_t cylinder = std::min(blockNumber / blocksPerCylinder, lastCylinder);
+	uint32_t endCylinder = std::min((blockNumber + blockCount - 1) / blocksPerCylinder,
+			lastCylinder);
+
+	uint64_t seekNs = 0;
+	uint32_t distance = abs((int32_t) cylinder - (int32_t) _currentCylinder);
+	if (distance > 0) {
+		double ratio = sqrt(3.0 * distance / _geometry->Cylinders);
+		seekNs = 1000
+				* (_geometry->SeekMinUs
+						+ (uint64_t) ((_geometry->SeekAvgUs - _geometry->SeekMinUs) * ratio));
+	}
+
+	uint64_t sectorStartNs = (blockNumber % _geometry->Sectors) * sectorNs;
+	uint64_t angleNs = (atNs + seekNs) % revolutionNs;
+	uint64_t latencyNs = (sectorStartNs + revolutionNs - angleNs) % revolutionNs;
+
+	// long transfers step to the next cylinder track-to-track
+	uint64_t transferNs = blockCount * sectorNs
+			+ (uint64_t) (endCylinder - cylinder) * _geometry->SeekMinUs * 1000;
+
+	_currentCylinder = endCylinder;
+	return seekNs + latencyNs + transferNs;
+}
+
+//
+// TimingDelay():
+//  Completes a Read() or Write() not before the modeled service time
+//  after "startNs".  The image file was accessed meanwhile, so only the
+//  rest of the modeled time is waited.
+//
+void mscp_drive_c::TimingDelay(uint32_t blockNumber, size_t lengthInBytes, uint64_t startNs) {
+	if (timing.value == 0 || _geometry == nullptr || lengthInBytes == 0) {
+		return;
+	}
+	uint32_t blockSize = GetBlockSize();
+	uint32_t blockCount = (lengthInBytes + blockSize - 1) / blockSize;
+	uint64_t delayNs;
 
-	file_read(buffer, blockNumber * GetBlockSize(), lengthInBytes);
+	pthread_mutex_lock(&_cacheMutex);
+	if (timing.value == 1) {
+		delayNs = ServiceTime(blockNumber, blockCount, _virtualNs);
+		_virtualNs += delayNs;
+	} else {
+		double speed = emulation_speed.value > 0 ? emulation_speed.value : 1;
+		delayNs = ServiceTime(blockNumber, blockCount, (uint64_t) (startNs * speed)) / speed;
+	}
+	pthread_mutex_unlock(&_cacheMutex);
 
-	return buffer;
+	uint64_t elapsedNs = _timingClock.elapsed_ns() - startNs;
+	if (delayNs > elapsedNs) {
+		timing_delay.value += (delayNs - elapsedNs) / 1000;
+		timeout_c::wait_ns(delayNs - elapsedNs);
+	}
+}
+
+//
+// ReadBlocks():
+//  Reads through the block cache: dirty and cached blocks are copied,
+//  runs of missing blocks are read from the image in one piece and entered
+//  into the cache.  A partial last block is read, but not cached.
+//  A read starting where the previous one ended is sequential and
+//  schedules read-ahead behind it.
+//
+void mscp_drive_c::ReadBlocks(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer) {
+	uint32_t blockSize = GetBlockSize();
+	uint32_t blockCount = (lengthInBytes + blockSize - 1) / blockSize;
+
+	pthread_mutex_lock(&_cacheMutex);
+	size_t offset = 0;
+	while (offset < lengthInBytes) {
+		uint32_t block = blockNumber + offset / blockSize;
+		size_t length = std::min((size_t) blockSize, lengthInBytes - offset);
+		auto dirty = _dirtyMap.find(block);
+		if (dirty != _dirtyMap.end()) {
+			memcpy(buffer + offset, &_dirtyData[(size_t) dirty->second * blockSize], length);
+			cache_hits.value++;
+			offset += length;
+			continue;
+		}
+		if (length == blockSize && _cache.Lookup(block, buffer + offset)) {
+			cache_hits.value++;
+			offset += blockSize;
+			continue;
+		}
+
+		// collect run of missing blocks
+		size_t runOffset = offset;
+		do {
+			offset = std::min(offset + blockSize, lengthInBytes);
+			cache_misses.value++;
+		} while (offset < lengthInBytes
+				&& !_cache.Contains(blockNumber + offset / blockSize)
+				&& !IsDirty(blockNumber + offset / blockSize));
+
+		file_read(buffer + runOffset, (uint64_t) blockNumber * blockSize + runOffset,
+				offset - runOffset);
+		for (size_t o = runOffset; o + blockSize <= offset; o += blockSize) {
+			_cache.Insert(blockNumber + o / blockSize, buffer + o);
+		}
+	}
+	pthread_mutex_unlock(&_cacheMutex);
+
+	bool sequential = (blockNumber == _lastReadEnd);
+	_lastReadEnd = blockNumber + blockCount;
+	if (sequential) {
+		ScheduleReadAhead(_lastReadEnd, readahead.value);
+	}
+}
+
+//
+// ScheduleReadAhead():
+//  Asks worker() to fetch "blockCount" blocks starting at "blockNumber"
+//  into the cache.  Called on each sequential read, so a new request is
+//  only made when reading has consumed half of the previous one: then the
+//  remainder is fetched in larger pieces.
+//  At most half of the cache is used for read-ahead.
+//
+void mscp_drive_c::ScheduleReadAhead(uint32_t blockNumber, uint32_t blockCount) {
+	blockCount = std::min(blockCount, _cache.GetCapacity() / 2);
+	uint32_t end = std::min(blockNumber + blockCount, GetBlockCount());
+	if (blockNumber >= end) {
+		return;
+	}
+
+	pthread_mutex_lock(&_readAheadMutex);
+	// is the end of the previous request ahead, but not too far away?
+	if (_readAheadEnd > blockNumber && _readAheadEnd <= blockNumber + blockCount) {
+		if (_readAheadEnd <= blockNumber + blockCount / 2) {
+			// continue behind previous request
+			if (_readAheadNext >= _readAheadEnd) {
+				_readAheadNext = _readAheadEnd;
+			}
+			_readAheadEnd = end;
+			pthread_cond_signal(&_readAheadCond);
+		}
+	} else {
+		// new sequential stream
+		_readAheadNext = blockNumber;
+		_readAheadEnd = end;
+		pthread_cond_signal(&_readAheadCond);
+	}
+	pthread_mutex_unlock(&_readAheadMutex);
 }
 
 //
@@ -232,20 +513,16 @@ void mscp_drive_c::WriteRCTBlock(uint32_t rctBlockNumber, uint8_t* buffer) {
 
 //
 // Reads a single block's worth of data from the RCT area (at the specified
-// block offset).  Returns a pointer to a buffer containing the data read.
-// Caller is responsible for freeing this buffer.
+// block offset) into the provided buffer.  Buffer must be at least as large
+// as the disk's block size.
 //
-uint8_t* mscp_drive_c::ReadRCTBlock(uint32_t rctBlockNumber) {
+void mscp_drive_c::ReadRCTBlock(uint32_t rctBlockNumber, uint8_t* buffer) {
 	assert(rctBlockNumber < GetRCTBlockCount());
-
-	uint8_t* buffer = new uint8_t[GetBlockSize()];
 	assert(nullptr != buffer);
 
 	memcpy(reinterpret_cast<void *>(buffer),
 			reinterpret_cast<void *>(_rctData.get() + rctBlockNumber * GetBlockSize()),
 			GetBlockSize());
-
-	return buffer;
 }
 
 //
@@ -288,6 +565,13 @@ bool mscp_drive_c::SetDriveType(const char* typeName) {
 	while (g_driveTable[index].BlockCount != 0) {
 		if (!strcasecmp(typeName, g_driveTable[index].TypeName)) {
 			_driveInfo = g_driveTable[index];
+			_geometry = nullptr;
+			for (int i = 0; g_driveGeometry[i].Sectors != 0; i++) {
+				if (!strcasecmp(typeName, g_driveGeometry[i].TypeName)) {
+					_geometry = &g_driveGeometry[i];
+				}
+			}
+			_currentCylinder = 0;
 			type_name.value = _driveInfo.TypeName;
 			UpdateCapacity();
 			UpdateMetadata();
@@ -325,3 +609,460 @@ void mscp_drive_c::on_init_changed(void) {
 	SetOffline();
 }
 
+//
+// worker():
+//  Instance 0 does read-ahead, instance 1 flushes write-back data.
+//  Both wait at most 50 ms, so workers_stop() finds them cooperative.
+//
+void mscp_drive_c::worker(unsigned instance) {
+	if (instance == 0) {
+		ReadAheadWorker();
+	} else {
+		FlushWorker();
+	}
+}
+
+//
+// ReadAheadWorker():
+//  Executes read-ahead requests from ScheduleReadAhead().
+//  The request is processed in chunks, so a newer request takes effect
+//  quickly and the MSCP server is never locked out of the image for long.
+//  Blocks already in the cache are not read again, dirty blocks are skipped.
+//
+void mscp_drive_c::ReadAheadWorker(void) {
+	uint32_t blockSize = GetBlockSize();
+	vector<uint8_t> chunk(MSCP_READAHEAD_CHUNK_BLOCKS * blockSize);
+
+	while (!workers_terminate) {
+		pthread_mutex_lock(&_readAheadMutex);
+		if (_readAheadNext >= _readAheadEnd) {
+			// wait for a request, check for termination regularly
+			struct timespec abstime;
+			timeout_c::deadline_ns(&abstime, 50 * MILLION);
+			pthread_cond_timedwait(&_readAheadCond, &_readAheadMutex, &abstime);
+		}
+		uint32_t blockNumber = _readAheadNext;
+		uint32_t blockCount = 0;
+		if (_readAheadNext < _readAheadEnd) {
+			blockCount = std::min(_readAheadEnd - _readAheadNext,
+					(uint32_t) MSCP_READAHEAD_CHUNK_BLOCKS);
+			_readAheadNext += blockCount;
+		}
+		pthread_mutex_unlock(&_readAheadMutex);
+
+		if (blockCount == 0) {
+			continue;
+		}
+
+		pthread_mutex_lock(&_cacheMutex);
+		// trim cached blocks at both ends, read the rest in one piece
+		while (blockCount > 0 && (_cache.Contains(blockNumber) || IsDirty(blockNumber))) {
+			blockNumber++;
+			blockCount--;
+		}
+		while (blockCount > 0
+				&& (_cache.Contains(blockNumber + blockCount - 1)
+						|| IsDirty(blockNumber + blockCount - 1))) {
+			blockCount--;
+		}
+		if (blockCount > 0 && file_is_open()) {
+			file_read(chunk.data(), (uint64_t) blockNumber * blockSize, blockCount * blockSize);
+			for (uint32_t i = 0; i < blockCount; i++) {
+				if (!_cache.Contains(blockNumber + i) && !IsDirty(blockNumber + i)) {
+					_cache.Insert(blockNumber + i, chunk.data() + i * blockSize);
+					readahead_blocks.value++;
+				}
+			}
+		}
+		pthread_mutex_unlock(&_cacheMutex);
+	}
+}
+
+//
+// FlushWorker():
+//  Writes dirty blocks to the image in the background: every
+//  MSCP_FLUSH_INTERVAL_TICKS, or early when half of write_back_limit
+//  is used.  The lock is released after each run, so the MSCP server
+//  is delayed by one file write at most.
+//
+void mscp_drive_c::FlushWorker(void) {
+	unsigned ticks = 0;
+
+	pthread_mutex_lock(&_cacheMutex);
+	while (!workers_terminate) {
+		struct timespec abstime;
+		timeout_c::deadline_ns(&abstime, 50 * MILLION);
+		bool signaled = (pthread_cond_timedwait(&_flushCond, &_cacheMutex, &abstime) == 0);
+		if (_dirtyMap.empty()) {
+			ticks = 0;
+			continue;
+		}
+		if (!signaled && ++ticks < MSCP_FLUSH_INTERVAL_TICKS) {
+			continue;
+		}
+		ticks = 0;
+
+		bool flushed = false;
+		while (!workers_terminate && FlushRun()) {
+			flushed = true;
+			pthread_mutex_unlock(&_cacheMutex);
+			pthread_mutex_lock(&_cacheMutex);
+		}
+		if (flushed && file_is_open()) {
+			file_flush();
+		}
+	}
+	pthread_mutex_unlock(&_cacheMutex);
+}
+
+//
+// IsDirty():
+//  Is the block staged by write-back and not yet written to the image?
+//  _cacheMutex must be held.
+//
+bool mscp_drive_c::IsDirty(uint32_t blockNumber) {
+	return _dirtyMap.count(blockNumber) != 0;
+}
+
+//
+// StageWrite():
+//  Write-back: copies the written blocks into dirty slots, a block
+//  written again reuses its slot.  A partial last block is merged
+//  with the current block content first.
+//  If staging would exceed write_back_limit, all dirty blocks are
+//  flushed before.  Returns false if the write is larger than the limit,
+//  caller must write through.
+//  _cacheMutex must be held.
+//
+bool mscp_drive_c::StageWrite(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer) {
+	uint32_t blockSize = GetBlockSize();
+	uint32_t blockCount = (lengthInBytes + blockSize - 1) / blockSize;
+
+	if (blockCount > _dirtyFreeSlots.size() + _dirtyMap.size()) {
+		return false;
+	}
+	if (blockCount > _dirtyFreeSlots.size()) {
+		// hard bound on unwritten data
+		FlushAll();
+	}
+
+	for (uint32_t i = 0; i < blockCount; i++) {
+		uint32_t block = blockNumber + i;
+		size_t offset = (size_t) i * blockSize;
+		size_t length = std::min((size_t) blockSize, lengthInBytes - offset);
+		uint8_t* data;
+
+		auto it = _dirtyMap.find(block);
+		if (it != _dirtyMap.end()) {
+			data = &_dirtyData[(size_t) it->second * blockSize];
+		} else {
+			uint32_t slot = _dirtyFreeSlots.back();
+			_dirtyFreeSlots.pop_back();
+			_dirtyMap[block] = slot;
+			data = &_dirtyData[(size_t) slot * blockSize];
+			if (length < blockSize && !_cache.Lookup(block, data)) {
+				file_read(data, (uint64_t) block * blockSize, blockSize);
+			}
+		}
+		memcpy(data, buffer + offset, length);
+		_cache.Update(block, data);
+	}
+
+	dirty_blocks.value = _dirtyMap.size();
+	if (_dirtyMap.size() >= write_back_limit.value / 2) {
+		pthread_cond_signal(&_flushCond);
+	}
+	return true;
+}
+
+//
+// FlushRun():
+//  Writes the dirty block with the lowest number and the adjacent ones
+//  following it with one file access, and frees their slots.
+//  Returns false if nothing was dirty.
+//  _cacheMutex must be held.
+//
+bool mscp_drive_c::FlushRun(void) {
+	uint32_t blockSize = GetBlockSize();
+
+	if (_dirtyMap.empty() || !file_is_open()) {
+		return false;
+	}
+
+	auto it = _dirtyMap.begin();
+	uint32_t blockNumber = it->first;
+	uint32_t blockCount = 0;
+	while (it != _dirtyMap.end() && it->first == blockNumber + blockCount
+			&& blockCount < MSCP_FLUSH_RUN_BLOCKS) {
+		memcpy(&_flushBuffer[(size_t) blockCount * blockSize],
+				&_dirtyData[(size_t) it->second * blockSize], blockSize);
+		_dirtyFreeSlots.push_back(it->second);
+		it = _dirtyMap.erase(it);
+		blockCount++;
+	}
+	file_write(_flushBuffer.data(), (uint64_t) blockNumber * blockSize,
+			blockCount * blockSize, /*flush*/false);
+
+	flush_writes.value++;
+	flushed_blocks.value += blockCount;
+	dirty_blocks.value = _dirtyMap.size();
+	return true;
+}
+
+//
+// FlushAll():
+//  Writes all dirty blocks to the image.
+//  _cacheMutex must be held.
+//
+void mscp_drive_c::FlushAll(void) {
+	bool flushed = false;
+	while (FlushRun()) {
+		flushed = true;
+	}
+	if (flushed) {
+		file_flush();
+	}
+}
+
+//
+// Flush():
+//  Writes all data staged by write-back to the image.
+//  Called when the unit goes offline and for the MSCP FLUSH command.
+//
+void mscp_drive_c::Flush(void) {
+	pthread_mutex_lock(&_cacheMutex);
+	FlushAll();
+	pthread_mutex_unlock(&_cacheMutex);
+}
+
+//
+// ResizeWriteBack():
+//  Allocates dirty block slots for "blockCount" blocks.
+//  Nothing may be dirty.
+//
+void mscp_drive_c::ResizeWriteBack(uint32_t blockCount) {
+	assert(_dirtyMap.empty());
+	_dirtyData.resize((size_t) blockCount * GetBlockSize());
+	_dirtyData.shrink_to_fit();
+	_dirtyFreeSlots.clear();
+	for (uint32_t slot = blockCount; slot > 0; slot--) {
+		_dirtyFreeSlots.push_back(slot - 1);
+	}
+}
+
+//
+// ResetStatistics():
+//  Clears the cache counters.
+//
+void mscp_drive_c::ResetStatistics(void) {
+	cache_hits.value = 0;
+	cache_misses.value = 0;
+	readahead_blocks.value = 0;
+	flushed_blocks.value = 0;
+	flush_writes.value = 0;
+	timing_delay.value = 0;
+}
+
+//
+// Replay():
+//  Benchmark for cache and read-ahead: executes the reads of a trace
+//  captured with the "trace" parameter against the image, as fast as
+//  possible and with a cold cache.  Trace lines are "R <lbn> <bytes>"
+//  or "W <lbn> <bytes>".  Writes are not executed to protect the image,
+//  only their blocks are dropped from the cache.
+//  Results are in replay_time and the cache statistics.
+//  The PDP-11 should not access the drive meanwhile.
+//
+bool mscp_drive_c::Replay(const char* traceFilePath) {
+	if (!file_is_open()) {
+		ERROR("Replay: no image file");
+		return false;
+	}
+	FILE* trace = fopen(traceFilePath, "r");
+	if (!trace) {
+		ERROR("Replay: can not open %s", traceFilePath);
+		return false;
+	}
+
+	pthread_mutex_lock(&_cacheMutex);
+	_cache.Clear();
+	pthread_mutex_unlock(&_cacheMutex);
+	ResetStatistics();
+	_lastReadEnd = 0;
+
+	vector<uint8_t> buffer;
+	unsigned commandCount = 0;
+	char op;
+	unsigned blockNumber, lengthInBytes;
+	timeout_c timer;
+	timer.start_ns(0);
+	while (fscanf(trace, " %c %u %u", &op, &blockNumber, &lengthInBytes) == 3) {
+		if (op == 'R') {
+			if (buffer.size() < lengthInBytes) {
+				buffer.resize(lengthInBytes);
+			}
+			ReadBlocks(blockNumber, lengthInBytes, buffer.data());
+		} else if (op == 'W') {
+			pthread_mutex_lock(&_cacheMutex);
+			for (unsigned i = 0; i * GetBlockSize() < lengthInBytes; i++) {
+				_cache.Invalidate(blockNumber + i);
+			}
+			pthread_mutex_unlock(&_cacheMutex);
+		}
+		commandCount++;
+	}
+	replay_time.value = timer.elapsed_us();
+	fclose(trace);
+
+	INFO("Replay of %u commands: %llu us, %u hits, %u misses, %u blocks read ahead",
+			commandCount, (unsigned long long) replay_time.value, cache_hits.value, cache_misses.value,
+			readahead_blocks.value);
+	return true;
+}
+
+//
+// mscp_block_cache_c:
+//  LRU block cache, see mscp_drive.hpp.
+//
+mscp_block_cache_c::mscp_block_cache_c(uint32_t blockSize) :
+		_blockSize(blockSize), _capacity(0), _used(0), _head(-1), _tail(-1) {
+}
+
+//
+// Resize():
+//  Sets the number of cached blocks, content is discarded.
+//
+void mscp_block_cache_c::Resize(uint32_t blockCount) {
+	_capacity = blockCount;
+	_entries.resize(blockCount);
+	_entries.shrink_to_fit();
+	_data.resize((size_t) blockCount * _blockSize);
+	_data.shrink_to_fit();
+	Clear();
+}
+
+//
+// Clear():
+//  Discards all cached blocks.
+//
+void mscp_block_cache_c::Clear(void) {
+	_map.clear();
+	_map.reserve(_capacity);
+	_used = 0;
+	_head = _tail = -1;
+}
+
+bool mscp_block_cache_c::Contains(uint32_t blockNumber) {
+	return _map.count(blockNumber) != 0;
+}
+
+//
+// Lookup():
+//  Copies a cached block into "buffer" and makes it most recently used.
+//  Returns false if the block is not cached.
+//
+bool mscp_block_cache_c::Lookup(uint32_t blockNumber, uint8_t* buffer) {
+	auto it = _map.find(blockNumber);
+	if (it == _map.end()) {
+		return false;
+	}
+	int32_t index = it->second;
+	memcpy(buffer, &_data[(size_t) index * _blockSize], _blockSize);
+	if (index != _head) {
+		Unlink(index);
+		LinkFront(index);
+	}
+	return true;
+}
+
+//
+// Insert():
+//  Enters a block as most recently used, the least recently used
+//  block is evicted if the cache is full.
+//
+void mscp_block_cache_c::Insert(uint32_t blockNumber, const uint8_t* buffer) {
+	if (_capacity == 0) {
+		return;
+	}
+	int32_t index;
+	auto it = _map.find(blockNumber);
+	if (it != _map.end()) {
+		index = it->second;
+		Unlink(index);
+	} else if (_used < _capacity) {
+		index = _used++;
+		_map[blockNumber] = index;
+	} else {
+		// evict
+		index = _tail;
+		Unlink(index);
+		_map.erase(_entries[index].BlockNumber);
+		_map[blockNumber] = index;
+	}
+	_entries[index].BlockNumber = blockNumber;
+	memcpy(&_data[(size_t) index * _blockSize], buffer, _blockSize);
+	LinkFront(index);
+}
+
+//
+// Update():
+//  Replaces the content of a block, if cached. LRU order is not changed.
+//
+void mscp_block_cache_c::Update(uint32_t blockNumber, const uint8_t* buffer) {
+	auto it = _map.find(blockNumber);
+	if (it != _map.end()) {
+		memcpy(&_data[(size_t) it->second * _blockSize], buffer, _blockSize);
+	}
+}
+
+//
+// Invalidate():
+//  Drops a block from the cache. Its entry becomes least recently used,
+//  so it is reused next.
+//
+void mscp_block_cache_c::Invalidate(uint32_t blockNumber) {
+	auto it = _map.find(blockNumber);
+	if (it == _map.end()) {
+		return;
+	}
+	int32_t index = it->second;
+	_map.erase(it);
+	Unlink(index);
+	// append at LRU end, marked unused by an impossible block number
+	_entries[index].BlockNumber = UINT32_MAX;
+	_entries[index].Prev = _tail;
+	_entries[index].Next = -1;
+	if (_tail >= 0) {
+		_entries[_tail].Next = index;
+	} else {
+		_head = index;
+	}
+	_tail = index;
+}
+
+void mscp_block_cache_c::Unlink(int32_t index) {
+	Entry& entry = _entries[index];
+	if (entry.Prev >= 0) {
+		_entries[entry.Prev].Next = entry.Next;
+	} else {
+		_head = entry.Next;
+	}
+	if (entry.Next >= 0) {
+		_entries[entry.Next].Prev = entry.Prev;
+	} else {
+		_tail = entry.Prev;
+	}
+}
+
+void mscp_block_cache_c::LinkFront(int32_t index) {
+	Entry& entry = _entries[index];
+	entry.Prev = -1;
+	entry.Next = _head;
+	if (_head >= 0) {
+		_entries[_head].Prev = index;
+	} else {
+		_tail = index;
+	}
+	_head = index;
+}
+
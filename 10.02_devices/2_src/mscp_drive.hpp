@@ -10,9 +10,70 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <stdio.h>
+#include <pthread.h>
 #include <memory>	// unique_ptr
+#include <vector>
+#include <unordered_map>
+#include <map>
 #include "parameter.hpp"
 #include "storagedrive.hpp"
+#include "timeout.hpp"
+
+// Default size of the block cache, in blocks (1 MB)
+#define MSCP_CACHE_DEFAULT_BLOCKS 2048
+// Default read-ahead after sequential access, in blocks
+#define MSCP_READAHEAD_DEFAULT_BLOCKS 32
+// Blocks read by the read-ahead worker per file access
+#define MSCP_READAHEAD_CHUNK_BLOCKS 8
+// Default bound of unwritten data in write-back mode, in blocks (512 KB)
+#define MSCP_WRITEBACK_DEFAULT_BLOCKS 1024
+// Max adjacent dirty blocks written with one file access
+#define MSCP_FLUSH_RUN_BLOCKS 128
+// Interval of background flush, in 50 ms worker ticks
+#define MSCP_FLUSH_INTERVAL_TICKS 5
+
+/*
+  LRU cache of disk blocks.
+  All entries and data are allocated in one piece by Resize(), lookup is
+  by hash, the LRU order is kept in a doubly linked list of entry indices.
+  No locking, the owning drive serializes all access.
+*/
+class mscp_block_cache_c
+{
+public:
+	mscp_block_cache_c(uint32_t blockSize);
+
+	void Resize(uint32_t blockCount);
+	void Clear(void);
+	uint32_t GetCapacity(void) { return _capacity; }
+
+	bool Contains(uint32_t blockNumber);
+	bool Lookup(uint32_t blockNumber, uint8_t* buffer);
+	void Insert(uint32_t blockNumber, const uint8_t* buffer);
+	void Update(uint32_t blockNumber, const uint8_t* buffer);
+	void Invalidate(uint32_t blockNumber);
+
+private:
+	struct Entry
+	{
+		uint32_t BlockNumber;
+		int32_t Prev;   // towards most recently used
+		int32_t Next;   // towards least recently used
+	};
+
+	void Unlink(int32_t index);
+	void LinkFront(int32_t index);
+
+	uint32_t _blockSize;
+	uint32_t _capacity;
+	uint32_t _used;
+	std::vector<Entry> _entries;
+	std::vector<uint8_t> _data;
+	std::unordered_map<uint32_t, int32_t> _map;
+	int32_t _head;  // most recently used
+	int32_t _tail;  // least recently used
+};
 
 //
 // Implements the backing store for MSCP disk images
@@ -37,22 +98,62 @@ public:
 	void SetOnline(void);
 	void SetOffline(void);bool IsOnline(void);bool IsAvailable(void);
 
+	void Flush(void);
+
 	void Write(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer);
 
-	uint8_t* Read(uint32_t blockNumber, size_t lengthInBytes);
+	void Read(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer);
 
 	void WriteRCTBlock(uint32_t rctBlockNumber, uint8_t* buffer);
 
-	uint8_t* ReadRCTBlock(uint32_t rctBlockNumber);
+	void ReadRCTBlock(uint32_t rctBlockNumber, uint8_t* buffer);
 
 public:
 	void on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) override;
 	void on_init_changed(void) override;
 
+	void worker(unsigned instance) override;
+
 public:
 	parameter_bool_c use_image_size = parameter_bool_c(this, "useimagesize", "uis", false,
 			"Determine unit size from image file instead of drive type");
 
+	parameter_unsigned_c cache_blocks = parameter_unsigned_c(this, "cache_blocks", "cb", /*readonly*/
+	false, "blocks", "%u", "Size of block cache, 0 = off.", 20, 10);
+	parameter_unsigned_c readahead = parameter_unsigned_c(this, "readahead", "ra", /*readonly*/
+	false, "blocks", "%u", "Blocks read ahead on sequential access, 0 = off.", 16, 10);
+	parameter_unsigned_c cache_hits = parameter_unsigned_c(this, "cache_hits", "ch", /*readonly*/
+	true, "blocks", "%u", "Blocks read from cache.", 32, 10);
+	parameter_unsigned_c cache_misses = parameter_unsigned_c(this, "cache_misses", "cm", /*readonly*/
+	true, "blocks", "%u", "Blocks read from image file.", 32, 10);
+	parameter_unsigned_c readahead_blocks = parameter_unsigned_c(this, "readahead_blocks", "rab", /*readonly*/
+	true, "blocks", "%u", "Blocks fetched into cache by read-ahead.", 32, 10);
+
+	parameter_bool_c write_back = parameter_bool_c(this, "write_back", "wb", /*readonly*/
+	false, "Delay writes to image, flush in background and on unit offline, INIT, power.");
+	parameter_unsigned_c write_back_limit = parameter_unsigned_c(this, "write_back_limit", "wbl", /*readonly*/
+	false, "blocks", "%u", "Max unwritten data in write-back mode.", 20, 10);
+	parameter_unsigned_c dirty_blocks = parameter_unsigned_c(this, "dirty_blocks", "db", /*readonly*/
+	true, "blocks", "%u", "Blocks not yet written to image.", 32, 10);
+	parameter_unsigned_c flushed_blocks = parameter_unsigned_c(this, "flushed_blocks", "fb", /*readonly*/
+	true, "blocks", "%u", "Blocks written to image by write-back.", 32, 10);
+	parameter_unsigned_c flush_writes = parameter_unsigned_c(this, "flush_writes", "fw", /*readonly*/
+	true, "", "%u", "Image file writes by write-back, after coalescing.", 32, 10);
+
+	// capture and replay of the block access stream, see Replay()
+	parameter_string_c trace_filepath = parameter_string_c(this, "trace", "tr", /*readonly*/
+	false, "Append all reads and writes to this file");
+	parameter_string_c replay_filepath = parameter_string_c(this, "replay", "rp", /*readonly*/
+	false, "Replay reads of a trace file against the image");
+	parameter_unsigned64_c replay_time = parameter_unsigned64_c(this, "replay_time", "rpt", /*readonly*/
+	true, "us", "%llu", "Duration of last replay.", 64, 10);
+
+	// mechanical delays, see ServiceTime()
+	parameter_unsigned_c timing = parameter_unsigned_c(this, "timing", "tim", /*readonly*/
+	false, "", "%u", "Seek and rotation delays: 0 = off, 1 = deterministic, 2 = real time / emulation_speed.", 2, 10);
+	parameter_unsigned64_c timing_delay = parameter_unsigned64_c(this, "timing_delay", "tid", /*readonly*/
+	true, "us", "%llu", "Sum of modeled delays not covered by image file access.", 64, 10);
+
 private:
 
 	struct DriveInfo {
@@ -87,7 +188,59 @@ private:
 					949, false, false }, { "RA73", 3920490, 0x25641049, 47, 198, false, false },
 			{ "", 0, 0, 0, 0, false, false } };
 
+	//
+	// Geometry and mechanics for the timing model.
+	// Sectors * Tracks * Cylinders cover the drive's LBNs, RCT and
+	// replacement blocks are ignored.  Seek times from DEC data sheets.
+	//
+	struct DriveGeometry {
+		char TypeName[16];
+		uint16_t Sectors;	// per track
+		uint16_t Tracks;	// per cylinder
+		uint16_t Cylinders;
+		uint16_t RPM;
+		uint32_t SeekMinUs;	// track to track
+		uint32_t SeekAvgUs;	// over 1/3 of all cylinders
+	};
+
+	DriveGeometry g_driveGeometry[21] {
+//    Name      Sect Trk  Cyl   RPM   SeekMin SeekAvg
+		{ "RX50",  10,  1,   80,  300,   6000, 160000 },
+		{ "RX33",  15,  2,   80,  360,   3000,  91000 },
+		{ "RD51",  18,  4,  306, 3600,   3000,  85000 },
+		{ "RD31",  17,  4,  615, 3600,   8000,  48000 },
+		{ "RC25",  31,  2,  821, 2850,   6000,  35000 },
+		{ "RC25F", 31,  2,  821, 2850,   6000,  35000 },
+		{ "RD52",  17,  8,  512, 3600,   5000,  35000 },
+		{ "RD32",  17,  6,  820, 3600,   8000,  48000 },
+		{ "RD53",  17,  8, 1024, 3600,   5000,  30000 },
+		{ "RA80",  31, 14,  546, 3600,   6000,  25000 },
+		{ "RD54",  17, 15, 1225, 3600,   5000,  38000 },
+		{ "RA60",  42,  6, 1600, 3600,   6000,  41700 },
+		{ "RA70",  33, 11, 1507, 4000,   3000,  19500 },
+		{ "RA81",  51, 14, 1248, 3600,   7000,  28000 },
+		{ "RA82",  57, 15, 1423, 3600,   6000,  24000 },
+		{ "RA71",  51, 14, 1915, 3600,   4000,  24000 },
+		{ "RA72",  51, 20, 1915, 3600,   4000,  24000 },
+		{ "RA90",  69, 13, 2649, 3600,   4000,  18500 },
+		{ "RA92",  73, 13, 3099, 3600,   4000,  16000 },
+		{ "RA73",  70, 21, 2667, 3600,   3000,  12800 },
+		{ "", 0, 0, 0, 0, 0, 0 } };
+
 	bool SetDriveType(const char* typeName);
+	uint64_t ServiceTime(uint32_t blockNumber, uint32_t blockCount, uint64_t atNs);
+	void TimingDelay(uint32_t blockNumber, size_t lengthInBytes, uint64_t startNs);
+	void ResetStatistics(void);
+	void ReadBlocks(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer);
+	void ScheduleReadAhead(uint32_t blockNumber, uint32_t blockCount);
+	void ReadAheadWorker(void);
+	void FlushWorker(void);
+	bool IsDirty(uint32_t blockNumber);
+	bool StageWrite(uint32_t blockNumber, size_t lengthInBytes, uint8_t* buffer);
+	bool FlushRun(void);
+	void FlushAll(void);
+	void ResizeWriteBack(uint32_t blockCount);
+	bool Replay(const char* traceFilePath);
 	void UpdateCapacity(void);
 	void UpdateMetadata(void);
 	DriveInfo _driveInfo;bool _online;
@@ -104,4 +257,46 @@ private:
 	// This data is not persisted to disk as it is unnecessary.
 	//
 	unique_ptr<uint8_t> _rctData;
+
+	//
+	// Block cache and read-ahead:
+	// _cacheMutex serializes all image file access and the cache, so a
+	// block fetched by read-ahead can never overwrite newer written data.
+	// Read-ahead requests are handed to worker() as the block range
+	// [_readAheadNext, _readAheadEnd), a newer request replaces an older one.
+	//
+	mscp_block_cache_c _cache;
+	pthread_mutex_t _cacheMutex;
+	pthread_mutex_t _readAheadMutex;
+	pthread_cond_t _readAheadCond;
+	uint32_t _readAheadNext;
+	uint32_t _readAheadEnd;
+	uint32_t _lastReadEnd;	// block after the last read, for sequential detection
+
+	//
+	// Write-back:
+	// Dirty blocks are kept in slots of _dirtyData, indexed by block number.
+	// They are newer than cache and image, reads check them first.
+	// Flushing writes them in ascending block order, adjacent blocks coalesced.
+	// Protected by _cacheMutex, _flushCond wakes the flush worker early.
+	//
+	std::map<uint32_t, uint32_t> _dirtyMap;	// block number -> slot
+	std::vector<uint8_t> _dirtyData;
+	std::vector<uint32_t> _dirtyFreeSlots;
+	std::vector<uint8_t> _flushBuffer;
+	pthread_cond_t _flushCond;
+
+	FILE* _traceFile;
+
+	//
+	// Timing model:
+	// Platter position follows _timingClock in real time mode, or
+	// _virtualNs in deterministic mode.  _virtualNs advances only by
+	// modeled service times, so the same command sequence gives the
+	// same delays on every run.  Protected by _cacheMutex.
+	//
+	const DriveGeometry* _geometry;
+	timeout_c _timingClock;
+	uint64_t _virtualNs;
+	uint32_t _currentCylinder;
 };
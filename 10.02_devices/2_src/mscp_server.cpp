@@ -198,12 +198,10 @@ mscp_server::Poll(void)
         //
         // Read all commands from the ring into a queue; then execute them.
         //
-        std::queue<shared_ptr<Message>> messages;
-
         int msgCount = 0;
         while (!_abort_polling && _pollState != PollingState::InitRestart)
         {
-            shared_ptr<Message> message(_port->GetNextCommand());
+            Message* message = _port->GetNextCommand();
             if (nullptr == message)
             {
                 DEBUG("End of command ring; %d messages to be executed.", msgCount);
@@ -211,16 +209,16 @@ mscp_server::Poll(void)
             }
 
             msgCount++;
-            messages.push(message);
+            _messages.push(message);
         } 
 
         //
         // Pull commands from the queue until it is empty or we're told to quit.
         //
-        while(!messages.empty() && !_abort_polling && _pollState != PollingState::InitRestart)
+        while(!_messages.empty() && !_abort_polling && _pollState != PollingState::InitRestart)
         {
-            shared_ptr<Message> message(messages.front());  
-            messages.pop();
+            Message* message = _messages.front();  
+            _messages.pop();
 
             //
             // Handle the message.  We dispatch on opcodes to the
@@ -269,6 +267,10 @@ mscp_server::Poll(void)
                     cmdStatus = Erase(message, header->UnitNumber, modifiers);
                     break;
 
+                case Opcodes::FLUSH:
+                    cmdStatus = Flush(header->UnitNumber);
+                    break;
+
                 case Opcodes::GET_COMMAND_STATUS:
                     cmdStatus = GetCommandStatus(message);
                     break;
@@ -350,16 +352,26 @@ mscp_server::Poll(void)
             // Post the response to the port's response ring.
             // If everything is working properly, there should always be room.
             //
-            if(!_port->PostResponse(message.get()))
+            if(!_port->PostResponse(message))
             {
                 FATAL("Unexpected: no room in response ring.");
             }
 
+            _port->ReleaseCommand(message);
+            _port->UpdateStatistics();
+
             //
             // Go around and pick up the next one.
             //
         }
 
+        // Discard commands not executed due to reset or abort.
+        while (!_messages.empty())
+        {
+            _port->ReleaseCommand(_messages.front());
+            _messages.pop();
+        }
+
         //
         // Go back to sleep.  If a UDA reset is pending, we need to signal
         // the Reset() call so it knows we've completed our poll and are
@@ -434,9 +446,35 @@ mscp_server::Available(
     return STATUS(Status::SUCCESS, 0x40, 0);  // still connected    
 }
 
+uint32_t
+mscp_server::Flush(
+    uint16_t unitNumber)
+{
+    // Message has no message-specific data.
+    // Writes data delayed by the drive's write-back mode to the image.
+    DEBUG("MSCP FLUSH");
+
+    mscp_drive_c* drive = GetDrive(unitNumber);
+
+    if (nullptr == drive ||
+        !drive->IsAvailable())
+    {
+        return STATUS(Status::UNIT_OFFLINE, UnitOfflineSubcodes::UNIT_UNKNOWN, 0);
+    }
+
+    if (!drive->IsOnline())
+    {
+        return STATUS(Status::UNIT_AVAILABLE, 0, 0);
+    }
+
+    drive->Flush();
+
+    return STATUS(Status::SUCCESS, 0, 0);
+}
+
 uint32_t
 mscp_server::Access(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber)
 {
     INFO("MSCP ACCESS");
@@ -450,7 +488,7 @@ mscp_server::Access(
 
 uint32_t
 mscp_server::CompareHostData(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber)
 {
     INFO("MSCP COMPARE HOST DATA");
@@ -485,7 +523,7 @@ mscp_server::DetermineAccessPaths(
 
 uint32_t
 mscp_server::Erase(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -498,7 +536,7 @@ mscp_server::Erase(
 
 uint32_t
 mscp_server::GetCommandStatus(
-    shared_ptr<Message> message)
+    Message* message)
 {
     INFO("MSCP GET COMMAND STATUS");
 
@@ -528,7 +566,7 @@ mscp_server::GetCommandStatus(
 
 uint32_t
 mscp_server::GetUnitStatus(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -633,7 +671,7 @@ mscp_server::GetUnitStatus(
 
 uint32_t
 mscp_server::Online(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -665,7 +703,7 @@ mscp_server::Online(
 
 uint32_t
 mscp_server::Replace(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber)
 {
     INFO("MSCP REPLACE");
@@ -690,7 +728,7 @@ mscp_server::Replace(
 
 uint32_t
 mscp_server::SetControllerCharacteristics(
-    shared_ptr<Message> message)
+    Message* message)
 {
     #pragma pack(push,1)
     struct SetControllerCharacteristicsParameters
@@ -753,7 +791,7 @@ mscp_server::SetControllerCharacteristics(
 
 uint32_t
 mscp_server::SetUnitCharacteristics(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -780,7 +818,7 @@ mscp_server::SetUnitCharacteristics(
 
 uint32_t
 mscp_server::Read(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -793,7 +831,7 @@ mscp_server::Read(
 
 uint32_t
 mscp_server::Write(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -810,7 +848,7 @@ mscp_server::Write(
 //
 uint32_t
 mscp_server::SetUnitCharacteristicsInternal(
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers,
     bool bringOnline)
@@ -881,7 +919,7 @@ mscp_server::SetUnitCharacteristicsInternal(
 uint32_t
 mscp_server::DoDiskTransfer(
     uint16_t operation,
-    shared_ptr<Message> message,
+    Message* message,
     uint16_t unitNumber,
     uint16_t modifiers)
 {
@@ -962,21 +1000,23 @@ mscp_server::DoDiskTransfer(
         case Opcodes::COMPARE_HOST_DATA:
         {
             // Read the data in from disk, read the data in from memory, and compare.
-            unique_ptr<uint8_t> diskBuffer;
+            uda_pooled_buffer_c diskBuffer(_port->buffer_pool, params->ByteCount);
 
             if (rctAccess)
             {
-                diskBuffer.reset(drive->ReadRCTBlock(rctBlockNumber));
+                drive->ReadRCTBlock(rctBlockNumber, diskBuffer.get());
             }
             else
             {
-                diskBuffer.reset(drive->Read(params->LBN, params->ByteCount));
+                drive->Read(params->LBN, params->ByteCount, diskBuffer.get());
             }
 
-            unique_ptr<uint8_t> memBuffer(_port->DMARead(
+            uda_pooled_buffer_c memBuffer(_port->buffer_pool, params->ByteCount);
+            _port->DMARead(
                 params->BufferPhysicalAddress & 0x00ffffff,
                 params->ByteCount,
-                params->ByteCount));
+                params->ByteCount,
+                memBuffer.get());
   
             if (!memcmp(diskBuffer.get(), memBuffer.get(), params->ByteCount))
             {
@@ -987,7 +1027,7 @@ mscp_server::DoDiskTransfer(
  
         case Opcodes::ERASE:
         {
-            unique_ptr<uint8_t> memBuffer(new uint8_t[params->ByteCount]);
+            uda_pooled_buffer_c memBuffer(_port->buffer_pool, params->ByteCount);
             memset(reinterpret_cast<void*>(memBuffer.get()), 0, params->ByteCount);
 
             if (rctAccess)
@@ -1006,15 +1046,15 @@ mscp_server::DoDiskTransfer(
 
         case Opcodes::READ:
         {
-            unique_ptr<uint8_t> diskBuffer;
+            uda_pooled_buffer_c diskBuffer(_port->buffer_pool, params->ByteCount);
         
             if (rctAccess)
             {
-                diskBuffer.reset(drive->ReadRCTBlock(rctBlockNumber));
+                drive->ReadRCTBlock(rctBlockNumber, diskBuffer.get());
             }
             else
             { 
-                diskBuffer.reset(drive->Read(params->LBN, params->ByteCount));
+                drive->Read(params->LBN, params->ByteCount, diskBuffer.get());
             }
 
             _port->DMAWrite(
@@ -1027,10 +1067,12 @@ mscp_server::DoDiskTransfer(
 
         case Opcodes::WRITE:
         {
-            unique_ptr<uint8_t> memBuffer(_port->DMARead(
+            uda_pooled_buffer_c memBuffer(_port->buffer_pool, params->ByteCount);
+            _port->DMARead(
                 params->BufferPhysicalAddress & 0x00ffffff,
                 params->ByteCount,
-                params->ByteCount));
+                params->ByteCount,
+                memBuffer.get());
  
             if (rctAccess)
             {
@@ -1067,7 +1109,7 @@ mscp_server::DoDiskTransfer(
 //
 uint8_t*
 mscp_server::GetParameterPointer(
-    shared_ptr<Message> message)
+    Message* message)
 {
     // We silence a strict aliasing warning here; this is safe (if perhaps not recommended
     // the general case.)
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include <queue>
 
 class uda_c;
 class Message;
@@ -74,6 +75,7 @@ enum Opcodes
     COMPARE_HOST_DATA = 0x20,
     DETERMINE_ACCESS_PATHS = 0x0b,
     ERASE = 0x12,
+    FLUSH = 0x13,
     GET_COMMAND_STATUS = 0x2,
     GET_UNIT_STATUS = 0x3,
     ONLINE = 0x9,
@@ -159,27 +161,28 @@ public:
 
 private:
     uint32_t Abort(void);
-    uint32_t Access(std::shared_ptr<Message> message, uint16_t unitNumber);
+    uint32_t Access(Message* message, uint16_t unitNumber);
     uint32_t Available(uint16_t unitNumber, uint16_t modifiers);
-    uint32_t CompareHostData(std::shared_ptr<Message> message, uint16_t unitNumber);
+    uint32_t CompareHostData(Message* message, uint16_t unitNumber);
     uint32_t DetermineAccessPaths(uint16_t unitNumber);
-    uint32_t Erase(std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
-    uint32_t GetCommandStatus(std::shared_ptr<Message> message);
-    uint32_t GetUnitStatus(std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
-    uint32_t Online(std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
-    uint32_t SetControllerCharacteristics(std::shared_ptr<Message> message);
-    uint32_t SetUnitCharacteristics(std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
-    uint32_t Read(std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
-    uint32_t Replace(std::shared_ptr<Message> message, uint16_t unitNumber);
-    uint32_t Write(std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
+    uint32_t Erase(Message* message, uint16_t unitNumber, uint16_t modifiers);
+    uint32_t Flush(uint16_t unitNumber);
+    uint32_t GetCommandStatus(Message* message);
+    uint32_t GetUnitStatus(Message* message, uint16_t unitNumber, uint16_t modifiers);
+    uint32_t Online(Message* message, uint16_t unitNumber, uint16_t modifiers);
+    uint32_t SetControllerCharacteristics(Message* message);
+    uint32_t SetUnitCharacteristics(Message* message, uint16_t unitNumber, uint16_t modifiers);
+    uint32_t Read(Message* message, uint16_t unitNumber, uint16_t modifiers);
+    uint32_t Replace(Message* message, uint16_t unitNumber);
+    uint32_t Write(Message* message, uint16_t unitNumber, uint16_t modifiers);
 
     uint32_t SetUnitCharacteristicsInternal(
-        std::shared_ptr<Message> message,
+        Message* message,
         uint16_t unitNumber,
         uint16_t modifiers,
         bool bringOnline);
-    uint32_t DoDiskTransfer(uint16_t operation, std::shared_ptr<Message> message, uint16_t unitNumber, uint16_t modifiers);
-    uint8_t* GetParameterPointer(std::shared_ptr<Message> message);
+    uint32_t DoDiskTransfer(uint16_t operation, Message* message, uint16_t unitNumber, uint16_t modifiers);
+    uint8_t* GetParameterPointer(Message* message);
     mscp_drive_c* GetDrive(uint32_t unitNumber);
 
 private:
@@ -204,6 +207,10 @@ private:
     bool _abort_polling;
     PollingState _pollState;
 
+    // Commands read from the ring, waiting for execution.
+    // Member, so the queue's storage is reused across polls.
+    std::queue<Message*> _messages;
+
     pthread_t polling_pthread;
     pthread_cond_t polling_cond;
     pthread_mutex_t polling_mutex;
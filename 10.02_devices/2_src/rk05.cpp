@@ -16,10 +16,17 @@ using namespace std;
 #include "rk11.hpp"
 #include "rk05.hpp"
 
+// RK05 mechanics, from the RK05 maintenance manual:
+// 1500 rpm, 12 sectors per track: 3.33 ms per sector.
+// Seek: 10 ms to next cylinder, 85 ms across all 200 cylinders.
+#define RK05_RPM	1500
+#define RK05_SEEK_MIN_US	10000
+#define RK05_SEEK_PER_CYLINDER_US	375
+
 rk05_c::rk05_c(storagecontroller_c *controller) :
 		storagedrive_c(controller), _current_cylinder(0), _seek_count(0), _sectorCount(0), _wps(
 		false), _rwsrdy(true), _dry(false), _sok(false), _sin(false), _dru(false), _rk05(
-		true), _dpl(false), _scp(false) {
+		true), _dpl(false), _scp(false), _track_cache(this) {
 	name.value = "RK05";
 	type_name.value = "RK05";
 	log_label = "RK05";
@@ -27,6 +34,14 @@ rk05_c::rk05_c(storagecontroller_c *controller) :
 	_geometry.Heads = 2;
 	_geometry.Sectors = 12;
 	_geometry.Sector_Size_Bytes = 512;
+
+	instant.value = false;
+	_rotation_clock.start_ns(0); // free running platter
+	_seek_end_ns = 0;
+
+	track_cache_tracks.value = 0; // off, image always up to date
+	_track_cache.configure(_geometry.Sectors, _geometry.Sector_Size_Bytes,
+			track_cache_tracks.value);
 }
 
 //
@@ -34,6 +49,8 @@ rk05_c::rk05_c(storagecontroller_c *controller) :
 //
 
 uint32_t rk05_c::get_sector_counter(void) {
+	if (!instant.value && file_is_open())
+		_sectorCount = sector_under_heads(_rotation_clock.elapsed_ns());
 	return _sectorCount;
 }
 
@@ -80,8 +97,15 @@ bool rk05_c::on_param_changed(parameter_c *param) {
 		if (!enabled.new_value) {
 			// disable switches power OFF.
 			drive_reset();
+			_track_cache.invalidate();
 		}
+	} else if (&track_cache_tracks == param) {
+		_track_cache.configure(_geometry.Sectors, _geometry.Sector_Size_Bytes,
+				track_cache_tracks.new_value);
+		update_track_cache_statistics();
 	} else if (&image_filepath == param) {
+		// buffered tracks belong to old image
+		_track_cache.invalidate();
 		if (file_open(image_filepath.new_value, true)) {
 			_dry = true;
 			controller->on_drive_status_changed(this);
@@ -92,6 +116,24 @@ bool rk05_c::on_param_changed(parameter_c *param) {
 	return storagedrive_c::on_param_changed(param); // more actions (for enable)
 }
 
+// dirty tracks into image, before close
+void rk05_c::file_flush_buffers(void) {
+	_track_cache.flush();
+	update_track_cache_statistics();
+}
+
+//
+// update_track_cache_statistics():
+//  Copy counters of track buffer to parameters.
+//
+void rk05_c::update_track_cache_statistics(void) {
+	cache_hits.value = _track_cache.hits;
+	cache_misses.value = _track_cache.misses;
+	uint64_t accesses = _track_cache.hits + _track_cache.misses;
+	cache_hit_rate.value = accesses ? (100 * _track_cache.hits) / accesses : 0;
+	cache_flushes.value = _track_cache.flushes;
+}
+
 //
 // Reset / Power handlers
 //
@@ -124,8 +166,6 @@ void rk05_c::read_sector(uint32_t cylinder, uint32_t surface, uint32_t sector,
 	assert(surface < _geometry.Heads);
 	assert(sector < _geometry.Sectors);
 
-	_current_cylinder = cylinder;
-
 // SCP is cleared at the start of any function.
 	_scp = false;
 
@@ -135,15 +175,18 @@ void rk05_c::read_sector(uint32_t cylinder, uint32_t surface, uint32_t sector,
 	_rwsrdy = false;
 	controller->on_drive_status_changed(this);
 
-	timeout_c delay;
-
-// Delay for seek / read.
-// TODO: maybe base this on real drive specs.
-	delay.wait_ms(10);
+// Delay for implied seek, rotation and transfer.
+	mechanical_delay(cylinder, sector);
+	_current_cylinder = cylinder;
 
 // Read the sector into the buffer passed to us.
-	file_read(reinterpret_cast<uint8_t*>(out_buffer),
-			get_disk_byte_offset(cylinder, surface, sector), _geometry.Sector_Size_Bytes);
+	if (_track_cache.enabled()) {
+		_track_cache.read_sector(cylinder * _geometry.Heads + surface, sector,
+				reinterpret_cast<uint8_t*>(out_buffer));
+		update_track_cache_statistics();
+	} else
+		file_read(reinterpret_cast<uint8_t*>(out_buffer),
+				get_disk_byte_offset(cylinder, surface, sector), _geometry.Sector_Size_Bytes);
 
 // Set RWS ready now that we're done.
 	_rwsrdy = true;
@@ -157,8 +200,6 @@ void rk05_c::write_sector(uint32_t cylinder, uint32_t surface, uint32_t sector,
 	assert(surface < _geometry.Heads);
 	assert(sector < _geometry.Sectors);
 
-	_current_cylinder = cylinder;
-
 // SCP is cleared at the start of any function.
 	_scp = false;
 
@@ -168,15 +209,18 @@ void rk05_c::write_sector(uint32_t cylinder, uint32_t surface, uint32_t sector,
 	_rwsrdy = false;
 	controller->on_drive_status_changed(this);
 
-	timeout_c delay;
-
-// Delay for seek / read.
-// TODO: maybe base this on real drive specs.
-	delay.wait_ms(10);
+// Delay for implied seek, rotation and transfer.
+	mechanical_delay(cylinder, sector);
+	_current_cylinder = cylinder;
 
-// Read the sector into the buffer passed to us.
-	file_write(reinterpret_cast<uint8_t*>(in_buffer),
-			get_disk_byte_offset(cylinder, surface, sector), _geometry.Sector_Size_Bytes);
+// Write the buffer passed to us into the sector.
+	if (_track_cache.enabled()) {
+		_track_cache.write_sector(cylinder * _geometry.Heads + surface, sector,
+				reinterpret_cast<uint8_t*>(in_buffer));
+		update_track_cache_statistics();
+	} else
+		file_write(reinterpret_cast<uint8_t*>(in_buffer),
+				get_disk_byte_offset(cylinder, surface, sector), _geometry.Sector_Size_Bytes);
 
 // Set RWS ready now that we're done.
 	_rwsrdy = true;
@@ -188,8 +232,13 @@ void rk05_c::seek(uint32_t cylinder) {
 	assert(cylinder < _geometry.Cylinders);
 
 	_seek_count = abs((int32_t) _current_cylinder - (int32_t) cylinder) + 1;
+	_seek_end_ns = _rotation_clock.elapsed_ns() + seek_time_ns(_seek_count - 1);
 	_current_cylinder = cylinder;
 
+	// Changed sectors to image while heads move.
+	_track_cache.flush();
+	update_track_cache_statistics();
+
 	if (_seek_count > 0) {
 		// We'll be busy for awhile:
 		_rwsrdy = false;
@@ -199,6 +248,10 @@ void rk05_c::seek(uint32_t cylinder) {
 		_scp = true;
 	}
 	controller->on_drive_status_changed(this);
+
+	pthread_mutex_lock(&_seek_mutex);
+	pthread_cond_signal(&_seek_cond);
+	pthread_mutex_unlock(&_seek_mutex);
 }
 
 void rk05_c::set_write_protect(bool protect) {
@@ -226,34 +279,52 @@ void rk05_c::drive_reset(void) {
 // SCP change will be posted when the seek instigated above is completed.
 }
 
+//
+// Sleep until seek() is called or max_ns passed.
+// _seek_count is checked under the mutex, so a seek() racing
+// with the wait is not lost.
+//
+void rk05_c::wait_seek_event(uint64_t max_ns) {
+	struct timespec abstime;
+	timeout_c::deadline_ns(&abstime, max_ns);
+	pthread_mutex_lock(&_seek_mutex);
+	if (_seek_count == 0)
+		pthread_cond_timedwait(&_seek_cond, &_seek_mutex, &abstime);
+	pthread_mutex_unlock(&_seek_mutex);
+}
+
 void rk05_c::worker(unsigned instance) {
 	UNUSED(instance) ; // only one
-	timeout_c timeout;
 
-	while (true) {
+	while (!workers_terminate) {
 		if (_seek_count > 0) {
-			// A seek is active.  Wait at least 10ms and decrement
-			// The seek count by a certain amount.  This is completely fudged.
-			timeout.wait_ms(3);
-			_seek_count -= 25;
-			// since simultaneous interrupts
-			// confuse me right now
-
-			if (_seek_count < 0) {
-				// Out of seeks to do, let the controller know we're done.
+			// A seek is active. Sleep until the heads arrive,
+			// max 50 ms to see workers_terminate.
+			uint64_t now_ns = _rotation_clock.elapsed_ns();
+			if (instant.value || now_ns >= _seek_end_ns) {
+				// Seek done, let the controller know.
+				_seek_count = 0;
 				_scp = true;
 				controller->on_drive_status_changed(this);
 
 				// Set RWSRDY only after posting status change / interrupt...
 				_rwsrdy = true;
-			}
+			} else
+				timeout_c::wait_ns(min<uint64_t>(_seek_end_ns - now_ns, 50 * MILLION));
 		} else {
-			// Move SectorCounter to next sector
-			// every 1/300th of a second (or so).
-			// (1600 revs/min = 25 revs / sec = 300 sectors / sec)
-			timeout.wait_ms(3);
+			// Update SectorCounter every 3 ms, a new seek wakes up at once.
+			// Derived from the platter clock, or just counted in "instant" mode.
+			wait_seek_event(3 * MILLION);
+			if (_seek_count > 0)
+				continue;
+			// writes buffered in track cache not older than TRACK_CACHE_FLUSH_MS
+			if (_track_cache.flush_aged())
+				update_track_cache_statistics();
 			if (file_is_open()) {
-				_sectorCount = (_sectorCount + 1) % 12;
+				if (instant.value)
+					_sectorCount = (_sectorCount + 1) % _geometry.Sectors;
+				else
+					_sectorCount = sector_under_heads(_rotation_clock.elapsed_ns());
 				_sok = true;
 				controller->on_drive_status_changed(this);
 			}
@@ -261,6 +332,64 @@ void rk05_c::worker(unsigned instance) {
 	}
 }
 
+//
+// Timing model
+//
+
+// Time for one sector to pass the heads, scaled by emulation_speed
+uint64_t rk05_c::sector_time_ns(void) {
+	uint64_t result = 60 * BILLION / ((uint64_t) RK05_RPM * _geometry.Sectors);
+	if (emulation_speed.value > 0)
+		result /= emulation_speed.value;
+	return result;
+}
+
+// Head movement over "cylinders", including settle time
+uint64_t rk05_c::seek_time_ns(uint32_t cylinders) {
+	if (cylinders == 0 || instant.value)
+		return 0;
+	uint64_t result = 1000
+			* ((uint64_t) RK05_SEEK_MIN_US + (uint64_t) (cylinders - 1) * RK05_SEEK_PER_CYLINDER_US);
+	if (emulation_speed.value > 0)
+		result /= emulation_speed.value;
+	return result;
+}
+
+// Sector passing the heads at _rotation_clock time "at_ns"
+uint32_t rk05_c::sector_under_heads(uint64_t at_ns) {
+	return (at_ns / sector_time_ns()) % _geometry.Sectors;
+}
+
+//
+// mechanical_delay():
+//  Wait for implied seek to "cylinder", until "sector" arrives and has passed the heads.
+//  The controller is late if it asks for the next sector after DMA of the previous one:
+//  if the sector has started less than a sector time ago, it is still taken,
+//  else we wait for the next revolution.
+//
+void rk05_c::mechanical_delay(uint32_t cylinder, uint32_t sector) {
+	if (instant.value)
+		return;
+
+	uint64_t now_ns = _rotation_clock.elapsed_ns();
+	uint64_t sector_ns = sector_time_ns();
+	uint64_t revolution_ns = sector_ns * _geometry.Sectors;
+
+	uint64_t delay_ns = seek_time_ns(abs((int32_t) _current_cylinder - (int32_t) cylinder));
+	if (_seek_count > 0 && _seek_end_ns > now_ns + delay_ns)
+		delay_ns = _seek_end_ns - now_ns; // explicit seek still running
+
+	// rotational latency, at time the heads are on cylinder
+	uint64_t angle_ns = (now_ns + delay_ns) % revolution_ns;
+	uint64_t sector_start_ns = sector * sector_ns;
+	uint64_t latency_ns = (sector_start_ns + revolution_ns - angle_ns) % revolution_ns;
+	if (latency_ns > revolution_ns - sector_ns)
+		latency_ns = 0; // sector just started: late, but still in time
+	delay_ns += latency_ns + sector_ns; // + transfer
+
+	timeout_c::wait_ns(delay_ns);
+}
+
 uint64_t rk05_c::get_disk_byte_offset(uint32_t cylinder, uint32_t surface, uint32_t sector) {
 	return _geometry.Sector_Size_Bytes
 			* ((cylinder * _geometry.Heads * _geometry.Sectors) + (surface * _geometry.Sectors)
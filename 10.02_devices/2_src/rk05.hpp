@@ -10,9 +10,11 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 using namespace std;
 
 #include "storagedrive.hpp"
+#include "trackcache.hpp"
 #include "rk11.hpp"
 
 enum DriveType
@@ -56,6 +58,23 @@ private:
 
         volatile bool _scp;          // Indicates the completion of a seek
 
+        // Timing model: platter position from free running clock
+        timeout_c _rotation_clock;
+        volatile uint64_t _seek_end_ns;   // _rotation_clock time when seek is complete
+        uint64_t sector_time_ns(void);
+        uint64_t seek_time_ns(uint32_t cylinders);
+        uint32_t sector_under_heads(uint64_t at_ns);
+        void mechanical_delay(uint32_t cylinder, uint32_t sector);
+
+        // seek() wakes the worker, which then sleeps until the heads arrive
+        pthread_cond_t _seek_cond = PTHREAD_COND_INITIALIZER;
+        pthread_mutex_t _seek_mutex = PTHREAD_MUTEX_INITIALIZER;
+        void wait_seek_event(uint64_t max_ns);
+
+        // Whole track buffers
+        track_cache_c _track_cache;
+        void update_track_cache_statistics(void);
+        void file_flush_buffers(void) override;
 
         uint64_t get_disk_byte_offset(
             uint32_t cylinder,
@@ -91,6 +110,21 @@ public:
 public:
 	DriveType _drivetype; 
 
+	parameter_bool_c instant = parameter_bool_c(this, "instant", "inst", /*readonly*/
+	false, "1 = no seek, rotational and transfer delays. Else scaled by emulation_speed.");
+
+	// track buffer, see trackcache.hpp
+	parameter_unsigned_c track_cache_tracks = parameter_unsigned_c(this, "track_cache", "tc", /*readonly*/
+	false, "tracks", "%u", "Tracks buffered, 0 = off.", 8, 10);
+	parameter_unsigned_c cache_hits = parameter_unsigned_c(this, "cache_hits", "ch", /*readonly*/
+	true, "", "%u", "Sector accesses served by track buffer.", 32, 10);
+	parameter_unsigned_c cache_misses = parameter_unsigned_c(this, "cache_misses", "cm", /*readonly*/
+	true, "", "%u", "Tracks read from image file.", 32, 10);
+	parameter_unsigned_c cache_hit_rate = parameter_unsigned_c(this, "cache_hit_rate", "chr", /*readonly*/
+	true, "%", "%u", "Percent of sector accesses served by track buffer.", 8, 10);
+	parameter_unsigned_c cache_flushes = parameter_unsigned_c(this, "cache_flushes", "cf", /*readonly*/
+	true, "", "%u", "Tracks with changed sectors written back to image file.", 32, 10);
+
 	rk05_c(storagecontroller_c *controller);
 
     bool on_param_changed(parameter_c* param) override;
@@ -18,6 +18,9 @@
 #include "rk11.hpp"   
 #include "rk05.hpp"
 
+// bound to a reference by min()
+const unsigned rk11_c::max_run_sectors;
+
 rk11_c::rk11_c() :
     storagecontroller_c(),
     _new_command_ready(false)
@@ -135,73 +138,50 @@ bool rk11_c::on_param_changed(parameter_c *param) {
 
 void rk11_c::dma_transfer(DMARequest &request)
 {
-    timeout_c timeout;
+    //
+    // If IBA is set for this transfer ("inhibit incrementing Bus Address") then
+    // each word being transferred goes to the same address.  The PRU repeats
+    // the address, so this is a single DMA just like a normal transfer.
+    //
+    unibusadapter->DMA(dma_request, true,
+        request.write ? UNIBUS_CONTROL_DATO : UNIBUS_CONTROL_DATI,
+        request.address,
+        request.buffer,
+        request.count,
+        request.iba);
+    request.timeout = !dma_request.success;
+    request.end_address = dma_request.unibus_end_addr;
+}
 
-    if (request.iba)
-    {
-        //
-        // If IBA is set for this transfer ("inhibit incrementing Bus Address") then what
-        // happens on the real machine is each word being transferred goes to the same
-        // address.  We can simplify these operations without having to do weird things 
-        // with DMA.
-        //
-        if (request.write)
-        {
-            // Write FROM buffer TO unibus memory, IBA on:
-            // We only need to write the last word in the buffer to memory.
-				unibusadapter->DMA(dma_request, true,
-                UNIBUS_CONTROL_DATO,
-                request.address,
-                request.buffer + request.count - 1,
-                1);
-            request.timeout = !dma_request.success ;
-        }
-        else
-        {
-            // Read FROM unibus memory TO buffer, IBA on:
-            // We read a single word from the unibus and fill the
-            // entire buffer with this value. 
-            unibusadapter->DMA(dma_request, true,
-                UNIBUS_CONTROL_DATI,
-                request.address,
-                request.buffer,
-                1);
-		request.timeout = !dma_request.success ;
-        } 
-    }
-    else
+//
+// Read or write "count" consecutive sectors of the selected drive,
+// starting at the current RKDA.  RKDA itself is not changed.
+//
+void rk11_c::drive_sector_run(bool write, uint32_t count, uint16_t *buffer)
+{
+    uint32_t cyl = _rkda_cyl;
+    uint32_t surface = _rkda_surface;
+    uint32_t sector = _rkda_sector;
+
+    for (uint32_t i = 0; i < count; i++)
     {
-        // Just a normal DMA transfer.
-        if (request.write)
+        if (write)
         {
-            // Write FROM buffer TO unibus memory
-            unibusadapter->DMA(dma_request, true,
-                UNIBUS_CONTROL_DATO,
-                request.address,
-                request.buffer,
-                request.count);
-		request.timeout = !dma_request.success ;
+            selected_drive()->write_sector(cyl, surface, sector, buffer + i * 256);
         }
         else
         {
-            // Read FROM unibus memory TO buffer
-            unibusadapter->DMA(dma_request, true,
-                UNIBUS_CONTROL_DATI, 
-                request.address,
-                request.buffer,
-                request.count);
-		request.timeout = !dma_request.success ;
+            selected_drive()->read_sector(cyl, surface, sector, buffer + i * 256);
         }
-    }
 
-
-    // If an IBA DMA read from memory, we need to fill the request buffer
-    // with the single word returned from memory by the DMA operation.
-    if (request.iba && !request.write)
-    {
-        for(uint32_t i = 1; i < request.count; i++)
+        if (++sector > 11)
         {
-            request.buffer[i] = request.buffer[0];
+            sector = 0;
+            if (++surface > 1)
+            {
+                surface = 0;
+                cyl++;
+            }
         }
     }
 }
@@ -272,12 +252,11 @@ void rk11_c::worker(unsigned instance)
                             bool read = command.function == Read && !command.format;
                             bool write_check = command.function == Write_Check;
 
-                            // We loop over the requested address range
-                            // and submit DMA requests one at a time, waiting for
-                            // their completion. 
-                          
-                            uint16_t sectorBuffer[256];
-                            uint16_t checkBuffer[256];
+                            // We loop over the requested address range in runs of
+                            // consecutive sectors, crossing surface and cylinder boundaries
+                            // like the RK11 does.  Each run is a single DMA request.
+                            // Read Format transfers one header word per sector, so its runs
+                            // are single sectors.
  
                             uint32_t current_address = command.address;
                             int16_t current_count = -(int16_t)(get_register_dato_value(RKWC_reg));
@@ -308,21 +287,32 @@ void rk11_c::worker(unsigned instance)
                                     continue;
                                 }
 
+                                //
+                                // Size of this run: the sectors needed for the remaining
+                                // word count, but not past the end of the disk. 
+                                // The next pass then fails validate_seek() with OVR, as before.
+                                //
+                                uint32_t run_sectors = 1;
+                                if (!read_format)
+                                {
+                                    uint32_t sectors_to_end =
+                                        ((202 - _rkda_cyl) * 2 + (1 - _rkda_surface)) * 12
+                                        + (12 - _rkda_sector);
+                                    run_sectors = min(static_cast<uint32_t>(current_count + 255) / 256, max_run_sectors);
+                                    run_sectors = min(run_sectors, sectors_to_end);
+                                }
+
                                 //
                                 // Clear the buffer.  This is only necessary because short writes
                                 // and reads expect the rest of the sector to be filled with zeroes.
                                 //
-                                memset(sectorBuffer, 0, sizeof(sectorBuffer));
+                                memset(_run_buffer, 0, run_sectors * 512);
                                 
                                 if (read)
                                 {
                                     // Doing a normal read from disk:  Grab the sector data and then
                                     // DMA it into memory.
-                                    selected_drive()->read_sector(
-                                        _rkda_cyl,
-                                        _rkda_surface,
-                                        _rkda_sector,
-                                        sectorBuffer);
+                                    drive_sector_run(false, run_sectors, _run_buffer);
                                 }
                                 else if (read_format)
                                 {
@@ -333,17 +323,14 @@ void rk11_c::worker(unsigned instance)
                                     // since we always seek correctly this is all that is required.
                                     //
                                     // The header is just the cylinder address, as in RKDA 05-12 (p. 3-9)   
-                                    sectorBuffer[0] = (_rkda_cyl << 5);
+                                    _run_buffer[0] = (_rkda_cyl << 5);
                                 }
                                 else if (write_check)
                                 {
                                     // Doing a Write Check:  Grab the sector data from the disk into
                                     // the check buffer.
-                                    selected_drive()->read_sector(
-                                        _rkda_cyl,
-                                        _rkda_surface,
-                                        _rkda_sector,
-                                        checkBuffer); 
+                                    memset(_check_buffer, 0, run_sectors * 512);
+                                    drive_sector_run(false, run_sectors, _check_buffer); 
                                 }
 
                                 //
@@ -354,16 +341,19 @@ void rk11_c::worker(unsigned instance)
                                 DMARequest request = { 0 };
                                 request.address = current_address; 
                                 request.count = (!read_format) ? 
-                                    min(static_cast<int16_t>(256) , current_count) : 
+                                    min(static_cast<int16_t>(run_sectors * 256) , current_count) : 
                                     1;
                                 request.write = !(write || write_check);  // Inverted sense from disk action
                                 request.timeout = false;
-                                request.buffer = sectorBuffer;
+                                request.buffer = _run_buffer;
                                 request.iba = command.iba;
 
                                 // And actually do the transfer.   
                                 dma_transfer(request);
 
+                                // Sectors of this run, for which registers are advanced.
+                                uint32_t done_sectors = run_sectors;
+
                                 // Check completion status -- if there was an error,
                                 // we'll abort and set the appropriate flags.
                                 if (request.timeout)
@@ -374,6 +364,16 @@ void rk11_c::worker(unsigned instance)
                                     // update_RKCS();
                                     // update_RKER(); 
                                     abort = true;
+
+                                    // Sectors before the failing one are complete,
+                                    // the failing sector is accounted but not written.
+                                    uint32_t failed_sector = request.iba ? 0 :
+                                        ((request.end_address - request.address) / 2) / 256;
+                                    done_sectors = min(failed_sector + 1, run_sectors);
+                                    if (write && failed_sector > 0)
+                                    {
+                                        drive_sector_run(true, failed_sector, _run_buffer);
+                                    }
                                 }
                                 else
                                 {
@@ -381,11 +381,7 @@ void rk11_c::worker(unsigned instance)
                                     {
                                         // Doing a write to disk:  Write the buffer DMA'd from
                                         // memory to the disk.
-                                        selected_drive()->write_sector(
-                                            _rkda_cyl,
-                                            _rkda_surface,
-                                            _rkda_sector,
-                                            sectorBuffer);
+                                        drive_sector_run(true, run_sectors, _run_buffer);
                                     }
                                     else if (write_check)
                                     {
@@ -393,7 +389,7 @@ void rk11_c::worker(unsigned instance)
                                         // any discrepancies, set WCE and interrupt as necessary.
                                         for (int i = 0; i < request.count; i++)
                                         {
-                                            if (sectorBuffer[i] != checkBuffer[i])
+                                            if (_run_buffer[i] != _check_buffer[i])
                                             {
                                                 _wce = true;
                                                 _err = true;
@@ -402,19 +398,13 @@ void rk11_c::worker(unsigned instance)
 
                                                 if (_sse)
                                                 {
-                                                    // Finish this transfer and abort.
+                                                    // Finish this sector and abort.
+                                                    done_sectors = i / 256 + 1;
                                                     abort = true;
                                                     break;
                                                 }
                                             } 
                                         }
-
-                                        if (_wce && _sse)
-                                        {
-                                            // Control action stops on error after this transfer
-                                            //  if SSE (Stop on Soft Error) is set.
-                                            abort = true; 
-                                        } 
                                     }
                                     else  // Read
                                     {
@@ -422,13 +412,17 @@ void rk11_c::worker(unsigned instance)
                                         // read (this satisfies ZRKK):
                                         set_register_dati_value(
                                             RKDB_reg, 
-                                            sectorBuffer[request.count - 1],
+                                            _run_buffer[request.count - 1],
                                             "RK11 READ");
                                     }
                                 }
 
-                                // Transfer completed.  Move to next and update registers.
-                                current_count -= request.count;
+                                // Transfer completed.  Move to next and update registers,
+                                // as if the done sectors were transferred one by one.
+                                int16_t done_count = (!read_format) ?
+                                    min(static_cast<int16_t>(done_sectors * 256), current_count) :
+                                    1;
+                                current_count -= done_count;
 
                                 set_register_dati_value(
                                     RKWC_reg,
@@ -437,7 +431,7 @@ void rk11_c::worker(unsigned instance)
 
                                 if (!command.iba)
                                 {
-                                    current_address += (request.count * 2);  // Byte address
+                                    current_address += (done_count * 2);  // Byte address
                                     set_register_dati_value(
                                         RKBA_reg, 
                                         (uint16_t)current_address,
@@ -447,7 +441,10 @@ void rk11_c::worker(unsigned instance)
                                 }
 
                                 // Move to next disk address
-                                increment_RKDA();
+                                for (uint32_t i = 0; i < done_sectors; i++)
+                                {
+                                    increment_RKDA();
+                                }
 
                                 // And go around, do it again. 
                             }
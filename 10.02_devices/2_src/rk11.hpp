@@ -101,6 +101,7 @@ private:
         bool iba;
         uint16_t *buffer;
         bool timeout;
+        uint32_t end_address;   // last address accessed, or failing address on timeout
     };
 
     volatile bool _new_command_ready;   // Used in sync. between C/S register updates and worker thread.
@@ -130,6 +131,14 @@ private:
 
     void dma_transfer(DMARequest &request);
 
+    // Max sectors per DMA: one cylinder
+    static const unsigned max_run_sectors = 24;
+    void drive_sector_run(bool write, uint32_t count, uint16_t *buffer);
+
+    // Data of one sector run, and disk data for Write Check
+    uint16_t _run_buffer[max_run_sectors * 256];
+    uint16_t _check_buffer[max_run_sectors * 256];
+
     // Drive functions:
     enum Function
     {
@@ -35,14 +35,22 @@ using namespace std;
 #include "rl0102.hpp"
 
 RL0102_c::RL0102_c(storagecontroller_c *controller) :
-		storagedrive_c(controller) {
+		storagedrive_c(controller), track_cache(this) {
 	log_label = "RL0102"; // to be overwritten by RL11 on create
 	status_word = 0;
+	state_event = false;
 	set_type(2); // default: RL02
 	runstop_button.value = false; // force user to load file assume drive is LOAD
 	fault_lamp.value = false;
 	cover_open.value = false;
+	instant.value = false;
 
+	rotational_timeout.start_ns(0); // free running platter clock
+	platter_segment = 12; // next header is 6
+	platter_segment_start_ns = 0;
+
+	track_cache_tracks.value = 0; // off, image always up to date
+	track_cache.configure(sector_count, sector_size_bytes, track_cache_tracks.value);
 }
 
 // return false, if illegal parameter value.
@@ -54,7 +62,11 @@ bool RL0102_c::on_param_changed(parameter_c *param) {
 			// must be power on by caller or user after enable
 			power_switch.value = false;
 			change_state(RL0102_STATE_power_off);
+			track_cache.invalidate();
 		}
+	} else if (param == &track_cache_tracks) {
+		track_cache.configure(sector_count, sector_size_bytes, track_cache_tracks.new_value);
+		update_track_cache_statistics();
 	} else if (param == &type_name) {
 		if (!strcasecmp(type_name.new_value.c_str(), "RL01"))
 			set_type(1);
@@ -69,6 +81,21 @@ bool RL0102_c::on_param_changed(parameter_c *param) {
 	return storagedrive_c::on_param_changed(param); // more actions (for enable)
 }
 
+// dirty tracks into image, before close
+void RL0102_c::file_flush_buffers(void) {
+	track_cache.flush();
+	update_track_cache_statistics();
+}
+
+// copy counters of track buffer to parameters
+void RL0102_c::update_track_cache_statistics(void) {
+	cache_hits.value = track_cache.hits;
+	cache_misses.value = track_cache.misses;
+	uint64_t accesses = track_cache.hits + track_cache.misses;
+	cache_hit_rate.value = accesses ? (100 * track_cache.hits) / accesses : 0;
+	cache_flushes.value = track_cache.flushes;
+}
+
 void RL0102_c::set_type(uint8_t drivetype) {
 	this->drivetype = drivetype;
 	switch (drivetype) {
@@ -161,13 +188,37 @@ bool RL0102_c::cmd_seek(unsigned destination_cylinder, unsigned destination_head
 	this->seek_destination_head = destination_head; // time needed to center on track
 	head = 0xff; // invalid, to get extra seek time
 
+	// changed sectors to image, while heads move
+	track_cache.flush();
+	update_track_cache_statistics();
+
 	// RL11 must see "READY=false" immediately
 	update_status_word(/*drive_ready_line*/false, drive_error_line);
 	change_state(RL0102_STATE_seek);
 //	worker_mutex.unlock() ;
+	signal_state_event();
 	return true;
 }
 
+// worker() sleeps until signal_state_event() or max_ms
+void RL0102_c::wait_state_event(unsigned max_ms) {
+	struct timespec abstime;
+	timeout_c::deadline_ns(&abstime, (uint64_t) max_ms * MILLION);
+	pthread_mutex_lock(&state_event_mutex);
+	while (!state_event && !workers_terminate)
+		if (pthread_cond_timedwait(&state_event_cond, &state_event_mutex, &abstime))
+			break; // timeout
+	state_event = false;
+	pthread_mutex_unlock(&state_event_mutex);
+}
+
+void RL0102_c::signal_state_event(void) {
+	pthread_mutex_lock(&state_event_mutex);
+	state_event = true;
+	pthread_cond_signal(&state_event_cond);
+	pthread_mutex_unlock(&state_event_mutex);
+}
+
 // separate proc, to have a testpoint
 void RL0102_c::change_state(unsigned new_state) {
 	unsigned old_state = state.value;
@@ -195,6 +246,7 @@ void RL0102_c::state_power_off() {
 	writeprotect_lamp.value = false;
 //	image_filepath.readonly = true ; // "door locked", disk can not be changed
 	image_filepath.readonly = false; // don't be so complicated
+	track_cache.invalidate();
 	if (power_switch.value == true)
 		change_state(RL0102_STATE_load_cartridge);
 	state_timeout.wait_ms(100);
@@ -230,8 +282,11 @@ void RL0102_c::state_load_cartridge() {
 	} else {
 		// load cartridge: unlock file
 		fault_lamp.value = false;
-		if (file_is_open())
+		if (file_is_open()) {
+			track_cache.invalidate();
+			update_track_cache_statistics();
 			file_close();
+		}
 	}
 	state_timeout.wait_ms(100);
 }
@@ -255,7 +310,10 @@ void RL0102_c::state_spin_up() {
 	rpm_increment *= emulation_speed.value;
 	INFO("Spin up drive speed = %d", rotation_umin.value);
 
-	rotation_umin.value += rpm_increment;
+	if (instant.value)
+		rotation_umin.value = full_rpm + 1;
+	else
+		rotation_umin.value += rpm_increment;
 	if (rotation_umin.value > full_rpm) {
 		rotation_umin.value = full_rpm;
 		cylinder = 0;
@@ -276,14 +334,14 @@ void RL0102_c::state_brush_cycle() {
 	// drive_ready_line = false ;
 	update_status_word(/*drive_ready_line*/false, drive_error_line);
 
-	state_timeout.wait_ms(100);
+	mechanical_delay_us(100000);
 	change_state(RL0102_STATE_load_heads);
 }
 
 void RL0102_c::state_load_heads() {
 	// drive_ready_line = false ;
 	update_status_word(/*drive_ready_line*/false, drive_error_line);
-	state_timeout.wait_ms(time_heads_out_ms);
+	mechanical_delay_us(time_heads_out_ms * 1000);
 
 	cylinder = 0;
 	this->seek_destination_cylinder = 0;
@@ -292,9 +350,6 @@ void RL0102_c::state_load_heads() {
 
 	// now perform a "guard band seek": seek head 0, track 0
 	change_state(RL0102_STATE_seek);
-
-//	next_sector_segment_under_heads = 0; // init rotation angle
-	next_sector_segment_under_heads = 12; // next header is 6
 }
 
 // DEC: seek = 100ms for 512/256 tracks
@@ -310,7 +365,7 @@ void RL0102_c::state_seek() {
 	unsigned trackmove_time_ms; // time for increment seek or part of it
 	if (drivetype == 1)
 		trackmove_increment /= 2; // RL01 tracks are wider apart
-	// trackmove_increment *= emulation_speed.value;
+	// emulation_speed scales the waits, not the increment
 
 	if (runstop_button.value == false || fault_lamp.value == true) { // stop spinning
 		change_state(RL0102_STATE_spin_down);
@@ -321,6 +376,13 @@ void RL0102_c::state_seek() {
 	ready_lamp.value = 0;
 	writeprotect_lamp.value = writeprotect_button.value || file_readonly;
 
+	if (instant.value) {
+		head = seek_destination_head;
+		cylinder = seek_destination_cylinder;
+		change_state(RL0102_STATE_lock_on);
+		return;
+	}
+
 	// need delay for head search (ZRLI, test 9)
 	// here done BEFORE cylinder search ...
 	// set cur head to "invalid" to get the extra head seek time
@@ -331,7 +393,7 @@ void RL0102_c::state_seek() {
 		// trackmove_time_ms = (5 * sector_time_us) / 1000;
 		// ZRLJ test 1: any seek > 3ms
 		trackmove_time_ms = 5;
-		state_timeout.wait_ms(trackmove_time_ms); // must be > 0!
+		mechanical_delay_us(trackmove_time_ms * 1000); // must be > 0!
 		DEBUG("Seek: head switch to %d", head);
 		return;
 	}
@@ -350,10 +412,10 @@ void RL0102_c::state_seek() {
 					/ trackmove_increment;
 			DEBUG("drive seek outwards complete, cyl = %d", cylinder);
 			// DEBUG("Seek: trackmove_time_ms =%d", trackmove_time_ms);
-			state_timeout.wait_ms(trackmove_time_ms);
+			mechanical_delay_us(trackmove_time_ms * 1000);
 			change_state(RL0102_STATE_lock_on);
 		} else
-			state_timeout.wait_ms(trackmove_time_ms);
+			mechanical_delay_us(trackmove_time_ms * 1000);
 	} else {
 		// seek head inwards
 		if ((cylinder - seek_destination_cylinder) <= trackmove_increment) {
@@ -363,13 +425,13 @@ void RL0102_c::state_seek() {
 			cylinder = seek_destination_cylinder;
 			DEBUG("drive seek inwards complete, cyl = %d", cylinder);
 			// DEBUG("Seek: trackmove_time_ms =%d", trackmove_time_ms);
-			state_timeout.wait_ms(trackmove_time_ms);
+			mechanical_delay_us(trackmove_time_ms * 1000);
 			change_state(RL0102_STATE_lock_on);
 			return;
 		} else {
 			DEBUG("drive seeking inwards, cyl = %d", cylinder);
 			cylinder -= trackmove_increment;
-			state_timeout.wait_ms(trackmove_time_ms);
+			mechanical_delay_us(trackmove_time_ms * 1000);
 		}
 	}
 }
@@ -388,14 +450,18 @@ void RL0102_c::state_lock_on() {
 	ready_lamp.value = 1;
 	writeprotect_lamp.value = writeprotect_button.value || file_readonly;
 
-	// fast polling, if ZRLI tests time of 0 cly seek with head switch
-	state_timeout.wait_ms(1);
+	// sleep until next seek, cmd_seek() wakes up at once
+	// (ZRLI tests time of 0 cyl seek with head switch).
+	// 50ms: panel buttons and workers_terminate are seen.
+	wait_state_event(50);
 //	state_wait_ms = 100 ;
 }
 
 void RL0102_c::state_unload_heads() {
 	drive_ready_line = false;
-	state_timeout.wait_ms(time_heads_out_ms);
+	track_cache.flush();
+	update_track_cache_statistics();
+	mechanical_delay_us(time_heads_out_ms * 1000);
 	change_state(RL0102_STATE_spin_down);
 }
 
@@ -410,7 +476,7 @@ void RL0102_c::state_spin_down() {
 
 	INFO("Spin down drive speed = %d", rotation_umin.value);
 
-	if (rotation_umin.value <= rpm_increment) {
+	if (instant.value || rotation_umin.value <= rpm_increment) {
 		rotation_umin.value = 0;
 		change_state(RL0102_STATE_load_cartridge);
 		return;
@@ -495,32 +561,82 @@ bool RL0102_c::header_on_track(uint16_t header) {
 		return true;
 }
 
+// wait for mechanical action, scaled by emulation_speed.
+// nothing to wait for in "instant" mode
+void RL0102_c::mechanical_delay_us(unsigned delay_us) {
+	if (instant.value || delay_us == 0)
+		return;
+	if (emulation_speed.value > 0)
+		delay_us /= emulation_speed.value;
+	state_timeout.wait_us(delay_us);
+}
+
 /*
- simulate an alternating stream of sector_headers and sector_data on the rotating platter.
- sector_segment_under_heads counts 0..79
- if even: sector header under head
- if odd: data under heads
- time for one sector on platter:
+ Time based model of the rotating platter.
+ Headers and data pass the heads alternating, sector after sector.
  1 rotation = 40 sectors = (60/2400)= 25ms
- 1 sector (header+data( = 25ms/40 = 625 us.
+ 1 sector (header+data) = 25ms/40 = 625 us, divided by emulation_speed.
+ A header with its gap takes about 1/8 of that, data the rest.
+
+ Segments are not counted by a timer, but each access first catches up
+ with the clock: what passed the heads while the controller was idle is lost.
+ A controller late for less than one sector time still gets the segment,
+ so DMA between sectors does not cost a rotation.
+ In "instant" mode the platter moves only on access, without delay.
  */
 
-#define NEXT_SECTOR_SEGMENT_ADVANCE do {	\
-	next_sector_segment_under_heads = (next_sector_segment_under_heads + 1) % 80 ;	\
-} while(0)
+uint64_t RL0102_c::sector_time_ns(void) {
+	uint64_t result = 60 * BILLION / ((uint64_t) full_rpm * sector_count);
+	if (emulation_speed.value > 0)
+		result /= emulation_speed.value;
+	return result;
+}
+
+// time for header or data segment to pass the heads
+uint64_t RL0102_c::segment_time_ns(uint64_t segment) {
+	uint64_t header_time_ns = sector_time_ns() / 8;
+	if (segment & 1)
+		return sector_time_ns() - header_time_ns;
+	else
+		return header_time_ns;
+}
+
+// advance platter position to "now", only whole sectors are skipped
+void RL0102_c::platter_sync(void) {
+	if (instant.value)
+		return;
+	uint64_t now_ns = rotational_timeout.elapsed_ns();
+	uint64_t sector_ns = sector_time_ns();
+	if (now_ns <= platter_segment_start_ns + sector_ns)
+		return; // not late
+	uint64_t sectors_passed = (now_ns - platter_segment_start_ns) / sector_ns;
+	platter_segment += 2 * sectors_passed;
+	platter_segment_start_ns += sectors_passed * sector_ns;
+}
+
+// wait until current segment has passed the heads, then select next
+void RL0102_c::platter_pass_segment(void) {
+	platter_pass_segments(1);
+}
 
-#ifdef OLD
-#define NEXT_SECTOR_SEGMENT_ADVANCE do {	\
- 	next_sector_segment_under_heads = (next_sector_segment_under_heads + 1) % 80 ;	\
- 	if (next_sector_segment_under_heads & 1)		\
- 		/* time to pass one sector 600 data, 25 header? */			\
- 		rotational_timeout.wait_us(600) ;		\
- 		else rotational_timeout.wait_us(25) ;		\
- } while(0)
-#endif
+// wait until "count" segments have passed, with a single delay
+void RL0102_c::platter_pass_segments(unsigned count) {
+	if (instant.value) {
+		platter_segment += count;
+		return;
+	}
+	uint64_t end_ns = platter_segment_start_ns;
+	for (unsigned i = 0; i < count; i++)
+		end_ns += segment_time_ns(platter_segment + i);
+	uint64_t now_ns = rotational_timeout.elapsed_ns();
+	if (end_ns > now_ns)
+		timeout_c::wait_ns(end_ns - now_ns);
+	platter_segment += count;
+	platter_segment_start_ns = end_ns;
+}
 
 // read next sector header from rotating platter
-// then increments "sector_segment_under_heads" to next data
+// then platter is positioned before next data
 // sector header has the format
 // 3 words: diskaddress, 0x0000, CRC
 // samples from real RL02: cyl=0,head. each header(=sector) and crc
@@ -533,14 +649,12 @@ bool RL0102_c::cmd_read_next_sector_header(uint16_t *buffer, unsigned buffer_siz
 
 	assert(buffer_size_words >= 3);
 
-	if (next_sector_segment_under_heads & 1) {
+	platter_sync();
+	if (platter_segment & 1)
 		// odd: next is data, let it pass the head
-		NEXT_SECTOR_SEGMENT_ADVANCE
-		;
-		// nanosleep() for rotational delay?
-	}
+		platter_pass_segment();
 
-	unsigned sectorno = next_sector_segment_under_heads >> 1; // LSB is header/data phase
+	unsigned sectorno = (platter_segment / 2) % sector_count; // LSB is header/data phase
 
 	// bits<0:5>=sector, bit<6>=head, bit<7:15>=cylinder
 	assert(cylinder < 512);
@@ -551,55 +665,98 @@ bool RL0102_c::cmd_read_next_sector_header(uint16_t *buffer, unsigned buffer_siz
 	buffer[1] = 0x0000;
 	buffer[2] = calc_crc(2, &buffer[0]); // header CRC
 
-	// circular advance to next header: 40x headers, 40x data
-	NEXT_SECTOR_SEGMENT_ADVANCE
-	;
-	// nanosleep() for rotational delay?
+	// header passes, next is data
+	platter_pass_segment();
 	return true;
 }
 
+// wait for header of "sectorno", skip the ones before without reading them
+// then positioned before data of "sectorno"
+bool RL0102_c::cmd_read_sector_header(unsigned sectorno, uint16_t *buffer,
+		unsigned buffer_size_words) {
+	if (state.value != RL0102_STATE_lock_on)
+		return false; // wrong state
+
+	assert(sectorno < sector_count);
+
+	platter_sync();
+	if (platter_segment & 1)
+		platter_pass_segment(); // data of current sector passes
+	unsigned cur_sectorno = (platter_segment / 2) % sector_count;
+	unsigned sectors_to_skip = (sectorno + sector_count - cur_sectorno) % sector_count;
+	// jump the platter, header and data of skipped sectors take full sector times
+	platter_segment += 2 * sectors_to_skip;
+	if (!instant.value)
+		platter_segment_start_ns += sectors_to_skip * sector_time_ns();
+	return cmd_read_next_sector_header(buffer, buffer_size_words);
+}
+
 // read next data block from rotating platter
-// then increments "sector_segment_under_heads" to next header
+// then platter is positioned before next header
 // controller must address sector by waiting for it with cmd_read_next_sector_header()
 bool RL0102_c::cmd_read_next_sector_data(uint16_t *buffer, unsigned buffer_size_words) {
+	assert(buffer_size_words * 2 >= sector_size_bytes);
+	return cmd_read_sector_data_run(buffer, 1);
+}
+
+// read data of "run_sectors" successive sectors, starting with the next data block.
+// run must not go past end of track.
+// one file access, platter moves over all data and the headers in between.
+bool RL0102_c::cmd_read_sector_data_run(uint16_t *buffer, unsigned run_sectors) {
 	if (state.value != RL0102_STATE_lock_on)
 		return false; // wrong state
 
-	assert(buffer_size_words * 2 >= sector_size_bytes);
-
-	if (!(next_sector_segment_under_heads & 1)) {
+	platter_sync();
+	if (!(platter_segment & 1))
 		// even: next segment is header, let it pass the head
-		NEXT_SECTOR_SEGMENT_ADVANCE
-		;
-		// nanosleep() for rotational delay?
-	}
-	unsigned sectorno = next_sector_segment_under_heads >> 1; // LSB is header/data phase
+		platter_pass_segment();
+	unsigned sectorno = (platter_segment / 2) % sector_count; // LSB is header/data phase
+	assert(run_sectors > 0 && sectorno + run_sectors <= sector_count);
 	unsigned track_size_bytes = sector_count * sector_size_bytes;
 	uint64_t offset = (uint64_t) (head_count * cylinder + head) * track_size_bytes
 			+ sectorno * sector_size_bytes;
 
-	// access image file
+	// access image file, or track buffer
 	// LSB saved before MSB -> word/byte conversion on ARM (little endian) is easy
-	file_read((uint8_t *) buffer, offset, sector_size_bytes);
-	DEBUG("File Read 0x%x words from c/h/s=%d/%d/%d, file pos=0x%llx, words = %06o, %06o, ...",
-			sector_size_bytes / 2, cylinder, head, sectorno, offset, (unsigned )(buffer[0]),
+	if (track_cache.enabled()) {
+		track_cache.read_sectors(head_count * cylinder + head, sectorno, run_sectors,
+				(uint8_t *) buffer);
+		update_track_cache_statistics();
+	} else
+		file_read((uint8_t *) buffer, offset, run_sectors * sector_size_bytes);
+	DEBUG("File Read %d sectors from c/h/s=%d/%d/%d, file pos=0x%llx, words = %06o, %06o, ...",
+			run_sectors, cylinder, head, sectorno, offset, (unsigned )(buffer[0]),
 			(unsigned )(buffer[1]));
 
-	// circular advance to next header: 40x headers, 40x data
-	NEXT_SECTOR_SEGMENT_ADVANCE
-	;
-	// nanosleep() for rotational delay?
+	// data passes, next is header
+	platter_pass_segments(2 * run_sectors - 1);
 	return true;
 }
 
 // write data for current sector under head
-// then increments "stuff_under_heads" to next header
+// then platter is positioned before next header
 // controller must address sector by waiting for it with cmd_read_next_sector_header()
 bool RL0102_c::cmd_write_next_sector_data(uint16_t *buffer, unsigned buffer_size_words) {
+	assert(buffer_size_words * 2 >= sector_size_bytes);
 	if (state.value != RL0102_STATE_lock_on)
 		return false; // wrong state
+	platter_sync();
+	if (!(platter_segment & 1))
+		// even: next segment is header, let it pass the head
+		platter_pass_segment();
+	unsigned sectorno = (platter_segment / 2) % sector_count; // LSB is header/data phase
+	return cmd_write_sector_data_run(sectorno, buffer, 1);
+}
 
-	assert(buffer_size_words * 2 >= sector_size_bytes);
+// write data of "run_sectors" successive sectors, starting with "sectorno".
+// Platter is positioned before data of "sectorno" by cmd_read_sector_header(),
+// the controller has done DMA since then: no platter_sync(), the DMA time
+// is part of the time the data segments need to pass.
+// run must not go past end of track.
+bool RL0102_c::cmd_write_sector_data_run(unsigned sectorno, uint16_t *buffer,
+		unsigned run_sectors) {
+	if (state.value != RL0102_STATE_lock_on)
+		return false; // wrong state
 
 	// error: write can not be executed, different reasons
 	if (file_readonly || writeprotect_button.value == true || !drive_ready_line) {
@@ -609,28 +766,25 @@ bool RL0102_c::cmd_write_next_sector_data(uint16_t *buffer, unsigned buffer_size
 	}
 	error_wge = false; // can read
 
-	if (!(next_sector_segment_under_heads & 1)) {
-		// even: next segment is header, let it pass the head
-		NEXT_SECTOR_SEGMENT_ADVANCE
-		;
-		// nanosleep() for rotational delay?
-	}
-	unsigned sectorno = next_sector_segment_under_heads >> 1; // LSB is header/data phase
+	assert(run_sectors > 0 && sectorno + run_sectors <= sector_count);
 	unsigned track_size_bytes = sector_count * sector_size_bytes;
 	uint64_t offset = (uint64_t) (head_count * cylinder + head) * track_size_bytes
 			+ sectorno * sector_size_bytes;
 
-	// access image file
+	// access image file, or track buffer
 	// LSB saved before MSB -> word/byte conversion on ARM (little endian) is easy
-	file_write((uint8_t *) buffer, offset, sector_size_bytes);
-	DEBUG("File Write 0x%x words from c/h/s=%d/%d/%d, file pos=0x%llx, words = %06o, %06o, ...",
-			sector_size_bytes / 2, cylinder, head, sectorno, offset, (unsigned )(buffer[0]),
+	if (track_cache.enabled()) {
+		track_cache.write_sectors(head_count * cylinder + head, sectorno, run_sectors,
+				(uint8_t *) buffer);
+		update_track_cache_statistics();
+	} else
+		file_write((uint8_t *) buffer, offset, run_sectors * sector_size_bytes);
+	DEBUG("File Write %d sectors to c/h/s=%d/%d/%d, file pos=0x%llx, words = %06o, %06o, ...",
+			run_sectors, cylinder, head, sectorno, offset, (unsigned )(buffer[0]),
 			(unsigned )(buffer[1]));
 
-	// circular advance to next header: 40x headers, 40x data
-	NEXT_SECTOR_SEGMENT_ADVANCE
-	;
-	// nanosleep() for rotational delay?
+	// data passes, next is header
+	platter_pass_segments(2 * run_sectors - 1);
 
 	return true;
 }
@@ -656,6 +810,10 @@ void RL0102_c::worker(unsigned instance) {
 		if (power_switch.value == false)
 			change_state(RL0102_STATE_power_off);
 
+		// writes buffered in track cache not older than TRACK_CACHE_FLUSH_MS
+		if (track_cache.flush_aged())
+			update_track_cache_statistics();
+
 		switch (state.value) {
 		case RL0102_STATE_power_off:
 			state_power_off();
@@ -28,9 +28,11 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 using namespace std;
 
 #include "storagedrive.hpp"
+#include "trackcache.hpp"
 
 #define RL0102_STATE_power_off 0xff // not enabled. no valid state
 // page 4-9 of RLO2 UG
@@ -79,7 +81,33 @@ private:
 	unsigned seek_destination_head;
 
 	timeout_c state_timeout;
+
+	// cmd_seek() wakes worker() sleeping in state_lock_on()
+	pthread_cond_t state_event_cond = PTHREAD_COND_INITIALIZER;
+	pthread_mutex_t state_event_mutex = PTHREAD_MUTEX_INITIALIZER;
+	bool state_event;
+	void wait_state_event(unsigned max_ms);
+	void signal_state_event(void);
+
+	track_cache_c track_cache;
+	void update_track_cache_statistics(void);
+	void file_flush_buffers(void) override;
+	// platter model: monotonic clock since construction
 	timeout_c rotational_timeout;
+
+	// platter passes an alternating stream of sector headers and sector data.
+	// platter_segment counts them since power on:
+	// if even: header of sector (platter_segment/2) % sector_count
+	// if odd: data of that sector
+	// platter_segment_start_ns: time when platter_segment arrives at heads
+	uint64_t platter_segment;
+	uint64_t platter_segment_start_ns;
+	uint64_t sector_time_ns(void);
+	uint64_t segment_time_ns(uint64_t segment);
+	void platter_sync(void);
+	void platter_pass_segment(void);
+	void platter_pass_segments(unsigned count);
+	void mechanical_delay_us(unsigned delay_us);
 //	unsigned state_wait_ms ;
 
 public:
@@ -147,6 +175,22 @@ public:
 	false, "1, if RL cover is open");
 	// not readonly only in "load" state
 
+	// no seek, spin up and rotational delays. "emulation_speed" scales them else.
+	parameter_bool_c instant = parameter_bool_c(this, "instant", "inst", /*readonly*/
+	false, "1 = no mechanical delays for seek, rotation and spin up");
+
+	// track buffer, see trackcache.hpp
+	parameter_unsigned_c track_cache_tracks = parameter_unsigned_c(this, "track_cache", "tc", /*readonly*/
+	false, "tracks", "%u", "Tracks buffered, 0 = off.", 8, 10);
+	parameter_unsigned_c cache_hits = parameter_unsigned_c(this, "cache_hits", "ch", /*readonly*/
+	true, "", "%u", "Sector accesses served by track buffer.", 32, 10);
+	parameter_unsigned_c cache_misses = parameter_unsigned_c(this, "cache_misses", "cm", /*readonly*/
+	true, "", "%u", "Tracks read from image file.", 32, 10);
+	parameter_unsigned_c cache_hit_rate = parameter_unsigned_c(this, "cache_hit_rate", "chr", /*readonly*/
+	true, "%", "%u", "Percent of sector accesses served by track buffer.", 8, 10);
+	parameter_unsigned_c cache_flushes = parameter_unsigned_c(this, "cache_flushes", "cf", /*readonly*/
+	true, "", "%u", "Tracks with changed sectors written back to image file.", 32, 10);
+
 	RL0102_c(storagecontroller_c *controller);
 
 	bool on_param_changed(parameter_c *param) override;
@@ -160,30 +204,34 @@ public:
 
 	bool cmd_seek(unsigned destination_cylinder, unsigned destination_head);
 
-	// simulate an alternating stream of sector_headers and sector_data
-	// on the rotating platter
-	// stuff_under_heads count 0..79
-	// if even: next segment on platter is sector header
-	// if odd: next segmetn on platter is data
-	unsigned next_sector_segment_under_heads = 0;
-
 	// is sector with given header on current track?
 	bool header_on_track(uint16_t header);
 
 	// wait for next sector header from rotating platter, read it,
-	// then increments "next_sector_segment_under_heads" to pos before next data
+	// then platter is positioned before next data
 	bool cmd_read_next_sector_header(uint16_t *buffer, unsigned buffer_size_words);
 
+	// wait until header of given sector has passed, without looping
+	// over all headers in between. Then platter is positioned before its data
+	bool cmd_read_sector_header(unsigned sectorno, uint16_t *buffer,
+			unsigned buffer_size_words);
+
 	// wait for next data block from rotating platter, read it,
-	// then increments "next_sector_segment_under_heads" to pos before next header
+	// then platter is positioned before next header
 	// controller must address sector by waiting for it with cmd_read_next_sector_header()
 	bool cmd_read_next_sector_data(uint16_t *buffer, unsigned buffer_size_words);
 
 	// write data for current sector under head
-	// then increments "stuff_under_heads" to pos before next header
+	// then platter is positioned before next header
 	// controller must address sector by waiting for it with cmd_read_next_sector_header()
 	bool cmd_write_next_sector_data(uint16_t *buffer, unsigned buffer_size_words);
 
+	// transfer data of successive sectors on the current track in one file access,
+	// starting with the next data block. buffer holds run_sectors * sector_size_bytes.
+	// Write starts at "sectorno", whose header the controller has matched before DMA.
+	bool cmd_read_sector_data_run(uint16_t *buffer, unsigned run_sectors);
+	bool cmd_write_sector_data_run(unsigned sectorno, uint16_t *buffer, unsigned run_sectors);
+
 	void clear_error_register(void);
 
 	// background worker function
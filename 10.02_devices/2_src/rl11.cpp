@@ -139,6 +139,9 @@ RL11_c::RL11_c(void) :
 	// base addr, intr-vector, intr level
 	set_default_bus_params(0774400, 15, 0160, 5);
 
+	sector_run.value = true;
+	rw_time.value = 0;
+
 	// add 4 RL disk drives
 	drivecount = 4;
 	for (i = 0; i < drivecount; i++) {
@@ -502,6 +505,11 @@ void RL11_c::on_init_changed(void) {
 // called by drive if ready or error
 // must update CS then
 void RL11_c::on_drive_status_changed(storagedrive_c *drive) {
+	// wake worker() waiting for end of seek
+	pthread_mutex_lock(&drive_status_mutex);
+	pthread_cond_broadcast(&drive_status_cond);
+	pthread_mutex_unlock(&drive_status_mutex);
+
 	if (drive->unitno.value != selected_drive_unitno)
 		return;
 	// show status lines in CS for selected drive
@@ -730,11 +738,18 @@ void RL11_c::state_readwrite() {
 				break;
 			}
 
-			// wait for right sector header
-			drive->cmd_read_next_sector_header((uint16_t *) mpr_silo, 3);
+			// wait for right sector header.
+			// platter model computes the rotational delay, no loop over all headers
+			drive->cmd_read_sector_header(disk_address & 0x3f, (uint16_t *) mpr_silo, 3);
 			if (mpr_silo[0] != get_register_dato_value(busreg_DA))
 				break; // wrong sector
 			// DEBUG(LC_RL, "Found sector header DA=%06o.", silo[0]);
+
+			// transfer all sectors up to end of track at once
+			if (sector_run.value) {
+				readwrite_sector_run();
+				break;
+			}
 		}
 
 		// # of words to read/write from/to memory
@@ -835,6 +850,95 @@ void RL11_c::state_readwrite() {
 //	update_unibus_address(unibus_address);
 }
 
+// Transfer successive sectors of READ DATA, WRITE DATA, WRITE CHECK
+// with one drive access and one DMA, instead of sector by sector.
+// Header of first sector has been found, platter is before its data.
+// Run ends at end of track, a longer transfer continues with the next
+// RL11_STATE_RW_DISK pass and gets the same "header not found" OPI as before.
+// On completion or NXM, DA, MP and BA are set as if the sectors
+// had been transfered one by one.
+void RL11_c::readwrite_sector_run() {
+	RL0102_c *drive = selected_drive();
+	uint16_t disk_address = get_register_dato_value(busreg_DA);
+	uint32_t unibus_address = get_unibus_address(); // device register to local var
+	uint32_t start_unibus_address = unibus_address;
+	unsigned sector_wordcount = drive->sector_size_bytes / 2; // size of sector
+	unsigned cmd_wordcount = get_MP_wordcount(); // wordcount in hidden MP register
+	unsigned sectorno = disk_address & 0x3f;
+	unsigned run_sectors; // sectors on track touched by this run
+	unsigned run_wordcount; // words to DMA
+	unsigned done_sectors; // sectors completely transfered
+
+	assert(sectorno < drive->sector_count);
+	assert(sizeof(run_buffer) / 2 >= drive->sector_count * sector_wordcount);
+
+	run_sectors = (cmd_wordcount + sector_wordcount - 1) / sector_wordcount;
+	if (run_sectors > drive->sector_count - sectorno)
+		run_sectors = drive->sector_count - sectorno;
+	run_wordcount = run_sectors * sector_wordcount;
+	if (run_wordcount > cmd_wordcount)
+		run_wordcount = cmd_wordcount; // last sector only partly
+	// partial last sector: rest 00s for write and compare
+	memset((uint8_t *) run_buffer, 0, run_sectors * sector_wordcount * 2);
+
+	if (function_code == CMD_READ_DATA) {
+		// all sectors of run pass the head: read them, then DMA into memory
+		drive->cmd_read_sector_data_run(run_buffer, run_sectors);
+		unibusadapter->DMA(dma_request, true, UNIBUS_CONTROL_DATO, unibus_address, run_buffer,
+				run_wordcount);
+	} else if (function_code == CMD_WRITE_CHECK) {
+		drive->cmd_read_sector_data_run(run_buffer, run_sectors);
+		memset((uint8_t *) run_compare, 0, run_sectors * sector_wordcount * 2);
+		unibusadapter->DMA(dma_request, true, UNIBUS_CONTROL_DATI, unibus_address,
+				run_compare, run_wordcount);
+	} else { // CMD_WRITE_DATA
+		unibusadapter->DMA(dma_request, true, UNIBUS_CONTROL_DATI, unibus_address, run_buffer,
+				run_wordcount);
+	}
+	error_dma_timeout = !dma_request.success;
+	unibus_address = dma_request.unibus_end_addr;
+	unibus_address += 2; // was last address, is now next to fill
+	// if timeout: yes, current addr is addr AFTER illegal address (verified)
+	update_unibus_address(unibus_address); // set addr msb to cs
+
+	if (error_dma_timeout) {
+		// sectors before the failing one completed, failing sector is not written
+		unsigned done_words = (dma_request.unibus_end_addr - start_unibus_address) / 2;
+		done_sectors = done_words / sector_wordcount;
+	} else
+		done_sectors = run_sectors;
+
+	if (function_code == CMD_WRITE_DATA && done_sectors > 0) {
+		// write whole sectors. if less data read from memory, 00s are filled in.
+		drive->cmd_write_sector_data_run(sectorno, run_buffer, done_sectors);
+	} else if (function_code == CMD_WRITE_CHECK) {
+		// compare data from disk with data from memory
+		// compare only full sectors, even if not all words of sector read
+		for (unsigned i = 0; i < done_sectors * sector_wordcount; i++)
+			if (run_buffer[i] != run_compare[i])
+				error_writecheck = true;
+	}
+
+	// DA and MP as after "done_sectors" single sector transfers
+	disk_address += done_sectors;
+	set_register_dati_value(busreg_DA, disk_address, __func__);
+	if (cmd_wordcount >= done_sectors * sector_wordcount)
+		cmd_wordcount -= done_sectors * sector_wordcount;
+	else
+		cmd_wordcount = 0;
+	set_MP_wordcount(cmd_wordcount);
+
+	if (error_dma_timeout) {
+		// NXM condition
+		do_operation_incomplete("RL11_STATE_RW_WAIT_DMA: dma timeout");
+	} else if (cmd_wordcount == 0) {
+		// last sector transfered
+		do_command_done();
+		// READY/INTR delayed against end of DMA: nanosleep() in worker()
+	} else
+		change_state(RL11_STATE_RW_DISK);
+}
+
 // thread
 // excutes commands
 void RL11_c::worker(unsigned instance) {
@@ -868,6 +972,7 @@ void RL11_c::worker(unsigned instance) {
 			continue;
 		}
 		// res==0: triggered by signal, execute next cmd
+		rw_timer.start_ns(0);
 		RL0102_c *drive = selected_drive();
 		if (init_asserted) {
 			DEBUG("cmd %d ignored because of INIT.", function_code);
@@ -888,13 +993,19 @@ void RL11_c::worker(unsigned instance) {
 		// inhibit command execution until previous seek complete (CRDY remains false)
 		bool seek_wait = false;
 		// DEBUG("AAA: drive->status_word = %06o", drive->status_word) ;
-		while ((drive->status_word & 0x07) == RL0102_STATE_seek) {
-			timeout.wait_ms(1);
+		// sleep until drive posts a status change, other drives seek meanwhile.
+		// timed: workers_terminate must be seen.
+		pthread_mutex_lock(&drive_status_mutex);
+		while ((drive->status_word & 0x07) == RL0102_STATE_seek && !workers_terminate) {
 			if (!seek_wait) // suppress to much output
 				DEBUG("Start drive_busy_seeking. drive->status_word = %06o",
 						drive->status_word);
 			seek_wait = true;
+			struct timespec abstime;
+			timeout_c::deadline_ns(&abstime, 50 * MILLION);
+			pthread_cond_timedwait(&drive_status_cond, &drive_status_mutex, &abstime);
 		}
+		pthread_mutex_unlock(&drive_status_mutex);
 		if (seek_wait) {
 			// wait for "DRIVE ready" after seek: race condition between RL0102 and RL11
 			while ((busreg_CS->shared_register->value & 1) == 0)
@@ -960,6 +1071,9 @@ void RL11_c::worker(unsigned instance) {
 			else if (state & RL11_STATE_RW_MASK)
 				state_readwrite();
 		}
+		if (function_code == CMD_READ_DATA || function_code == CMD_WRITE_DATA
+				|| function_code == CMD_WRITE_CHECK)
+			rw_time.value = rw_timer.elapsed_us();
 	}
 	assert(!pthread_mutex_unlock(&on_after_register_access_mutex));
 }
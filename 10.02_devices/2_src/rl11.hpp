@@ -59,10 +59,22 @@ private:
 	uint16_t silo[128]; // buffer from/to drive
 	uint16_t silo_compare[128]; // memory data to be compared with silo
 
+	// multi sector transfers: whole rest of track in one file access and one DMA
+	static const unsigned max_run_sectors = 40;
+	uint16_t run_buffer[max_run_sectors * 128];
+	uint16_t run_compare[max_run_sectors * 128];
+
+	timeout_c rw_timer; // duration of READ/WRITE commands
+
 	// RL11 has one INTR and DMA
 	dma_request_c dma_request = dma_request_c(this); // operated by unibusadapter
 	intr_request_c intr_request = intr_request_c(this);
 
+	// drives post status changes (seek complete) here,
+	// worker() waits for it instead of polling
+	pthread_cond_t drive_status_cond = PTHREAD_COND_INITIALIZER;
+	pthread_mutex_t drive_status_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 	// only 16*16 = 256 byte buffer from drive (SILO)
 	// one DMA transaction per sector, must be complete within one sector time
 	// (2400 rpm = 40 rounds per second -> 1/160 sec per sector  = 6,25 millisecs
@@ -87,6 +99,7 @@ private:
 	void change_state_INTR(unsigned new_state);
 	void state_seek(void);
 	void state_readwrite(void);
+	void readwrite_sector_run(void);
 
 	void connect_to_panel(void);
 	void disconnect_from_panel(void);
@@ -100,6 +113,11 @@ public:
 	unibusdevice_register_t *busreg_DA;	// disk address: offset +4
 	unibusdevice_register_t *busreg_MP;	// Multi Purpose: offset +6
 
+	parameter_bool_c sector_run = parameter_bool_c(this, "sector_run", "sr", /*readonly*/
+	false, "1 = transfer rest of track with one file access and one DMA, 0 = sector by sector");
+	parameter_unsigned_c rw_time = parameter_unsigned_c(this, "rw_time", "rwt", /*readonly*/
+	true, "us", "%u", "Duration of last READ DATA, WRITE DATA or WRITE CHECK.", 32, 10);
+
 	RL11_c(void);
 	~RL11_c(void);
 
@@ -0,0 +1,469 @@
+/* tm11.cpp: TM11 magnetic tape controller, with TU10 drives
+
+ See LICENSE for terms of use.
+
+ Command execution follows the TM11 manual (DEC-11-HTMAA) and the
+ SIMH pdp11_tm emulation, so SIMH tape images and diagnostics behave alike:
+ - GO starts a function, CU RDY is cleared until completion.
+   Interrupt on completion, and when IE is set while CU RDY.
+ - READ: record longer than -MTBRC: RLE, only MTBRC bytes transferred.
+   Shorter records end with MTBRC != 0 and no error.
+ - SPACE: MTBRC counts records, stops on tape mark with EOF.
+ - WRITE EOF sets EOF.
+ - Reading past recorded data sets BTE (bad tape).
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <algorithm>
+
+#include "logger.hpp"
+#include "timeout.hpp"
+#include "unibus.h"
+#include "unibusadapter.hpp"
+#include "tm11.hpp"
+
+TM11_c::TM11_c(void) :
+		storagecontroller_c() {
+	name.value = "tm";
+	type_name.value = "TM11";
+	log_label = "tm";
+
+	// base addr, priority slot, intr-vector, intr level
+	set_default_bus_params(0772520, 12, 0224, 5);
+
+	// add 8 TU10 drives
+	drivecount = 8;
+	for (unsigned i = 0; i < drivecount; i++) {
+		tapedrive_c *drive = new tapedrive_c(this);
+		drive->unitno.value = i; // set the number plug
+		drive->name.value = name.value + std::to_string(i);
+		drive->log_label = drive->name.value;
+		drive->parent = this; // link drive to controller
+		storagedrives.push_back(drive);
+	}
+
+	// create UNIBUS registers
+	register_count = 6;
+
+	// status: offset +0
+	busreg_MTS = &(this->registers[0]);
+	strcpy_s(busreg_MTS->name, sizeof(busreg_MTS->name), "MTS");
+	busreg_MTS->active_on_dati = false; // calculated by controller
+	busreg_MTS->active_on_dato = false;
+	busreg_MTS->reset_value = 0;
+	busreg_MTS->writable_bits = 0x0000; // read only
+
+	// command: offset +2
+	busreg_MTC = &(this->registers[1]);
+	strcpy_s(busreg_MTC->name, sizeof(busreg_MTC->name), "MTC");
+	busreg_MTC->active_on_dati = false;
+	busreg_MTC->active_on_dato = true; // GO, power clear, unit select
+	busreg_MTC->reset_value = 0x80; // CU RDY
+	busreg_MTC->writable_bits = 0x7f7f; // all but ERR, CU RDY
+
+	// byte/record counter: offset +4
+	busreg_MTBRC = &(this->registers[2]);
+	strcpy_s(busreg_MTBRC->name, sizeof(busreg_MTBRC->name), "MTBRC");
+	busreg_MTBRC->active_on_dati = false; // pure storage
+	busreg_MTBRC->active_on_dato = false;
+	busreg_MTBRC->reset_value = 0;
+	busreg_MTBRC->writable_bits = 0xffff;
+
+	// current memory address: offset +6
+	busreg_MTCMA = &(this->registers[3]);
+	strcpy_s(busreg_MTCMA->name, sizeof(busreg_MTCMA->name), "MTCMA");
+	busreg_MTCMA->active_on_dati = false; // pure storage
+	busreg_MTCMA->active_on_dato = false;
+	busreg_MTCMA->reset_value = 0;
+	busreg_MTCMA->writable_bits = 0xfffe; // word transfers
+
+	// data buffer: offset +10
+	busreg_MTD = &(this->registers[4]);
+	strcpy_s(busreg_MTD->name, sizeof(busreg_MTD->name), "MTD");
+	busreg_MTD->active_on_dati = false;
+	busreg_MTD->active_on_dato = false;
+	busreg_MTD->reset_value = 0;
+	busreg_MTD->writable_bits = 0x0000; // maintenance only
+
+	// read lines: offset +12
+	busreg_MTRD = &(this->registers[5]);
+	strcpy_s(busreg_MTRD->name, sizeof(busreg_MTRD->name), "MTRD");
+	busreg_MTRD->active_on_dati = false;
+	busreg_MTRD->active_on_dato = false;
+	busreg_MTRD->reset_value = 0;
+	busreg_MTRD->writable_bits = 0x0000; // maintenance only
+
+	command_pending = false;
+	unit_select = 0;
+	clear_errors();
+}
+
+TM11_c::~TM11_c() {
+	for (unsigned i = 0; i < drivecount; i++)
+		delete storagedrives[i];
+}
+
+bool TM11_c::on_param_changed(parameter_c *param) {
+	if (param == &priority_slot) {
+		dma_request.set_priority_slot(priority_slot.new_value);
+		intr_request.set_priority_slot(priority_slot.new_value);
+	} else if (param == &intr_level) {
+		intr_request.set_level(intr_level.new_value);
+	} else if (param == &intr_vector) {
+		intr_request.set_vector(intr_vector.new_value);
+	}
+	return storagecontroller_c::on_param_changed(param); // more actions (for enable)
+}
+
+tapedrive_c *TM11_c::selected_drive(void) {
+	return dynamic_cast<tapedrive_c *>(storagedrives[unit_select]);
+}
+
+/*** register mapping ***/
+
+bool TM11_c::any_error(void) {
+	return error_illegal_command || error_eof || error_crc || error_parity || error_eot
+			|| error_record_length || error_bad_tape || error_nxm;
+}
+
+void TM11_c::clear_errors(void) {
+	error_illegal_command = false;
+	error_eof = false;
+	error_crc = false;
+	error_parity = false;
+	error_eot = false;
+	error_record_length = false;
+	error_bad_tape = false;
+	error_nxm = false;
+}
+
+// MTS: errors of last function and state of selected drive
+void TM11_c::update_MTS(void) {
+	tapedrive_c *drive = selected_drive();
+	uint16_t tmp = 0;
+	if (error_illegal_command)
+		tmp |= 0x8000;
+	if (error_eof)
+		tmp |= 0x4000;
+	if (error_crc)
+		tmp |= 0x2000;
+	if (error_parity)
+		tmp |= 0x1000;
+	if (error_eot)
+		tmp |= 0x0400;
+	if (error_record_length)
+		tmp |= 0x0200;
+	if (error_bad_tape)
+		tmp |= 0x0100;
+	if (error_nxm)
+		tmp |= 0x0080;
+	if (drive->is_ready()) {
+		tmp |= 0x0040; // SELR: on line
+		if (drive->is_bot())
+			tmp |= 0x0020;
+		if (drive->is_write_locked())
+			tmp |= 0x0004;
+		if (controller_ready)
+			tmp |= 0x0001; // TUR: tape not moving
+	}
+	set_register_dati_value(busreg_MTS, tmp, __func__);
+}
+
+void TM11_c::update_MTC(void) {
+	uint16_t tmp = (density << 13) | (unit_select << 8) | ((unibus_address_msb & 3) << 4)
+			| (function_code << 1);
+	if (any_error())
+		tmp |= 0x8000;
+	if (parity_even)
+		tmp |= 0x0800;
+	if (controller_ready)
+		tmp |= 0x0080;
+	if (interrupt_enable)
+		tmp |= 0x0040;
+	set_register_dati_value(busreg_MTC, tmp, __func__);
+}
+
+uint32_t TM11_c::get_unibus_address(void) {
+	return (unibus_address_msb << 16) | get_register_dato_value(busreg_MTCMA);
+}
+
+// set the changed current DMA unibus address
+void TM11_c::update_unibus_address(uint32_t addr) {
+	unibus_address_msb = (addr >> 16) & 3; // XBA 17,16 shown in MTC
+	set_register_dati_value(busreg_MTCMA, addr & 0xfffe, __func__);
+}
+
+// 2's complement in MTBRC, 0 = 64KB
+unsigned TM11_c::get_byte_count(void) {
+	return 0x10000 - get_register_dato_value(busreg_MTBRC);
+}
+
+// "bytes" transferred: count up MTBRC and MTCMA
+void TM11_c::advance_registers(unsigned bytes) {
+	uint16_t brc = get_register_dato_value(busreg_MTBRC) + bytes;
+	set_register_dati_value(busreg_MTBRC, brc, __func__);
+	update_unibus_address(get_unibus_address() + ((bytes + 1) & ~1));
+}
+
+void TM11_c::do_interrupt(void) {
+	if (interrupt_enable)
+		unibusadapter->INTR(intr_request, NULL, 0);
+}
+
+// all registers to power on state
+void TM11_c::reset_controller(void) {
+	reset_unibus_registers();
+	clear_errors();
+	controller_ready = true;
+	interrupt_enable = false;
+	function_code = 0;
+	unit_select = 0;
+	density = 0;
+	parity_even = false;
+	unibus_address_msb = 0;
+	command_pending = false;
+	update_MTC();
+	update_MTS();
+}
+
+/*** register access ***/
+
+// process DATO access to MTC.
+// !! called asynchronuously by PRU, with SSYN asserted and blocking UNIBUS.
+void TM11_c::on_after_register_access(unibusdevice_register_t *device_reg,
+		uint8_t unibus_control) {
+	UNUSED(unibus_control);
+	if (device_reg != busreg_MTC)
+		return;
+
+	uint16_t val = get_register_dato_value(busreg_MTC);
+	pthread_mutex_lock(&on_after_register_access_mutex);
+	if (val & 0x1000) {
+		// power clear
+		reset_controller();
+		pthread_mutex_unlock(&on_after_register_access_mutex);
+		return;
+	}
+	bool old_interrupt_enable = interrupt_enable;
+	density = (val >> 13) & 3;
+	parity_even = !!(val & 0x0800);
+	unit_select = (val >> 8) & 7;
+	interrupt_enable = !!(val & 0x0040);
+	unibus_address_msb = (val >> 4) & 3;
+	function_code = (val >> 1) & 7;
+
+	if ((val & 1) && controller_ready) {
+		// GO: worker() executes
+		clear_errors();
+		controller_ready = false;
+		command_pending = true;
+		pthread_cond_signal(&on_after_register_access_cond);
+	} else if (interrupt_enable && !old_interrupt_enable && controller_ready)
+		do_interrupt();
+	update_MTC();
+	update_MTS(); // unit may have changed
+	pthread_mutex_unlock(&on_after_register_access_mutex);
+}
+
+// called by drive if image loaded or write protect changed
+void TM11_c::on_drive_status_changed(storagedrive_c *drive) {
+	if (drive->unitno.value != unit_select)
+		return;
+	pthread_mutex_lock(&on_after_register_access_mutex);
+	update_MTS();
+	pthread_mutex_unlock(&on_after_register_access_mutex);
+}
+
+/*** DMA of records ***/
+
+// "bytes" from record_buffer to memory, result: bytes transferred.
+// Odd length: the upper byte of the last word is read before and written back.
+unsigned TM11_c::dma_to_memory(uint32_t addr, unsigned bytes) {
+	unsigned wordcount = (bytes + 1) / 2;
+	if (wordcount == 0)
+		return 0;
+	if (bytes & 1) {
+		uint16_t last_word;
+		uint32_t last_addr = addr + 2 * (wordcount - 1);
+		if (last_addr >= 2 * UNIBUS_WORDCOUNT)
+			last_word = 0; // behind 18 bit address space, NXM is found by the DATO below
+		else {
+			unibusadapter->DMA(dma_request, true, UNIBUS_CONTROL_DATI, last_addr, &last_word, 1);
+			if (!dma_request.success) {
+				// NXM is found by the DATO below
+				last_word = 0;
+			}
+		}
+		record_buffer[wordcount - 1] = (record_buffer[wordcount - 1] & 0x00ff)
+				| (last_word & 0xff00);
+	}
+	unibusadapter->DMA(dma_request, true, UNIBUS_CONTROL_DATO, addr, record_buffer, wordcount);
+	if (!dma_request.success) {
+		error_nxm = true;
+		return dma_request.unibus_end_addr - addr;
+	}
+	return bytes;
+}
+
+// "bytes" from memory to record_buffer, result: bytes transferred
+unsigned TM11_c::dma_from_memory(uint32_t addr, unsigned bytes) {
+	unsigned wordcount = (bytes + 1) / 2;
+	if (wordcount == 0)
+		return 0;
+	unibusadapter->DMA(dma_request, true, UNIBUS_CONTROL_DATI, addr, record_buffer, wordcount);
+	if (!dma_request.success) {
+		error_nxm = true;
+		return dma_request.unibus_end_addr - addr;
+	}
+	return bytes;
+}
+
+/*** function execution ***/
+
+void TM11_c::map_drive_status(tapedrive_status_enum status) {
+	switch (status) {
+	case tapedrive_ok:
+	case tapedrive_bot: // shown by BOT status
+		break;
+	case tapedrive_tapemark:
+		error_eof = true;
+		break;
+	case tapedrive_record_error:
+		error_parity = true;
+		break;
+	case tapedrive_eom:
+	case tapedrive_format_error:
+		error_bad_tape = true;
+		break;
+	case tapedrive_not_ready:
+		error_illegal_command = true;
+		break;
+	}
+}
+
+void TM11_c::execute_read(tapedrive_c *drive) {
+	unsigned byte_count = get_byte_count();
+	unsigned record_len;
+	tapedrive_status_enum status = drive->read_record((uint8_t *) record_buffer, byte_count,
+			&record_len);
+	map_drive_status(status);
+	if (status != tapedrive_ok && status != tapedrive_record_error)
+		return;
+	if (record_len > byte_count)
+		error_record_length = true;
+	unsigned bytes = std::min(record_len, byte_count);
+	advance_registers(dma_to_memory(get_unibus_address(), bytes));
+}
+
+void TM11_c::execute_write(tapedrive_c *drive) {
+	unsigned bytes = dma_from_memory(get_unibus_address(), get_byte_count());
+	// on NXM the fetched part is written
+	if (bytes > 0)
+		map_drive_status(drive->write_record((uint8_t *) record_buffer, bytes));
+	advance_registers(bytes);
+}
+
+// MTBRC counts records
+void TM11_c::execute_space(tapedrive_c *drive, bool forward) {
+	tapedrive_status_enum status;
+	uint16_t record_count = get_register_dato_value(busreg_MTBRC);
+	unsigned record_len;
+	do {
+		record_count++;
+		if (forward)
+			status = drive->read_record(NULL, 0, &record_len);
+		else
+			status = drive->space_reverse(&record_len);
+		map_drive_status(status);
+	} while (record_count != 0 && status == tapedrive_ok);
+	set_register_dati_value(busreg_MTBRC, record_count, __func__);
+}
+
+// thread
+// executes functions started with GO
+void TM11_c::worker(unsigned instance) {
+	UNUSED(instance); // only one
+
+	// set prio to RT, but less than unibus_adapter
+	worker_init_realtime_priority(rt_device);
+
+	pthread_mutex_lock(&on_after_register_access_mutex);
+	while (!workers_terminate) {
+		if (!command_pending) {
+			// wait for GO, check for termination regularly
+			struct timespec abstime;
+			timeout_c::deadline_ns(&abstime, 50 * MILLION);
+			pthread_cond_timedwait(&on_after_register_access_cond,
+					&on_after_register_access_mutex, &abstime);
+			continue;
+		}
+		command_pending = false;
+		unsigned function = function_code;
+		tapedrive_c *drive = selected_drive();
+		update_MTS(); // TUR off
+		// registers accessible while tape moves and DMA runs
+		pthread_mutex_unlock(&on_after_register_access_mutex);
+
+		DEBUG("Function %d on unit %d", function, drive->unitno.value);
+		bool write_function = function == TM11_FN_WRITE || function == TM11_FN_WRITE_EOF
+				|| function == TM11_FN_WRITE_EXTENDED_IRG;
+		if (!drive->is_ready() || (write_function && drive->is_write_locked()))
+			error_illegal_command = true;
+		else
+			switch (function) {
+			case TM11_FN_OFFLINE:
+				drive->unload();
+				break;
+			case TM11_FN_READ:
+				execute_read(drive);
+				break;
+			case TM11_FN_WRITE:
+			case TM11_FN_WRITE_EXTENDED_IRG:
+				execute_write(drive);
+				break;
+			case TM11_FN_WRITE_EOF:
+				map_drive_status(drive->write_tapemark());
+				error_eof = true;
+				break;
+			case TM11_FN_SPACE_FORWARD:
+				execute_space(drive, true);
+				break;
+			case TM11_FN_SPACE_REVERSE:
+				execute_space(drive, false);
+				break;
+			case TM11_FN_REWIND:
+				drive->rewind();
+				break;
+			}
+
+		// CU RDY and INTR atomic to MTC access
+		pthread_mutex_lock(&on_after_register_access_mutex);
+		controller_ready = true;
+		update_MTS();
+		update_MTC();
+		do_interrupt();
+	}
+	pthread_mutex_unlock(&on_after_register_access_mutex);
+}
+
+// after UNIBUS install, device is reset by DCLO cycle
+void TM11_c::on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) {
+	storagecontroller_c::on_power_changed(aclo_edge, dclo_edge);
+	if (dclo_edge == SIGNAL_EDGE_RAISING) {
+		pthread_mutex_lock(&on_after_register_access_mutex);
+		reset_controller();
+		pthread_mutex_unlock(&on_after_register_access_mutex);
+	}
+}
+
+// UNIBUS INIT: clear all registers
+void TM11_c::on_init_changed(void) {
+	if (init_asserted) {
+		pthread_mutex_lock(&on_after_register_access_mutex);
+		reset_controller();
+		pthread_mutex_unlock(&on_after_register_access_mutex);
+	}
+	storagecontroller_c::on_init_changed();
+}
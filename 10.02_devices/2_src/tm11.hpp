@@ -0,0 +1,118 @@
+/* tm11.hpp: TM11 magnetic tape controller, with TU10 drives
+
+ See LICENSE for terms of use.
+
+ Registers, base address 772520:
+	+0	MTS	status, read only
+	+2	MTC	command
+	+4	MTBRC	byte/record counter, 2's complement
+	+6	MTCMA	current memory address
+	+10	MTD	data buffer, not used by programs
+	+12	MTRD	TU10 read lines, not used by programs
+ Tape images are SIMH .tap files, see tapedrive.hpp.
+ Tape motion is instantaneous, throughput is limited by DMA and image file.
+ */
+#ifndef _TM11_HPP_
+#define _TM11_HPP_
+
+#include <stdint.h>
+
+#include "unibusadapter.hpp"
+#include "storagecontroller.hpp"
+#include "tapedrive.hpp"
+
+// MTC functions
+#define TM11_FN_OFFLINE	0
+#define TM11_FN_READ	1
+#define TM11_FN_WRITE	2
+#define TM11_FN_WRITE_EOF	3
+#define TM11_FN_SPACE_FORWARD	4
+#define TM11_FN_SPACE_REVERSE	5
+#define TM11_FN_WRITE_EXTENDED_IRG	6
+#define TM11_FN_REWIND	7
+
+// MTBRC is 16 bit: max record 64KB
+#define TM11_MAX_RECORD_BYTES	0x10000
+
+class TM11_c: public storagecontroller_c {
+private:
+	/*** internal register values, to be mapped to UNIBUS registers ***/
+	// MTC
+	volatile bool controller_ready; // CU RDY
+	volatile bool interrupt_enable;
+	volatile unsigned function_code;
+	volatile unsigned unit_select;
+	volatile unsigned density;
+	volatile bool parity_even;
+	volatile uint32_t unibus_address_msb; // XBA 17,16, as bits <17:16>
+
+	// MTS errors, cleared on every GO
+	volatile bool error_illegal_command; // ILC
+	volatile bool error_eof; // EOF: tape mark passed
+	volatile bool error_crc; // CRE
+	volatile bool error_parity; // PAE: record marked bad in image
+	volatile bool error_eot; // EOT
+	volatile bool error_record_length; // RLE
+	volatile bool error_bad_tape; // BTE: end of medium, image corrupt
+	volatile bool error_nxm; // NXM: DMA timeout
+
+	// function to be executed by worker()
+	volatile bool command_pending;
+
+	// record buffer, as words for DMA
+	uint16_t record_buffer[TM11_MAX_RECORD_BYTES / 2];
+
+	// TM11 has one INTR and DMA
+	dma_request_c dma_request = dma_request_c(this); // operated by unibusadapter
+	intr_request_c intr_request = intr_request_c(this);
+
+	bool any_error(void);
+	void clear_errors(void);
+	void update_MTS(void);
+	void update_MTC(void);
+	void reset_controller(void);
+	void do_interrupt(void);
+
+	uint32_t get_unibus_address(void);
+	void update_unibus_address(uint32_t addr);
+	unsigned get_byte_count(void);
+	void advance_registers(unsigned bytes);
+
+	unsigned dma_to_memory(uint32_t addr, unsigned bytes);
+	unsigned dma_from_memory(uint32_t addr, unsigned bytes);
+
+	void execute_read(tapedrive_c *drive);
+	void execute_write(tapedrive_c *drive);
+	void execute_space(tapedrive_c *drive, bool forward);
+	void map_drive_status(tapedrive_status_enum status);
+
+public:
+
+	// register interface to TM11 controller
+	unibusdevice_register_t *busreg_MTS;	// status: offset +0
+	unibusdevice_register_t *busreg_MTC;	// command: offset +2
+	unibusdevice_register_t *busreg_MTBRC;	// byte record counter: offset +4
+	unibusdevice_register_t *busreg_MTCMA;	// current memory address: offset +6
+	unibusdevice_register_t *busreg_MTD;	// data buffer: offset +10
+	unibusdevice_register_t *busreg_MTRD;	// read lines: offset +12
+
+	TM11_c(void);
+	~TM11_c(void);
+
+	bool on_param_changed(parameter_c *param) override;
+
+	tapedrive_c *selected_drive(void);
+
+	// background worker function
+	void worker(unsigned instance) override;
+
+	// called by unibusadapter after DATI/DATO access to active emulated register
+	void on_after_register_access(unibusdevice_register_t *device_reg, uint8_t unibus_control)
+			override;
+
+	void on_power_changed(signal_edge_enum aclo_edge, signal_edge_enum dclo_edge) override;
+	void on_init_changed(void) override;
+	void on_drive_status_changed(storagedrive_c *drive) override;
+};
+
+#endif
@@ -29,6 +29,93 @@
 #include "mscp_drive.hpp"
 #include "uda.hpp"
 
+//
+// Size classes of the buffer pool: buffer size and number of buffers.
+// One disk block, small multi-block transfers, command messages
+// (one per command ring slot in flight) and big transfers up to the
+// full 18 bit UNIBUS address space.
+//
+static const struct
+{
+    size_t size;
+    unsigned count;
+} uda_buffer_pool_classes[] = {
+    { 512, 8 },
+    { 0x1000, 4 },
+    { sizeof(Message), 32 },
+    { 0x10000, 2 },
+    { 0x40000, 2 } // COMPARE HOST DATA needs disk and memory buffer
+};
+
+uda_buffer_pool_c::uda_buffer_pool_c() :
+        pool_count(0),
+        heap_count(0)
+{
+    for (auto& c : uda_buffer_pool_classes)
+    {
+        SizeClass sizeClass;
+        sizeClass.size = c.size;
+        sizeClass.count = c.count;
+        sizeClass.slab = new uint8_t[c.size * c.count];
+        for (unsigned i = 0; i < c.count; i++)
+        {
+            sizeClass.free_list.push_back(sizeClass.slab + i * c.size);
+        }
+        _classes.push_back(sizeClass);
+    }
+}
+
+uda_buffer_pool_c::~uda_buffer_pool_c()
+{
+    for (auto& c : _classes)
+    {
+        delete[] c.slab;
+    }
+}
+
+//
+// Get():
+//  Returns a buffer of at least "size" bytes, from the smallest size class
+//  with a free buffer. If none is available, the buffer is allocated from heap.
+//  Must be given back with Release().
+//
+uint8_t*
+uda_buffer_pool_c::Get(size_t size)
+{
+    for (auto& c : _classes)
+    {
+        if (c.size >= size && !c.free_list.empty())
+        {
+            uint8_t* buffer = c.free_list.back();
+            c.free_list.pop_back();
+            pool_count++;
+            return buffer;
+        }
+    }
+
+    heap_count++;
+    return new uint8_t[size];
+}
+
+//
+// Release():
+//  Returns a buffer obtained by Get() to its size class, or to the heap.
+//
+void
+uda_buffer_pool_c::Release(uint8_t* buffer)
+{
+    for (auto& c : _classes)
+    {
+        if (buffer >= c.slab && buffer < c.slab + c.size * c.count)
+        {
+            c.free_list.push_back(buffer);
+            return;
+        }
+    }
+
+    delete[] buffer;
+}
+
 uda_c::uda_c() :
         storagecontroller_c(),
         _server(nullptr),
@@ -37,6 +124,8 @@ uda_c::uda_c() :
         _responseRingLength(0),
         _commandRingPointer(0),
         _responseRingPointer(0),
+        _dmaCount(0),
+        _dmaTimeNs(0),
         _interruptVector(0),
         _interruptEnable(false),
         _purgeInterruptEnable(false),
@@ -68,6 +157,8 @@ uda_c::uda_c() :
     SA_reg->reset_value = 0;
     SA_reg->writable_bits = 0xffff;
 
+    ring_cache.value = true;
+
     _server.reset(new mscp_server(this));
 
     //
@@ -130,6 +221,30 @@ void uda_c::Reset(void)
     intr_vector.value = 0;
     _interruptEnable = false;
     _purgeInterruptEnable = false;
+
+    buffer_pool.pool_count = 0;
+    buffer_pool.heap_count = 0;
+    buffers_pooled.value = 0;
+    buffers_allocated.value = 0;
+    command_count.value = 0;
+    _dmaCount = 0;
+    _dmaTimeNs = 0;
+    dma_count.value = 0;
+    dma_time.value = 0;
+}
+
+//
+// UpdateStatistics():
+//  Publishes the buffer pool counters as parameters.
+//  Called by the MSCP server after each command.
+//
+void uda_c::UpdateStatistics(void)
+{
+    command_count.value++;
+    buffers_pooled.value = buffer_pool.pool_count;
+    buffers_allocated.value = buffer_pool.heap_count;
+    dma_count.value = _dmaCount;
+    dma_time.value = _dmaTimeNs / 1000;
 }
 
 //
@@ -276,6 +391,10 @@ void uda_c::worker(unsigned instance)
                          reinterpret_cast<uint8_t*>(&blankDescriptor));
                  }  
  
+                 // Command ring is all zero now, response ring owned by port.
+                 _commandRingShadow.assign(_commandRingLength, Descriptor());
+                 _responseRingShadow.assign(_responseRingLength, blankDescriptor);
+
                  DEBUG("Transition to Init state S4, comm area initialized.");
                  // Update the SA read value for step 4:
                  // Bits 7-0 indicating our control microcode version.
@@ -487,8 +606,9 @@ uda_c::update_SA(uint16_t value)
 // GetNextCommand():
 //  Attempts to pull the next command from the command ring, if any
 //  are available.
-//  If successful, returns a pointer to a Message struct; this pointer
-//  is owned by the caller.
+//  If successful, returns a pointer to a Message struct; this buffer
+//  is taken from the buffer pool and must be given back by the caller
+//  with ReleaseCommand().
 //  On failure, nullptr is returned.  This indicates that the ring is
 //  empty or that an attempt to access non-existent memory occurred.
 //  TODO: Need to handle NXM cases properly. 
@@ -496,56 +616,37 @@ uda_c::update_SA(uint16_t value)
 Message*
 uda_c::GetNextCommand(void)
 {
-    timeout_c timer;
- 
     // Grab the next descriptor being pointed to    
-    uint32_t descriptorAddress = 
-        GetCommandDescriptorAddress(_commandRingPointer);
-
     DEBUG("Next descriptor (ring ptr 0x%x) address is o%o", 
         _commandRingPointer, 
-        descriptorAddress);
+        GetCommandDescriptorAddress(_commandRingPointer));
 
-    std::unique_ptr<Descriptor> cmdDescriptor(
-        reinterpret_cast<Descriptor*>(
-            DMARead(
-                descriptorAddress,
-                sizeof(Descriptor),
-                sizeof(Descriptor))));
+    Descriptor cmdDescriptor;
+    bool success = ReadRingDescriptor(
+        GetCommandDescriptorAddress(0),
+        _commandRingShadow,
+        _commandRingPointer,
+        cmdDescriptor);
 
     // TODO: if NULL is returned after retry assume a bus error and handle it appropriately.
-    assert(cmdDescriptor != nullptr);
+    assert(success);
 
     // Check owner bit: if set, ownership has been passed to us, in which case
     // we can attempt to pull the actual message from memory.
-    if (cmdDescriptor->Word1.Fields.Ownership)
+    if (cmdDescriptor.Word1.Fields.Ownership)
     {
         bool doInterrupt = false;
 
         uint32_t messageAddress =
-            cmdDescriptor->Word0.EnvelopeLow |
-            (cmdDescriptor->Word1.Fields.EnvelopeHigh << 16);
+            cmdDescriptor.Word0.EnvelopeLow |
+            (cmdDescriptor.Word1.Fields.EnvelopeHigh << 16);
 
         DEBUG("Next message address is o%o, flag %d", 
-            messageAddress, cmdDescriptor->Word1.Fields.Flag);
+            messageAddress, cmdDescriptor.Word1.Fields.Flag);
 
-        //
-        // Grab the message length; this is at messageAddress - 4
-        //
-        bool success = false;
-        uint16_t messageLength = 
-            DMAReadWord(
-                messageAddress - 4,
-                success);
-       
-        assert(messageLength > 0 && messageLength < MAX_MESSAGE_LENGTH);
-        
-        std::unique_ptr<Message> cmdMessage(
-            reinterpret_cast<Message*>(
-                DMARead(
-                    messageAddress - 4,
-                    messageLength + 4, 
-                    sizeof(Message)))); 
+        Message* cmdMessage = reinterpret_cast<Message*>(
+            buffer_pool.Get(sizeof(Message)));
+        ReadCommandEnvelope(messageAddress, cmdMessage);
 
         //
         // Handle Ring Transitions (from full to not-full) and associated
@@ -554,7 +655,7 @@ uda_c::GetNextCommand(void)
         // that the ring was previously full (i.e. the descriptor we're now returning
         // is the first free entry.)
         //
-        if (cmdDescriptor->Word1.Fields.Flag)
+        if (cmdDescriptor.Word1.Fields.Flag)
         {
             //
             // Flag is set, host is requesting a transition interrupt.
@@ -567,18 +668,16 @@ uda_c::GetNextCommand(void)
             }
             else
             {
-                uint32_t previousDescriptorAddress =
-                    GetCommandDescriptorAddress(
-                        (_commandRingPointer - 1) % _commandRingLength);
-
-                std::unique_ptr<Descriptor> previousDescriptor(
-                    reinterpret_cast<Descriptor*>(
-                        DMARead(
-                            previousDescriptorAddress,
-                            sizeof(Descriptor),
-                            sizeof(Descriptor))));
-
-                if (previousDescriptor->Word1.Fields.Ownership)
+                // Always read fresh, the host may just have given it to us.
+                size_t previousIndex = (_commandRingPointer - 1) % _commandRingLength;
+                Descriptor& previousDescriptor = _commandRingShadow[previousIndex];
+                DMARead(
+                    GetCommandDescriptorAddress(previousIndex),
+                    sizeof(Descriptor),
+                    sizeof(Descriptor),
+                    reinterpret_cast<uint8_t*>(&previousDescriptor));
+
+                if (previousDescriptor.Word1.Fields.Ownership)
                 {
                     // We own the previous descriptor, so the ring was previously
                     // full.
@@ -592,12 +691,13 @@ uda_c::GetNextCommand(void)
         // set the Flag bit (to indicate that we've processed it)
         // and return a pointer to the message.
         //
-        cmdDescriptor->Word1.Fields.Ownership = 0;
-        cmdDescriptor->Word1.Fields.Flag = 1;
-        DMAWrite(
-            descriptorAddress,
-            sizeof(Descriptor),
-            reinterpret_cast<uint8_t*>(cmdDescriptor.get()));     
+        cmdDescriptor.Word1.Fields.Ownership = 0;
+        cmdDescriptor.Word1.Fields.Flag = 1;
+        WriteRingDescriptor(
+            GetCommandDescriptorAddress(0),
+            _commandRingShadow,
+            _commandRingPointer,
+            cmdDescriptor);
 
         //
         // Move to the next descriptor in the ring for next time.
@@ -613,15 +713,83 @@ uda_c::GetNextCommand(void)
             Interrupt();
         }
 
-        return cmdMessage.release();
+        return cmdMessage;
     }
    
-    DEBUG("No descriptor found.  0x%x 0x%x", cmdDescriptor->Word0.Word0, cmdDescriptor->Word1.Word1);  
+    DEBUG("No descriptor found.  0x%x 0x%x", cmdDescriptor.Word0.Word0, cmdDescriptor.Word1.Word1);  
  
     // No descriptor available.
     return nullptr;
 }
 
+//
+// ReleaseCommand():
+//  Gives a message returned by GetNextCommand() back to the buffer pool.
+//
+void
+uda_c::ReleaseCommand(Message* message)
+{
+    buffer_pool.Release(reinterpret_cast<uint8_t*>(message));
+}
+
+//
+// ReadCommandEnvelope():
+//  Reads the message length, the credits/type word and the message text
+//  of a command at "messageAddress" into "message".
+//  With ring_cache enabled, the envelope is read speculatively with
+//  the usual message size in one DMA, only longer messages need a second one.
+//  Returns false if memory could not be read.
+//
+bool
+uda_c::ReadCommandEnvelope(
+    uint32_t messageAddress,
+    Message* message)
+{
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(message);
+    uint32_t envelopeAddress = messageAddress - 4;
+    bool success = false;
+
+    // Never prefetch into the IO page: reads of device registers have side effects.
+    if (ring_cache.value
+        && envelopeAddress + ENVELOPE_PREFETCH_LENGTH <= UNIBUS_IOPAGE_START
+        && DMARead(envelopeAddress, ENVELOPE_PREFETCH_LENGTH, sizeof(Message), buffer))
+    {
+        uint16_t messageLength = message->MessageLength;
+        assert(messageLength > 0 && messageLength < MAX_MESSAGE_LENGTH);
+
+        size_t envelopeLength = messageLength + 4;
+        if (envelopeLength > ENVELOPE_PREFETCH_LENGTH)
+        {
+            // Fetch the rest of a long message
+            return DMARead(
+                envelopeAddress + ENVELOPE_PREFETCH_LENGTH,
+                envelopeLength - ENVELOPE_PREFETCH_LENGTH,
+                sizeof(Message) - ENVELOPE_PREFETCH_LENGTH,
+                buffer + ENVELOPE_PREFETCH_LENGTH);
+        }
+
+        // Same fill pattern behind the message as for the exact read
+        memset(buffer + envelopeLength, 0xc3, ENVELOPE_PREFETCH_LENGTH - envelopeLength);
+        return true;
+    }
+
+    //
+    // Grab the message length; this is at messageAddress - 4
+    //
+    uint16_t messageLength = 
+        DMAReadWord(
+            envelopeAddress,
+            success);
+   
+    assert(messageLength > 0 && messageLength < MAX_MESSAGE_LENGTH);
+
+    return DMARead(
+        envelopeAddress,
+        messageLength + 4, 
+        sizeof(Message),
+        buffer); 
+}
+
 //
 // PostResponse():
 //  Posts the provided Message to the response ring.
@@ -636,13 +804,12 @@ uda_c::PostResponse(
     bool res = false;
 
     // Grab the next descriptor.
-    uint32_t descriptorAddress = GetResponseDescriptorAddress(_responseRingPointer);
-    std::unique_ptr<Descriptor> cmdDescriptor(
-        reinterpret_cast<Descriptor*>(
-            DMARead(
-                descriptorAddress,
-                sizeof(Descriptor),
-                sizeof(Descriptor))));
+    Descriptor cmdDescriptor;
+    ReadRingDescriptor(
+        GetResponseDescriptorAddress(0),
+        _responseRingShadow,
+        _responseRingPointer,
+        cmdDescriptor);
 
     // TODO: if NULL is returned assume a bus error and handle it appropriately.
 
@@ -651,13 +818,13 @@ uda_c::PostResponse(
     // we can use this descriptor and fill in the response buffer it points to.
     // If not, we return false to indicate to the caller the need to try again later.
     //
-    if (cmdDescriptor->Word1.Fields.Ownership)
+    if (cmdDescriptor.Word1.Fields.Ownership)
     {
         bool doInterrupt = false;
 
         uint32_t messageAddress =
-            cmdDescriptor->Word0.EnvelopeLow |
-            (cmdDescriptor->Word1.Fields.EnvelopeHigh << 16);
+            cmdDescriptor.Word0.EnvelopeLow |
+            (cmdDescriptor.Word1.Fields.EnvelopeHigh << 16);
 
         //
         // Read the buffer length the host has allocated for this response.
@@ -677,12 +844,17 @@ uda_c::PostResponse(
         // 
         // Message length is at messageAddress - 4 -- this is the size of the command
         // not including the two header words.
+        // As it is only logged, it is not read when optimizing bus traffic with ring_cache.
         //
         bool success = false;
-        uint16_t messageLength =
-            DMAReadWord(
-                messageAddress - 4,
-                success);
+        uint16_t messageLength = response->MessageLength;
+        if (!ring_cache.value)
+        {
+            messageLength =
+                DMAReadWord(
+                    messageAddress - 4,
+                    success);
+        }
 
         DEBUG("response address o%o length o%o", messageAddress, response->MessageLength);
 
@@ -721,7 +893,7 @@ uda_c::PostResponse(
         // that the ring was previously empty (i.e. the descriptor we're now returning
         // is the first entry returned to the ring by the Port.)
         //
-        if (cmdDescriptor->Word1.Fields.Flag)
+        if (cmdDescriptor.Word1.Fields.Flag)
         {
             //
             // Flag is set, host is requesting a transition interrupt.
@@ -734,18 +906,16 @@ uda_c::PostResponse(
             }
             else
             {
-                uint32_t previousDescriptorAddress =
-                    GetResponseDescriptorAddress(
-                    (_responseRingPointer - 1) % _responseRingLength);
-
-                std::unique_ptr<Descriptor> previousDescriptor(
-                    reinterpret_cast<Descriptor*>(
-                        DMARead(
-                            previousDescriptorAddress,
-                            sizeof(Descriptor),
-                            sizeof(Descriptor))));
-
-                if (previousDescriptor->Word1.Fields.Ownership)
+                // Always read fresh, the host may just have given it to us.
+                size_t previousIndex = (_responseRingPointer - 1) % _responseRingLength;
+                Descriptor& previousDescriptor = _responseRingShadow[previousIndex];
+                DMARead(
+                    GetResponseDescriptorAddress(previousIndex),
+                    sizeof(Descriptor),
+                    sizeof(Descriptor),
+                    reinterpret_cast<uint8_t*>(&previousDescriptor));
+
+                if (previousDescriptor.Word1.Fields.Ownership)
                 {
                     // We own the previous descriptor, so the ring was previously
                     // full.
@@ -758,12 +928,13 @@ uda_c::PostResponse(
         // Message posted; reset the Owner bit of the response descriptor,
         // and set the Flag bit (to indicate that we've processed it).
         //
-        cmdDescriptor->Word1.Fields.Ownership = 0;
-        cmdDescriptor->Word1.Fields.Flag = 1;
-        DMAWrite(
-            descriptorAddress,
-            sizeof(Descriptor),
-            reinterpret_cast<uint8_t*>(cmdDescriptor.get()));
+        cmdDescriptor.Word1.Fields.Ownership = 0;
+        cmdDescriptor.Word1.Fields.Flag = 1;
+        WriteRingDescriptor(
+            GetResponseDescriptorAddress(0),
+            _responseRingShadow,
+            _responseRingPointer,
+            cmdDescriptor);
 
         // Post an interrupt as necessary.
         if (doInterrupt)
@@ -908,6 +1079,66 @@ uda_c::GetResponseDescriptorAddress(
     return  _ringBase + index * sizeof(Descriptor);
 }
 
+//
+// ReadRingDescriptor():
+//  Gets descriptor "index" of the ring at "ringAddress".
+//  With ring_cache enabled, a descriptor owned by the port is taken from
+//  the shadow copy.  A host owned one may have changed, then it is refetched
+//  together with its successors (up to the ring end) with a single DMA.
+//  Without ring_cache, each descriptor is read on its own.
+//  Returns false if memory could not be read.
+//
+bool
+uda_c::ReadRingDescriptor(
+    uint32_t ringAddress,
+    std::vector<Descriptor>& shadow,
+    size_t index,
+    Descriptor& descriptor)
+{
+    bool success = true;
+
+    if (!ring_cache.value)
+    {
+        success = DMARead(
+            ringAddress + index * sizeof(Descriptor),
+            sizeof(Descriptor),
+            sizeof(Descriptor),
+            reinterpret_cast<uint8_t*>(&shadow[index]));
+    }
+    else if (!shadow[index].Word1.Fields.Ownership)
+    {
+        size_t count = std::min(shadow.size() - index, (size_t)RING_PREFETCH_DESCRIPTORS);
+        size_t windowSize = count * sizeof(Descriptor);
+        success = DMARead(
+            ringAddress + index * sizeof(Descriptor),
+            windowSize,
+            windowSize,
+            reinterpret_cast<uint8_t*>(&shadow[index]));
+    }
+
+    descriptor = shadow[index];
+    return success;
+}
+
+//
+// WriteRingDescriptor():
+//  Writes descriptor "index" of the ring at "ringAddress" to memory
+//  and to the shadow copy.
+//
+bool
+uda_c::WriteRingDescriptor(
+    uint32_t ringAddress,
+    std::vector<Descriptor>& shadow,
+    size_t index,
+    Descriptor& descriptor)
+{
+    shadow[index] = descriptor;
+    return DMAWrite(
+        ringAddress + index * sizeof(Descriptor),
+        sizeof(Descriptor),
+        reinterpret_cast<uint8_t*>(&descriptor));
+}
+
 //
 // DMAWriteWord():
 //  Writes a single word to Unibus memory.  Returns true 
@@ -934,26 +1165,17 @@ uda_c::DMAReadWord(
     uint32_t address,
     bool& success)
 {
-    uint8_t* buffer = DMARead(
+    uint16_t word;
+
+    success = DMARead(
         address,
         sizeof(uint16_t),
-        sizeof(uint16_t));
+        sizeof(uint16_t),
+        reinterpret_cast<uint8_t*>(&word));
 
-    if (buffer)
-    {
-        success = true;
-        uint16_t retval = *reinterpret_cast<uint16_t *>(buffer);
-        delete[] buffer;
-        return retval;
-    }
-    else
-    {
-        success = false;
-        return 0;
-    }
+    return success ? word : 0;
 }
 
-
 //
 // DMAWrite():
 //  Write data from the provided buffer to Unibus memory.  Returns true
@@ -972,50 +1194,48 @@ uda_c::DMAWrite(
 //    	logger->dump(logger->default_filepath) ;
     assert (address < 0x40000);
 
+    _dmaTimer.start_ns(0);
     unibusadapter->DMA(dma_request, true,
             UNIBUS_CONTROL_DATO,
             address,
             reinterpret_cast<uint16_t*>(buffer),
             lengthInBytes >> 1);
+    _dmaTimeNs += _dmaTimer.elapsed_ns();
+    _dmaCount++;
 	return dma_request.success ;
 }
 
 //
 // DMARead():
-// Read data from Unibus memory into the returned buffer.
-// Buffer returned is nullptr if memory could not be read.
-// Caller is responsible for freeing the buffer when done.
+// Read data from Unibus memory into the caller's buffer,
+// which must hold at least "bufferSize" bytes.
+// Bytes behind "lengthInBytes" are filled with a 0xc3 pattern.
+// Returns false if memory could not be read.
 // The address specified in 'address' must be word-aligned
 // and the length must be even.
 //
-uint8_t*
+bool
 uda_c::DMARead(
     uint32_t address,
     size_t lengthInBytes,
-    size_t bufferSize)
+    size_t bufferSize,
+    uint8_t* buffer)
 {
     assert (bufferSize >= lengthInBytes);
     assert((lengthInBytes % 2) == 0);
     assert (address < 0x40000);
-
-    uint16_t* buffer = new uint16_t[bufferSize >> 1];
-
     assert(buffer);
 
-    memset(reinterpret_cast<uint8_t*>(buffer), 0xc3, bufferSize);
+    memset(buffer + lengthInBytes, 0xc3, bufferSize - lengthInBytes);
 
+    _dmaTimer.start_ns(0);
     unibusadapter->DMA(dma_request, true,
                 UNIBUS_CONTROL_DATI,
                 address,
-                buffer,
+                reinterpret_cast<uint16_t*>(buffer),
                 lengthInBytes >> 1);
+    _dmaTimeNs += _dmaTimer.elapsed_ns();
+    _dmaCount++;
 
-    if (dma_request.success)
-    { 
-	return reinterpret_cast<uint8_t*>(buffer);
-    }
-    else
-    {
-        return nullptr;     
-    }
+    return dma_request.success;
 } 
@@ -8,7 +8,9 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include "utils.hpp"
+#include "timeout.hpp"
 #include "unibusadapter.hpp"
 #include "unibusdevice.hpp"
 #include "storagecontroller.hpp"
@@ -28,6 +30,15 @@
 // to prvent parsing clearly invalid commands.
 #define MAX_MESSAGE_LENGTH 0x1000
 
+// Bytes read speculatively for a command envelope (length word, credits/type
+// word and message text), so most commands need only a single DMA.
+// 60 bytes is the minimum message slot size defined by MSCP.
+#define ENVELOPE_PREFETCH_LENGTH (4 + 60)
+
+// Max number of ring descriptors fetched with one DMA.
+// Bigger windows save arbitrations, but cost bus time for every empty ring poll.
+#define RING_PREFETCH_DESCRIPTORS 8
+
 
 // TODO: this currently assumes a little-endian machine!
 #pragma pack(push,1)
@@ -50,6 +61,56 @@ struct Message
 };
 #pragma pack(pop)
 
+/*
+  Preallocated buffers for MSCP messages and data transfers,
+  replacing a new[]/delete for every descriptor, message and disk block.
+
+  Buffers are handed out from a few fixed size classes, each a single
+  slab allocated at construction. Requests larger than the biggest class,
+  or made while a class is exhausted, fall back to the heap and are counted.
+  Only used from the MSCP polling thread, so no locking.
+*/
+class uda_buffer_pool_c
+{
+public:
+    uda_buffer_pool_c();
+    ~uda_buffer_pool_c();
+
+    uint8_t* Get(size_t size);
+    void Release(uint8_t* buffer);
+
+    // statistics
+    unsigned pool_count;   // buffers served from the slabs
+    unsigned heap_count;   // buffers which had to be allocated from heap
+
+private:
+    struct SizeClass
+    {
+        size_t size;
+        unsigned count;
+        uint8_t* slab;
+        std::vector<uint8_t*> free_list;
+    };
+
+    std::vector<SizeClass> _classes;
+};
+
+//
+// Scoped buffer from a uda_buffer_pool_c, given back on destruction.
+//
+class uda_pooled_buffer_c
+{
+public:
+    uda_pooled_buffer_c(uda_buffer_pool_c& pool, size_t size) :
+        _pool(pool), _buffer(pool.Get(size)) {}
+    ~uda_pooled_buffer_c() { _pool.Release(_buffer); }
+    uint8_t* get(void) { return _buffer; }
+
+private:
+    uda_buffer_pool_c& _pool;
+    uint8_t* _buffer;
+};
+
 /*
   This implements the Transport layer for a Unibus MSCP controller.
 
@@ -79,14 +140,34 @@ public:
     // As every storage controller UDA has one INTR and DMA
     dma_request_c dma_request = dma_request_c(this) ; // operated by unibusadapter
     intr_request_c intr_request = intr_request_c(this) ;
-	
+
+    parameter_unsigned_c buffers_pooled = parameter_unsigned_c(this, "buffers_pooled", "bp", /*readonly*/
+    true, "", "%u", "Transfer buffers taken from preallocated pool.", 32, 10);
+    parameter_unsigned_c buffers_allocated = parameter_unsigned_c(this, "buffers_allocated", "ba", /*readonly*/
+    true, "", "%u", "Transfer buffers allocated from heap (pool exhausted).", 32, 10);
+    parameter_unsigned_c command_count = parameter_unsigned_c(this, "command_count", "cc", /*readonly*/
+    true, "", "%u", "MSCP commands executed since INIT (32bit roll around).", 32, 10);
+    parameter_bool_c ring_cache = parameter_bool_c(this, "ring_cache", "rc", /*readonly*/
+    false, "Cache command/response ring descriptors, fetch rings with one DMA.");
+    parameter_unsigned_c dma_count = parameter_unsigned_c(this, "dma_count", "dc", /*readonly*/
+    true, "", "%u", "DMA transfers since INIT (32bit roll around).", 32, 10);
+    parameter_unsigned64_c dma_time = parameter_unsigned64_c(this, "dma_time", "dt", /*readonly*/
+    true, "us", "%llu", "Time spent in DMA transfers since INIT.", 64, 10);
+
+    // Buffers for messages and data transfers, used by the MSCP server
+    uda_buffer_pool_c buffer_pool;
+
+    void UpdateStatistics(void);
+
 public:
 
     //
     // Returns the next command message from the command ring, if any.
     // Returns NULL if the ring is empty.
+    // The message is taken from buffer_pool, give it back with ReleaseCommand().
     //
     Message* GetNextCommand(void);
+    void ReleaseCommand(Message* message);
 
     //
     // Posts a response message to the response ring and memory
@@ -109,12 +190,14 @@ private:
     uint32_t GetCommandDescriptorAddress(size_t index);
     uint32_t GetResponseDescriptorAddress(size_t index);
 
+    bool ReadCommandEnvelope(uint32_t messageAddress, Message* message);
+
 public:
     bool DMAWriteWord(uint32_t address, uint16_t word);
     uint16_t DMAReadWord(uint32_t address, bool& success);
 
     bool DMAWrite(uint32_t address, size_t lengthInBytes, uint8_t* buffer);
-    uint8_t* DMARead(uint32_t address, size_t lengthInBytes, size_t bufferSize);
+    bool DMARead(uint32_t address, size_t lengthInBytes, size_t bufferSize, uint8_t* buffer);
 
 private:
     void update_SA(uint16_t value);
@@ -136,6 +219,11 @@ private:
     uint32_t _commandRingPointer;
     uint32_t _responseRingPointer;
 
+    // Measures the bus time of DMA transfers
+    timeout_c _dmaTimer;
+    uint32_t _dmaCount;
+    uint64_t _dmaTimeNs;
+
     // Interrupt vector -- if zero, no interrupts
     // will be generated.
     uint32_t _interruptVector;
@@ -188,5 +276,19 @@ private:
         } Word1;
     };   
     #pragma pack(pop) 
+
+    //
+    // Shadow copies of the command and response rings.
+    // A descriptor owned by the port can not be changed by the host, so
+    // its shadow is valid until the port gives it back.
+    // Descriptors owned by the host may change any time.
+    //
+    std::vector<Descriptor> _commandRingShadow;
+    std::vector<Descriptor> _responseRingShadow;
+
+    bool ReadRingDescriptor(uint32_t ringAddress, std::vector<Descriptor>& shadow,
+        size_t index, Descriptor& descriptor);
+    bool WriteRingDescriptor(uint32_t ringAddress, std::vector<Descriptor>& shadow,
+        size_t index, Descriptor& descriptor);
 };
 
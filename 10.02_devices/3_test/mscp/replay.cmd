@@ -0,0 +1,34 @@
+# inputfile for demo to benchmark the MSCP drive block cache.
+# Replays the reads of a trace captured by trace.cmd against the image,
+# without and with cache and read-ahead.
+# Read in with command line option  "demo --cmdfile ..."
+d			# device menu
+
+en uda			# enable UDA50 controller
+en uda0			# enable drive #0, starts read-ahead worker
+sd uda0			# select
+p type RA80
+p image ../../../10.03_app_demo/5_applications/rt11.mscp/rt11v5.5_34.ra80
+
+.print No cache
+p cache_blocks 0
+p replay /tmp/rt11.trace
+p replay_time
+p cache_hits
+p cache_misses
+
+.print Cache, no read-ahead
+p cache_blocks 2048
+p readahead 0
+p replay /tmp/rt11.trace
+p replay_time
+p cache_hits
+p cache_misses
+
+.print Cache and read-ahead
+p readahead 32
+p replay /tmp/rt11.trace
+p replay_time
+p cache_hits
+p cache_misses
+p readahead_blocks
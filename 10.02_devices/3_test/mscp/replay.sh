@@ -0,0 +1,3 @@
+# benchmark MSCP block cache by replaying a captured trace
+cd ~/10.02_devices/3_test/mscp
+~/10.03_app_demo/4_deploy/demo --verbose --cmdfile replay.cmd
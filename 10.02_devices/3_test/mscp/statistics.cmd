@@ -0,0 +1,31 @@
+# inputfile for demo to measure MSCP controller statistics.
+# Boots RT11 v5.5 from UDA50 drive #0, the OS issues a stream of MSCP commands.
+# Read in with command line option  "demo --cmdfile ..."
+d			# device menu
+
+pwr			# reboot PDP-11
+.wait 3000		# wait for PDP-11 to reset
+m i			# install max UNIBUS memory
+
+# Deposit bootloader into memory
+m ll ../../../10.03_app_demo/5_applications/rt11.mscp/du.lst
+
+en uda			# enable UDA50 controller
+
+en uda0			# enable drive #0
+sd uda0			# select
+p type RA80
+p image ../../../10.03_app_demo/5_applications/rt11.mscp/rt11v5.5_34.ra80
+
+.print MSCP drive ready, UDA50 boot loader installed.
+.print Start 10000 on the PDP-11 to boot, then run a workload (DIR, COPY, ...).
+.print Show statistics with "sd uda" and "p":
+.print   command_count      MSCP commands executed
+.print   buffers_pooled     transfer buffers taken from the preallocated pool
+.print   buffers_allocated  transfer buffers allocated from heap, should stay 0
+.print   dma_count          DMA transfers, divide by command_count for DMAs per command
+.print   dma_time           microseconds spent in DMA transfers
+.print Compare with descriptor caching off: "p ring_cache 0", then INIT the PDP-11.
+.print Drive statistics with "sd uda0" and "p":
+.print   cache_hits, cache_misses, readahead_blocks   block cache
+.print   dirty_blocks, flushed_blocks, flush_writes   write-back, enable with "p write_back 1"
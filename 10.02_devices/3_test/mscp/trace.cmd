@@ -0,0 +1,23 @@
+# inputfile for demo to capture a MSCP block trace for the replay benchmark.
+# Boots RT11 v5.5 from UDA50 drive #0, all reads and writes are logged.
+# Read in with command line option  "demo --cmdfile ..."
+d			# device menu
+
+pwr			# reboot PDP-11
+.wait 3000		# wait for PDP-11 to reset
+m i			# install max UNIBUS memory
+
+# Deposit bootloader into memory
+m ll ../../../10.03_app_demo/5_applications/rt11.mscp/du.lst
+
+en uda			# enable UDA50 controller
+
+en uda0			# enable drive #0
+sd uda0			# select
+p type RA80
+p image ../../../10.03_app_demo/5_applications/rt11.mscp/rt11v5.5_34.ra80
+p trace /tmp/rt11.trace	# append reads and writes
+
+.print MSCP drive ready, UDA50 boot loader installed, tracing into /tmp/rt11.trace
+.print Start 10000 on the PDP-11 to boot, then run a workload (DIR, COPY, ...).
+.print The trace is written continuously. Quit demo, then run replay.cmd.
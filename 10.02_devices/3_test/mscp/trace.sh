@@ -0,0 +1,3 @@
+# capture a MSCP block trace while RT11 runs from an UDA50 drive
+cd ~/10.02_devices/3_test/mscp
+~/10.03_app_demo/4_deploy/demo --verbose --cmdfile trace.cmd
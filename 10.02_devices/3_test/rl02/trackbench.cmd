@@ -0,0 +1,82 @@
+# inputfile for demo: RL11 full track READ DATA, sector run against sector by sector.
+# Reads the 40 sectors of cyl 0/head 0 three times with "sector_run 1"
+# (one file access and one DMA for the track) into memory @ 0,
+# then three times with "sector_run 0" (one file access and DMA per sector) into memory @ 24000.
+# "p rw_time" shows the duration of the last READ DATA in microseconds.
+# Image "trackbench.rl02" with a different pattern in each sector is made by trackbench.sh,
+# which also compares both memory copies with the track after "q".
+# Read in with command line option  "demo --cmdfile ..."
+d			# device menu
+.wait 3000		# wait for PDP-11 to reset
+m i			# install max UNIBUS memory
+
+en rl			# enable RL11 controller
+en rl0			# enable drive #0
+sd rl0			# select
+p emulation_speed 100	# 100x speed: one revolution in 250 us, DMA and file access dominate
+p instant 0		# platter rotates, sectors pass the heads in time
+p track_cache 0		# direct image access
+p runstopbutton 0	# released: "LOAD"
+p powerswitch 1		# power on, now in "load" state
+p image trackbench.rl02 	# mount image file with sector pattern
+p runstopbutton 1	# press RUN/STOP, will start
+
+.print Disk drive now on track
+.wait	1000		# wait until drive spins up
+
+m f 0
+sd rl
+d DA 13			# get status and reset errors
+d CS 4
+.wait 100
+
+.print Sector run: full track with one file access and one DMA
+p sector_run 1
+d 1 0			# set BA
+d DA 0			# cyl=0, head=0, sector=0
+d MP 166000		# MP = -wordcount = -5120 = 40 sectors
+d CS 14			# read data
+.wait 500
+p rw_time
+d 1 0
+d DA 0
+d MP 166000
+d CS 14
+.wait 500
+p rw_time
+d 1 0
+d DA 0
+d MP 166000
+d CS 14
+.wait 500
+p rw_time
+e			# CS = 000200 ready, no error. DA = 000050
+
+.print Sector by sector: 40 file accesses and 40 DMAs
+p sector_run 0
+d 1 24000		# set BA to 10240
+d DA 0
+d MP 166000
+d CS 14
+.wait 500
+p rw_time
+d 1 24000
+d DA 0
+d MP 166000
+d CS 14
+.wait 500
+p rw_time
+d 1 24000
+d DA 0
+d MP 166000
+d CS 14
+.wait 500
+p rw_time
+e			# CS = 000200 ready, no error. DA = 000050
+
+p sector_run 1
+m d			# dump memory to "memory.dump"
+
+.print Expected: all commands without error, CS = 000200.
+.print Compare the rw_time values of both modes.
+.print Quit with "q", then trackbench.sh compares both copies with the track.
@@ -0,0 +1,18 @@
+# RL11 full track READ DATA timing: sector run against sector by sector
+cd ~/10.02_devices/3_test/rl02
+
+# RL02 image, each of the 40 sectors of cyl 0/head 0 filled with its number + 1
+rm -f trackbench.rl02 memory.dump
+for s in $(seq 0 39) ; do
+	head -c 256 /dev/zero | tr '\0' "\\$(printf %03o $((s + 1)))" >>trackbench.rl02
+done
+truncate -s 10485760 trackbench.rl02
+
+~/10.03_app_demo/4_deploy/demo --arbitration_active 1 --verbose --cmdfile trackbench.cmd
+
+# track 0 = 10240 bytes, sector run copy @ 0, sector by sector copy @ 10240
+if cmp -n 10240 trackbench.rl02 memory.dump && cmp -n 10240 trackbench.rl02 memory.dump 0 10240 ; then
+	echo "trackbench: OK, both modes read the same data"
+else
+	echo "trackbench: FAILED, data differs"
+fi
@@ -0,0 +1,62 @@
+# inputfile for demo: RL11 multi sector run with rotational timing ("instant" off).
+# Copies the full track cyl 0/head 0 to cyl 1/head 0 with one 40 sector
+# READ DATA and one 40 sector WRITE DATA, then reads the copy back.
+# Image "trackrun.rl02" with a different pattern in each sector is made by trackrun.sh,
+# which also compares the tracks after "q".
+# Read in with command line option  "demo --cmdfile ..."
+d			# device menu
+.wait 3000		# wait for PDP-11 to reset
+m i			# install max UNIBUS memory
+
+en rl			# enable RL11 controller
+en rl0			# enable drive #0
+sd rl0			# select
+p emulation_speed 10	# 10x speed. Load disk in 5 seconds
+p instant 0		# platter rotates, sectors pass the heads in time
+p track_cache 0		# direct image access
+p runstopbutton 0	# released: "LOAD"
+p powerswitch 1		# power on, now in "load" state
+p image trackrun.rl02 	# mount image file with sector pattern
+p runstopbutton 1	# press RUN/STOP, will start
+
+.print Disk drive now on track after 5 secs
+.wait	6000		# wait until drive spins up
+
+# read full track cyl 0/head 0 into memory @ 0
+m f 0
+d DA 13			# get status and reset errors
+d CS 4
+.wait 100
+d 1 0			# set BA
+d DA 0			# cyl=0, head=0, sector=0
+d MP 166000		# MP = -wordcount = -5120 = 40 sectors
+d CS 14			# read data
+.wait 1000
+e			# CS = 000200 ready, no error. DA = 000050
+
+# seek to cyl 1, head 0
+d DA 205		# (1 << 7) | 4 | 1: one cylinder outward
+d CS 6			# seek
+.wait 1000
+
+# write full track cyl 1/head 0 from memory @ 0.
+# Run starts at the matched header of sector 0, not where the platter is after DMA
+d 1 0			# set BA
+d DA 200		# cyl=1, head=0, sector=0
+d MP 166000		# MP = -5120 words
+d CS 12			# write data
+.wait 1000
+e			# CS = 000200 ready, no error. DA = 000250
+
+# read copy back
+m f 0
+d 1 0			# set BA
+d DA 200
+d MP 166000
+d CS 14			# read data
+.wait 1000
+e			# CS = 000200 ready, no error
+m d			# dump memory to "memory.dump"
+
+.print Expected: all commands without error, CS = 000200.
+.print Quit with "q", then trackrun.sh compares image tracks and memory dump.
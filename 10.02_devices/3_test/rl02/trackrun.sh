@@ -0,0 +1,18 @@
+# RL11 full track write and read back with rotational timing
+cd ~/10.02_devices/3_test/rl02
+
+# RL02 image, each of the 40 sectors of cyl 0/head 0 filled with its number + 1
+rm -f trackrun.rl02 memory.dump
+for s in $(seq 0 39) ; do
+	head -c 256 /dev/zero | tr '\0' "\\$(printf %03o $((s + 1)))" >>trackrun.rl02
+done
+truncate -s 10485760 trackrun.rl02
+
+~/10.03_app_demo/4_deploy/demo --arbitration_active 1 --verbose --cmdfile trackrun.cmd
+
+# track 0 = 10240 bytes @ 0, track cyl 1/head 0 @ 20480
+if cmp -n 10240 trackrun.rl02 trackrun.rl02 0 20480 && cmp -n 10240 trackrun.rl02 memory.dump ; then
+	echo "trackrun: OK"
+else
+	echo "trackrun: FAILED, sectors written to wrong place"
+fi
@@ -0,0 +1,31 @@
+# inputfile for demo to run XXDP RL11/RL02 diagnostics against the track buffer.
+# Run once with "p track_cache 0" (direct image access) and once with buffering,
+# results must be identical.
+# Read in with command line option  "demo --cmdfile ..."
+d			# device menu
+
+pwr
+.wait 3000		# wait for PDP-11 to reset
+m i			# install max UNIBUS memory
+
+en rl			# enable RL11 controller
+
+# scratch disk for the diagnostics in RL02 #0
+en rl0			# enable drive #0
+sd rl0			# select
+p emulation_speed 10	# 10x speed. Load disk in 5 seconds
+p track_cache 4		# 4 tracks buffered. 0 = off, for reference run
+p runstopbutton 0	# released: "LOAD"
+p powerswitch 1		# power on, now in "load" state
+p image scratch0.rl02 	# mount image file, is overwritten
+p runstopbutton 1	# press RUN/STOP, will start
+
+.print Disk drive now on track after 5 secs
+.wait	6000		# wait until drive spins up
+
+# ZRLM: data reliability, random sector read/write/compare
+m lp ZRLMB1.BIN
+.print ZRLMB1 loaded. Start at 200, let it run some passes.
+.print Then compare errors with a run with "p track_cache 0".
+.print Show buffer statistics with "p" : cache_hits, cache_hit_rate, cache_flushes.
+.print Other tests: "m lp ZRLID1.BIN" (drive test), "m lp ZRLLC1.BIN" (performance).
@@ -0,0 +1,3 @@
+# run XXDP ZRLx diagnostics on RL02 with track buffer
+cd ~/10.02_devices/3_test/rl02
+~/10.03_app_demo/4_deploy/demo --arbitration_active 1 --verbose --cmdfile zrl_trackcache.cmd
@@ -52,6 +52,7 @@
 #include "testcontroller.hpp"
 #include "rl11.hpp"
 #include "rk11.hpp"
+#include "tm11.hpp"
 #include "uda.hpp"
 #include "dl11w.hpp"
 #include "m9312.hpp"
@@ -163,6 +164,8 @@ void application_c::menu_devices(const char *menu_code, bool with_emulated_CPU)
 	paneldriver->reset(); // reset I2C, restart worker()
 	// create RK11 + drives
 	rk11_c *RK11 = new rk11_c();
+	// create TM11 + tape drives
+	TM11_c *TM11 = new TM11_c();
 	// Create UDA50
 	uda_c *UDA50 = new uda_c();
 	// Create SLU+ LTC
@@ -580,6 +583,9 @@ void application_c::menu_devices(const char *menu_code, bool with_emulated_CPU)
 	RK11->enabled.set(false);
 	delete RK11;
 
+	TM11->enabled.set(false);
+	delete TM11;
+
 	UDA50->enabled.set(false);
 	delete UDA50;
 
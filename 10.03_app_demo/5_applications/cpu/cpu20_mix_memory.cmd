@@ -0,0 +1,56 @@
+# Inputfile for demo to benchmark the emulated PDP-11/20 with KT11.
+# Runs the instruction mix of "pdp11sim -b" from memory over UNIBUS,
+# from CPU local memory (PMI) and from CPU local memory above 248KB,
+# mapped by the KT11 with 22 bit addresses.
+# Compare with "pdp11sim -b" and "pdp11sim -b -m", 10.06_pdp11sim/3_test/bench.sh
+# Read in with command line option  "demo --cmdfile ..."
+
+dc			    # "device with cpu" menu
+
+m i   			# emulate missing memory
+
+en cpu20		# switch on emulated 11/20 CPU
+sd cpu20		# select
+
+m ll mix.lst		# load test program
+
+init
+.wait 500
+
+.print Make sure physical CPU is disabled.
+
+p pf 0
+
+.print Memory over UNIBUS
+p mmu 0
+p pmi 0
+p pc 03000		# label "start"
+p s 1
+.wait 10000
+p ips
+p cc
+p h 1
+p h 0
+
+.print CPU local memory below 248KB
+p pc 03000
+p pmi 1
+p s 1
+.wait 10000
+p ips
+p cc
+p h 1
+p h 0
+
+.print CPU local memory above 248KB, KT11 mapped
+p pmi 0
+p mmu 1
+p lm 8			# 8KB at 760000: page 0 copy
+p pc 03014		# label "mapped"
+p s 1
+.wait 10000
+p ips
+p cc
+p h 1
+p h 0
+p mmu 0
@@ -0,0 +1,50 @@
+# Inputfile for demo to benchmark the emulated PDP-11/20 with ZQKC.
+# Measures instructions per second with PRU GRANT handshake
+# before every opcode, and only on pending BR requests.
+# Read in with command line option  "demo --cmdfile ..."
+#
+# Listing corresponding to ZQKC rev E:
+# bitsavers.informatik.uni-stuttgart.de/pdf/dec/pdp11/xxdp/diag_listings/MAINDEC-11-DZQKC-E-D_11_Family_Instruction_Exerciser_Mar75.pdf
+
+dc			    # "device with cpu" menu
+
+m i   			# emulate missing memory
+
+sd dl11
+p p ttyS2		# use "UART2" connector, see FAQ
+en dl11			# switch on emulated DL11
+
+en cpu20		# switch on emulated 11/20 CPU
+sd cpu20		# select
+
+m lp ../zqkc/ZQKC_E_05_20.abs   # load test program
+
+init
+.wait 500
+
+.print Make sure physical CPU is disabled.
+
+p pc 0200
+p swr 0114200
+p swab 1        # ZQKC fails unless 11/20 SWAB insn sets psw v-bit (not std 11/20 behavior)
+p pmi 1         # faster memory access
+
+.print GRANT handshake before every opcode
+p ga 1
+p s 1
+.wait 10000
+p ips
+p gh
+p cc
+p h 1
+p h 0
+
+.print GRANT handshake only on BR above CPU level
+p pc 0200
+p ga 0
+p s 1
+.wait 10000
+p ips
+p gh
+p cc
+p h 1
@@ -0,0 +1,61 @@
+# Inputfile for demo to benchmark the emulated PDP-11/20 with ZQKC.
+# Measures instructions per second with memory over UNIBUS
+# and with CPU local memory (PMI).
+# Read in with command line option  "demo --cmdfile ..."
+#
+# Listing corresponding to ZQKC rev E:
+# bitsavers.informatik.uni-stuttgart.de/pdf/dec/pdp11/xxdp/diag_listings/MAINDEC-11-DZQKC-E-D_11_Family_Instruction_Exerciser_Mar75.pdf
+# ZQKC rejects CPUs with memory management, so mmu stays 0 here.
+# Mapping overhead for local memory above 248KB: cpu20_mix_memory.cmd
+
+dc			    # "device with cpu" menu
+
+m i   			# emulate missing memory
+
+sd dl11
+p p ttyS2		# use "UART2" connector, see FAQ
+en dl11			# switch on emulated DL11
+
+en cpu20		# switch on emulated 11/20 CPU
+sd cpu20		# select
+
+m lp ../zqkc/ZQKC_E_05_20.abs   # load test program
+
+init
+.wait 500
+
+.print Make sure physical CPU is disabled.
+
+p swr 0114200
+p swab 1        # ZQKC fails unless 11/20 SWAB insn sets psw v-bit (not std 11/20 behavior)
+p mmu 0
+
+.print Memory over UNIBUS
+p pc 0200
+p pmi 0
+p pf 0
+p s 1
+.wait 10000
+p ips
+p cc
+p h 1
+p h 0
+
+.print Memory over UNIBUS, instruction prefetch
+p pc 0200
+p pf 4
+p s 1
+.wait 10000
+p ips
+p cc
+p h 1
+p h 0
+
+.print CPU local memory
+p pc 0200
+p pmi 1
+p s 1
+.wait 10000
+p ips
+p cc
+p h 1
@@ -0,0 +1,53 @@
+# Inputfile for demo to benchmark the emulated PDP-11/20 with ZQKC.
+# CPU accesses memory over UNIBUS (no PMI).
+# Measures instructions per second with and without
+# instruction stream prefetch in DATI bursts.
+# Read in with command line option  "demo --cmdfile ..."
+#
+# Listing corresponding to ZQKC rev E:
+# bitsavers.informatik.uni-stuttgart.de/pdf/dec/pdp11/xxdp/diag_listings/MAINDEC-11-DZQKC-E-D_11_Family_Instruction_Exerciser_Mar75.pdf
+
+dc			    # "device with cpu" menu
+
+m i   			# emulate missing memory
+
+sd dl11
+p p ttyS2		# use "UART2" connector, see FAQ
+en dl11			# switch on emulated DL11
+
+en cpu20		# switch on emulated 11/20 CPU
+sd cpu20		# select
+
+m lp ../zqkc/ZQKC_E_05_20.abs   # load test program
+
+init
+.wait 500
+
+.print Make sure physical CPU is disabled.
+
+p swr 0114200
+p swab 1        # ZQKC fails unless 11/20 SWAB insn sets psw v-bit (not std 11/20 behavior)
+p pmi 0         # memory over UNIBUS
+
+.print Single DATI for every opcode and operand
+p pc 0200
+p pf 0
+p s 1
+.wait 10000
+p ips
+p pfh
+p pfb
+p cc
+p h 1
+p h 0
+
+.print Prefetch 4 words per DATI burst
+p pc 0200
+p pf 4
+p s 1
+.wait 10000
+p ips
+p pfh
+p pfb
+p cc
+p h 1
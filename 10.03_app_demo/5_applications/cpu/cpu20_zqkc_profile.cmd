@@ -0,0 +1,43 @@
+# Inputfile for demo to profile the emulated PDP-11/20 with ZQKC.
+# Samples the PC every 100us of emulated time and writes a report
+# sorted by hot spots, and "folded stacks" for flame graphs:
+#   flamegraph.pl cpu20_zqkc_profile.folded > cpu20_zqkc_profile.svg
+# Read in with command line option  "demo --cmdfile ..."
+#
+# Listing corresponding to ZQKC rev E:
+# bitsavers.informatik.uni-stuttgart.de/pdf/dec/pdp11/xxdp/diag_listings/MAINDEC-11-DZQKC-E-D_11_Family_Instruction_Exerciser_Mar75.pdf
+# No MACRO-11 listing for ZQKC here, so PCs are grouped in 64 byte ranges.
+
+dc			    # "device with cpu" menu
+
+m i   			# emulate missing memory
+
+sd dl11
+p p ttyS2		# use "UART2" connector, see FAQ
+en dl11			# switch on emulated DL11
+
+en cpu20		# switch on emulated 11/20 CPU
+sd cpu20		# select
+
+m lp ../zqkc/ZQKC_E_05_20.abs   # load test program
+
+init
+.wait 500
+
+.print Make sure physical CPU is disabled.
+
+p swr 0114200
+p swab 1        # ZQKC fails unless 11/20 SWAB insn sets psw v-bit (not std 11/20 behavior)
+p pmi 1
+p pri 100		# sample interval in us
+p prg 64		# PC range size
+p prf cpu20_zqkc_profile
+p prof 1
+
+p pc 0200
+p s 1
+.wait 10000
+p ips
+p prs
+p prr 1			# write report
+p h 1
@@ -0,0 +1,42 @@
+# Inputfile for demo to profile the emulated PDP-11/20 with ZQKC.
+# Records the last opcodes in the trace ring and dumps it on demand,
+# on a trap through vector 4 and on HALT.
+# Read in with command line option  "demo --cmdfile ..."
+#
+# Listing corresponding to ZQKC rev E:
+# bitsavers.informatik.uni-stuttgart.de/pdf/dec/pdp11/xxdp/diag_listings/MAINDEC-11-DZQKC-E-D_11_Family_Instruction_Exerciser_Mar75.pdf
+# Evaluate the dump with "tracetool", see 10.06_pdp11sim:
+#   ~/10.06_pdp11sim/4_deploy/tracetool -g 0100 cpu20_zqkc_trace.bin
+
+dc			    # "device with cpu" menu
+
+m i   			# emulate missing memory
+
+sd dl11
+p p ttyS2		# use "UART2" connector, see FAQ
+en dl11			# switch on emulated DL11
+
+en cpu20		# switch on emulated 11/20 CPU
+sd cpu20		# select
+
+m lp ../zqkc/ZQKC_E_05_20.abs   # load test program
+
+init
+.wait 500
+
+.print Make sure physical CPU is disabled.
+
+p swr 0114200
+p swab 1        # ZQKC fails unless 11/20 SWAB insn sets psw v-bit (not std 11/20 behavior)
+p pmi 1
+p tr 65536		# trace ring entries, set with CPU stopped
+p tf cpu20_zqkc_trace.bin
+p th 1			# dump on HALT
+p tv 4			# dump once on bus error trap
+
+p pc 0200
+p s 1
+.wait 10000
+p ips
+p td 1			# dump now
+p h 1
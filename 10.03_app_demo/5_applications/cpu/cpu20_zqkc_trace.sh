@@ -0,0 +1,4 @@
+# profile PDP-11/20 opcode execution with MAINDEC ZQKC
+# Main PDP-11/20 must be HALTed
+cd ~/10.03_app_demo/5_applications/cpu
+~/10.03_app_demo/4_deploy/demo --verbose --cmdfile cpu20_zqkc_trace.cmd
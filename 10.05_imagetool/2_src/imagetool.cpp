@@ -0,0 +1,221 @@
+/* imagetool.cpp: convert and inspect compressed disk images
+
+ See LICENSE for terms of use.
+
+ imagetool compress <raw image> <compressed image> [<chunk size> [<capacity>]]
+ imagetool expand <compressed image> <raw image>
+ imagetool info <compressed image>
+ imagetool bench <raw image> <compressed image> [<reads>]
+
+ Raw images are often shorter than the drive, the emulated drive extends
+ them on write. A compressed image can only grow to its "capacity",
+ give the full drive size in bytes there. Default is the raw image size.
+
+ "bench" reads the same random 512 byte blocks from both files, like
+ single block MSCP READs, and prints the average time per read.
+ Only blocks which are not all zero are used, so every compressed
+ read hits a stored chunk. Run on the BeagleBone for real numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <vector>
+using namespace std;
+
+#include "compressedimage.hpp"
+
+#define BLOCK_SIZE	512
+
+static void help(void) {
+	fprintf(stderr, "Usage:\n"
+			"  imagetool compress <raw image> <compressed image> [<chunk size> [<capacity>]]\n"
+			"  imagetool expand <compressed image> <raw image>\n"
+			"  imagetool info <compressed image>\n"
+			"  imagetool bench <raw image> <compressed image> [<reads>]\n"
+			"Default chunk size is %d bytes.\n", COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE);
+	exit(1);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool open_compressed(fstream &f, compressed_image_c &cimage, const char *fname) {
+	f.open(fname, ios::in | ios::out | ios::binary);
+	if (!f.is_open()) {
+		fprintf(stderr, "Can not open %s\n", fname);
+		return false;
+	}
+	if (!cimage.attach(&f)) {
+		fprintf(stderr, "%s: %s\n", fname, cimage.error_text.c_str());
+		return false;
+	}
+	return true;
+}
+
+static int compress(const char *raw_fname, const char *cimage_fname, uint32_t chunk_size,
+		uint64_t capacity) {
+	ifstream raw(raw_fname, ios::in | ios::binary | ios::ate);
+	if (!raw.is_open()) {
+		fprintf(stderr, "Can not open %s\n", raw_fname);
+		return 1;
+	}
+	uint64_t image_size = raw.tellg();
+	raw.seekg(0);
+
+	fstream f(cimage_fname, ios::in | ios::out | ios::binary | ios::trunc);
+	if (!f.is_open()) {
+		fprintf(stderr, "Can not create %s\n", cimage_fname);
+		return 1;
+	}
+	compressed_image_c cimage;
+	if (!cimage.create(&f, image_size, capacity, chunk_size)) {
+		fprintf(stderr, "%s: %s\n", cimage_fname, cimage.error_text.c_str());
+		return 1;
+	}
+	vector<uint8_t> buffer(chunk_size);
+	for (uint64_t pos = 0; pos < image_size; pos += chunk_size) {
+		unsigned len = min((uint64_t) chunk_size, image_size - pos);
+		raw.read((char *) buffer.data(), len);
+		if (!cimage.write(buffer.data(), pos, len)) {
+			fprintf(stderr, "%s: %s\n", cimage_fname, cimage.error_text.c_str());
+			return 1;
+		}
+	}
+	f.close();
+	printf("%s: %llu bytes in %u chunks of %u bytes\n", cimage_fname,
+			(unsigned long long) image_size, cimage.get_chunk_count(), chunk_size);
+	return 0;
+}
+
+static int expand(const char *cimage_fname, const char *raw_fname) {
+	fstream f;
+	compressed_image_c cimage;
+	if (!open_compressed(f, cimage, cimage_fname))
+		return 1;
+	ofstream raw(raw_fname, ios::out | ios::binary | ios::trunc);
+	if (!raw.is_open()) {
+		fprintf(stderr, "Can not create %s\n", raw_fname);
+		return 1;
+	}
+	uint32_t chunk_size = cimage.get_chunk_size();
+	vector<uint8_t> buffer(chunk_size);
+	for (uint64_t pos = 0; pos < cimage.size(); pos += chunk_size) {
+		unsigned len = min((uint64_t) chunk_size, cimage.size() - pos);
+		if (!cimage.read(buffer.data(), pos, len)) {
+			fprintf(stderr, "%s: %s\n", cimage_fname, cimage.error_text.c_str());
+			return 1;
+		}
+		raw.write((const char *) buffer.data(), len);
+	}
+	raw.close();
+	if (raw.fail()) {
+		fprintf(stderr, "Write to %s failed\n", raw_fname);
+		return 1;
+	}
+	return 0;
+}
+
+static int info(const char *cimage_fname) {
+	fstream f;
+	compressed_image_c cimage;
+	if (!open_compressed(f, cimage, cimage_fname))
+		return 1;
+	uint32_t holes, compressed, uncompressed;
+	uint64_t data_bytes;
+	cimage.get_usage(&holes, &compressed, &uncompressed, &data_bytes);
+	f.seekg(0, ios::end);
+	uint64_t file_size = f.tellg();
+	printf("Image size   %llu bytes\n", (unsigned long long) cimage.size());
+	printf("File size    %llu bytes (%.1f%%)\n", (unsigned long long) file_size,
+			cimage.size() ? 100.0 * file_size / cimage.size() : 0.0);
+	printf("Chunks       %u of %u bytes\n", cimage.get_chunk_count(), cimage.get_chunk_size());
+	printf("  holes        %u\n", holes);
+	printf("  compressed   %u\n", compressed);
+	printf("  uncompressed %u\n", uncompressed);
+	printf("Data         %llu bytes\n", (unsigned long long) data_bytes);
+	return 0;
+}
+
+static int bench(const char *raw_fname, const char *cimage_fname, unsigned reads) {
+	fstream raw(raw_fname, ios::in | ios::binary | ios::ate);
+	if (!raw.is_open()) {
+		fprintf(stderr, "Can not open %s\n", raw_fname);
+		return 1;
+	}
+	uint64_t image_size = raw.tellg();
+	fstream f;
+	compressed_image_c cimage;
+	if (!open_compressed(f, cimage, cimage_fname))
+		return 1;
+
+	// collect blocks with data
+	vector<uint32_t> blocks;
+	uint8_t buffer[BLOCK_SIZE];
+	raw.seekg(0);
+	for (uint32_t block = 0; (uint64_t) (block + 1) * BLOCK_SIZE <= image_size; block++) {
+		raw.read((char *) buffer, BLOCK_SIZE);
+		for (unsigned i = 0; i < BLOCK_SIZE; i++)
+			if (buffer[i]) {
+				blocks.push_back(block);
+				break;
+			}
+	}
+	if (blocks.empty()) {
+		fprintf(stderr, "%s has no data\n", raw_fname);
+		return 1;
+	}
+	vector<uint32_t> sequence(reads);
+	srand(1);
+	for (unsigned i = 0; i < reads; i++)
+		sequence[i] = blocks[rand() % blocks.size()];
+
+	// raw: fstream, as storagedrive_c
+	uint64_t start = now_ns();
+	for (unsigned i = 0; i < reads; i++) {
+		raw.clear();
+		raw.seekg((uint64_t) sequence[i] * BLOCK_SIZE);
+		raw.read((char *) buffer, BLOCK_SIZE);
+	}
+	uint64_t raw_ns = now_ns() - start;
+
+	start = now_ns();
+	for (unsigned i = 0; i < reads; i++)
+		cimage.read(buffer, (uint64_t) sequence[i] * BLOCK_SIZE, BLOCK_SIZE);
+	uint64_t compressed_ns = now_ns() - start;
+
+	printf("%u random reads of %d bytes from %zu non-zero blocks\n", reads, BLOCK_SIZE,
+			blocks.size());
+	printf("  raw          %8.2f us/read\n", raw_ns / 1000.0 / reads);
+	printf("  compressed   %8.2f us/read, %llu chunks of %u bytes decompressed\n",
+			compressed_ns / 1000.0 / reads, (unsigned long long) cimage.chunks_decompressed,
+			cimage.get_chunk_size());
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3)
+		help();
+	if (!strcmp(argv[1], "compress") && argc >= 4 && argc <= 6) {
+		uint32_t chunk_size = argc >= 5 ? strtoul(argv[4], NULL, 0) : COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE;
+		uint64_t capacity = argc == 6 ? strtoull(argv[5], NULL, 0) : 0;
+		if (chunk_size == 0 || chunk_size % BLOCK_SIZE || chunk_size > 0x10000) {
+			fprintf(stderr, "Chunk size must be a multiple of %d, max 65536\n", BLOCK_SIZE);
+			return 1;
+		}
+		return compress(argv[2], argv[3], chunk_size, capacity);
+	} else if (!strcmp(argv[1], "expand") && argc == 4)
+		return expand(argv[2], argv[3]);
+	else if (!strcmp(argv[1], "info") && argc == 3)
+		return info(argv[2]);
+	else if (!strcmp(argv[1], "bench") && (argc == 4 || argc == 5))
+		return bench(argv[2], argv[3], argc == 5 ? strtoul(argv[4], NULL, 0) : 10000);
+	help();
+	return 1;
+}
@@ -0,0 +1,13 @@
+# Compress the RT11 RA80 image and compare 512 byte block read latency
+# of raw and compressed image, for several chunk sizes.
+# Build imagetool first: cd ~/10.05_imagetool/2_src ; make
+cd ~/10.05_imagetool/3_test
+IMAGE=~/10.03_app_demo/5_applications/rt11.mscp/rt11v5.5_34.ra80
+TOOL=~/10.05_imagetool/4_deploy/imagetool
+for CHUNK in 1024 2048 4096 8192 ; do
+	echo "*** chunk size $CHUNK"
+	$TOOL compress $IMAGE /tmp/bench.ubc $CHUNK
+	$TOOL info /tmp/bench.ubc
+	$TOOL bench $IMAGE /tmp/bench.ubc 20000
+done
+rm -f /tmp/bench.ubc
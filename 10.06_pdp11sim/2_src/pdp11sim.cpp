@@ -0,0 +1,510 @@
+/* pdp11sim.cpp: standalone PDP-11/20 on the host, without UniBone hardware
+
+ See LICENSE for terms of use.
+
+ pdp11sim [options] [<program file> [<start address>]]
+ pdp11sim -b [options]
+
+ Runs the cpu20 KA11 emulator on a software bus:
+ memory below the IO page, the KL11 console on stdin/stdout,
+ optionally the KW11 line clock, the KE11 EAE, KT11 memory management
+ and local memory above the 18 bit address space.
+ Program files are PDP-11 papertapes (*.abs, *.ptap, *.bin) or
+ MACRO-11 listings (*.lst), loaded like the "demo" memory menu.
+ Start address is octal, default is the papertape entry or "start" label.
+
+ -r: record the last opcodes in the cpu20 trace ring,
+ save it at exit for "tracetool".
+ -p: sample PC every -i microseconds of emulated time, write a
+ profile report and flamegraph folded stacks at exit.
+ Labels of a MACRO-11 listing program file symbolize the PCs.
+ -d: write CPU state and memory at exit, to compare runs with and
+ without -c (predecoded dispatch against classic decode).
+ -b: run a fixed instruction mix from memory and print MIPS.
+ With -m the mix runs mapped from local memory above 248KB.
+ At exit instruction count, run time, MIPS and the time a real
+ 11/20 would have needed (ka11 opcode timing) are printed.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+#include "logger.hpp"
+#include "memoryimage.hpp"
+#include "pcprofile.hpp"
+
+#include "cpu20/11.h"
+#include "cpu20/ka11.h"
+#include "cpu20/kl11.h"
+#include "cpu20/kw11.h"
+
+#define MEMORY_SIZE	0160000	// all below IO page
+#define TRACE_RING_ENTRIES	0x10000
+#define PROFILE_INTERVAL_US	100
+
+// defined in ka11.c
+void printstate(KA11 *cpu);
+
+static KA11 ka11;
+static Bus bus;
+static word memory_words[MEMORY_SIZE / 2];
+static word *xmem_words; // above KA11_XMEM_START
+static Memory memory = { memory_words, 0, MEMORY_SIZE };
+static KL11 kl11;
+static KW11 kw11;
+static KE11 ke11;
+static Busdev busdev_memory, busdev_kl11, busdev_kw11, busdev_ke11;
+
+static bool trace_enabled = false;
+static pcprofile_c profiler;
+
+static struct termios tty_saved;
+static bool tty_raw = false;
+
+/*** software bus for the KA11, replaces the UniBone UNIBUS adapter ***/
+
+int dati_mem(Bus *bus, void *dev) {
+	Memory *mem = (Memory *) dev;
+	if (bus->addr < mem->start || bus->addr >= mem->end)
+		return 1;
+	bus->data = mem->mem[(bus->addr - mem->start) / 2];
+	return 0;
+}
+
+int dato_mem(Bus *bus, void *dev) {
+	Memory *mem = (Memory *) dev;
+	if (bus->addr < mem->start || bus->addr >= mem->end)
+		return 1;
+	mem->mem[(bus->addr - mem->start) / 2] = bus->data;
+	return 0;
+}
+
+int datob_mem(Bus *bus, void *dev) {
+	Memory *mem = (Memory *) dev;
+	if (bus->addr < mem->start || bus->addr >= mem->end)
+		return 1;
+	word *w = &mem->mem[(bus->addr - mem->start) / 2];
+	if (bus->addr & 1)
+		*w = (*w & 0377) | (bus->data & 0177400);
+	else
+		*w = (*w & 0177400) | (bus->data & 0377);
+	return 0;
+}
+
+void reset_null(void *dev) {
+	(void) dev;
+}
+
+// no BR
+static int svc_null(Bus *bus, void *dev) {
+	(void) bus;
+	(void) dev;
+	return 0;
+}
+
+// first device answering ends the bus cycle. Result: 1 = OK, 0 = bus timeout
+int unibone_dati(unsigned addr, unsigned *data) {
+	bus.addr = addr;
+	for (Busdev *bd = bus.devs; bd; bd = bd->next)
+		if (bd->dati(&bus, bd->dev) == 0) {
+			*data = bus.data;
+			return 1;
+		}
+	return 0;
+}
+
+int unibone_dato(unsigned addr, unsigned data) {
+	bus.addr = addr;
+	bus.data = data;
+	for (Busdev *bd = bus.devs; bd; bd = bd->next)
+		if (bd->dato(&bus, bd->dev) == 0)
+			return 1;
+	return 0;
+}
+
+int unibone_datob(unsigned addr, unsigned data) {
+	bus.addr = addr;
+	bus.data = data;
+	for (Busdev *bd = bus.devs; bd; bd = bd->next)
+		if (bd->datob(&bus, bd->dev) == 0)
+			return 1;
+	return 0;
+}
+
+// Device BRs are polled by svc() in ka11.c over bus.devs,
+// no external INTRs as with UniBone.
+void unibone_grant_interrupts(void) {
+}
+
+void unibone_prioritylevelchange(uint8_t level) {
+	(void) level;
+}
+
+// RESET opcode
+void unibone_bus_init(unsigned pulsewidth_ms) {
+	(void) pulsewidth_ms;
+	for (Busdev *bd = bus.devs; bd; bd = bd->next)
+		bd->reset(bd->dev);
+}
+
+void unibone_log(unsigned msglevel, const char *srcfilename, unsigned srcline, const char *fmt,
+		...) {
+	(void) msglevel;
+	(void) srcfilename;
+	(void) srcline;
+	if (!trace_enabled)
+		return;
+	va_list arg_ptr;
+	va_start(arg_ptr, fmt);
+	vfprintf(stderr, fmt, arg_ptr);
+	va_end(arg_ptr);
+}
+
+void unibone_logdump(void) {
+}
+
+static void add_device(Busdev *bd, void *dev, int (*dati)(Bus *bus, void *dev),
+		int (*dato)(Bus *bus, void *dev), int (*datob)(Bus *bus, void *dev),
+		int (*svc)(Bus *bus, void *dev), int (*bg)(void *dev), void (*reset)(void *dev)) {
+	bd->dev = dev;
+	bd->dati = dati;
+	bd->dato = dato;
+	bd->datob = datob;
+	bd->svc = svc;
+	bd->bg = bg;
+	bd->reset = reset;
+	// append, memory is searched first
+	Busdev **last = &bus.devs;
+	while (*last)
+		last = &(*last)->next;
+	bd->next = NULL;
+	*last = bd;
+}
+
+/*** console ***/
+
+static void tty_restore(void) {
+	if (tty_raw)
+		tcsetattr(0, TCSANOW, &tty_saved);
+	tty_raw = false;
+}
+
+// KL11 gets single characters without echo
+static void tty_setup(void) {
+	struct termios t;
+	if (!isatty(0) || tcgetattr(0, &tty_saved) != 0)
+		return;
+	t = tty_saved;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_iflag &= ~ICRNL;
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	tcsetattr(0, TCSANOW, &t);
+	tty_raw = true;
+	atexit(tty_restore);
+}
+
+/*** fixed instruction mix for -b ***/
+
+// Moves, arithmetic, byte ops, shifts, compare & branch, index mode, subroutine.
+static const word bench_code[] = {
+	// 001000
+	012706, 001000,	//		mov	#1000,sp
+	012700, 002000,	// loop:	mov	#2000,r0
+	012701, 000040,	//		mov	#40,r1
+	012002,	// inner:	mov	(r0)+,r2
+	060203,	//		add	r2,r3
+	042703, 000001,	//		bic	#1,r3
+	0110304,	//		movb	r3,r4
+	006304,	//		asl	r4
+	020403,	//		cmp	r4,r3
+	001401,	//		beq	1$
+	005205,	//		inc	r5
+	004767, 000012,	// 1$:	jsr	pc,sub
+	016002, 000076,	//		mov	76(r0),r2
+	005301,	//		dec	r1
+	001361,	//		bne	inner
+	000754,	//		br	loop
+	010246,	// sub:	mov	r2,-(sp)
+	005102,	//		com	r2
+	012602,	//		mov	(sp)+,r2
+	000207	//		rts	pc
+};
+#define BENCH_START	001000
+#define BENCH_DATA	002000
+
+static void bench_load(word *page0) {
+	memcpy(&page0[BENCH_START / 2], bench_code, sizeof(bench_code));
+	for (unsigned i = 0; i < 0100; i++)
+		page0[BENCH_DATA / 2 + i] = i * 0123457;
+}
+
+// kernel page 0 to start of local memory, others identity, 22 bit
+static void bench_map(void) {
+	for (unsigned page = 0; page < 8; page++) {
+		ka11.par[0][page] = page * 0200;
+		ka11.pdr[0][page] = 077406; // 128 blocks, read/write
+	}
+	ka11.par[0][0] = KA11_XMEM_START >> 6;
+	ka11.par[0][7] = KA11_IOPAGE22_START >> 6;
+	ka11.mmr3 = 020; // 22 bit
+	ka11.mmr0 = 1; // enable
+}
+
+static bool program_load(const char *fname, uint32_t *entry_address) {
+	codelabel_map_c codelabels;
+	const char *ext = strrchr(fname, '.');
+	bool load_ok;
+	membuffer->init();
+	if (ext && !strcasecmp(ext, ".lst")) {
+		load_ok = membuffer->load_macro11_listing(fname, &codelabels);
+		profiler.add_labels(&codelabels);
+		if (codelabels.is_defined("start"))
+			*entry_address = codelabels.get_address("start");
+	} else {
+		load_ok = membuffer->load_papertape(fname, &codelabels);
+		if (codelabels.size() > 0)
+			*entry_address = codelabels.begin()->second;
+	}
+	if (!load_ok) {
+		fprintf(stderr, "Can not load %s\n", fname);
+		return false;
+	}
+	for (unsigned addr = 0; addr < MEMORY_SIZE; addr += 2)
+		if (membuffer->is_valid(addr))
+			memory_words[addr / 2] = membuffer->get_word(addr);
+	return true;
+}
+
+// registers, PSW, MMU and all memory as octal text, for "diff" between runs
+static bool state_dump(const char *fname, uint64_t opcodes, uint64_t emulated_ns) {
+	FILE *f = fopen(fname, "w");
+	if (f == NULL)
+		return false;
+	fprintf(f, "opcodes %llu, emulated %llu ns, state %d\n", (unsigned long long) opcodes,
+			(unsigned long long) emulated_ns, ka11.state);
+	for (unsigned i = 0; i < 8; i++)
+		fprintf(f, "r%u %06o\n", i, ka11.r[i]);
+	fprintf(f, "psw %06o\n", ka11.psw);
+	if (ka11.mmu) {
+		fprintf(f, "sp %06o %06o %06o %06o\n", ka11.sp[0], ka11.sp[1], ka11.sp[2], ka11.sp[3]);
+		for (unsigned mode = 0; mode < 4; mode += 3)
+			for (unsigned page = 0; page < 8; page++)
+				fprintf(f, "mode %u page %u par %06o pdr %06o\n", mode, page,
+						ka11.par[mode][page], ka11.pdr[mode][page]);
+		fprintf(f, "mmr0 %06o mmr2 %06o mmr3 %06o\n", ka11.mmr0, ka11.mmr2, ka11.mmr3);
+	}
+	for (unsigned addr = 0; addr < MEMORY_SIZE; addr += 16) {
+		fprintf(f, "%08o:", addr);
+		for (unsigned i = 0; i < 8; i++)
+			fprintf(f, " %06o", memory_words[addr / 2 + i]);
+		fprintf(f, "\n");
+	}
+	for (unsigned offset = 0; offset < ka11.xmem_size; offset += 16) {
+		fprintf(f, "%08o:", KA11_XMEM_START + offset);
+		for (unsigned i = 0; i < 8; i++)
+			fprintf(f, " %06o", xmem_words[offset / 2 + i]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return true;
+}
+
+static void help(void) {
+	fprintf(stderr, "Usage:\n"
+			"  pdp11sim [options] <program file> [<start address>]\n"
+			"  pdp11sim -b [options]\n"
+			"Options:\n"
+			"  -b         run built-in instruction mix, print MIPS\n"
+			"  -n <count> stop after <count> opcodes. Default for -b: 100000000\n"
+			"  -s <swr>   console switch register, octal\n"
+			"  -v         SWAB modifies PSW V-bit (needed by ZQKC)\n"
+			"  -c         classic opcode decode, no predecoded dispatch\n"
+			"  -e         add KE11 EAE\n"
+			"  -l         add KW11-L line clock (interrupt not level triggered, fails ZQKC)\n"
+			"  -m         add KT11 memory management\n"
+			"  -x <KB>    local memory above 248KB, for 22 bit mapping. Default for -b -m: 8\n"
+			"  -t         trace to stderr\n"
+			"  -r <file>  save trace ring of last %u opcodes to <file> at exit\n"
+			"  -p <file>  PC profile to <file>.txt, flamegraph stacks to <file>.folded\n"
+			"  -i <us>    PC sample interval in emulated time. Default: %u\n"
+			"  -d <file>  dump registers, PSW, MMU and memory to <file> at exit\n"
+			"Program files: papertape, or MACRO-11 listing (*.lst).\n", TRACE_RING_ENTRIES,
+			PROFILE_INTERVAL_US);
+	exit(1);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	bool bench = false, eae = false, line_clock = false;
+	unsigned xmem_kb = 0;
+	const char *trace_file = NULL;
+	const char *profile_file = NULL;
+	const char *dump_file = NULL;
+	unsigned profile_interval_us = PROFILE_INTERVAL_US;
+	uint64_t max_opcodes = 0;
+	int opt;
+
+	memset(&ka11, 0, sizeof(ka11));
+	ka11.predecode = 1;
+	while ((opt = getopt(argc, argv, "bn:s:vcelmx:tr:p:i:d:")) != -1)
+		switch (opt) {
+		case 'b':
+			bench = true;
+			break;
+		case 'n':
+			max_opcodes = strtoull(optarg, NULL, 10);
+			break;
+		case 's':
+			ka11.sw = strtoul(optarg, NULL, 8);
+			break;
+		case 'v':
+			ka11.swab_vbit = 1;
+			break;
+		case 'c':
+			ka11.predecode = 0;
+			break;
+		case 'e':
+			eae = true;
+			break;
+		case 'l':
+			line_clock = true;
+			break;
+		case 'm':
+			ka11.mmu = 1;
+			break;
+		case 'x':
+			xmem_kb = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			trace_enabled = true;
+			break;
+		case 'r':
+			trace_file = optarg;
+			break;
+		case 'p':
+			profile_file = optarg;
+			break;
+		case 'i':
+			profile_interval_us = strtoul(optarg, NULL, 10);
+			if (profile_interval_us == 0)
+				help();
+			break;
+		case 'd':
+			dump_file = optarg;
+			break;
+		default:
+			help();
+		}
+	if (bench == (optind < argc))
+		help(); // either -b or program file
+	if (bench && ka11.mmu && xmem_kb == 0)
+		xmem_kb = 8;
+	if (xmem_kb > (KA11_IOPAGE22_START - KA11_XMEM_START) / 1024)
+		help();
+	if (xmem_kb) {
+		xmem_words = (word *) calloc(xmem_kb, 1024);
+		ka11.xmem = xmem_words;
+		ka11.xmem_size = xmem_kb * 1024;
+	}
+
+	logger = new logger_c();
+	membuffer = new memoryimage_c();
+
+	ka11.bus = &bus;
+	add_device(&busdev_memory, &memory, dati_mem, dato_mem, datob_mem, svc_null, NULL,
+			reset_null);
+	kl11.ttyfd = 0;
+	kl11.ttyofd = 1;
+	add_device(&busdev_kl11, &kl11, dati_kl11, dato_kl11, datob_kl11, svc_kl11, bg_kl11,
+			reset_kl11);
+	if (line_clock)
+		add_device(&busdev_kw11, &kw11, dati_kw11, dato_kw11, datob_kw11, svc_kw11, bg_kw11,
+				reset_kw11);
+	if (eae)
+		add_device(&busdev_ke11, &ke11, dati_ke11, dato_ke11, datob_ke11, svc_null, NULL,
+				reset_ke11);
+
+	uint32_t entry_address = MEMORY_ADDRESS_INVALID;
+	if (bench) {
+		bench_load(ka11.mmu ? xmem_words : memory_words);
+		entry_address = BENCH_START;
+		if (max_opcodes == 0)
+			max_opcodes = 100000000;
+	} else {
+		if (!program_load(argv[optind], &entry_address))
+			return 1;
+		if (optind + 1 < argc)
+			entry_address = strtoul(argv[optind + 1], NULL, 8);
+		if (entry_address == MEMORY_ADDRESS_INVALID) {
+			fprintf(stderr, "No start address\n");
+			return 1;
+		}
+		tty_setup();
+	}
+
+	ka11_reset(&ka11); // resets devices also
+	if (bench && ka11.mmu)
+		bench_map();
+	if (trace_file)
+		ka11.tracering = ka11_tracering_alloc(TRACE_RING_ENTRIES);
+	if (profile_file)
+		profiler.clear(profile_interval_us * 1000);
+	ka11.r[7] = entry_address;
+	ka11.state = KA11_STATE_RUNNING;
+
+	uint64_t opcodes = 0, emulated_ns = 0;
+	uint64_t start_ns = now_ns();
+	while (ka11.state != KA11_STATE_HALTED && (max_opcodes == 0 || opcodes < max_opcodes)) {
+		if (profile_file) {
+			uint16_t pc = ka11.r[7];
+			unsigned mode =
+					(ka11.psw >> 14) == 3 ? pcprofile_c::mode_user : pcprofile_c::mode_kernel;
+			ka11_condstep(&ka11);
+			if (ka11.state == KA11_STATE_RUNNING)
+				profiler.step(pc, mode, ka11.time_ns);
+			else if (ka11.state == KA11_STATE_WAITING)
+				profiler.wait(500); // loop time estimate as in cpu_c
+		} else
+			ka11_condstep(&ka11);
+		if (ka11.state == KA11_STATE_RUNNING) {
+			opcodes++;
+			emulated_ns += ka11.time_ns;
+		}
+	}
+	double seconds = (now_ns() - start_ns) / 1e9;
+	tty_restore();
+
+	if (ka11.state == KA11_STATE_HALTED) {
+		fprintf(stderr, "\nHALT at %06o\n", ka11.r[7]);
+		fflush(stderr);
+		printstate(&ka11);
+		fflush(stdout);
+	}
+	fprintf(stderr, "%llu opcodes in %0.3f s = %0.2f MIPS, real 11/20: %0.3f s\n",
+			(unsigned long long) opcodes, seconds, opcodes / seconds / 1e6, emulated_ns / 1e9);
+	if (trace_file && ka11_tracering_save(ka11.tracering, trace_file)) {
+		fprintf(stderr, "Can not save trace ring to %s\n", trace_file);
+		return 1;
+	}
+	if (profile_file && !profiler.report(profile_file, 0, stderr, 10)) {
+		fprintf(stderr, "Can not write profile %s\n", profile_file);
+		return 1;
+	}
+	if (dump_file && !state_dump(dump_file, opcodes, emulated_ns)) {
+		fprintf(stderr, "Can not write state dump %s\n", dump_file);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+/* tracetool.cpp: evaluate cpu20 trace ring dumps
+
+ See LICENSE for terms of use.
+
+ tracetool [options] <trace file>
+
+ Trace files are written by the cpu20 "trace_ring" on HALT, on a trap vector
+ or on demand, or by "pdp11sim -r".
+ Default output is an instruction level hot spot profile:
+ opcodes and emulated time per PC range, sorted by opcode count.
+ PCs are symbolized with the labels of MACRO-11 listings.
+
+ -d: list all trace entries instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include "logger.hpp"
+#include "memoryimage.hpp"
+
+#include "cpu20/11.h"
+#include "cpu20/ka11.h"
+
+static codelabel_map_c codelabels;
+
+// per PC range
+struct hotspot_c {
+	unsigned key; // mode << 16 | range start
+	uint64_t opcodes;
+	uint64_t time_ns;
+};
+
+static bool hotspot_greater(const hotspot_c &a, const hotspot_c &b) {
+	return a.opcodes > b.opcodes;
+}
+
+// all labels of all listings. Addresses not relocated.
+static bool listing_load(const char *fname) {
+	codelabel_map_c labels;
+	membuffer->init();
+	if (!membuffer->load_macro11_listing(fname, &labels)) {
+		fprintf(stderr, "Can not load %s\n", fname);
+		return false;
+	}
+	for (codelabel_map_c::iterator it = labels.begin(); it != labels.end(); ++it)
+		codelabels.add(it->first, it->second);
+	return true;
+}
+
+static void profile(KA11_tracering *ring, unsigned granularity, unsigned top) {
+	std::map<unsigned, hotspot_c> hotspots;
+	uint64_t opcodes = 0, traps = 0;
+	bool user_mode = false;
+
+	for (uint64_t i = 0; i < ring->count; i++) {
+		KA11_trace *t = &ring->entries[i];
+		if (t->flags & KA11_TRACE_TRAP)
+			traps++;
+		if (!(t->flags & KA11_TRACE_FETCHED))
+			continue; // interrupt accepted, no opcode
+		unsigned mode = t->psw >> 14;
+		if (mode)
+			user_mode = true;
+		unsigned key = mode << 16 | codelabels.range_start(t->pc, granularity);
+		hotspot_c *h = &hotspots[key];
+		h->key = key;
+		h->opcodes++;
+		// duration up to next step(), unknown for last
+		if (i + 1 < ring->count)
+			h->time_ns += ring->entries[i + 1].stamp - t->stamp;
+		opcodes++;
+	}
+	uint64_t time_ns = ring->count ? ring->stamp - ring->entries[0].stamp : 0;
+
+	std::vector<hotspot_c> sorted;
+	for (std::map<unsigned, hotspot_c>::iterator it = hotspots.begin(); it != hotspots.end();
+			++it)
+		sorted.push_back(it->second);
+	std::sort(sorted.begin(), sorted.end(), hotspot_greater);
+
+	printf("%llu opcodes, %llu traps and interrupts, %0.3f ms emulated\n",
+			(unsigned long long) opcodes, (unsigned long long) traps, time_ns / 1e6);
+	printf("   opcodes      %%   time %%  %srange\n", user_mode ? "mode " : "");
+	for (unsigned i = 0; i < sorted.size() && (top == 0 || i < top); i++) {
+		hotspot_c *h = &sorted[i];
+		unsigned start = h->key & 0177777;
+		printf("%10llu %6.2f %6.2f  %s%s%s\n", (unsigned long long) h->opcodes,
+				100.0 * h->opcodes / opcodes, time_ns ? 100.0 * h->time_ns / time_ns : 0.0,
+				user_mode ? ((h->key >> 16) ? "U    " : "K    ") : "",
+				codelabels.range_text(start, granularity).c_str(),
+				codelabels.symbolize(start).c_str());
+	}
+}
+
+static void dump(KA11_tracering *ring) {
+	printf("     stamp ns  pc      ir      psw     access\n");
+	for (uint64_t i = 0; i < ring->count; i++) {
+		KA11_trace *t = &ring->entries[i];
+		printf("%13llu  %06o  ", (unsigned long long) t->stamp, t->pc);
+		if (t->flags & KA11_TRACE_FETCHED)
+			printf("%06o  ", t->ir);
+		else
+			printf("------  ");
+		printf("%06o ", t->psw);
+		for (unsigned j = 0; j < t->naddr; j++)
+			printf(" %c:%o", (t->addr[j] & KA11_TRACE_WRITE) ? 'W' : 'R',
+					t->addr[j] & ~KA11_TRACE_WRITE);
+		if (t->flags & KA11_TRACE_TRAP)
+			printf("  TRAP %03o", t->vector);
+		if (!codelabels.empty())
+			printf("  ; %s", codelabels.symbolize(t->pc).c_str());
+		printf("\n");
+	}
+}
+
+static void help(void) {
+	fprintf(stderr, "Usage:\n"
+			"  tracetool [options] <trace file>\n"
+			"Options:\n"
+			"  -l <file>   MACRO-11 listing for PC symbols, may be repeated\n"
+			"  -g <bytes>  profile PC ranges of fixed size, not by label. Default without -l: 2\n"
+			"  -n <count>  print only <count> hottest ranges, 0 = all. Default: 30\n"
+			"  -d          list trace entries, no profile\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned granularity = 0, top = 30;
+	bool list = false;
+	int opt;
+
+	logger = new logger_c();
+	membuffer = new memoryimage_c();
+
+	while ((opt = getopt(argc, argv, "l:g:n:d")) != -1)
+		switch (opt) {
+		case 'l':
+			if (!listing_load(optarg))
+				return 1;
+			break;
+		case 'g':
+			granularity = strtoul(optarg, NULL, 0);
+			if (granularity == 0)
+				help();
+			break;
+		case 'n':
+			top = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			list = true;
+			break;
+		default:
+			help();
+		}
+	if (optind + 1 != argc)
+		help();
+
+	KA11_tracering *ring = ka11_tracering_load(argv[optind]);
+	if (ring == NULL) {
+		fprintf(stderr, "Can not load trace file %s\n", argv[optind]);
+		return 1;
+	}
+	if (list)
+		dump(ring);
+	else
+		profile(ring, granularity, top);
+	ka11_tracering_free(ring);
+	return 0;
+}
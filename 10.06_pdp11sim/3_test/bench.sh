@@ -0,0 +1,22 @@
+# Measure KA11 emulation speed without UNIBUS and PRU:
+# built-in instruction mix with predecoded and classic dispatch,
+# and mapped by KT11 from local memory above 248KB,
+# then MAINDEC ZQKC instruction exerciser (must not HALT)
+# and its profile from the trace ring and by PC sampling.
+# Equivalence of predecoded and classic dispatch: predecode.sh
+# Build pdp11sim first: cd ~/10.06_pdp11sim/2_src ; make
+cd ~/10.06_pdp11sim/3_test
+SIM=~/10.06_pdp11sim/4_deploy/pdp11sim
+echo "*** instruction mix, predecoded dispatch"
+$SIM -b -n 50000000
+echo "*** instruction mix, classic decode"
+$SIM -b -c -n 50000000
+echo "*** instruction mix, KT11 22 bit mapping, local memory"
+$SIM -b -m -n 50000000
+echo "*** ZQKC, 30000000 opcodes"
+$SIM -v -s 0114200 -n 30000000 ~/10.03_app_demo/5_applications/zqkc/ZQKC_E_05_20.abs 200 </dev/null
+echo "*** ZQKC hot spots from trace ring of last opcodes"
+$SIM -v -s 0114200 -n 30000000 -r zqkc.trc ~/10.03_app_demo/5_applications/zqkc/ZQKC_E_05_20.abs 200 </dev/null
+~/10.06_pdp11sim/4_deploy/tracetool -g 0100 -n 10 zqkc.trc
+echo "*** ZQKC PC sampling profile, flamegraph stacks in zqkc_profile.folded"
+$SIM -v -s 0114200 -n 30000000 -p zqkc_profile ~/10.03_app_demo/5_applications/zqkc/ZQKC_E_05_20.abs 200 </dev/null
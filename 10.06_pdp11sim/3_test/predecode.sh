@@ -0,0 +1,29 @@
+# Predecoded dispatch must execute bit for bit like the classic decode cascade:
+# run the cpu20 test programs and ZQKC with and without -c,
+# then compare final registers, PSW, MMU, memory and console output.
+# Build pdp11sim first: cd ~/10.06_pdp11sim/2_src ; make
+cd ~/10.06_pdp11sim/3_test
+SIM=~/10.06_pdp11sim/4_deploy/pdp11sim
+failed=0
+
+# <name> <pdp11sim options and program>
+compare() {
+	name=$1
+	shift
+	$SIM -d $name.predecode.dump "$@" </dev/null >$name.predecode.out 2>/dev/null
+	$SIM -c -d $name.classic.dump "$@" </dev/null >$name.classic.out 2>/dev/null
+	if cmp -s $name.predecode.dump $name.classic.dump && cmp -s $name.predecode.out $name.classic.out ; then
+		echo "$name: OK, $(head -1 $name.predecode.dump)"
+	else
+		echo "$name: FAILED, diff $name.predecode.dump $name.classic.dump"
+		failed=1
+	fi
+}
+
+compare hello2 -n 1000000 ~/10.02_devices/3_test/cpu20/hello2.lst
+# no RK, RL, KW11 here: bus timeouts and console interrupts
+compare multiarb -n 2000000 ~/10.02_devices/3_test/cpu20/multiarb.lst
+compare zqkc -v -s 0114200 -n 30000000 ~/10.03_app_demo/5_applications/zqkc/ZQKC_E_05_20.abs 200
+# KT11 mapped, label "mapped"
+compare mix_kt11 -m -x 8 -n 10000000 ~/10.03_app_demo/5_applications/cpu/mix.lst 3014
+exit $failed